@@ -0,0 +1,602 @@
+/* filepath: bench/load.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/*
+ * HTTP load generator for a locally started web_server. Each of N
+ * client threads keeps one request in flight and replays a weighted mix
+ * of what the pages do: static pages, .rec fetches, record creates and
+ * updates, obligation numbers and logins. The server answers HTTP/1.0
+ * and closes every connection, so each request opens a fresh one and
+ * its latency includes the connect.
+ *
+ * Every latency is kept, so the percentiles are exact. Results are
+ * printed and written as JSON; given the JSON of an earlier run, the
+ * change against it is printed too.
+ */
+
+/* Standard C headers */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX headers */
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/* Local headers */
+#include "../include/web_server.h"
+
+/* Benchmark constants */
+#define BENCH_CONNECTIONS 16            /* Client threads, one request each */
+#define BENCH_SECONDS 10                /* Measured run */
+#define BENCH_WARMUP 1                  /* Unmeasured run before it */
+#define BENCH_CONNECTIONS_MAX 1024
+#define BENCH_READY_MS 5000             /* Wait this long for the server */
+#define BENCH_REQUEST_MAX 2048
+#define BENCH_USER "john:smith"
+
+/* Kinds of request in the mix */
+#define KIND_STATIC 0
+#define KIND_REC 1
+#define KIND_CREATE 2
+#define KIND_UPDATE 3
+#define KIND_NEXT_NUMBER 4
+#define KIND_AUTH 5
+#define KINDS 6
+
+static const char *const kind_names[KINDS] = {
+    "static", "rec", "create", "update", "next_number", "auth"
+};
+
+/* Share of the mix in percent, by kind */
+static const int kind_weights[KINDS] = { 40, 30, 8, 7, 10, 5 };
+
+static const char *const static_pages[] = {
+    "/", "/index.html", "/dashboard.html", "/scjv.html"
+};
+
+static const char *const rec_files[] = {
+    "/scjv.rec", "/ms1180.rec", "/w6946.rec"
+};
+
+struct worker {
+    unsigned long *latencies;           /* Microseconds, measured run only */
+    size_t count;
+    size_t cap;
+    unsigned long kinds[KINDS];
+    unsigned long statuses[6];          /* By hundreds; 0 if unparsed */
+    unsigned long errors;               /* Failed connects, reads and 5xx */
+    unsigned long seed;
+    unsigned long created;              /* Records this worker created */
+    pthread_t thread;
+    int id;
+    int pad;
+};
+
+struct bench {
+    struct sockaddr_in addr;
+    struct timespec measure;            /* End of the warmup */
+    struct timespec deadline;
+    char *user;
+    const char *password;
+    const char *output;
+    const char *baseline;
+    struct worker *workers;
+    double seconds;
+    int connections;
+    int warmup;
+};
+
+static struct bench bench;
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-h host] [-p port] [-c connections] [-d seconds]\n"
+            "          [-w warmup] [-u user:password] [-o results.json]\n"
+            "          [-b baseline.json]\n", name);
+}
+
+static double
+seconds_since(const struct timespec *from, const struct timespec *to)
+{
+    return (double)(to->tv_sec - from->tv_sec) +
+           (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static int
+before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* xorshift; good enough to pick from the mix */
+static unsigned long
+next_random(struct worker *w)
+{
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    return w->seed;
+}
+
+static int
+pick_kind(struct worker *w)
+{
+    int roll;
+    int kind;
+
+    roll = (int)(next_random(w) % 100);
+    for (kind = 0; kind < KINDS - 1; kind++) {
+        roll -= kind_weights[kind];
+        if (roll < 0) {
+            break;
+        }
+    }
+    /* Nothing to update until this worker has created a record */
+    if (kind == KIND_UPDATE && !w->created) {
+        kind = KIND_CREATE;
+    }
+    return kind;
+}
+
+static int
+format_record(char *buf, const char *path, int id, unsigned long number,
+              const char *status)
+{
+    char body[512];
+    int len;
+
+    len = sprintf(body,
+                  "Project_Name: SCJV - Pilbara Ports\n"
+                  "Obligation_Number: BENCH-%d-%lu\n"
+                  "Obligation: Load test record\n"
+                  "Status: %s\n", id, number, status);
+    return sprintf(buf,
+                   "POST %s HTTP/1.0\r\n"
+                   "Content-Type: text/plain\r\n"
+                   "Content-Length: %d\r\n\r\n%s", path, len, body);
+}
+
+/* Fill buf with the next request of kind; returns its length */
+static int
+format_request(struct worker *w, int kind, char *buf)
+{
+    size_t i;
+
+    switch (kind) {
+    case KIND_STATIC:
+        i = (size_t)(next_random(w) % (sizeof(static_pages) / sizeof(static_pages[0])));
+        return sprintf(buf, "GET %s HTTP/1.0\r\n\r\n", static_pages[i]);
+    case KIND_REC:
+        i = (size_t)(next_random(w) % (sizeof(rec_files) / sizeof(rec_files[0])));
+        return sprintf(buf, "GET %s HTTP/1.0\r\n\r\n", rec_files[i]);
+    case KIND_CREATE:
+        return format_record(buf, ENDPOINT_CREATE, w->id, ++w->created,
+                             "In Progress");
+    case KIND_UPDATE:
+        return format_record(buf, ENDPOINT_UPDATE, w->id,
+                             1 + next_random(w) % w->created, "Closed");
+    case KIND_NEXT_NUMBER:
+        return sprintf(buf, "GET %s?project=scjv HTTP/1.0\r\n\r\n",
+                       ENDPOINT_NEXT_NUMBER);
+    case KIND_AUTH:
+        return sprintf(buf, "GET /auth?username=%s&password=%s HTTP/1.0\r\n\r\n",
+                       bench.user, bench.password);
+    default:
+        return -1;
+    }
+}
+
+/* Send one request and read the whole response; returns the status or -1 */
+static int
+exchange(const char *request, size_t len)
+{
+    char response[4096];
+    size_t used;
+    ssize_t n;
+    int status;
+    int one;
+    int fd;
+
+    n = 0;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (const struct sockaddr *)&bench.addr, sizeof(bench.addr)) != 0 ||
+        write(fd, request, len) != (ssize_t)len) {
+        close(fd);
+        return -1;
+    }
+
+    /* Only the status line matters; the rest is drained */
+    used = 0;
+    for (;;) {
+        n = read(fd, response + used, sizeof(response) - 1 - used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+        if (used > 64) {
+            used = 64;
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    response[used] = '\0';
+    status = 0;
+    if (sscanf(response, "HTTP/%*d.%*d %d", &status) != 1) {
+        status = 0;
+    }
+    return status;
+}
+
+static int
+record_latency(struct worker *w, unsigned long us)
+{
+    unsigned long *grown;
+    size_t cap;
+
+    if (w->count == w->cap) {
+        cap = w->cap ? w->cap * 2 : 4096;
+        grown = realloc(w->latencies, cap * sizeof(*grown));
+        if (!grown) {
+            return -1;
+        }
+        w->latencies = grown;
+        w->cap = cap;
+    }
+    w->latencies[w->count++] = us;
+    return 0;
+}
+
+static void *
+worker_run(void *arg)
+{
+    struct worker *w;
+    struct timespec start;
+    struct timespec end;
+    char request[BENCH_REQUEST_MAX];
+    double us;
+    int kind;
+    int len;
+    int status;
+
+    w = arg;
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!before(&start, &bench.deadline)) {
+            break;
+        }
+        kind = pick_kind(w);
+        len = format_request(w, kind, request);
+        if (len <= 0) {
+            continue;
+        }
+        status = exchange(request, (size_t)len);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (before(&start, &bench.measure)) {
+            continue;
+        }
+
+        w->kinds[kind]++;
+        w->statuses[status > 0 && status < 600 ? status / 100 : 0]++;
+        if (status < 0 || status >= 500) {
+            w->errors++;
+        }
+        us = seconds_since(&start, &end) * 1e6;
+        if (record_latency(w, (unsigned long)us) != 0) {
+            w->errors++;
+        }
+    }
+    return NULL;
+}
+
+/* Wait for the server to answer a request */
+static int
+wait_ready(void)
+{
+    static const char request[] = "GET / HTTP/1.0\r\n\r\n";
+    struct timespec pause;
+    int waited;
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = 50000000L;
+    for (waited = 0; waited < BENCH_READY_MS; waited += 50) {
+        if (exchange(request, sizeof(request) - 1) > 0) {
+            return 0;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return -1;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+    unsigned long x;
+    unsigned long y;
+
+    x = *(const unsigned long *)a;
+    y = *(const unsigned long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted latencies */
+static unsigned long
+percentile(const unsigned long *sorted, size_t count, double p)
+{
+    size_t rank;
+
+    if (!count) {
+        return 0;
+    }
+    rank = (size_t)(p * (double)count + 0.999999);
+    return sorted[rank ? rank - 1 : 0];
+}
+
+/* A number after "key": in a results file; -1 if absent */
+static double
+baseline_value(const char *text, const char *key)
+{
+    char quoted[64];
+    const char *p;
+
+    sprintf(quoted, "\"%s\":", key);
+    p = strstr(text, quoted);
+    return p ? strtod(p + strlen(quoted), NULL) : -1.0;
+}
+
+static void
+compare_baseline(double throughput, const unsigned long *p)
+{
+    static const char *const keys[] = { "throughput", "p50_us", "p99_us", "p999_us" };
+    char text[4096];
+    double now[4];
+    double then;
+    size_t len;
+    FILE *fp;
+    int i;
+
+    fp = fopen(bench.baseline, "r");
+    if (!fp) {
+        fprintf(stderr, "No baseline at %s\n", bench.baseline);
+        return;
+    }
+    len = fread(text, 1, sizeof(text) - 1, fp);
+    fclose(fp);
+    text[len] = '\0';
+
+    now[0] = throughput;
+    for (i = 1; i < 4; i++) {
+        now[i] = (double)p[i - 1];
+    }
+    printf("Against %s:\n", bench.baseline);
+    for (i = 0; i < 4; i++) {
+        then = baseline_value(text, keys[i]);
+        if (then > 0) {
+            printf("  %-12s %12.1f -> %12.1f  %+6.1f%%\n", keys[i], then, now[i],
+                   (now[i] - then) / then * 100.0);
+        }
+    }
+}
+
+static int
+report(void)
+{
+    unsigned long kinds[KINDS];
+    unsigned long statuses[6];
+    unsigned long p[3];
+    unsigned long *all;
+    unsigned long errors;
+    double throughput;
+    size_t count;
+    size_t used;
+    FILE *fp;
+    int i;
+    int k;
+
+    memset(kinds, 0, sizeof(kinds));
+    memset(statuses, 0, sizeof(statuses));
+    errors = 0;
+    count = 0;
+    for (i = 0; i < bench.connections; i++) {
+        count += bench.workers[i].count;
+    }
+    all = malloc((count ? count : 1) * sizeof(*all));
+    if (!all) {
+        return -1;
+    }
+    used = 0;
+    for (i = 0; i < bench.connections; i++) {
+        memcpy(all + used, bench.workers[i].latencies,
+               bench.workers[i].count * sizeof(*all));
+        used += bench.workers[i].count;
+        for (k = 0; k < KINDS; k++) {
+            kinds[k] += bench.workers[i].kinds[k];
+        }
+        for (k = 0; k < 6; k++) {
+            statuses[k] += bench.workers[i].statuses[k];
+        }
+        errors += bench.workers[i].errors;
+    }
+    qsort(all, count, sizeof(*all), compare_latency);
+    p[0] = percentile(all, count, 0.50);
+    p[1] = percentile(all, count, 0.99);
+    p[2] = percentile(all, count, 0.999);
+    throughput = (double)count / bench.seconds;
+
+    printf("%lu requests in %.1f s over %d connections: %.1f req/s, %lu errors\n",
+           (unsigned long)count, bench.seconds, bench.connections, throughput,
+           errors);
+    printf("Latency p50 %lu us, p99 %lu us, p999 %lu us, max %lu us\n",
+           p[0], p[1], p[2], count ? all[count - 1] : 0UL);
+    for (k = 0; k < KINDS; k++) {
+        printf("  %-12s %lu\n", kind_names[k], kinds[k]);
+    }
+    if (bench.baseline) {
+        compare_baseline(throughput, p);
+    }
+
+    if (bench.output) {
+        fp = fopen(bench.output, "w");
+        if (!fp) {
+            perror(bench.output);
+            free(all);
+            return -1;
+        }
+        fprintf(fp, "{\"connections\":%d,\"seconds\":%.1f,\"requests\":%lu,"
+                    "\"errors\":%lu,\"throughput\":%.1f,\n"
+                    " \"p50_us\":%lu,\"p99_us\":%lu,\"p999_us\":%lu,\"max_us\":%lu,\n"
+                    " \"mix\":{",
+                bench.connections, bench.seconds, (unsigned long)count, errors,
+                throughput, p[0], p[1], p[2], count ? all[count - 1] : 0UL);
+        for (k = 0; k < KINDS; k++) {
+            fprintf(fp, "%s\"%s\":%lu", k ? "," : "", kind_names[k], kinds[k]);
+        }
+        fprintf(fp, "},\n \"status\":{\"none\":%lu,\"1xx\":%lu,\"2xx\":%lu,"
+                    "\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu}}\n",
+                statuses[0], statuses[1], statuses[2], statuses[3],
+                statuses[4], statuses[5]);
+        if (fclose(fp) != 0) {
+            perror(bench.output);
+        }
+    }
+    free(all);
+    return 0;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+    const char *host;
+    char *colon;
+    long port;
+    int opt;
+
+    host = "127.0.0.1";
+    port = DEFAULT_PORT;
+    bench.connections = BENCH_CONNECTIONS;
+    bench.seconds = BENCH_SECONDS;
+    bench.warmup = BENCH_WARMUP;
+    while ((opt = getopt(argc, argv, "h:p:c:d:w:u:o:b:")) != -1) {
+        switch (opt) {
+        case 'h':
+            host = optarg;
+            break;
+        case 'p':
+            port = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            bench.connections = atoi(optarg);
+            break;
+        case 'd':
+            bench.seconds = strtod(optarg, NULL);
+            break;
+        case 'w':
+            bench.warmup = atoi(optarg);
+            break;
+        case 'u':
+            bench.user = optarg;
+            break;
+        case 'o':
+            bench.output = optarg;
+            break;
+        case 'b':
+            bench.baseline = optarg;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (bench.connections < 1 || bench.connections > BENCH_CONNECTIONS_MAX ||
+        bench.seconds < 1.0 || bench.warmup < 0 || port < 1 || port > 65535) {
+        return -1;
+    }
+
+    /* user:password, split in place */
+    colon = strchr(bench.user, ':');
+    if (!colon) {
+        return -1;
+    }
+    *colon = '\0';
+    bench.password = colon + 1;
+
+    bench.addr.sin_family = AF_INET;
+    bench.addr.sin_port = htons((unsigned short)port);
+    return inet_pton(AF_INET, host, &bench.addr.sin_addr) == 1 ? 0 : -1;
+}
+
+int
+main(int argc, char **argv)
+{
+    static char default_user[] = BENCH_USER;
+    struct timespec now;
+    int result;
+    int i;
+
+    bench.user = default_user;
+    if (parse_args(argc, argv) != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (wait_ready() != 0) {
+        fprintf(stderr, "No server at port %d\n", ntohs(bench.addr.sin_port));
+        return EXIT_FAILURE;
+    }
+
+    bench.workers = calloc((size_t)bench.connections, sizeof(*bench.workers));
+    if (!bench.workers) {
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bench.measure = now;
+    bench.measure.tv_sec += bench.warmup;
+    bench.deadline = bench.measure;
+    bench.deadline.tv_sec += (time_t)bench.seconds;
+    bench.deadline.tv_nsec += (long)((bench.seconds - (double)(time_t)bench.seconds) * 1e9);
+    if (bench.deadline.tv_nsec >= 1000000000L) {
+        bench.deadline.tv_sec++;
+        bench.deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (i = 0; i < bench.connections; i++) {
+        bench.workers[i].id = i;
+        bench.workers[i].seed = 0x9e3779b9UL * (unsigned long)(i + 1) ^ (unsigned long)now.tv_nsec;
+        if (pthread_create(&bench.workers[i].thread, NULL, worker_run,
+                           &bench.workers[i]) != 0) {
+            fprintf(stderr, "Failed to start connection %d\n", i);
+            bench.connections = i;
+            break;
+        }
+    }
+    for (i = 0; i < bench.connections; i++) {
+        pthread_join(bench.workers[i].thread, NULL);
+    }
+
+    result = report();
+    for (i = 0; i < bench.connections; i++) {
+        free(bench.workers[i].latencies);
+    }
+    free(bench.workers);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
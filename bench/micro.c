@@ -0,0 +1,457 @@
+/* filepath: bench/micro.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/*
+ * Microbenchmarks for the parsers every request or load runs through.
+ * Each case is run on synthetic inputs of MICRO_SIZES sizes, each four
+ * times the last. A case is warmed up, then timed in MICRO_SAMPLES
+ * samples of enough calls to take MICRO_SAMPLE_NS each. The median
+ * per call is reported, with its median absolute deviation, so a
+ * sample hit by a page fault or a preemption moves neither.
+ *
+ * Cycles come from the time stamp counter on x86 and the virtual counter
+ * (cntvct_el0) on AArch64; both tick at a fixed reference rate, not the
+ * core clock. Elsewhere the column is left as "-".
+ *
+ * update_record_in_file writes next to var/records, so the benchmarks
+ * run in a scratch directory of their own.
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Local headers */
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+
+/* Microbenchmark constants */
+#define MICRO_SAMPLES 25                /* Timed samples per case and size */
+#define MICRO_SAMPLE_NS 2000000.0       /* Each sample runs at least 2 ms */
+#define MICRO_WARMUP_NS 50000000.0      /* Untimed calls before the first */
+#define MICRO_SIZES 4                   /* Input sizes, each 4x the last */
+#define MICRO_RECORDS "bench.rec"
+#define MICRO_AUTH "bench.passwd"
+
+struct micro_input {
+    struct buffer text;                 /* Input, or the file's contents */
+    void *scratch;                      /* Output space for the parser */
+    size_t count;                       /* Records, users or parameters */
+};
+
+struct micro_case {
+    const char *name;
+    int (*prepare)(struct micro_input *in, size_t scale);
+    void (*run)(struct micro_input *in);
+};
+
+struct micro_result {
+    double ns;                          /* Median per call */
+    double mad;                         /* Median absolute deviation */
+    double min;
+    double cycles;                      /* Median per call */
+};
+
+static char scratch_dir[] = "/tmp/micro.XXXXXX";
+static volatile unsigned long sink;     /* Keeps results from being elided */
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define MICRO_HAVE_CYCLES 1
+#else
+#define MICRO_HAVE_CYCLES 0
+#endif
+
+static double
+now_cycles(void)
+{
+    unsigned long tsc;
+
+#if defined(__x86_64__) || defined(__i386__)
+    tsc = __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(tsc) : : "memory");
+#else
+    tsc = 0;
+#endif
+    return (double)tsc;
+}
+
+/* One record shaped like those in var/records, about 600 bytes */
+static int
+append_record(struct buffer *out, size_t n)
+{
+    if (buffer_appendf(out,
+            "Project_Name: SCJV - Pilbara Ports\n"
+            "Primary_Environmental_Mechanism: Portside CEMP\n"
+            "Procedure: PPA requirement\n"
+            "Environmental_Aspect: Administration\n"
+            "Obligation_Number: BENCH-%04lu\n"
+            "Obligation: Personnel working on the project undertake the "
+            "required induction before commencing work on site.\n"
+            "Accountability: SCJV - during construction\n"
+            "+ Perdaman - during operations\n", (unsigned long)n) != 0) {
+        return -1;
+    }
+    return buffer_appendf(out,
+        "Responsibility: SCJV - HSSE Manager\n"
+        "ProjectPhase: Design and Construction\n"
+        "Action_DueDate: %lu/01/2027\n"
+        "Status: %s\n"
+        "Compliance_Comments: Verify compliance through training records.\n"
+        "Recurring_Obligation: Yes\n"
+        "Recurring_Frequency: Quarterly\n\n",
+        (unsigned long)(n % 28 + 1), n % 3 ? "In Progress" : "Closed");
+}
+
+static int
+write_file(const char *path, const struct buffer *text)
+{
+    FILE *fp;
+    int result;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    result = fwrite(text->data, 1, text->len, fp) == text->len ? 0 : -1;
+    if (fclose(fp) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/* "/auth?" query: scale filler parameters, then the credentials */
+static int
+prepare_query(struct micro_input *in, size_t scale)
+{
+    size_t i;
+
+    in->count = scale * 4;
+    for (i = 0; i < in->count; i++) {
+        if (buffer_appendf(&in->text, "field%lu=value%lu&",
+                           (unsigned long)i, (unsigned long)i) != 0) {
+            return -1;
+        }
+    }
+    in->scratch = malloc(512);
+    return in->scratch &&
+           buffer_append_str(&in->text, "username=john&password=smith") == 0 ? 0 : -1;
+}
+
+static void
+run_query(struct micro_input *in)
+{
+    char *username;
+
+    username = in->scratch;
+    parse_query_string(in->text.data, username, username + 256);
+    sink += (unsigned long)username[0];
+}
+
+/* A request as read: the request line, then headers growing with scale */
+static int
+prepare_request(struct micro_input *in, size_t scale)
+{
+    size_t i;
+
+    if (buffer_append_str(&in->text,
+                          "GET /api/query?project=scjv&q=Status%3DOpen HTTP/1.0\r\n") != 0) {
+        return -1;
+    }
+    in->count = scale * 2;
+    for (i = 0; i < in->count; i++) {
+        if (buffer_appendf(&in->text, "X-Header-%lu: %s\r\n", (unsigned long)i,
+                           "text/html,application/xhtml+xml;q=0.9") != 0) {
+            return -1;
+        }
+    }
+    return buffer_append_str(&in->text, "\r\n");
+}
+
+/* The request line parse handle_client does */
+static void
+run_request(struct micro_input *in)
+{
+    char method[16];
+    char uri[256];
+
+    if (sscanf(in->text.data, "%15s %255s", method, uri) == 2) {
+        sink += (unsigned long)uri[1];
+    }
+}
+
+static int
+prepare_auth(struct micro_input *in, size_t scale)
+{
+    size_t i;
+
+    in->count = scale * 16;
+    if (buffer_append_str(&in->text,
+                          "# Format: Username:Password:UID:GID:FullName:HomeDir:Shell:IsAdmin\n") != 0) {
+        return -1;
+    }
+    for (i = 0; i < in->count; i++) {
+        if (buffer_appendf(&in->text,
+                           "user%lu:$6$rounds=5000$saltsalt$%040lu:%lu:%lu:"
+                           "User Number %lu:/home/user%lu:/bin/sh:%d\n",
+                           (unsigned long)i, (unsigned long)i,
+                           (unsigned long)(1000 + i), (unsigned long)(1000 + i),
+                           (unsigned long)i, (unsigned long)i, (int)(i % 2)) != 0) {
+            return -1;
+        }
+    }
+    in->scratch = calloc(in->count, sizeof(struct user_entry));
+    return in->scratch ? write_file(MICRO_AUTH, &in->text) : -1;
+}
+
+static void
+run_auth(struct micro_input *in)
+{
+    int users;
+
+    users = parse_auth_file(MICRO_AUTH, in->scratch, in->count);
+    sink += (unsigned long)users;
+}
+
+static int
+prepare_records(struct micro_input *in, size_t scale)
+{
+    size_t i;
+
+    in->count = scale * 16;
+    if (buffer_append_str(&in->text, "%rec: Project\n\n") != 0) {
+        return -1;
+    }
+    for (i = 0; i < in->count; i++) {
+        if (append_record(&in->text, i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+prepare_update(struct micro_input *in, size_t scale)
+{
+    if (prepare_records(in, scale) != 0 || write_file(MICRO_RECORDS, &in->text) != 0) {
+        return -1;
+    }
+    in->scratch = strdup("Project_Name: SCJV - Pilbara Ports\n"
+                         "Obligation_Number: NONE-0000\n"
+                         "Status: Closed\n");
+    return in->scratch ? 0 : -1;
+}
+
+/* A whole scan for a record that is not there; nothing is replaced */
+static void
+run_update(struct micro_input *in)
+{
+    FILE *fp;
+
+    fp = fopen(MICRO_RECORDS, "r");
+    if (fp) {
+        sink += (unsigned long)(update_record_in_file(fp, in->scratch) == ERR_NOTFOUND);
+        fclose(fp);
+    }
+}
+
+/* Splitting .rec text into records and parsing each */
+static void
+run_chunks(struct micro_input *in)
+{
+    struct rec_record *record;
+    const char *chunk;
+    const char *next;
+    const char *end;
+    size_t len;
+
+    end = in->text.data + in->text.len;
+    for (chunk = in->text.data; chunk < end; chunk = next) {
+        next = rec_next_chunk(chunk, end, &len);
+        record = rec_parse_record(chunk, len);
+        if (record) {
+            sink += (unsigned long)len;
+            free(record);
+        }
+    }
+}
+
+/* Loading a whole store: records, keys and indexes */
+static void
+run_store(struct micro_input *in)
+{
+    struct rec_store *store;
+
+    store = rec_store_parse("bench", in->text.data, in->text.len);
+    if (store) {
+        sink += (unsigned long)store->count;
+        rec_store_free(store);
+    }
+}
+
+static const struct micro_case cases[] = {
+    { "query_string", prepare_query, run_query },
+    { "request_line", prepare_request, run_request },
+    { "auth_file", prepare_auth, run_auth },
+    { "update_scan", prepare_update, run_update },
+    { "rec_chunks", prepare_records, run_chunks },
+    { "rec_store", prepare_records, run_store }
+};
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x;
+    double y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+median(double *values, size_t count)
+{
+    qsort(values, count, sizeof(*values), compare_double);
+    return count % 2 ? values[count / 2]
+                     : (values[count / 2 - 1] + values[count / 2]) / 2.0;
+}
+
+static void
+measure(const struct micro_case *c, struct micro_input *in,
+        struct micro_result *result)
+{
+    double ns[MICRO_SAMPLES];
+    double cycles[MICRO_SAMPLES];
+    double start;
+    double elapsed;
+    double started;
+    unsigned long calls;
+    unsigned long i;
+    int s;
+
+    /* Warm up, finding how many calls fill a sample on the way */
+    calls = 1;
+    started = now_ns();
+    for (;;) {
+        start = now_ns();
+        for (i = 0; i < calls; i++) {
+            c->run(in);
+        }
+        elapsed = now_ns() - start;
+        if (elapsed < MICRO_SAMPLE_NS) {
+            calls *= 2;
+        } else if (start - started >= MICRO_WARMUP_NS) {
+            break;
+        }
+    }
+
+    for (s = 0; s < MICRO_SAMPLES; s++) {
+        cycles[s] = now_cycles();
+        start = now_ns();
+        for (i = 0; i < calls; i++) {
+            c->run(in);
+        }
+        ns[s] = (now_ns() - start) / (double)calls;
+        cycles[s] = (now_cycles() - cycles[s]) / (double)calls;
+    }
+
+    result->ns = median(ns, MICRO_SAMPLES);
+    result->min = ns[0];
+    result->cycles = median(cycles, MICRO_SAMPLES);
+    for (s = 0; s < MICRO_SAMPLES; s++) {
+        ns[s] = ns[s] > result->ns ? ns[s] - result->ns : result->ns - ns[s];
+    }
+    result->mad = median(ns, MICRO_SAMPLES);
+}
+
+static int
+run_case(const struct micro_case *c)
+{
+    struct micro_input in;
+    struct micro_result result;
+    size_t scale;
+    int size;
+
+    scale = 1;
+    for (size = 0; size < MICRO_SIZES; size++, scale *= 4) {
+        memset(&in, 0, sizeof(in));
+        buffer_init(&in.text);
+        if (c->prepare(&in, scale) != 0) {
+            fprintf(stderr, "%s: cannot prepare input\n", c->name);
+            buffer_free(&in.text);
+            free(in.scratch);
+            return -1;
+        }
+        measure(c, &in, &result);
+        printf("%-13s %6lu %9lu %12.1f %6.1f%% %12.1f ",
+               c->name, (unsigned long)in.count, (unsigned long)in.text.len,
+               result.ns, result.ns > 0 ? result.mad / result.ns * 100.0 : 0.0,
+               result.min);
+        if (MICRO_HAVE_CYCLES) {
+            printf("%12.1f", result.cycles);
+        } else {
+            printf("%12s", "-");
+        }
+        printf(" %9.1f\n",
+               result.ns > 0 ? (double)in.text.len / result.ns * 1e3 : 0.0);
+        fflush(stdout);
+        buffer_free(&in.text);
+        free(in.scratch);
+    }
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    char cwd[4096];
+    size_t i;
+    int result;
+
+    /* update_record_in_file writes var/records/scjv.rec.tmp */
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(scratch_dir) ||
+        chdir(scratch_dir) != 0 || mkdir("var", 0755) != 0 ||
+        mkdir(RECORDS_DIR, 0755) != 0) {
+        perror("Failed to set up a scratch directory");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-13s %6s %9s %12s %7s %12s %12s %9s\n", "case", "items",
+           "bytes/op", "ns/op", "mad", "min ns/op", "cycles/op", "MB/s");
+    result = 0;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]) && result == 0; i++) {
+        /* A list of names, such as "auth_file,rec_store", picks cases */
+        if (argc < 2 || strstr(argv[1], cases[i].name)) {
+            result = run_case(&cases[i]);
+        }
+    }
+
+    remove(MICRO_RECORDS);
+    remove(MICRO_AUTH);
+    rmdir(RECORDS_DIR);
+    rmdir("var");
+    if (chdir(cwd) != 0 || rmdir(scratch_dir) != 0) {
+        perror(scratch_dir);
+    }
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,33 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/archive.h */
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+#include "record_store.h"
+
+struct buffer;
+
+/* Archive constants */
+#define ARCHIVE_SUFFIX ".archive"           /* Compressed segment */
+#define ARCHIVE_INDEX_SUFFIX ".archive.idx" /* "KEY offset" lines */
+#define ARCHIVE_MAGIC "RCA1"
+#define ARCHIVE_BLOCK_HEADER 16             /* Magic, raw, stored, count */
+#define ARCHIVE_AGE_DAYS 365                /* Closed this long ago moves out */
+#define ARCHIVE_INTERVAL 3600               /* Seconds between passes */
+#define ARCHIVE_KEYS_MIN 64                 /* Initial archived key slots */
+
+/* Cold archive functions */
+void archive_set_age(long days);
+long archive_project(const char *project);
+int archive_find(const char *project, const char *key, struct buffer *out);
+struct rec_store *archive_open(const char *project);
+void archive_start(void);
+
+#endif /* ARCHIVE_H */
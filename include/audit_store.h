@@ -0,0 +1,24 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/audit_store.h */
+#ifndef AUDIT_STORE_H
+#define AUDIT_STORE_H
+
+/* Audit store constants */
+#define AUDIT_BLOCK_LINES 64        /* Lines per index block */
+#define AUDIT_PAGE_SIZE 100         /* Entries per page unless size= is given */
+#define AUDIT_PAGE_MAX 1000         /* Largest size= accepted */
+#define AUDIT_SCAN_MAX 4096         /* Blocks read per request */
+#define AUDIT_FILTER_MAX 128        /* Longest user= or action= */
+#define AUDIT_READ_CHUNK 65536      /* Bytes read at a time while indexing */
+
+/* Audit store functions */
+int audit_store_init(const char *dir);
+int audit_store_refresh(void);
+void audit_store_clear(void);
+int handle_audit_request(int client_socket, const char *uri);
+
+#endif /* AUDIT_STORE_H */
@@ -0,0 +1,30 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/buffer.h */
+#ifndef BUFFER_H
+#define BUFFER_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+/* Growable byte buffer used to build response bodies */
+struct buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+void buffer_init(struct buffer *buf);
+void buffer_free(struct buffer *buf);
+void buffer_reset(struct buffer *buf);
+int buffer_reserve(struct buffer *buf, size_t extra);
+int buffer_append(struct buffer *buf, const char *data, size_t len);
+int buffer_append_str(struct buffer *buf, const char *str);
+int buffer_appendf(struct buffer *buf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int buffer_append_json(struct buffer *buf, const char *str);
+
+#endif /* BUFFER_H */
@@ -0,0 +1,56 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/diag.h */
+#ifndef DIAG_H
+#define DIAG_H
+
+#include "web_server.h"
+
+/*
+ * Verbosity of a LOG_* level: errors 1, warnings 2, information 3 and
+ * debugging 4; LOG_NONE is 0. A constant level folds to a constant.
+ */
+#define DIAG_RANK(level) \
+    ((level) < LOG_NONE ? 1 : (level) == LOG_WARN ? 2 : \
+     (level) == LOG_INFO ? 3 : (level) == LOG_DEBUG ? 4 : 0)
+
+/* Most verbose level compiled in; the production build sets LOG_INFO */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX LOG_DEBUG
+#endif
+
+#define DIAG_LEVEL_DEFAULT LOG_WARN     /* Until diag_set_level is called */
+#define DIAG_LEVEL_ENV "WEB_LOG_LEVEL"  /* error, warn, info, debug or none */
+
+/* Rank of the most verbose level printed; read on every DIAG */
+extern int diag_rank;
+
+/*
+ * True if diagnostics at level are printed. Levels above LOG_LEVEL_MAX
+ * are false at compile time; the rest cost one well predicted branch.
+ */
+#define DIAG_ENABLED(level) \
+    (DIAG_RANK(level) <= DIAG_RANK(LOG_LEVEL_MAX) && \
+     __builtin_expect(DIAG_RANK(level) <= diag_rank, 0))
+
+/*
+ * DIAG(LOG_DEBUG, ("Method: %s\n", method)) - Print a diagnostic to
+ * stderr. The arguments are not evaluated unless level is enabled.
+ */
+#define DIAG(level, args) \
+    do { \
+        if (DIAG_ENABLED(level)) { \
+            diag_printf args; \
+        } \
+    } while (0)
+
+/* Diagnostics functions */
+void diag_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int diag_set_level(int level);
+int diag_get_level(void);
+int diag_parse_level(const char *name, int *level);
+
+#endif /* DIAG_H */
@@ -0,0 +1,16 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/export.h */
+#ifndef EXPORT_H
+#define EXPORT_H
+
+/* Export constants */
+#define EXPORT_MAX_FILTERS 16
+
+/* Export functions */
+int handle_export_request(int client_socket, const char *uri);
+
+#endif /* EXPORT_H */
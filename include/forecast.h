@@ -0,0 +1,24 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/forecast.h */
+#ifndef FORECAST_H
+#define FORECAST_H
+
+#include "record_store.h"
+
+/* Forecast engine constants */
+#define FORECAST_INTERVAL 300       /* Seconds between background passes */
+#define FORECAST_DEFAULT_MONTHS 3
+#define FORECAST_MAX_MONTHS 24
+
+/* Forecast engine functions */
+int forecast_parse_frequency(const char *text, int *days, int *months);
+long forecast_add_months(long days, int months);
+int forecast_refresh(struct rec_store *store);
+void forecast_start(void);
+int handle_forecast_request(int client_socket, const char *uri);
+
+#endif /* FORECAST_H */
@@ -0,0 +1,30 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/history.h */
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+struct buffer;
+
+/* Record history constants */
+#define HISTORY_SUFFIX ".history"
+#define HISTORY_CHECKPOINT_EVERY 8  /* Every 8th revision is stored in full */
+#define HISTORY_HEADER_MAX 256      /* Longest entry header line */
+#define HISTORY_KEY_MAX 64
+
+/* Record history functions */
+int history_baseline(const char *project, const char *text);
+int history_append(const char *project, const char *text, const char *user,
+                   long when);
+int history_at(const char *project, const char *key, long when,
+               struct buffer *out);
+void history_shutdown(void);
+int handle_records_request(int client_socket, const char *uri);
+
+#endif /* HISTORY_H */
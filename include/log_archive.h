@@ -0,0 +1,64 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/log_archive.h */
+#ifndef LOG_ARCHIVE_H
+#define LOG_ARCHIVE_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+/* POSIX headers */
+#include <sys/types.h>
+
+struct buffer;
+
+/* Compressed log constants */
+#define LOG_COMPRESSED_SUFFIX ".lz"     /* Appended to a rotated log's name */
+#define LOG_FRAME_SIZE 65536            /* Raw bytes per frame, at most */
+#define LOG_FRAME_MAGIC "LZF1"
+#define LOG_FRAME_ENTRY 16              /* Index bytes per frame */
+#define LOG_FRAME_TRAILER 24            /* Index offset, count, size, inode, magic */
+#define LOG_ARCHIVE_QUEUE 4             /* Logs waiting for the compressor */
+#define LOG_ARCHIVE_NAME_MAX 32         /* Longest log name queued */
+
+/* One frame of a compressed log */
+struct log_frame {
+    off_t raw;                          /* Offset in the original file */
+    off_t stored;                       /* Offset in the compressed file */
+    size_t raw_len;
+    size_t stored_len;
+};
+
+/* A rotated log, compressed or not, read by offset in the original text */
+struct log_archive {
+    struct log_frame *frames;           /* NULL for a plain file */
+    char *cache;                        /* Last frame expanded */
+    char *stored;                       /* Compressed bytes being read */
+    off_t size;                         /* Bytes of text */
+    ino_t ino;                          /* Inode of the file the text came from */
+    size_t count;
+    size_t cached;                      /* Frame in cache, plus one; 0 if none */
+    size_t stored_cap;
+    int fd;
+    int pad;
+};
+
+/* Compressed log functions */
+int log_archive_compress(const char *path);
+int log_archive_open(struct log_archive *archive, const char *path);
+ssize_t log_archive_read(struct log_archive *archive, char *dst, size_t len,
+                         off_t offset);
+void log_archive_close(struct log_archive *archive);
+
+/* Background compressor */
+int log_archive_start(void);
+void log_archive_shutdown(void);
+void log_archive_queue(const char *logname);
+void log_archive_lock(void);
+void log_archive_unlock(void);
+int log_archive_stats(struct buffer *out);
+
+#endif /* LOG_ARCHIVE_H */
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/log_writer.h */
+#ifndef LOG_WRITER_H
+#define LOG_WRITER_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+struct buffer;
+
+/* Log files */
+#define LOG_FILE_WEB 0                  /* var/log/web.log */
+#define LOG_FILE_AUDIT 1                /* var/log/audit.log */
+#define LOG_FILES 2
+
+/* Log writer constants */
+#define LOG_RING_SIZE 256               /* Entries per thread; power of two */
+#define LOG_RINGS_MAX 16                /* Threads with a ring of their own */
+#define LOG_ENTRY_MAX 512               /* Longest line, with timestamp */
+#define LOG_STAMP_LEN 19                /* "YYYY-mm-dd HH:MM:SS" */
+#define LOG_BATCH_MAX 64                /* Lines per writev */
+#define LOG_FLUSH_MS 50                 /* Writer wakes this often when idle */
+#define LOG_REOPEN_INTERVAL 1           /* Seconds between checks for a moved file */
+
+/* What a full ring does with a web log line; audit lines always wait */
+#define LOG_POLICY_DROP 0
+#define LOG_POLICY_BLOCK 1
+#define LOG_POLICY_DEFAULT LOG_POLICY_DROP
+
+/* Flags */
+#define LOG_WRITE_DURABLE 1             /* Return once the line is in the file */
+
+/* Log writer functions */
+int log_writer_start(void);
+void log_writer_shutdown(void);
+void log_writer_set_policy(int policy);
+int log_writer_printf(int file, int flags, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+int log_writer_stats(struct buffer *out);
+unsigned long log_writer_dropped(void);
+
+#endif /* LOG_WRITER_H */
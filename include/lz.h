@@ -0,0 +1,28 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/lz.h */
+#ifndef LZ_H
+#define LZ_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+struct buffer;
+
+/* Compressor constants */
+#define LZ_HASH_BITS 12             /* Match finder table of 4096 entries */
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/* Worst-case compressed size of len bytes */
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/* Block compression functions */
+int lz_compress(const char *src, size_t len, struct buffer *out);
+int lz_decompress(const char *src, size_t len, char *dst, size_t size,
+                  size_t *written);
+
+#endif /* LZ_H */
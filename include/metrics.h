@@ -0,0 +1,34 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/metrics.h */
+#ifndef METRICS_H
+#define METRICS_H
+
+/* Standard C headers */
+#include <stddef.h>
+#include <time.h>
+
+struct buffer;
+
+/* Metrics constants */
+#define METRICS_SHARDS_MAX 16           /* Threads with counters of their own */
+#define METRICS_SUB_BUCKETS 4           /* Histogram buckets per power of two */
+#define METRICS_BUCKETS 96              /* Up to 2^26 microseconds, about 67 s */
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+/* Request metrics */
+void metrics_request_begin(void);
+void metrics_request_route(const char *uri);
+void metrics_request_end(int result);
+void metrics_connection_done(void);
+void metrics_bytes_sent(size_t bytes);
+void metrics_lock_wait(const struct timespec *start);
+
+/* Scraping */
+int metrics_render(struct buffer *out);
+int handle_metrics_request(int client_socket);
+
+#endif /* METRICS_H */
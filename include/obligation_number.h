@@ -0,0 +1,26 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/obligation_number.h */
+#ifndef OBLIGATION_NUMBER_H
+#define OBLIGATION_NUMBER_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+/* Allocator constants */
+#define OBLIGATION_DEFAULT_PREFIX "PCEMP"
+#define OBLIGATION_PREFIX_MAX 16
+#define OBLIGATION_MAX_PREFIXES 256        /* One per project (REC_MAX_PROJECTS) */
+#define OBLIGATION_LINE_MAX 40             /* "PREFIX-N\n" in the counter file */
+#define OBLIGATION_BLOCK_SIZE 100
+
+/* Obligation number allocator functions */
+int obligation_number_init(const char *path);
+void obligation_number_shutdown(void);
+long obligation_number_next(const char *prefix, const char *project);
+int obligation_number_prefix(const char *project, char *prefix, size_t size);
+
+#endif /* OBLIGATION_NUMBER_H */
@@ -0,0 +1,53 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/password.h */
+#ifndef PASSWORD_H
+#define PASSWORD_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+/* Password hashing constants */
+#ifndef PASSWORD_ROUNDS
+#define PASSWORD_ROUNDS 20000       /* SHA-512 crypt rounds for new hashes */
+#endif
+#define PASSWORD_DEFAULT_ROUNDS 5000    /* Rounds of a hash that names none */
+#define PASSWORD_SALT_LEN 16
+#define PASSWORD_HASH_MAX 128       /* Longest stored hash, with NUL */
+#define PASSWORD_INPUT_MAX 256      /* Longest password accepted */
+#define PASSWORD_WORKERS 2          /* Threads verifying logins */
+#define PASSWORD_QUEUE_MAX 64       /* Logins waiting or in progress */
+
+/*
+ * A login handed to the worker pool. The job owns client_socket: it is
+ * closed once done has run on the server thread.
+ */
+struct password_job {
+    struct password_job *next;
+    void (*done)(struct password_job *job);
+    int client_socket;
+    int match;                              /* Set by the worker */
+    char username[64];
+    char password[PASSWORD_INPUT_MAX];      /* Cleared once verified */
+    char stored[PASSWORD_HASH_MAX];         /* Looked up by the worker */
+    char rehash[PASSWORD_HASH_MAX];         /* New hash when stored is outdated */
+};
+
+/* Password hashing functions */
+int password_hash(const char *password, char *out, size_t size);
+int password_verify(const char *password, const char *stored);
+int password_needs_rehash(const char *stored);
+
+/* Worker pool functions */
+int password_pool_start(void);
+void password_pool_shutdown(void);
+int password_pool_fd(void);
+int password_pool_submit(int client_socket, const char *username,
+                         const char *password,
+                         void (*done)(struct password_job *job));
+long password_pool_dispatch(void);
+
+#endif /* PASSWORD_H */
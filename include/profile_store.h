@@ -0,0 +1,40 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/profile_store.h */
+#ifndef PROFILE_STORE_H
+#define PROFILE_STORE_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+/* Profile store constants */
+#define PROFILE_FILE "var/profiles.rec"
+#define PROFILE_UPDATES_LOG "var/log/updates.log"   /* Imported once, then renamed */
+#define PROFILE_IMPORTED_SUFFIX ".imported"
+#define PROFILE_MAX 1024                /* Profiles kept */
+#define PROFILE_FIELD_MAX 128           /* Longest value, with NUL */
+#define PROFILE_FLUSH_INTERVAL 1        /* Seconds between batch writes */
+#define PROFILE_BATCH_MAX 32            /* Pending updates forcing a write */
+
+struct profile {
+    char username[64];
+    char fullname[PROFILE_FIELD_MAX];
+    char email[PROFILE_FIELD_MAX];
+    char project[PROFILE_FIELD_MAX];
+};
+
+/* Profile store functions */
+int profile_store_init(const char *path);
+void profile_store_start(void);
+void profile_store_shutdown(void);
+int profile_store_get(const char *username, struct profile *profile);
+int profile_store_update(const struct profile *profile);
+int profile_store_flush(void);
+long profile_store_import(const char *log_path);
+int handle_profile_request(int client_socket, const char *uri,
+                           const char *request);
+
+#endif /* PROFILE_STORE_H */
@@ -0,0 +1,43 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/query.h */
+#ifndef QUERY_H
+#define QUERY_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+#include "record_store.h"
+
+struct buffer;
+
+/* Query engine constants */
+#define QUERY_EXPR_MAX 1024         /* Longest selection expression */
+#define QUERY_MAX_NODES 256         /* Syntax tree nodes per expression */
+#define QUERY_MAX_CONSTANTS 32      /* Literals per expression */
+#define QUERY_MAX_REGEXES 8         /* '~' operators per expression */
+#define QUERY_MAX_PUSHDOWN 4        /* Indexable conjuncts considered */
+#define QUERY_STACK_MAX 64          /* Evaluation stack depth */
+#define QUERY_PLAN_CACHE_SIZE 64    /* Compiled plans kept */
+
+/* How query_run reached the records */
+#define QUERY_ACCESS_SCAN 0
+#define QUERY_ACCESS_KEY 1
+#define QUERY_ACCESS_INDEX 2
+
+struct query_plan;
+
+/* Query engine functions */
+struct query_plan *query_compile(const char *text, size_t *error_at);
+long query_run(const struct query_plan *plan, struct rec_store *store,
+               int (*visit)(void *arg, const struct rec_record *record),
+               void *arg, int *access);
+void query_cache_clear(void);
+int query_stats(struct buffer *out);
+void query_plan_counts(unsigned long *hits, unsigned long *misses);
+int handle_query_request(int client_socket, const char *uri);
+
+#endif /* QUERY_H */
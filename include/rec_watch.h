@@ -0,0 +1,19 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/rec_watch.h */
+#ifndef REC_WATCH_H
+#define REC_WATCH_H
+
+/* Watcher constants */
+#define REC_WATCH_BUFFER 4096       /* Bytes of inotify events read at once */
+
+/* Records directory watcher functions */
+int rec_watch_init(const char *records_dir);
+void rec_watch_shutdown(void);
+int rec_watch_fd(void);
+long rec_watch_dispatch(void);
+
+#endif /* REC_WATCH_H */
@@ -0,0 +1,192 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/record_store.h */
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+/* Standard C headers */
+#include <limits.h>
+#include <stddef.h>
+
+struct archive_keys;
+struct buffer;
+
+/* Record store constants */
+#define REC_SUFFIX ".rec"
+#define REC_SCHEMA_FILE "schema.desc"
+#define REC_KEY_FIELD "Obligation_Number"
+#define REC_MAX_FIELD_NAMES 128
+#define REC_NAME_MAX 64
+#define REC_TITLE_MAX 128
+#define REC_MAX_PROJECTS 256
+#define REC_MEMORY_BUDGET (32UL * 1024 * 1024) /* Resident store bytes */
+#define REC_DICT_MAX_CODES 1024     /* Distinct values interned per field */
+#define REC_BLOOM_PROBES 3          /* Bloom filter bits set per key */
+#define REC_DATE_INVALID LONG_MIN
+
+/* Forecast kinds, used as indexes into the per-record forecast arrays */
+#define REC_DUE_RECURRING 0
+#define REC_DUE_INSPECTION 1
+#define REC_DUE_KINDS 2
+
+/*
+ * One "Name: value" pair. Continuation lines ("+ text") are folded into
+ * the value separated by '\n'. Names are ids into a global name table.
+ * Values of low-cardinality fields are interned: code is then their
+ * non-zero dictionary code and value points at the shared copy.
+ */
+struct rec_field {
+    const char *value;
+    unsigned short name;
+    unsigned short code;
+    unsigned int len;
+};
+
+/*
+ * A parsed record lives in a single allocation: the struct, its field
+ * array and the value bytes. source hashes the record's text as read from
+ * the file (0 if it did not come from the file), so a re-read can tell
+ * unchanged records apart without parsing them. The forecast members
+ * cache the last result of the forecast engine together with a hash of
+ * the inputs it used.
+ */
+struct rec_record {
+    struct rec_field *fields;
+    size_t nfields;
+    unsigned long hash;
+    unsigned long source;
+    unsigned long forecast_inputs;
+    long forecast_next[REC_DUE_KINDS];
+    int forecast_days[REC_DUE_KINDS];
+    int forecast_months[REC_DUE_KINDS];
+};
+
+/* Due-date entry; the store keeps these sorted by day */
+struct rec_due {
+    struct rec_record *record;
+    long day;
+    long kind;
+};
+
+/*
+ * Postings of one interned field: positions of the records whose value
+ * has code c are positions[starts[c - 1]] .. positions[starts[c] - 1].
+ * Built on demand and rebuilt when the store version moves on.
+ */
+struct rec_index {
+    size_t *starts;
+    size_t *positions;
+    size_t codes;
+    unsigned long field;
+    unsigned long version;
+    struct rec_index *next;
+};
+
+/*
+ * Positions of the records ordered on the %sort field, naturally sorted
+ * (digit runs by value, so PCEMP-9 precedes PCEMP-10). Records without
+ * the field are left out. Rebuilt on demand when the version moves on.
+ */
+struct rec_order {
+    size_t *positions;
+    size_t count;
+    unsigned long field;
+    unsigned long version;
+};
+
+/*
+ * A var/records/<name>.rec file found by scanning the records directory.
+ * title is the Project_Name of its first record, or the name.
+ */
+struct rec_project {
+    char name[REC_NAME_MAX];
+    char title[REC_TITLE_MAX];
+    unsigned long size;
+};
+
+/*
+ * In-memory copy of one var/records/<project>.rec file. keys and bloom
+ * index the records by Obligation_Number. version changes on every
+ * mutation and is unique across all stores, so it can key caches.
+ * used orders stores for eviction; bytes estimates the store's memory
+ * as of bytes_version. archived holds the keys of its archive once
+ * archive.c has needed them.
+ */
+struct rec_store {
+    char name[REC_NAME_MAX];
+    char path[512];
+    char *header;
+    struct rec_record **records;
+    size_t count;
+    size_t capacity;
+    size_t *keys;
+    size_t key_size;
+    size_t key_count;
+    unsigned char *bloom;
+    size_t bloom_size;
+    struct archive_keys *archived;
+    struct rec_index *indexes;
+    struct rec_order *order;
+    struct rec_due *due;
+    size_t due_count;
+    unsigned long version;
+    unsigned long used;
+    unsigned long bytes_version;
+    size_t bytes;
+    unsigned long forecast_version;
+    long forecast_day;
+    struct rec_store *next;
+};
+
+/* Registry of loaded project stores */
+int rec_registry_init(const char *records_dir);
+void rec_registry_shutdown(void);
+struct rec_store *rec_registry_list(void);
+size_t rec_registry_projects(const struct rec_project **list);
+const struct rec_project *rec_registry_find(const char *name);
+void rec_registry_trim(size_t budget);
+int rec_registry_stats(struct buffer *out);
+int rec_valid_project_name(const char *name);
+struct rec_store *rec_store_get(const char *project);
+int rec_store_apply(const char *project, const char *text);
+long rec_store_sync(const char *project);
+struct rec_store *rec_store_parse(const char *name, const char *text, size_t len);
+void rec_store_free(struct rec_store *store);
+
+/* Store and record access */
+struct rec_record *rec_store_find(const struct rec_store *store, const char *key);
+int rec_store_key_repeated(const struct rec_store *store, const char *key);
+int rec_store_upsert(struct rec_store *store, const char *text, size_t len);
+const struct rec_index *rec_store_index(struct rec_store *store, unsigned short field);
+const struct rec_order *rec_store_order(struct rec_store *store);
+size_t rec_order_seek(const struct rec_store *store, const struct rec_order *order,
+                      const char *value, int after);
+int rec_natural_compare(const char *a, const char *b);
+struct rec_record *rec_parse_record(const char *text, size_t len);
+const char *rec_get(const struct rec_record *record, const char *field);
+const char *rec_get_id(const struct rec_record *record, unsigned short id);
+const struct rec_field *rec_find_field(const struct rec_record *record,
+                                       unsigned short id);
+int rec_field_id(const char *name);
+int rec_field_lookup(const char *name);
+unsigned short rec_field_count(void);
+const char *rec_field_name(unsigned short id);
+unsigned long rec_hash(const char *data, size_t len, unsigned long seed);
+char *rec_read_file(const char *path, size_t *size);
+const char *rec_next_chunk(const char *chunk, const char *end, size_t *len);
+
+/* Value dictionaries of interned fields */
+unsigned short rec_dict_lookup(unsigned short field, const char *value);
+int rec_dict_stats(struct buffer *out);
+
+/* Date helpers: dates are whole days since 1970-01-01 */
+long rec_days_from_civil(int year, int month, int day);
+void rec_civil_from_days(long days, int *year, int *month, int *day);
+long rec_parse_date(const char *text);
+long rec_today(void);
+void rec_format_date(long days, char *out, size_t size);
+
+#endif /* RECORD_STORE_H */
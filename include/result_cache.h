@@ -0,0 +1,33 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/result_cache.h */
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+struct buffer;
+
+/* Result cache constants */
+#define RESULT_CACHE_MAX_ENTRIES 256
+#define RESULT_CACHE_MAX_BYTES (4 * 1024 * 1024)
+#define RESULT_CACHE_MAX_ENTRY (256 * 1024)    /* Larger bodies are not kept */
+#define RESULT_CACHE_BUCKETS 512
+
+/* result_cache_begin outcomes */
+#define RESULT_CACHE_HIT 1
+#define RESULT_CACHE_MISS 0
+
+/* Result cache functions */
+int result_cache_begin(const char *key, unsigned long version, struct buffer *out);
+void result_cache_finish(const char *key, unsigned long version,
+                         const char *body, size_t len);
+void result_cache_clear(void);
+int result_cache_stats(struct buffer *out);
+void result_cache_counts(unsigned long *hits, unsigned long *misses);
+
+#endif /* RESULT_CACHE_H */
@@ -0,0 +1,34 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/session.h */
+#ifndef SESSION_H
+#define SESSION_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+struct buffer;
+
+/* Session constants */
+#define SESSION_TOKEN_BYTES 16                      /* Random bytes per token */
+#define SESSION_TOKEN_LEN (SESSION_TOKEN_BYTES * 2) /* Hex characters */
+#define SESSION_COOKIE "session"
+#define SESSION_TIMEOUT 3600        /* Seconds idle before a session ends */
+#define SESSION_SHARDS 16           /* Independently locked tables */
+#define SESSION_BUCKETS 256         /* Hash chains per shard */
+#define SESSION_MAX 4096            /* Live sessions across all shards */
+#define SESSION_USER_MAX 64         /* Longest username kept, with NUL */
+
+/* Session functions */
+int session_create(const char *username, char *token, size_t size);
+int session_lookup(const char *token, char *username, size_t size);
+int session_from_request(const char *request, char *username, size_t size);
+int session_destroy(const char *token);
+int session_destroy_request(const char *request);
+void session_clear(void);
+int session_stats(struct buffer *out);
+
+#endif /* SESSION_H */
@@ -0,0 +1,13 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/stats.h */
+#ifndef STATS_H
+#define STATS_H
+
+/* Introspection functions */
+int handle_stats_request(int client_socket);
+
+#endif /* STATS_H */
@@ -0,0 +1,21 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/table.h */
+#ifndef TABLE_H
+#define TABLE_H
+
+/* Table rendering constants */
+#define TABLE_PAGE_SIZE 100         /* Rows per page unless size= is given */
+#define TABLE_PAGE_MAX 1000         /* Largest size= accepted */
+#define TABLE_FILTER_MAX 64         /* Longest column filter */
+#define TABLE_ORDER_CACHE 16        /* Sorted orders kept */
+#define TABLE_WARNING_DAYS 14       /* Rows due this soon are marked */
+
+/* Table rendering functions */
+int handle_table_request(int client_socket, const char *uri);
+void table_cache_clear(void);
+
+#endif /* TABLE_H */
@@ -0,0 +1,36 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/timer_wheel.h */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/*
+ * Hierarchical timer wheel driven by the main loop, one tick per second.
+ * Four levels of 64 slots cover delays of up to 64^4 seconds (~194 days).
+ * Timers are intrusive: callers own the struct timer storage.
+ */
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    void (*fn)(void *arg);
+    void *arg;
+    unsigned long expires;  /* Absolute tick */
+};
+
+void timer_wheel_init(unsigned long now);
+void timer_wheel_advance(unsigned long now);
+unsigned long timer_wheel_now(void);
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg);
+void timer_add(struct timer *t, unsigned long delay);
+void timer_del(struct timer *t);
+int timer_pending(const struct timer *t);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,65 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/trace.h */
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Standard C headers */
+#include <time.h>
+
+struct buffer;
+
+/* Trace constants */
+#define TRACE_RINGS_MAX 16              /* Threads that can record traces */
+#define TRACE_RING_SIZE 1024            /* Spans kept per thread, oldest dropped */
+#define TRACE_DETAIL_MAX 64             /* URI kept with a request span */
+#define TRACE_SAMPLE_ENV "WEB_TRACE_SAMPLE"     /* Trace one request in N; 0 is off */
+#define TRACE_DUMP_FILE "var/log/trace.json"    /* Written on SIGUSR1 */
+
+/* Trace one request in trace_every; 0 turns tracing off. Read on every span */
+extern unsigned long trace_every;
+
+/* A phase being timed; name is NULL unless the request is sampled */
+struct trace_span {
+    const char *name;
+    struct timespec start;
+};
+
+/*
+ * TRACE_BEGIN(span, "flock") - Start timing a phase of the request this
+ * thread is handling. With tracing off this is one predicted branch.
+ * The name must be a string constant.
+ */
+#define TRACE_BEGIN(span, label) \
+    do { \
+        (span).name = NULL; \
+        if (__builtin_expect(trace_every != 0, 0)) { \
+            trace_span_begin(&(span), (label)); \
+        } \
+    } while (0)
+
+/* TRACE_END(span) - Record the phase begun with TRACE_BEGIN */
+#define TRACE_END(span) \
+    do { \
+        if ((span).name) { \
+            trace_span_end(&(span)); \
+        } \
+    } while (0)
+
+/* Tracing functions */
+void trace_set_sample(unsigned long every);
+void trace_request_begin(void);
+void trace_request_uri(const char *uri);
+void trace_request_end(void);
+void trace_span_begin(struct trace_span *span, const char *name);
+void trace_span_end(const struct trace_span *span);
+
+/* Dumping */
+int trace_render(struct buffer *out);
+int trace_dump(const char *path);
+int handle_trace_request(int client_socket);
+
+#endif /* TRACE_H */
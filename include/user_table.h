@@ -0,0 +1,31 @@
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: 	AGPL-3.0-or-later
+ */
+
+/* filepath: include/user_table.h */
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+/* Standard C headers */
+#include <stddef.h>
+
+struct buffer;
+struct user_entry;
+
+/* User table constants */
+#define USER_TABLE_MAX 1024             /* Users kept from the auth file */
+#define USER_TABLE_CHECK_INTERVAL 1     /* Seconds between auth file checks */
+
+/* User table functions */
+int user_table_init(const char *path);
+void user_table_shutdown(void);
+void user_table_start(void);
+int user_table_refresh(void);
+int user_table_find(const char *username, struct user_entry *entry);
+int user_table_password(const char *username, char *out, size_t size);
+int user_table_users(struct buffer *out);
+int user_table_set_password(const char *username, const char *hash);
+int user_table_parse_line(char *line, struct user_entry *entry);
+
+#endif /* USER_TABLE_H */
@@ -14,14 +14,16 @@
 /* System constants */
 #define MAX_BUFFER_SIZE 4096
 #define DEFAULT_PORT 8080
+#define HTTP_CHUNK_SIZE 4096    /* Largest chunk of a streamed response */
+#define HTTP_CHUNK_HEADER 6     /* "XXXX\r\n" size line, fixed width */
 #define UNUSED(x) ((void)(x))
 
 /* Path constants */
 #define WWW_ROOT "./www"
 #define AUTH_FILE "./etc/auth.passwd"
-#define RECORDS_DIR "/home/appuser/fork-web-app/var/records"
-#define ENDPOINT_READ "/var/records/scjv.rec"
-#define OBLIGATION_NUMBER_FILE "/var/records/next_number.txt"
+#define RECORDS_DIR "var/records"
+#define PROJECT_PAGE "project.html"
+#define OBLIGATION_NUMBER_FILE "var/records/obligation_number.txt"
 
 /* Logging constants */
 #define LOG_DIR "var/log"
@@ -42,6 +44,18 @@
 #define ENDPOINT_CREATE "/create_record"
 #define ENDPOINT_UPDATE "/update_record"
 #define ENDPOINT_NEXT_NUMBER "/get_next_number"
+#define ENDPOINT_FORECAST "/api/forecast"
+#define ENDPOINT_EXPORT "/api/export"
+#define ENDPOINT_STATS "/api/stats"
+#define ENDPOINT_QUERY "/api/query"
+#define ENDPOINT_RECORDS "/api/records/"
+#define ENDPOINT_TABLE "/api/table"
+#define ENDPOINT_PROJECTS "/api/projects"
+#define ENDPOINT_LOGOUT "/logout"
+#define ENDPOINT_PROFILE "/api/profile"
+#define ENDPOINT_AUDIT "/api/audit"
+#define ENDPOINT_METRICS "/metrics"
+#define ENDPOINT_TRACE "/debug/trace"
 
 /* Error codes */
 #define ERR_NONE 0      /* No error */
@@ -51,6 +65,10 @@
 #define ERR_PERM -4     /* Permission denied */
 #define ERR_NOTFOUND -5 /* Not found */
 #define ERR_INTERNAL -6 /* Internal error */
+#define ERR_EXISTS -7   /* Already exists */
+
+/* handle_client handed the socket on; the caller must not close it */
+#define HANDLE_DEFERRED 1
 
 /* Log levels */
 #define LOG_NONE    0   /* No logging */
@@ -71,7 +89,7 @@
 /* Data structures */
 struct user_entry {
     char username[64];
-    char password[64];
+    char password[128];     /* crypt hash, or a legacy plaintext password */
     int uid;
     int gid;
     char fullname[128];
@@ -80,9 +98,26 @@ struct user_entry {
     int is_admin;
 };
 
+/* Streamed response state; data holds the size line, payload and CRLF */
+struct chunked_writer {
+    size_t len;
+    int fd;
+    int error;
+    char data[HTTP_CHUNK_HEADER + HTTP_CHUNK_SIZE + 2];
+};
+
 /* Core server functions */
 int setup_server(int port);
 int handle_client(int client_socket, const char *www_root);
+int send_response(int client_socket, const char *status, const char *content_type,
+                  const char *body, size_t length);
+int send_error_json(int client_socket, const char *status, const char *message);
+int get_query_param(const char *query, const char *name, char *value, size_t size);
+size_t url_decode(const char *src, size_t len, char *out, size_t size);
+int chunked_begin(struct chunked_writer *writer, int client_socket,
+                  const char *content_type, const char *extra_headers);
+int chunked_write(struct chunked_writer *writer, const char *data, size_t length);
+int chunked_end(struct chunked_writer *writer);
 
 /* Authentication functions */
 int check_auth(const char *username, const char *password);
@@ -99,8 +134,9 @@ int handle_create_record(int client_socket, const char *data);
 int handle_update_record(int client_socket, const char *data);
 int create_record_in_file(const char *data);
 int update_record_in_file(FILE *fp, const char *data);
-int handle_next_number(int client_socket);
+int handle_next_number(int client_socket, const char *uri);
 int get_next_obligation_number(void);
+int handle_projects_request(int client_socket);
 
 /* Logging functions */
 int log_message(int level, const char *username, const char *action, const char *msg);
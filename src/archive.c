@@ -0,0 +1,685 @@
+/* filepath: src/archive.c */
+#include "../include/archive.h"
+#include "../include/buffer.h"
+#include "../include/lz.h"
+#include "../include/metrics.h"
+#include "../include/timer_wheel.h"
+#include "../include/web_server.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+/*
+ * Closed obligations that were closed out long enough ago move from
+ * <project>.rec to <project>.archive, so the resident store, its indexes
+ * and every scan only cover open work. The archive is append-only: each
+ * pass adds one block holding the moved record chunks, verbatim and
+ * compressed with lz_compress, behind a small header:
+ *
+ *   "RCA1" raw-length stored-length record-count (32-bit little-endian)
+ *
+ * <project>.archive.idx gets one "KEY offset" line per record naming the
+ * block that holds it. The index is read once per store into a table of
+ * key hashes that append_block keeps current, so checking a new key
+ * costs no I/O unless its hash is there; a lookup then reads a single
+ * block. Queries decompress the segment on demand.
+ */
+static long archive_age = ARCHIVE_AGE_DAYS;
+static struct timer archive_timer;
+
+/* A record selected for archiving, found again by its text hash */
+struct archive_pick {
+    unsigned long source;
+    const char *key;
+};
+
+/*
+ * Archived keys of one store by hash, each with the offset of the block
+ * holding it. A hash of 0 marks an empty slot. A matching hash is only
+ * trusted once the key is found in its block.
+ */
+struct archive_slot {
+    unsigned long hash;
+    long offset;
+};
+
+struct archive_keys {
+    size_t size;                        /* Slots, a power of two */
+    size_t count;
+    struct archive_slot slots[1];
+};
+
+void
+archive_set_age(long days)
+{
+    archive_age = days;
+}
+
+static int
+archive_path(const struct rec_store *store, const char *suffix,
+             char *path, size_t size)
+{
+    size_t len;
+    int n;
+
+    len = strlen(store->path) - strlen(REC_SUFFIX);
+    n = snprintf(path, size, "%.*s%s", (int)len, store->path, suffix);
+    return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+static void
+put32(unsigned char *p, size_t value)
+{
+    p[0] = (unsigned char)(value & 0xff);
+    p[1] = (unsigned char)((value >> 8) & 0xff);
+    p[2] = (unsigned char)((value >> 16) & 0xff);
+    p[3] = (unsigned char)((value >> 24) & 0xff);
+}
+
+static size_t
+get32(const unsigned char *p)
+{
+    return (size_t)p[0] | ((size_t)p[1] << 8) |
+           ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+}
+
+static unsigned long
+key_hash(const char *key, size_t len)
+{
+    unsigned long hash;
+
+    hash = rec_hash(key, len, 0);
+    return hash ? hash : 1;
+}
+
+static struct archive_keys *
+keys_alloc(size_t size)
+{
+    struct archive_keys *keys;
+
+    keys = calloc(1, sizeof(*keys) + (size - 1) * sizeof(keys->slots[0]));
+    if (keys) {
+        keys->size = size;
+    }
+    return keys;
+}
+
+static void
+keys_insert(struct archive_keys *keys, unsigned long hash, long offset)
+{
+    size_t slot;
+
+    slot = hash & (keys->size - 1);
+    while (keys->slots[slot].hash) {
+        slot = (slot + 1) & (keys->size - 1);
+    }
+    keys->slots[slot].hash = hash;
+    keys->slots[slot].offset = offset;
+    keys->count++;
+}
+
+/* Add one key, doubling the table once it is half full */
+static int
+keys_add(struct archive_keys **keys, const char *key, size_t len, long offset)
+{
+    struct archive_keys *grown;
+    size_t i;
+
+    if (((*keys)->count + 1) * 2 > (*keys)->size) {
+        grown = keys_alloc((*keys)->size * 2);
+        if (!grown) {
+            return -1;
+        }
+        for (i = 0; i < (*keys)->size; i++) {
+            if ((*keys)->slots[i].hash) {
+                keys_insert(grown, (*keys)->slots[i].hash, (*keys)->slots[i].offset);
+            }
+        }
+        free(*keys);
+        *keys = grown;
+    }
+    keys_insert(*keys, key_hash(key, len), offset);
+    return 0;
+}
+
+/* The store's archived keys, read from its index the first time */
+static struct archive_keys *
+keys_load(struct rec_store *store)
+{
+    struct archive_keys *keys;
+    char path[sizeof(store->path) + sizeof(ARCHIVE_INDEX_SUFFIX)];
+    const char *line;
+    const char *next;
+    const char *space;
+    char *index;
+    size_t size;
+
+    if (store->archived) {
+        return store->archived;
+    }
+    keys = keys_alloc(ARCHIVE_KEYS_MIN);
+    if (!keys) {
+        return NULL;
+    }
+    index = archive_path(store, ARCHIVE_INDEX_SUFFIX, path, sizeof(path)) == 0 ?
+        rec_read_file(path, &size) : NULL;
+    for (line = index; line && *line; line = next) {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        space = next - 1;
+        while (space > line && *space != ' ') {
+            space--;
+        }
+        if (space > line &&
+            keys_add(&keys, line, (size_t)(space - line), atol(space + 1)) != 0) {
+            free(index);
+            free(keys);
+            return NULL;
+        }
+    }
+    free(index);
+    store->archived = keys;
+    return keys;
+}
+
+static int
+compare_pick(const void *a, const void *b)
+{
+    const struct archive_pick *x;
+    const struct archive_pick *y;
+
+    x = a;
+    y = b;
+    return x->source < y->source ? -1 : x->source > y->source;
+}
+
+static int
+is_closed(const struct rec_record *record)
+{
+    const char *status;
+
+    status = rec_get(record, "Status");
+    return status && (strcmp(status, "Closed") == 0 ||
+                      strcmp(status, "Completed") == 0);
+}
+
+static int
+write_all_fd(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Append one compressed block and its index lines */
+static int
+append_block(struct rec_store *store, const struct buffer *cold,
+             const struct buffer *keys, size_t count)
+{
+    unsigned char header[ARCHIVE_BLOCK_HEADER];
+    struct buffer block;
+    struct buffer index;
+    struct stat st;
+    char path[sizeof(store->path) + sizeof(ARCHIVE_INDEX_SUFFIX)];
+    const char *key;
+    const char *eol;
+    int fd;
+    int result;
+
+    buffer_init(&block);
+    buffer_init(&index);
+    if (archive_path(store, ARCHIVE_SUFFIX, path, sizeof(path)) != 0 ||
+        lz_compress(cold->data, cold->len, &block) != 0) {
+        buffer_free(&block);
+        return ERR_INTERNAL;
+    }
+
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        buffer_free(&block);
+        return ERR_IO;
+    }
+    memcpy(header, ARCHIVE_MAGIC, 4);
+    put32(header + 4, cold->len);
+    put32(header + 8, block.len);
+    put32(header + 12, count);
+
+    /* Index lines name the block by the offset it is written at */
+    result = fstat(fd, &st) == 0 ? ERR_NONE : ERR_IO;
+    for (key = keys->data; result == ERR_NONE && key < keys->data + keys->len;
+         key = eol + 1) {
+        eol = strchr(key, '\n');
+        if (buffer_appendf(&index, "%.*s %ld\n", (int)(eol - key), key,
+                           (long)st.st_size) != 0) {
+            result = ERR_INTERNAL;
+        }
+    }
+    if (result == ERR_NONE &&
+        (write_all_fd(fd, (const char *)header, sizeof(header)) != 0 ||
+         write_all_fd(fd, block.data, block.len) != 0 || fsync(fd) != 0)) {
+        result = ERR_IO;
+    }
+    close(fd);
+    buffer_free(&block);
+
+    if (result == ERR_NONE &&
+        archive_path(store, ARCHIVE_INDEX_SUFFIX, path, sizeof(path)) == 0) {
+        fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0 || write_all_fd(fd, index.data, index.len) != 0 ||
+            fsync(fd) != 0) {
+            result = ERR_IO;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    buffer_free(&index);
+
+    /* Keep the loaded keys current; if that fails, reload them later */
+    for (key = keys->data; result == ERR_NONE && store->archived &&
+         key < keys->data + keys->len; key = eol + 1) {
+        eol = strchr(key, '\n');
+        if (keys_add(&store->archived, key, (size_t)(eol - key),
+                     (long)st.st_size) != 0) {
+            free(store->archived);
+            store->archived = NULL;
+        }
+    }
+    return result;
+}
+
+/* Write the records that stay behind and swap them in */
+static int
+replace_hot(const struct rec_store *store, const struct buffer *hot)
+{
+    char path[sizeof(store->path) + 8];
+    int fd;
+    int n;
+
+    n = snprintf(path, sizeof(path), "%s.tmp", store->path);
+    if (n < 0 || (size_t)n >= sizeof(path)) {
+        return ERR_PARAM;
+    }
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return ERR_IO;
+    }
+    if (write_all_fd(fd, hot->data ? hot->data : "", hot->len) != 0 ||
+        fsync(fd) != 0) {
+        close(fd);
+        unlink(path);
+        return ERR_IO;
+    }
+    close(fd);
+    if (rename(path, store->path) != 0) {
+        unlink(path);
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/* Choose the records to move, sorted by source hash */
+static size_t
+pick_records(const struct rec_store *store, struct archive_pick *picks)
+{
+    const struct rec_record *record;
+    long cutoff;
+    long closed;
+    size_t count;
+    size_t i;
+
+    cutoff = rec_today() - archive_age;
+    count = 0;
+    for (i = 0; i < store->count; i++) {
+        record = store->records[i];
+
+        /* Upserts have no file text yet; they go on a later pass */
+        if (!record->source || !is_closed(record) ||
+            !rec_get(record, REC_KEY_FIELD)) {
+            continue;
+        }
+        closed = rec_parse_date(rec_get(record, "Close_Out_Date"));
+        if (closed != REC_DATE_INVALID && closed <= cutoff) {
+            picks[count].source = record->source;
+            picks[count].key = rec_get(record, REC_KEY_FIELD);
+            count++;
+        }
+    }
+    qsort(picks, count, sizeof(*picks), compare_pick);
+    return count;
+}
+
+/* Split the file into the chunks that stay and the ones that move */
+static size_t
+split_file(const char *data, size_t size, const struct archive_pick *picks,
+           size_t npicks, struct buffer *hot, struct buffer *cold,
+           struct buffer *keys)
+{
+    struct archive_pick probe;
+    const struct archive_pick *pick;
+    const char *chunk;
+    const char *next;
+    const char *end;
+    size_t count;
+    size_t len;
+
+    count = 0;
+    end = data + size;
+    for (chunk = data; chunk < end; chunk = next) {
+        next = rec_next_chunk(chunk, end, &len);
+        probe.source = rec_hash(chunk, len, 0);
+        pick = chunk[0] == '%' ? NULL :
+            bsearch(&probe, picks, npicks, sizeof(*picks), compare_pick);
+        if (!pick) {
+            buffer_append(hot, chunk, (size_t)(next - chunk));
+            continue;
+        }
+        buffer_append(cold, chunk, len);
+        buffer_append(cold, "\n", 1);
+        buffer_append_str(keys, pick->key);
+        buffer_append(keys, "\n", 1);
+        count++;
+    }
+    return count;
+}
+
+/* Archive one loaded store; see archive_project */
+static long
+archive_store(struct rec_store *store)
+{
+    struct archive_pick *picks;
+    struct timespec wait;
+    struct buffer hot;
+    struct buffer cold;
+    struct buffer keys;
+    char *data;
+    size_t npicks;
+    size_t count;
+    size_t size;
+    int result;
+    int fd;
+
+    if (!store->count) {
+        return 0;
+    }
+    picks = malloc(store->count * sizeof(*picks));
+    if (!picks) {
+        return -1;
+    }
+    npicks = pick_records(store, picks);
+    if (!npicks) {
+        free(picks);
+        return 0;
+    }
+
+    fd = open(store->path, O_RDONLY);
+    clock_gettime(CLOCK_MONOTONIC, &wait);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(picks);
+        return -1;
+    }
+    metrics_lock_wait(&wait);
+
+    buffer_init(&hot);
+    buffer_init(&cold);
+    buffer_init(&keys);
+    count = 0;
+    result = ERR_IO;
+    data = rec_read_file(store->path, &size);
+    if (data) {
+        count = split_file(data, size, picks, npicks, &hot, &cold, &keys);
+        result = ERR_NONE;
+    }
+
+    /* Archive first: a crash in between leaves copies, never losses */
+    if (result == ERR_NONE && count > 0) {
+        result = append_block(store, &cold, &keys, count);
+        if (result == ERR_NONE) {
+            result = replace_hot(store, &hot);
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    free(data);
+    free(picks);
+    buffer_free(&hot);
+    buffer_free(&cold);
+    buffer_free(&keys);
+    if (result != ERR_NONE) {
+        return -1;
+    }
+    if (count > 0) {
+        rec_store_sync(store->name);
+    }
+    return (long)count;
+}
+
+/*
+ * archive_project - Move a project's old closed records to its archive
+ * @project: Project name
+ *
+ * A record is moved when its Status is Closed or Completed and its
+ * Close_Out_Date is at least the configured age in the past. The file is
+ * rewritten under the same flock the record handlers use and the store
+ * re-synced, which only drops the moved records.
+ *
+ * Returns the number of records moved, or -1 on error.
+ */
+long
+archive_project(const char *project)
+{
+    struct rec_store *store;
+
+    store = rec_store_get(project);
+    return store ? archive_store(store) : -1;
+}
+
+/* Read and expand the block at offset, appending its text to out */
+static int
+read_block(int fd, long offset, struct buffer *out)
+{
+    unsigned char header[ARCHIVE_BLOCK_HEADER];
+    char *stored;
+    size_t raw;
+    size_t len;
+    size_t written;
+    int result;
+
+    if (pread(fd, header, sizeof(header), (off_t)offset) != (ssize_t)sizeof(header) ||
+        memcmp(header, ARCHIVE_MAGIC, 4) != 0) {
+        return ERR_IO;
+    }
+    raw = get32(header + 4);
+    len = get32(header + 8);
+    stored = malloc(len ? len : 1);
+    if (!stored) {
+        return ERR_INTERNAL;
+    }
+    if (pread(fd, stored, len, (off_t)offset + ARCHIVE_BLOCK_HEADER) != (ssize_t)len ||
+        buffer_reserve(out, raw) != 0) {
+        free(stored);
+        return ERR_IO;
+    }
+
+    result = lz_decompress(stored, len, out->data + out->len, raw, &written);
+    free(stored);
+    if (result != 0 || written != raw) {
+        return ERR_IO;
+    }
+    out->len += raw;
+    out->data[out->len] = '\0';
+    return ERR_NONE;
+}
+
+/* Find key in the block at offset, appending its chunk to out if given */
+static int
+find_in_block(int fd, long offset, const char *key, struct buffer *out)
+{
+    struct rec_record *record;
+    struct buffer block;
+    const char *chunk;
+    const char *next;
+    const char *value;
+    size_t len;
+    int result;
+
+    buffer_init(&block);
+    result = read_block(fd, offset, &block);
+    for (chunk = block.data; result == ERR_NONE && chunk < block.data + block.len;
+         chunk = next) {
+        next = rec_next_chunk(chunk, block.data + block.len, &len);
+        record = rec_parse_record(chunk, len);
+        value = record ? rec_get(record, REC_KEY_FIELD) : NULL;
+        if (value && strcmp(value, key) == 0) {
+            free(record);
+            result = !out || buffer_append(out, chunk, len) == 0 ?
+                ERR_NONE : ERR_INTERNAL;
+            buffer_free(&block);
+            return result;
+        }
+        free(record);
+    }
+    buffer_free(&block);
+    return result == ERR_NONE ? ERR_NOTFOUND : result;
+}
+
+/*
+ * archive_find - Look up an archived record by Obligation_Number
+ * @project: Project name
+ * @key: Key value
+ * @out: Receives the record text, or NULL to test for existence only
+ *
+ * The archive is only read if the key's hash is among the archived
+ * keys, which are loaded once per store.
+ *
+ * Returns ERR_NONE, ERR_NOTFOUND, or ERR_IO if the archive is damaged.
+ */
+int
+archive_find(const char *project, const char *key, struct buffer *out)
+{
+    struct archive_keys *keys;
+    struct rec_store *store;
+    char path[sizeof(store->path) + sizeof(ARCHIVE_SUFFIX)];
+    unsigned long hash;
+    size_t mask;
+    size_t slot;
+    int result;
+    int fd;
+
+    store = rec_store_get(project);
+    keys = store ? keys_load(store) : NULL;
+    if (!keys || !key || !key[0]) {
+        return ERR_NOTFOUND;
+    }
+
+    /* A key archived twice (after a crash) is the same record */
+    hash = key_hash(key, strlen(key));
+    mask = keys->size - 1;
+    result = ERR_NOTFOUND;
+    fd = -1;
+    for (slot = hash & mask; result == ERR_NOTFOUND && keys->slots[slot].hash;
+         slot = (slot + 1) & mask) {
+        if (keys->slots[slot].hash != hash) {
+            continue;
+        }
+        if (fd < 0 &&
+            (archive_path(store, ARCHIVE_SUFFIX, path, sizeof(path)) != 0 ||
+             (fd = open(path, O_RDONLY)) < 0)) {
+            return ERR_IO;
+        }
+        result = find_in_block(fd, keys->slots[slot].offset, key, out);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return result;
+}
+
+/*
+ * archive_open - Load a project's archived records for one query
+ * @project: Project name
+ *
+ * The store is not registered; release it with rec_store_free.
+ * Returns NULL if the project has no archive or it cannot be read.
+ */
+struct rec_store *
+archive_open(const char *project)
+{
+    unsigned char header[ARCHIVE_BLOCK_HEADER];
+    struct rec_store *store;
+    struct rec_store *cold;
+    struct buffer text;
+    struct stat st;
+    char path[sizeof(store->path) + sizeof(ARCHIVE_INDEX_SUFFIX)];
+    long offset;
+    int result;
+    int fd;
+
+    store = rec_store_get(project);
+    if (!store || archive_path(store, ARCHIVE_SUFFIX, path, sizeof(path)) != 0) {
+        return NULL;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    buffer_init(&text);
+    result = fstat(fd, &st) == 0 ? ERR_NONE : ERR_IO;
+    for (offset = 0; result == ERR_NONE && offset < (long)st.st_size;) {
+        if (pread(fd, header, sizeof(header), (off_t)offset) != (ssize_t)sizeof(header)) {
+            result = ERR_IO;
+            break;
+        }
+        result = read_block(fd, offset, &text);
+        offset += ARCHIVE_BLOCK_HEADER + (long)get32(header + 8);
+    }
+    close(fd);
+
+    cold = result == ERR_NONE && text.data ?
+        rec_store_parse(project, text.data, text.len) : NULL;
+    buffer_free(&text);
+    return cold;
+}
+
+/*
+ * Only resident stores are archived, so a pass costs as much as the
+ * projects in use. A cold project is archived on the first pass after
+ * it is loaded again. Stores are passed straight to archive_store so
+ * the pass does not make them look recently used to eviction.
+ */
+static void
+archive_tick(void *arg)
+{
+    struct rec_store *store;
+
+    UNUSED(arg);
+    for (store = rec_registry_list(); store; store = store->next) {
+        archive_store(store);
+    }
+    timer_add(&archive_timer, ARCHIVE_INTERVAL);
+}
+
+/* Schedule the periodic archive pass on the timer wheel */
+void
+archive_start(void)
+{
+    timer_init(&archive_timer, archive_tick, NULL);
+    timer_add(&archive_timer, ARCHIVE_INTERVAL);
+}
@@ -0,0 +1,720 @@
+/* filepath: src/audit_store.c */
+#include "../include/audit_store.h"
+#include "../include/buffer.h"
+#include "../include/log_archive.h"
+#include "../include/log_writer.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The audit log and its rotated copies, oldest first, form one trail.
+ * Each file is indexed in blocks of AUDIT_BLOCK_LINES lines: a block
+ * knows where it starts and ends and the range of its timestamps, and
+ * each user knows the blocks they appear in. A query reads only the
+ * blocks that can hold a match.
+ *
+ * Files are known by inode, so rotation renames a file without losing
+ * its index. A compressed copy keeps the inode and offsets of the file
+ * it was made from, so compression loses neither the index nor cursors,
+ * and a query expands only the frames holding the blocks it reads. New
+ * lines are indexed on the next query; only whole lines are, so a line
+ * being written is picked up later. Used from the server thread only.
+ */
+#define AUDIT_SEGMENTS (LOG_MAX_FILES + 1)
+
+struct audit_block {
+    off_t offset;                       /* First line */
+    off_t end;                          /* Past the last line */
+    char first[LOG_STAMP_LEN + 1];      /* Earliest stamp in the block */
+    char reach[LOG_STAMP_LEN + 1];      /* Latest stamp up to this block */
+};
+
+struct audit_user {
+    char *name;
+    size_t *blocks;                     /* Block numbers, ascending */
+    size_t count;
+    size_t cap;
+};
+
+struct audit_segment {
+    struct audit_block *blocks;
+    struct audit_user *users;           /* Open addressed on name */
+    off_t size;                         /* Bytes indexed */
+    ino_t ino;
+    size_t block_count;
+    size_t block_cap;
+    size_t user_count;
+    size_t user_slots;
+    size_t tail_lines;                  /* Lines in the last block */
+    size_t generation;                  /* Last refresh that found the file */
+};
+
+/* One parsed line */
+struct audit_line {
+    const char *stamp;
+    const char *user;
+    const char *action;
+    size_t stamp_len;
+    size_t user_len;
+    size_t action_len;
+};
+
+struct audit_filter {
+    char user[AUDIT_FILTER_MAX];
+    char action[AUDIT_FILTER_MAX];
+    char from[LOG_STAMP_LEN + 1];
+    char to[LOG_STAMP_LEN + 1];
+    off_t offset;                       /* Cursor position in its file */
+    ino_t ino;                          /* Cursor file; 0 starts at the oldest */
+    size_t user_len;
+    size_t from_len;
+    size_t to_len;
+    size_t size;
+};
+
+static struct audit_segment segments[AUDIT_SEGMENTS];
+static struct audit_segment *trail[AUDIT_SEGMENTS];     /* Oldest first */
+static struct log_archive trail_files[AUDIT_SEGMENTS];  /* Open until the next refresh */
+static char trail_paths[AUDIT_SEGMENTS][PATH_MAX];
+static size_t trail_count = 0;
+static size_t trail_open = 0;
+static size_t generation = 0;
+static char audit_dir[PATH_MAX - 32] = LOG_DIR;
+
+static void
+segment_reset(struct audit_segment *seg)
+{
+    size_t i;
+
+    for (i = 0; i < seg->user_slots; i++) {
+        free(seg->users[i].name);
+        free(seg->users[i].blocks);
+    }
+    free(seg->users);
+    free(seg->blocks);
+    memset(seg, 0, sizeof(*seg));
+}
+
+/* "stamp|user|action"; lines without a stamp have an empty one */
+static void
+line_parse(const char *line, size_t len, struct audit_line *out)
+{
+    const char *bar;
+    const char *end;
+
+    end = line + len;
+    bar = memchr(line, '|', len);
+    out->stamp = line;
+    out->stamp_len = bar ? (size_t)(bar - line) : 0;
+    if (out->stamp_len > LOG_STAMP_LEN) {
+        out->stamp_len = LOG_STAMP_LEN;
+    }
+    out->user = bar ? bar + 1 : end;
+    bar = memchr(out->user, '|', (size_t)(end - out->user));
+    out->user_len = (size_t)((bar ? bar : end) - out->user);
+    out->action = bar ? bar + 1 : end;
+    out->action_len = (size_t)(end - out->action);
+}
+
+static size_t
+user_slot(const struct audit_segment *seg, const char *name, size_t len)
+{
+    size_t i;
+
+    i = rec_hash(name, len, 0) & (seg->user_slots - 1);
+    while (seg->users[i].name &&
+           (strncmp(seg->users[i].name, name, len) != 0 ||
+            seg->users[i].name[len] != '\0')) {
+        i = (i + 1) & (seg->user_slots - 1);
+    }
+    return i;
+}
+
+static int
+users_grow(struct audit_segment *seg)
+{
+    struct audit_user *old;
+    size_t old_slots;
+    size_t slot;
+    size_t i;
+
+    old = seg->users;
+    old_slots = seg->user_slots;
+    seg->user_slots = old_slots ? old_slots * 2 : 16;
+    seg->users = calloc(seg->user_slots, sizeof(*seg->users));
+    if (!seg->users) {
+        seg->users = old;
+        seg->user_slots = old_slots;
+        return ERR_INTERNAL;
+    }
+    for (i = 0; i < old_slots; i++) {
+        if (old[i].name) {
+            slot = user_slot(seg, old[i].name, strlen(old[i].name));
+            seg->users[slot] = old[i];
+        }
+    }
+    free(old);
+    return ERR_NONE;
+}
+
+/* Note that the user has a line in the segment's last block */
+static int
+user_add(struct audit_segment *seg, const char *name, size_t len)
+{
+    struct audit_user *user;
+    size_t *blocks;
+    size_t block;
+
+    if ((seg->user_count + 1) * 2 > seg->user_slots &&
+        users_grow(seg) != ERR_NONE) {
+        return ERR_INTERNAL;
+    }
+    user = &seg->users[user_slot(seg, name, len)];
+    if (!user->name) {
+        user->name = malloc(len + 1);
+        if (!user->name) {
+            return ERR_INTERNAL;
+        }
+        memcpy(user->name, name, len);
+        user->name[len] = '\0';
+        seg->user_count++;
+    }
+
+    block = seg->block_count - 1;
+    if (user->count > 0 && user->blocks[user->count - 1] == block) {
+        return ERR_NONE;
+    }
+    if (user->count == user->cap) {
+        blocks = realloc(user->blocks, (user->cap ? user->cap * 2 : 4) *
+                         sizeof(*blocks));
+        if (!blocks) {
+            return ERR_INTERNAL;
+        }
+        user->blocks = blocks;
+        user->cap = user->cap ? user->cap * 2 : 4;
+    }
+    user->blocks[user->count++] = block;
+    return ERR_NONE;
+}
+
+static int
+index_line(struct audit_segment *seg, const char *line, size_t len, off_t offset)
+{
+    struct audit_block *block;
+    struct audit_block *blocks;
+    struct audit_line parsed;
+    char stamp[LOG_STAMP_LEN + 1];
+
+    line_parse(line, len, &parsed);
+    memcpy(stamp, parsed.stamp, parsed.stamp_len);
+    stamp[parsed.stamp_len] = '\0';
+
+    if (seg->block_count == 0 || seg->tail_lines == AUDIT_BLOCK_LINES) {
+        if (seg->block_count == seg->block_cap) {
+            blocks = realloc(seg->blocks, (seg->block_cap ? seg->block_cap * 2 : 64) *
+                             sizeof(*blocks));
+            if (!blocks) {
+                return ERR_INTERNAL;
+            }
+            seg->blocks = blocks;
+            seg->block_cap = seg->block_cap ? seg->block_cap * 2 : 64;
+        }
+        block = &seg->blocks[seg->block_count];
+        block->offset = offset;
+        strcpy(block->first, stamp);
+        if (seg->block_count > 0) {
+            strcpy(block->reach, seg->blocks[seg->block_count - 1].reach);
+        } else {
+            block->reach[0] = '\0';
+        }
+        seg->block_count++;
+        seg->tail_lines = 0;
+    }
+
+    block = &seg->blocks[seg->block_count - 1];
+    if (strcmp(stamp, block->first) < 0) {
+        strcpy(block->first, stamp);
+    }
+    if (strcmp(stamp, block->reach) > 0) {
+        strcpy(block->reach, stamp);
+    }
+    block->end = offset + (off_t)len + 1;
+    seg->tail_lines++;
+    return user_add(seg, parsed.user, parsed.user_len);
+}
+
+/* Index the whole lines added to the file since the last look */
+static int
+segment_extend(struct audit_segment *seg, struct log_archive *file)
+{
+    char *chunk;
+    char *line;
+    char *eol;
+    char *end;
+    ssize_t n;
+    int result;
+
+    if (file->size <= seg->size) {
+        return ERR_NONE;
+    }
+    chunk = malloc(AUDIT_READ_CHUNK);
+    if (!chunk) {
+        return ERR_INTERNAL;
+    }
+
+    result = ERR_NONE;
+    while (result == ERR_NONE && seg->size < file->size) {
+        n = log_archive_read(file, chunk, AUDIT_READ_CHUNK, seg->size);
+        if (n <= 0) {
+            result = n < 0 ? ERR_IO : ERR_NONE;
+            break;
+        }
+        end = chunk + n;
+        line = chunk;
+        while (result == ERR_NONE &&
+               (eol = memchr(line, '\n', (size_t)(end - line))) != NULL) {
+            if (eol > line) {
+                result = index_line(seg, line, (size_t)(eol - line),
+                                    seg->size + (off_t)(line - chunk));
+            }
+            line = eol + 1;
+        }
+        if (line == chunk) {
+            /* No whole line yet; a line longer than a chunk is skipped */
+            if (n < AUDIT_READ_CHUNK) {
+                break;
+            }
+            line = end;
+        }
+        seg->size += (off_t)(line - chunk);
+    }
+    free(chunk);
+    return result;
+}
+
+static void
+trail_close(void)
+{
+    size_t i;
+
+    for (i = 0; i < trail_open; i++) {
+        log_archive_close(&trail_files[i]);
+    }
+    trail_open = 0;
+    trail_count = 0;
+}
+
+/* Open the trail's file i, oldest first, at trail_files[n]; 0 if it is missing */
+static int
+trail_file(size_t i, size_t n)
+{
+    char *path;
+    size_t len;
+
+    path = trail_paths[n];
+    if (i == LOG_MAX_FILES) {
+        snprintf(path, PATH_MAX, "%s/audit%s", audit_dir, LOG_SUFFIX);
+        return log_archive_open(&trail_files[n], path) == ERR_NONE;
+    }
+    len = (size_t)snprintf(path, PATH_MAX, "%s/audit.%d%s", audit_dir,
+                           (int)(LOG_MAX_FILES - i), LOG_ARCHIVE_SUFFIX);
+    if (log_archive_open(&trail_files[n], path) == ERR_NONE) {
+        return 1;
+    }
+    /* Not plain, so perhaps compressed by now */
+    snprintf(path + len, PATH_MAX - len, "%s", LOG_COMPRESSED_SUFFIX);
+    return log_archive_open(&trail_files[n], path) == ERR_NONE;
+}
+
+/*
+ * audit_store_refresh - Bring the index up to date with the files
+ *
+ * The files stay open for the scan that follows.
+ *
+ * Returns the number of files in the trail, or ERR_INTERNAL.
+ */
+int
+audit_store_refresh(void)
+{
+    struct audit_segment *found[AUDIT_SEGMENTS];
+    struct log_archive *file;
+    size_t count;
+    size_t i;
+    size_t j;
+
+    trail_close();
+    generation++;
+    count = 0;
+    for (i = 0; i < AUDIT_SEGMENTS; i++) {
+        if (!trail_file(i, count)) {
+            continue;
+        }
+        found[count] = NULL;
+        for (j = 0; j < AUDIT_SEGMENTS; j++) {
+            if (segments[j].ino == trail_files[count].ino &&
+                segments[j].generation != generation) {
+                found[count] = &segments[j];
+                found[count]->generation = generation;
+                break;
+            }
+        }
+        trail_open = ++count;
+    }
+
+    /* Files not seen before take the places of files that are gone */
+    for (i = 0; i < count; i++) {
+        file = &trail_files[i];
+        if (!found[i]) {
+            for (j = 0; segments[j].generation == generation; j++) {
+            }
+            segment_reset(&segments[j]);
+            segments[j].ino = file->ino;
+            segments[j].generation = generation;
+            found[i] = &segments[j];
+        }
+        if (file->size < found[i]->size) {
+            segment_reset(found[i]);
+            found[i]->ino = file->ino;
+            found[i]->generation = generation;
+        }
+        if (segment_extend(found[i], file) == ERR_INTERNAL) {
+            return ERR_INTERNAL;
+        }
+        trail[i] = found[i];
+    }
+    for (j = 0; j < AUDIT_SEGMENTS; j++) {
+        if (segments[j].generation != generation && segments[j].ino) {
+            segment_reset(&segments[j]);
+        }
+    }
+    trail_count = count;
+    return (int)count;
+}
+
+/* Forget every index */
+void
+audit_store_clear(void)
+{
+    size_t i;
+
+    trail_close();
+    for (i = 0; i < AUDIT_SEGMENTS; i++) {
+        segment_reset(&segments[i]);
+    }
+}
+
+/* Read the trail from another directory; indexes are rebuilt on use */
+int
+audit_store_init(const char *dir)
+{
+    if (!dir || strlen(dir) >= sizeof(audit_dir)) {
+        return ERR_PARAM;
+    }
+    audit_store_clear();
+    strcpy(audit_dir, dir);
+    return ERR_NONE;
+}
+
+static size_t
+block_at(const size_t *ids, size_t i)
+{
+    return ids ? ids[i] : i;
+}
+
+/* First position in ids whose block could hold a line at or after from */
+static size_t
+first_block(const struct audit_segment *seg, const size_t *ids, size_t count,
+            const struct audit_filter *filter)
+{
+    const struct audit_block *block;
+    size_t low;
+    size_t high;
+    size_t mid;
+
+    low = 0;
+    high = count;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        block = &seg->blocks[block_at(ids, mid)];
+        if (block->end <= filter->offset ||
+            (filter->from_len &&
+             strncmp(block->reach, filter->from, filter->from_len) < 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int
+line_matches(const struct audit_line *line, const struct audit_filter *filter)
+{
+    char action[AUDIT_FILTER_MAX * 2];
+    size_t len;
+
+    if (filter->user_len &&
+        (line->user_len != filter->user_len ||
+         strncmp(line->user, filter->user, filter->user_len) != 0)) {
+        return 0;
+    }
+    if (filter->from_len &&
+        (line->stamp_len < filter->from_len ||
+         strncmp(line->stamp, filter->from, filter->from_len) < 0)) {
+        return 0;
+    }
+    if (filter->to_len && line->stamp_len >= filter->to_len &&
+        strncmp(line->stamp, filter->to, filter->to_len) > 0) {
+        return 0;
+    }
+    if (filter->action[0]) {
+        len = line->action_len < sizeof(action) - 1 ? line->action_len :
+              sizeof(action) - 1;
+        memcpy(action, line->action, len);
+        action[len] = '\0';
+        if (!strstr(action, filter->action)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+append_entry(struct buffer *out, const struct audit_line *line, size_t count)
+{
+    char value[AUDIT_FILTER_MAX * 2];
+    size_t len;
+    int result;
+
+    result = buffer_append_str(out, count ? ",{\"time\":" : "{\"time\":");
+    memcpy(value, line->stamp, line->stamp_len);
+    value[line->stamp_len] = '\0';
+    result |= buffer_append_json(out, value);
+    result |= buffer_append_str(out, ",\"user\":");
+    len = line->user_len < sizeof(value) - 1 ? line->user_len : sizeof(value) - 1;
+    memcpy(value, line->user, len);
+    value[len] = '\0';
+    result |= buffer_append_json(out, value);
+    result |= buffer_append_str(out, ",\"action\":");
+    len = line->action_len < sizeof(value) - 1 ? line->action_len : sizeof(value) - 1;
+    memcpy(value, line->action, len);
+    value[len] = '\0';
+    result |= buffer_append_json(out, value);
+    result |= buffer_append_str(out, "}");
+    return result;
+}
+
+/*
+ * Append one page of matches to out, oldest first. Sets *next_ino and
+ * *next_offset to where the next page starts, or *next_ino to 0 when
+ * there are no more.
+ */
+static int
+audit_scan(const struct audit_filter *filter, struct buffer *out,
+           ino_t *next_ino, off_t *next_offset)
+{
+    struct audit_filter from;
+    struct audit_segment *seg;
+    const struct audit_block *block;
+    const struct audit_user *user;
+    struct audit_line parsed;
+    struct buffer chunk;
+    const size_t *ids;
+    const char *line;
+    const char *eol;
+    const char *end;
+    off_t start;
+    size_t ids_count;
+    size_t emitted;
+    size_t scanned;
+    size_t first;
+    size_t i;
+    size_t s;
+    ssize_t n;
+    int result;
+
+    *next_ino = 0;
+    *next_offset = 0;
+    from = *filter;
+    first = 0;
+    if (filter->ino) {
+        for (first = 0; first < trail_count && trail[first]->ino != filter->ino;
+             first++) {
+        }
+        if (first == trail_count) {
+            /* The cursor's file has been rotated away */
+            first = 0;
+            from.offset = 0;
+        }
+    }
+
+    buffer_init(&chunk);
+    emitted = 0;
+    scanned = 0;
+    result = 0;
+    for (s = first; s < trail_count && result == 0 && !*next_ino; s++) {
+        seg = trail[s];
+        if (s != first) {
+            from.offset = 0;
+        }
+        ids = NULL;
+        ids_count = seg->block_count;
+        if (filter->user_len) {
+            if (seg->user_slots == 0) {
+                continue;
+            }
+            user = &seg->users[user_slot(seg, filter->user, filter->user_len)];
+            if (!user->name) {
+                continue;
+            }
+            ids = user->blocks;
+            ids_count = user->count;
+        }
+
+        for (i = first_block(seg, ids, ids_count, &from);
+             i < ids_count && result == 0 && !*next_ino; i++) {
+            block = &seg->blocks[block_at(ids, i)];
+            if (filter->to_len &&
+                strncmp(block->first, filter->to, filter->to_len) > 0) {
+                continue;
+            }
+            start = block->offset > from.offset ? block->offset : from.offset;
+            if (scanned++ == AUDIT_SCAN_MAX) {
+                *next_ino = seg->ino;
+                *next_offset = start;
+                break;
+            }
+
+            buffer_reset(&chunk);
+            if (buffer_reserve(&chunk, (size_t)(block->end - start)) != 0) {
+                result = -1;
+                break;
+            }
+            n = log_archive_read(&trail_files[s], chunk.data,
+                                 (size_t)(block->end - start), start);
+            if (n <= 0) {
+                continue;
+            }
+            end = chunk.data + n;
+            for (line = chunk.data;
+                 (eol = memchr(line, '\n', (size_t)(end - line))) != NULL;
+                 line = eol + 1) {
+                line_parse(line, (size_t)(eol - line), &parsed);
+                if (eol == line || !line_matches(&parsed, filter)) {
+                    continue;
+                }
+                if (emitted == filter->size) {
+                    *next_ino = seg->ino;
+                    *next_offset = start + (off_t)(line - chunk.data);
+                    break;
+                }
+                result = append_entry(out, &parsed, emitted++);
+            }
+        }
+    }
+    buffer_free(&chunk);
+    return result;
+}
+
+/* "<inode>.<offset>" in hex */
+static int
+parse_cursor(const char *text, struct audit_filter *filter)
+{
+    unsigned long ino;
+    unsigned long offset;
+    char *end;
+
+    ino = strtoul(text, &end, 16);
+    if (end == text || *end != '.') {
+        return ERR_PARAM;
+    }
+    text = end + 1;
+    offset = strtoul(text, &end, 16);
+    if (end == text || *end != '\0' || ino == 0) {
+        return ERR_PARAM;
+    }
+    filter->ino = (ino_t)ino;
+    filter->offset = (off_t)offset;
+    return ERR_NONE;
+}
+
+/*
+ * handle_audit_request - Serve a page of the audit trail as JSON
+ * @client_socket: Socket to send response
+ * @uri: Request URI, /api/audit[?user=<name>][&action=<text>]
+ *      [&from=<stamp>][&to=<stamp>][&size=<n>][&cursor=<cursor>]
+ *
+ * Entries come oldest first from the rotated files and then the live
+ * log. user= matches exactly and action= as a substring; from= and to=
+ * are inclusive and may be cut short, so to=2024-01-31 covers that whole
+ * day. "next" is the cursor for the following page, or null.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_audit_request(int client_socket, const char *uri)
+{
+    struct audit_filter filter;
+    struct buffer body;
+    const char *query;
+    char value[48];
+    ino_t next_ino;
+    off_t next_offset;
+    long size;
+    int result;
+
+    query = strchr(uri, '?');
+    query = query ? query + 1 : "";
+
+    memset(&filter, 0, sizeof(filter));
+    get_query_param(query, "user", filter.user, sizeof(filter.user));
+    get_query_param(query, "action", filter.action, sizeof(filter.action));
+    get_query_param(query, "from", filter.from, sizeof(filter.from));
+    get_query_param(query, "to", filter.to, sizeof(filter.to));
+    filter.user_len = strlen(filter.user);
+    filter.from_len = strlen(filter.from);
+    filter.to_len = strlen(filter.to);
+
+    size = AUDIT_PAGE_SIZE;
+    if (get_query_param(query, "size", value, sizeof(value)) && value[0]) {
+        size = atol(value);
+    }
+    if (size < 1 || size > AUDIT_PAGE_MAX) {
+        return send_error_json(client_socket, "400 Bad Request", "Invalid page");
+    }
+    filter.size = (size_t)size;
+    if (get_query_param(query, "cursor", value, sizeof(value)) && value[0] &&
+        parse_cursor(value, &filter) != ERR_NONE) {
+        return send_error_json(client_socket, "400 Bad Request", "Invalid cursor");
+    }
+
+    if (audit_store_refresh() < 0) {
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+
+    buffer_init(&body);
+    result = buffer_append_str(&body, "{\"entries\":[");
+    if (result == 0) {
+        result = audit_scan(&filter, &body, &next_ino, &next_offset);
+    }
+    if (result == 0) {
+        result = next_ino ?
+            buffer_appendf(&body, "],\"next\":\"%lx.%lx\"}",
+                           (unsigned long)next_ino, (unsigned long)next_offset) :
+            buffer_append_str(&body, "],\"next\":null}");
+    }
+    if (result != 0) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", "application/json",
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
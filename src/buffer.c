@@ -0,0 +1,150 @@
+/* filepath: src/buffer.c */
+#include "../include/buffer.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUFFER_MIN_CAP 256
+
+void
+buffer_init(struct buffer *buf)
+{
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void
+buffer_free(struct buffer *buf)
+{
+    free(buf->data);
+    buffer_init(buf);
+}
+
+void
+buffer_reset(struct buffer *buf)
+{
+    buf->len = 0;
+    if (buf->data) {
+        buf->data[0] = '\0';
+    }
+}
+
+int
+buffer_reserve(struct buffer *buf, size_t extra)
+{
+    size_t need;
+    size_t cap;
+    char *data;
+
+    need = buf->len + extra + 1;
+    if (need <= buf->cap) {
+        return 0;
+    }
+
+    cap = buf->cap ? buf->cap : BUFFER_MIN_CAP;
+    while (cap < need) {
+        cap *= 2;
+    }
+
+    data = realloc(buf->data, cap);
+    if (!data) {
+        return -1;
+    }
+
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+int
+buffer_append(struct buffer *buf, const char *data, size_t len)
+{
+    if (buffer_reserve(buf, len) != 0) {
+        return -1;
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+int
+buffer_append_str(struct buffer *buf, const char *str)
+{
+    return buffer_append(buf, str, strlen(str));
+}
+
+int
+buffer_appendf(struct buffer *buf, const char *fmt, ...)
+{
+    va_list ap;
+    size_t avail;
+    int n;
+
+    if (buffer_reserve(buf, 64) != 0) {
+        return -1;
+    }
+
+    /* First attempt into the spare capacity */
+    avail = buf->cap - buf->len;
+    va_start(ap, fmt);
+    n = vsnprintf(buf->data + buf->len, avail, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return -1;
+    }
+
+    /* Grow and format again if it did not fit */
+    if ((size_t)n >= avail) {
+        if (buffer_reserve(buf, (size_t)n) != 0) {
+            return -1;
+        }
+        va_start(ap, fmt);
+        n = vsnprintf(buf->data + buf->len, buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            return -1;
+        }
+    }
+
+    buf->len += (size_t)n;
+    return 0;
+}
+
+/* Append str as a quoted JSON string; ISO-8859-1 bytes map to \u00XX */
+int
+buffer_append_json(struct buffer *buf, const char *str)
+{
+    const unsigned char *p;
+    char esc[8];
+
+    if (buffer_append(buf, "\"", 1) != 0) {
+        return -1;
+    }
+
+    for (p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            esc[0] = '\\';
+            esc[1] = (char)*p;
+            if (buffer_append(buf, esc, 2) != 0) {
+                return -1;
+            }
+        } else if (*p == '\n') {
+            if (buffer_append(buf, "\\n", 2) != 0) {
+                return -1;
+            }
+        } else if (*p < 0x20 || *p >= 0x7f) {
+            sprintf(esc, "\\u%04x", (unsigned int)*p);
+            if (buffer_append(buf, esc, 6) != 0) {
+                return -1;
+            }
+        } else if (buffer_append(buf, (const char *)p, 1) != 0) {
+            return -1;
+        }
+    }
+
+    return buffer_append(buf, "\"", 1);
+}
@@ -0,0 +1,90 @@
+/* filepath: src/diag.c */
+#include "../include/diag.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Request path diagnostics go to stderr through DIAG, which tests the
+ * level before the arguments are formatted or even evaluated. The level
+ * is set once at startup, before any thread reads it.
+ */
+int diag_rank = DIAG_RANK(DIAG_LEVEL_DEFAULT);
+
+static const struct {
+    const char *name;
+    int level;
+    int pad;
+} diag_levels[] = {
+    { "none", LOG_NONE, 0 },
+    { "error", LOG_ERROR, 0 },
+    { "warn", LOG_WARN, 0 },
+    { "info", LOG_INFO, 0 },
+    { "debug", LOG_DEBUG, 0 }
+};
+
+void
+diag_printf(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * diag_set_level - Print diagnostics up to a level
+ * @level: LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO or LOG_DEBUG
+ *
+ * Levels above LOG_LEVEL_MAX are accepted but stay compiled out.
+ *
+ * Returns ERR_NONE or ERR_PARAM.
+ */
+int
+diag_set_level(int level)
+{
+    if (level != LOG_NONE && DIAG_RANK(level) == 0) {
+        return ERR_PARAM;
+    }
+    diag_rank = DIAG_RANK(level);
+    return ERR_NONE;
+}
+
+/* The level last set, as a LOG_* constant */
+int
+diag_get_level(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(diag_levels) / sizeof(diag_levels[0]); i++) {
+        if (DIAG_RANK(diag_levels[i].level) == diag_rank) {
+            return diag_levels[i].level;
+        }
+    }
+    return LOG_NONE;
+}
+
+/*
+ * diag_parse_level - Look up a level by name
+ * @name: "none", "error", "warn", "info" or "debug"
+ * @level: Receives the LOG_* constant
+ *
+ * Returns ERR_NONE, or ERR_PARAM for an unknown name.
+ */
+int
+diag_parse_level(const char *name, int *level)
+{
+    size_t i;
+
+    if (!name || !level) {
+        return ERR_PARAM;
+    }
+    for (i = 0; i < sizeof(diag_levels) / sizeof(diag_levels[0]); i++) {
+        if (strcmp(name, diag_levels[i].name) == 0) {
+            *level = diag_levels[i].level;
+            return ERR_NONE;
+        }
+    }
+    return ERR_PARAM;
+}
@@ -0,0 +1,220 @@
+/* filepath: src/export.c */
+#include "../include/export.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Equality filter taken from a "Field=value" query parameter */
+struct export_filter {
+    const char *value;
+    unsigned int field;
+    unsigned int code;
+};
+
+/*
+ * Split the query into filters. Names and values are decoded in place in
+ * the caller's copy of the query; "project" and "format" are not filters.
+ */
+static int
+parse_filters(char *query, struct export_filter *filters, size_t *count)
+{
+    char *param;
+    char *value;
+    char *saveptr;
+    int id;
+
+    *count = 0;
+    for (param = strtok_r(query, "&", &saveptr); param;
+         param = strtok_r(NULL, "&", &saveptr)) {
+        value = strchr(param, '=');
+        if (!value) {
+            continue;
+        }
+        *value++ = '\0';
+        url_decode(param, strlen(param), param, strlen(param) + 1);
+        url_decode(value, strlen(value), value, strlen(value) + 1);
+
+        if (strcmp(param, "project") == 0 || strcmp(param, "format") == 0) {
+            continue;
+        }
+        id = rec_field_lookup(param);
+        if (id < 0 || *count >= EXPORT_MAX_FILTERS) {
+            return ERR_PARAM;
+        }
+        filters[*count].value = value;
+        filters[*count].field = (unsigned int)id;
+        filters[*count].code = rec_dict_lookup((unsigned short)id, value);
+        (*count)++;
+    }
+    return ERR_NONE;
+}
+
+/*
+ * Missing fields compare equal to the empty string. Interned values are
+ * compared by dictionary code; a value that was never interned can only
+ * match a field stored inline.
+ */
+static int
+record_matches(const struct rec_record *record,
+               const struct export_filter *filters, size_t count)
+{
+    const struct rec_field *field;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        field = rec_find_field(record, (unsigned short)filters[i].field);
+        if (!field) {
+            if (filters[i].value[0]) {
+                return 0;
+            }
+        } else if (filters[i].code) {
+            if (field->code != filters[i].code) {
+                return 0;
+            }
+        } else if (field->code || strcmp(field->value, filters[i].value) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Write one RFC 4180 cell. Values holding a separator, quote or line
+ * break (folded "+" continuation lines) are quoted with quotes doubled;
+ * spreadsheet applications keep the embedded line breaks in the cell.
+ */
+static void
+write_csv_cell(struct chunked_writer *writer, const char *value)
+{
+    const char *quote;
+
+    if (!value || !value[0]) {
+        return;
+    }
+    if (!strpbrk(value, ",\"\r\n") && value[0] != ' ' &&
+        value[strlen(value) - 1] != ' ') {
+        chunked_write(writer, value, strlen(value));
+        return;
+    }
+
+    chunked_write(writer, "\"", 1);
+    while ((quote = strchr(value, '"')) != NULL) {
+        chunked_write(writer, value, (size_t)(quote - value) + 1);
+        chunked_write(writer, "\"", 1);
+        value = quote + 1;
+    }
+    chunked_write(writer, value, strlen(value));
+    chunked_write(writer, "\"", 1);
+}
+
+/*
+ * handle_export_request - Stream a project's records as CSV
+ * @client_socket: Socket to send response
+ * @uri: Request URI, /api/export?project=<name>[&format=csv][&<Field>=<value>...]
+ *
+ * Columns are every field name used in the project, in order of first
+ * appearance. Rows are written straight from the record store into
+ * HTTP_CHUNK_SIZE chunks, so memory use does not grow with the project.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_export_request(int client_socket, const char *uri)
+{
+    struct export_filter filters[EXPORT_MAX_FILTERS];
+    struct chunked_writer writer;
+    struct rec_store *store;
+    struct rec_record *record;
+    unsigned short columns[REC_MAX_FIELD_NAMES];
+    unsigned char seen[REC_MAX_FIELD_NAMES];
+    char project[REC_NAME_MAX];
+    char format[16];
+    char headers[128];
+    const char *query;
+    char *copy;
+    size_t ncolumns;
+    size_t nfilters;
+    size_t i;
+    size_t j;
+    int result;
+
+    query = strchr(uri, '?');
+    query = query ? query + 1 : "";
+
+    if (!get_query_param(query, "project", project, sizeof(project))) {
+        return send_error_json(client_socket, "400 Bad Request", "Missing project");
+    }
+    if (get_query_param(query, "format", format, sizeof(format)) &&
+        strcmp(format, "csv") != 0) {
+        return send_error_json(client_socket, "400 Bad Request",
+                               "Unsupported format");
+    }
+
+    store = rec_store_get(project);
+    if (!store) {
+        return send_error_json(client_socket, "404 Not Found", "Unknown project");
+    }
+
+    copy = malloc(strlen(query) + 1);
+    if (!copy) {
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    strcpy(copy, query);
+    if (parse_filters(copy, filters, &nfilters) != ERR_NONE) {
+        free(copy);
+        return send_error_json(client_socket, "400 Bad Request", "Invalid filter");
+    }
+
+    /* Column set: every field name in the project, first use first */
+    memset(seen, 0, sizeof(seen));
+    ncolumns = 0;
+    for (i = 0; i < store->count; i++) {
+        record = store->records[i];
+        for (j = 0; j < record->nfields; j++) {
+            if (!seen[record->fields[j].name]) {
+                seen[record->fields[j].name] = 1;
+                columns[ncolumns++] = record->fields[j].name;
+            }
+        }
+    }
+
+    snprintf(headers, sizeof(headers),
+             "Content-Disposition: attachment; filename=\"%s.csv\"\r\n",
+             store->name);
+    if (chunked_begin(&writer, client_socket, "text/csv; charset=utf-8",
+                      headers) != 0) {
+        free(copy);
+        return -1;
+    }
+
+    /* Byte order mark so spreadsheet applications detect UTF-8 */
+    chunked_write(&writer, "\xef\xbb\xbf", 3);
+    for (i = 0; i < ncolumns; i++) {
+        if (i) {
+            chunked_write(&writer, ",", 1);
+        }
+        write_csv_cell(&writer, rec_field_name(columns[i]));
+    }
+    chunked_write(&writer, "\r\n", 2);
+
+    for (i = 0; i < store->count && !writer.error; i++) {
+        record = store->records[i];
+        if (!record_matches(record, filters, nfilters)) {
+            continue;
+        }
+        for (j = 0; j < ncolumns; j++) {
+            if (j) {
+                chunked_write(&writer, ",", 1);
+            }
+            write_csv_cell(&writer, rec_get_id(record, columns[j]));
+        }
+        chunked_write(&writer, "\r\n", 2);
+    }
+
+    result = chunked_end(&writer);
+    free(copy);
+    return result;
+}
@@ -0,0 +1,504 @@
+/* filepath: src/forecast.c */
+#include "../include/forecast.h"
+#include "../include/buffer.h"
+#include "../include/timer_wheel.h"
+#include "../include/web_server.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* Fields whose values determine a record's forecast */
+static const char *const forecast_fields[] = {
+    "Status",
+    "Action_DueDate",
+    "Recurring_Obligation",
+    "Recurring_Frequency",
+    "Recurring_Status",
+    "Recurring_Forcasted_Date",
+    "Inspection",
+    "Inspection_Frequency",
+    NULL
+};
+
+/* Named frequencies used in the records; event-driven ones are absent */
+static const struct {
+    const char *name;
+    int days;
+    int months;
+} frequencies[] = {
+    { "Daily", 1, 0 },
+    { "Weekly", 7, 0 },
+    { "Fortnightly", 14, 0 },
+    { "Monthly", 0, 1 },
+    { "Quarterly", 0, 3 },
+    { "Biannual", 0, 6 },
+    { "Biannually", 0, 6 },
+    { "Six Monthly", 0, 6 },
+    { "Annual", 0, 12 },
+    { "Annually", 0, 12 },
+    { "Yearly", 0, 12 },
+    { NULL, 0, 0 }
+};
+
+static const char *const due_kind_names[REC_DUE_KINDS] = {
+    "recurring",
+    "inspection"
+};
+
+static struct timer forecast_timer;
+
+/*
+ * forecast_parse_frequency - Convert a frequency field to a period
+ * @text: Named frequency ("Weekly", "Quarterly") or a number of days
+ * @days: Set to the period in days, or 0
+ * @months: Set to the period in months, or 0
+ *
+ * Returns 1 for a periodic frequency, 0 otherwise (e.g. "As required").
+ */
+int
+forecast_parse_frequency(const char *text, int *days, int *months)
+{
+    const char *p;
+    long value;
+    int i;
+
+    *days = 0;
+    *months = 0;
+    if (!text || !text[0]) {
+        return 0;
+    }
+
+    for (i = 0; frequencies[i].name; i++) {
+        if (strcasecmp(text, frequencies[i].name) == 0) {
+            *days = frequencies[i].days;
+            *months = frequencies[i].months;
+            return 1;
+        }
+    }
+
+    /* Schema type is int: a plain number of days */
+    value = 0;
+    for (p = text; *p >= '0' && *p <= '9' && value < 100000; p++) {
+        value = value * 10 + (*p - '0');
+    }
+    if (*p != '\0' || value <= 0 || value >= 100000) {
+        return 0;
+    }
+    *days = (int)value;
+    return 1;
+}
+
+static long
+days_in_month(int year, int month)
+{
+    if (month == 12) {
+        return 31;
+    }
+    return rec_days_from_civil(year, month + 1, 1) -
+           rec_days_from_civil(year, month, 1);
+}
+
+/* Add calendar months, clamping the day to the end of the month */
+long
+forecast_add_months(long days, int months)
+{
+    int year;
+    int month;
+    int day;
+    long total;
+
+    rec_civil_from_days(days, &year, &month, &day);
+    total = (long)year * 12 + (month - 1) + months;
+    year = (int)(total / 12);
+    month = (int)(total % 12) + 1;
+    if (day > days_in_month(year, month)) {
+        day = (int)days_in_month(year, month);
+    }
+    return rec_days_from_civil(year, month, day);
+}
+
+/* First occurrence of anchor + k * period that falls on or after today */
+static long
+next_occurrence(long anchor, int days, int months, long today)
+{
+    int ay;
+    int am;
+    int ad;
+    int ty;
+    int tm;
+    int td;
+    long k;
+    long next;
+
+    if (anchor >= today) {
+        return anchor;
+    }
+
+    if (days > 0) {
+        k = (today - anchor + days - 1) / days;
+        return anchor + k * days;
+    }
+
+    /* Estimate the step count from the month difference, then settle */
+    rec_civil_from_days(anchor, &ay, &am, &ad);
+    rec_civil_from_days(today, &ty, &tm, &td);
+    k = ((long)(ty - ay) * 12 + (tm - am)) / months;
+    if (k < 0) {
+        k = 0;
+    }
+    next = forecast_add_months(anchor, (int)(k * months));
+    while (next < today) {
+        k++;
+        next = forecast_add_months(anchor, (int)(k * months));
+    }
+    return next;
+}
+
+static int
+field_is(const struct rec_record *record, const char *field, const char *value)
+{
+    const char *actual;
+
+    actual = rec_get(record, field);
+    return actual && strcasecmp(actual, value) == 0;
+}
+
+static unsigned long
+forecast_inputs(const struct rec_record *record)
+{
+    const char *value;
+    unsigned long hash;
+    int i;
+
+    hash = 0;
+    for (i = 0; forecast_fields[i]; i++) {
+        value = rec_get(record, forecast_fields[i]);
+        if (!value) {
+            value = "\001";
+        }
+        hash = rec_hash(value, strlen(value) + 1, hash);
+    }
+    return hash;
+}
+
+/* Recompute both forecast kinds of one record */
+static void
+forecast_record(struct rec_record *record, long today)
+{
+    long anchor;
+    int closed;
+    int days;
+    int months;
+
+    record->forecast_next[REC_DUE_RECURRING] = REC_DATE_INVALID;
+    record->forecast_next[REC_DUE_INSPECTION] = REC_DATE_INVALID;
+
+    closed = field_is(record, "Status", "Completed") ||
+             field_is(record, "Status", "Closed");
+    if (closed) {
+        return;
+    }
+
+    if (field_is(record, "Recurring_Obligation", "Yes") &&
+        !field_is(record, "Recurring_Status", "Inactive") &&
+        forecast_parse_frequency(rec_get(record, "Recurring_Frequency"),
+                                 &days, &months)) {
+        anchor = rec_parse_date(rec_get(record, "Recurring_Forcasted_Date"));
+        if (anchor == REC_DATE_INVALID) {
+            anchor = rec_parse_date(rec_get(record, "Action_DueDate"));
+        }
+        if (anchor == REC_DATE_INVALID) {
+            anchor = today;
+        }
+        record->forecast_next[REC_DUE_RECURRING] =
+            next_occurrence(anchor, days, months, today);
+        record->forecast_days[REC_DUE_RECURRING] = days;
+        record->forecast_months[REC_DUE_RECURRING] = months;
+    }
+
+    if (field_is(record, "Inspection", "Yes") &&
+        forecast_parse_frequency(rec_get(record, "Inspection_Frequency"),
+                                 &days, &months)) {
+        anchor = rec_parse_date(rec_get(record, "Action_DueDate"));
+        if (anchor == REC_DATE_INVALID) {
+            anchor = today;
+        }
+        record->forecast_next[REC_DUE_INSPECTION] =
+            next_occurrence(anchor, days, months, today);
+        record->forecast_days[REC_DUE_INSPECTION] = days;
+        record->forecast_months[REC_DUE_INSPECTION] = months;
+    }
+}
+
+static int
+compare_due(const void *a, const void *b)
+{
+    const struct rec_due *x;
+    const struct rec_due *y;
+
+    x = a;
+    y = b;
+    if (x->day != y->day) {
+        return x->day < y->day ? -1 : 1;
+    }
+    if (x->kind != y->kind) {
+        return x->kind < y->kind ? -1 : 1;
+    }
+    return strcmp(rec_get(x->record, REC_KEY_FIELD) ?
+                      rec_get(x->record, REC_KEY_FIELD) : "",
+                  rec_get(y->record, REC_KEY_FIELD) ?
+                      rec_get(y->record, REC_KEY_FIELD) : "");
+}
+
+/* Rebuild the store's sorted due-date array from the cached forecasts */
+static int
+rebuild_due(struct rec_store *store)
+{
+    struct rec_due *due;
+    size_t count;
+    size_t i;
+    int kind;
+
+    due = realloc(store->due, (store->count * REC_DUE_KINDS + 1) * sizeof(*due));
+    if (!due) {
+        return ERR_INTERNAL;
+    }
+
+    count = 0;
+    for (i = 0; i < store->count; i++) {
+        for (kind = 0; kind < REC_DUE_KINDS; kind++) {
+            if (store->records[i]->forecast_next[kind] != REC_DATE_INVALID) {
+                due[count].record = store->records[i];
+                due[count].day = store->records[i]->forecast_next[kind];
+                due[count].kind = kind;
+                count++;
+            }
+        }
+    }
+
+    qsort(due, count, sizeof(*due), compare_due);
+    store->due = due;
+    store->due_count = count;
+    return ERR_NONE;
+}
+
+/*
+ * forecast_refresh - Bring a store's due-date structures up to date
+ * @store: Store to refresh
+ *
+ * Only records whose forecast inputs changed, or whose next date has
+ * passed, are recomputed. Returns the number of records recomputed, or
+ * a negative error code.
+ */
+int
+forecast_refresh(struct rec_store *store)
+{
+    struct rec_record *record;
+    unsigned long inputs;
+    long today;
+    size_t i;
+    int recomputed;
+    int stale;
+    int kind;
+
+    if (!store) {
+        return ERR_PARAM;
+    }
+
+    today = rec_today();
+    if (today == store->forecast_day &&
+        store->forecast_version == store->version) {
+        return 0;
+    }
+
+    recomputed = 0;
+    for (i = 0; i < store->count; i++) {
+        record = store->records[i];
+        inputs = forecast_inputs(record);
+
+        stale = inputs != record->forecast_inputs;
+        for (kind = 0; kind < REC_DUE_KINDS && !stale; kind++) {
+            stale = record->forecast_next[kind] != REC_DATE_INVALID &&
+                    record->forecast_next[kind] < today;
+        }
+        if (!stale) {
+            continue;
+        }
+
+        forecast_record(record, today);
+        record->forecast_inputs = inputs;
+        recomputed++;
+    }
+
+    if (rebuild_due(store) != ERR_NONE) {
+        return ERR_INTERNAL;
+    }
+    store->forecast_day = today;
+    store->forecast_version = store->version;
+    return recomputed;
+}
+
+static void
+forecast_tick(void *arg)
+{
+    struct rec_store *store;
+
+    UNUSED(arg);
+    for (store = rec_registry_list(); store; store = store->next) {
+        forecast_refresh(store);
+    }
+    timer_add(&forecast_timer, FORECAST_INTERVAL);
+}
+
+/* Schedule the periodic forecast pass on the timer wheel */
+void
+forecast_start(void)
+{
+    timer_init(&forecast_timer, forecast_tick, NULL);
+    timer_add(&forecast_timer, 1);
+}
+
+/* Append every occurrence of one due entry that falls before end */
+static int
+expand_due(const struct rec_due *due, long end, struct rec_due **out,
+           size_t *count, size_t *capacity)
+{
+    struct rec_due *grown;
+    const struct rec_record *record;
+    long day;
+    long step;
+    int kind;
+
+    record = due->record;
+    kind = (int)due->kind;
+    day = due->day;
+    for (step = 1; day <= end; step++) {
+        if (*count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 256;
+            grown = realloc(*out, *capacity * sizeof(*grown));
+            if (!grown) {
+                return ERR_INTERNAL;
+            }
+            *out = grown;
+        }
+        (*out)[*count] = *due;
+        (*out)[*count].day = day;
+        (*count)++;
+
+        if (record->forecast_days[kind] > 0) {
+            day = due->day + step * record->forecast_days[kind];
+        } else {
+            day = forecast_add_months(due->day,
+                                      (int)(step * record->forecast_months[kind]));
+        }
+    }
+    return ERR_NONE;
+}
+
+/*
+ * handle_forecast_request - Serve the projected obligation calendar
+ * @client_socket: Socket to send response
+ * @uri: Request URI, /api/forecast?project=<name>[&months=<n>]
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_forecast_request(int client_socket, const char *uri)
+{
+    struct rec_store *store;
+    struct rec_due *occurrences;
+    struct buffer body;
+    const char *query;
+    const char *key;
+    const char *frequency;
+    char project[REC_NAME_MAX];
+    char value[16];
+    char date[16];
+    size_t count;
+    size_t capacity;
+    size_t i;
+    long today;
+    long end;
+    int months;
+    int result;
+
+    query = strchr(uri, '?');
+    query = query ? query + 1 : "";
+
+    if (!get_query_param(query, "project", project, sizeof(project))) {
+        return send_error_json(client_socket, "400 Bad Request", "Missing project");
+    }
+
+    store = rec_store_get(project);
+    if (!store) {
+        return send_error_json(client_socket, "404 Not Found", "Unknown project");
+    }
+
+    months = FORECAST_DEFAULT_MONTHS;
+    if (get_query_param(query, "months", value, sizeof(value))) {
+        months = atoi(value);
+        if (months < 1) {
+            months = 1;
+        } else if (months > FORECAST_MAX_MONTHS) {
+            months = FORECAST_MAX_MONTHS;
+        }
+    }
+
+    if (forecast_refresh(store) < 0) {
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+
+    today = rec_today();
+    end = forecast_add_months(today, months);
+
+    /* Expand each series over the window, then order by date */
+    occurrences = NULL;
+    count = 0;
+    capacity = 0;
+    result = ERR_NONE;
+    for (i = 0; i < store->due_count && result == ERR_NONE; i++) {
+        result = expand_due(&store->due[i], end, &occurrences, &count, &capacity);
+    }
+    if (count > 1) {
+        qsort(occurrences, count, sizeof(*occurrences), compare_due);
+    }
+
+    buffer_init(&body);
+    rec_format_date(today, date, sizeof(date));
+    buffer_appendf(&body, "{\"project\":");
+    buffer_append_json(&body, store->name);
+    buffer_appendf(&body, ",\"from\":\"%s\"", date);
+    rec_format_date(end, date, sizeof(date));
+    buffer_appendf(&body, ",\"to\":\"%s\",\"occurrences\":[", date);
+
+    for (i = 0; i < count && result == ERR_NONE; i++) {
+        key = rec_get(occurrences[i].record, REC_KEY_FIELD);
+        frequency = rec_get(occurrences[i].record,
+                            occurrences[i].kind == REC_DUE_RECURRING ?
+                            "Recurring_Frequency" : "Inspection_Frequency");
+        rec_format_date(occurrences[i].day, date, sizeof(date));
+        buffer_appendf(&body, "%s{\"date\":\"%s\",\"obligation\":",
+                       i ? "," : "", date);
+        buffer_append_json(&body, key ? key : "");
+        buffer_appendf(&body, ",\"type\":\"%s\",\"frequency\":",
+                       due_kind_names[occurrences[i].kind]);
+        buffer_append_json(&body, frequency ? frequency : "");
+        result = buffer_append_str(&body, "}");
+    }
+    if (buffer_append_str(&body, "]}") != 0) {
+        result = ERR_INTERNAL;
+    }
+    free(occurrences);
+
+    if (result != ERR_NONE) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+
+    result = send_response(client_socket, "200 OK", "application/json",
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
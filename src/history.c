@@ -0,0 +1,1127 @@
+/* filepath: src/history.c */
+#include "../include/history.h"
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Every accepted create or update appends a revision of the record to
+ * var/records/<project>.history. An entry is one header line
+ *
+ *   <C|D> <revision> <time> <previous offset> <body length> <key> <user>
+ *
+ * followed by the body. Checkpoints (C) hold the whole record in .rec
+ * syntax; deltas (D) hold only the fields that were set, in the same
+ * syntax, and "-Name" lines for fields that were removed. Each key's
+ * entries are chained backwards through the previous offset, and every
+ * HISTORY_CHECKPOINT_EVERY-th revision is a checkpoint, so rebuilding
+ * any revision reads one checkpoint and at most a handful of deltas.
+ *
+ * The offset of each key's newest entry is kept in memory, built by
+ * reading the headers once per project.
+ */
+#define KIND_CHECKPOINT 'C'
+#define KIND_DELTA 'D'
+
+/* One field of a revision; in a delta a NULL value removes the field */
+struct hist_field {
+    char *name;
+    char *value;
+};
+
+struct hist_rev {
+    struct hist_field *fields;
+    size_t count;
+    size_t cap;
+};
+
+struct hist_entry {
+    long when;
+    long prev;
+    unsigned long rev;
+    size_t len;
+    size_t header_len;
+    char key[HISTORY_KEY_MAX];
+    char user[HISTORY_KEY_MAX - 1];
+    char kind;
+};
+
+/* Newest entry of one key */
+struct hist_key {
+    char *key;
+    long offset;
+    unsigned long rev;
+    unsigned long since_checkpoint;
+};
+
+struct hist_log {
+    char name[REC_NAME_MAX];
+    char path[512 + 16];
+    struct hist_key *keys;
+    size_t size;
+    size_t count;
+    struct hist_log *next;
+};
+
+static struct hist_log *logs = NULL;
+
+static void
+rev_free(struct hist_rev *rev)
+{
+    size_t i;
+
+    for (i = 0; i < rev->count; i++) {
+        free(rev->fields[i].name);
+        free(rev->fields[i].value);
+    }
+    free(rev->fields);
+    rev->fields = NULL;
+    rev->count = 0;
+    rev->cap = 0;
+}
+
+static struct hist_field *
+rev_find(const struct hist_rev *rev, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < rev->count; i++) {
+        if (strcmp(rev->fields[i].name, name) == 0) {
+            return &rev->fields[i];
+        }
+    }
+    return NULL;
+}
+
+static char *
+copy_text(const char *text, size_t len)
+{
+    char *copy;
+
+    copy = malloc(len + 1);
+    if (copy) {
+        memcpy(copy, text, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/*
+ * Set a field, replacing an existing one of the same name. With append
+ * set the field is always added, which is how deltas keep their "-Name"
+ * entries apart from the fields they remove. Returns the field or NULL.
+ */
+static struct hist_field *
+rev_set(struct hist_rev *rev, const char *name, size_t nlen,
+        const char *value, size_t vlen, int append)
+{
+    struct hist_field *fields;
+    struct hist_field *field;
+    char *copy;
+    size_t cap;
+
+    copy = value ? copy_text(value, vlen) : NULL;
+    if (value && !copy) {
+        return NULL;
+    }
+
+    field = NULL;
+    if (!append) {
+        for (field = rev->fields; field < rev->fields + rev->count; field++) {
+            if (strlen(field->name) == nlen && memcmp(field->name, name, nlen) == 0) {
+                break;
+            }
+        }
+        if (field == rev->fields + rev->count) {
+            field = NULL;
+        }
+    }
+    if (field) {
+        free(field->value);
+        field->value = copy;
+        return field;
+    }
+
+    if (rev->count == rev->cap) {
+        cap = rev->cap ? rev->cap * 2 : 32;
+        fields = realloc(rev->fields, cap * sizeof(*fields));
+        if (!fields) {
+            free(copy);
+            return NULL;
+        }
+        rev->fields = fields;
+        rev->cap = cap;
+    }
+    field = &rev->fields[rev->count];
+    field->name = copy_text(name, nlen);
+    if (!field->name) {
+        free(copy);
+        return NULL;
+    }
+    field->value = copy;
+    rev->count++;
+    return field;
+}
+
+static void
+rev_remove(struct hist_rev *rev, const char *name)
+{
+    struct hist_field *field;
+
+    field = rev_find(rev, name);
+    if (!field) {
+        return;
+    }
+    free(field->name);
+    free(field->value);
+    memmove(field, field + 1,
+            (size_t)(rev->fields + rev->count - field - 1) * sizeof(*field));
+    rev->count--;
+}
+
+/* Parse record text, or delta text when delta is set; order is kept */
+static int
+rev_parse(struct hist_rev *rev, const char *text, size_t len, int delta)
+{
+    struct hist_field *last;
+    const char *line;
+    const char *end;
+    const char *eol;
+    const char *colon;
+    const char *value;
+    char *grown;
+    size_t seg;
+    size_t old;
+
+    last = NULL;
+    end = text + len;
+    for (line = text; line < end; line = eol + 1) {
+        eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) {
+            eol = end;
+        }
+        seg = (size_t)(eol - line);
+        if (seg > 0 && line[seg - 1] == '\r') {
+            seg--;
+        }
+        if (seg == 0 || line[0] == '#' || line[0] == '%') {
+            continue;
+        }
+
+        /* Continuation of the previous value */
+        if (line[0] == '+') {
+            if (!last || !last->value) {
+                continue;
+            }
+            value = line + 1;
+            if (value < line + seg && *value == ' ') {
+                value++;
+            }
+            old = strlen(last->value);
+            grown = realloc(last->value, old + (size_t)(line + seg - value) + 2);
+            if (!grown) {
+                return -1;
+            }
+            grown[old] = '\n';
+            memcpy(grown + old + 1, value, (size_t)(line + seg - value));
+            grown[old + 1 + (size_t)(line + seg - value)] = '\0';
+            last->value = grown;
+            continue;
+        }
+
+        if (delta && line[0] == '-') {
+            if (!rev_set(rev, line + 1, seg - 1, NULL, 0, 1)) {
+                return -1;
+            }
+            last = NULL;
+            continue;
+        }
+
+        colon = memchr(line, ':', seg);
+        if (!colon || colon == line) {
+            continue;
+        }
+        value = colon + 1;
+        if (value < line + seg && *value == ' ') {
+            value++;
+        }
+        last = rev_set(rev, line, (size_t)(colon - line), value,
+                       (size_t)(line + seg - value), 1);
+        if (!last) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Apply a parsed delta to a revision */
+static int
+rev_apply(struct hist_rev *rev, const struct hist_rev *delta)
+{
+    const struct hist_field *field;
+
+    for (field = delta->fields; field < delta->fields + delta->count; field++) {
+        if (!field->value) {
+            rev_remove(rev, field->name);
+        } else if (!rev_set(rev, field->name, strlen(field->name), field->value,
+                            strlen(field->value), 0)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* One field in .rec syntax; embedded newlines become continuation lines */
+static int
+format_field(struct buffer *out, const char *name, const char *value)
+{
+    const char *nl;
+
+    if (buffer_append_str(out, name) != 0 || buffer_append(out, ": ", 2) != 0) {
+        return -1;
+    }
+    while ((nl = strchr(value, '\n')) != NULL) {
+        if (buffer_append(out, value, (size_t)(nl - value)) != 0 ||
+            buffer_append(out, "\n+ ", 3) != 0) {
+            return -1;
+        }
+        value = nl + 1;
+    }
+    return buffer_append_str(out, value) == 0 ? buffer_append(out, "\n", 1) : -1;
+}
+
+static int
+rev_format(const struct hist_rev *rev, struct buffer *out)
+{
+    size_t i;
+
+    for (i = 0; i < rev->count; i++) {
+        if (format_field(out, rev->fields[i].name, rev->fields[i].value) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+rev_equal(const struct hist_rev *a, const struct hist_rev *b)
+{
+    size_t i;
+
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (i = 0; i < a->count; i++) {
+        if (strcmp(a->fields[i].name, b->fields[i].name) != 0 ||
+            strcmp(a->fields[i].value, b->fields[i].value) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Whether a field name occurs more than once */
+static int
+rev_repeats(const struct hist_rev *rev)
+{
+    size_t i;
+
+    for (i = 0; i < rev->count; i++) {
+        if (rev_find(rev, rev->fields[i].name) != &rev->fields[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Fields of next that differ from prev, then removals */
+static int
+rev_delta(const struct hist_rev *prev, const struct hist_rev *next,
+          struct buffer *out)
+{
+    const struct hist_field *field;
+    const struct hist_field *old;
+    size_t i;
+
+    for (i = 0; i < next->count; i++) {
+        field = &next->fields[i];
+        old = rev_find(prev, field->name);
+        if ((!old || strcmp(old->value, field->value) != 0) &&
+            format_field(out, field->name, field->value) != 0) {
+            return -1;
+        }
+    }
+    for (i = 0; i < prev->count; i++) {
+        if (!rev_find(next, prev->fields[i].name) &&
+            buffer_appendf(out, "-%s\n", prev->fields[i].name) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+valid_token(const char *text)
+{
+    const char *p;
+
+    if (!text[0] || strlen(text) >= HISTORY_KEY_MAX - 1) {
+        return 0;
+    }
+    for (p = text; *p; p++) {
+        if (isspace((unsigned char)*p) || !isprint((unsigned char)*p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Read the header and, if body is given, the body of the entry at offset */
+static int
+read_entry(int fd, long offset, struct hist_entry *entry, struct buffer *body)
+{
+    char line[HISTORY_HEADER_MAX];
+    char *eol;
+    ssize_t n;
+
+    n = pread(fd, line, sizeof(line) - 1, (off_t)offset);
+    if (n <= 0) {
+        return ERR_IO;
+    }
+    line[n] = '\0';
+    eol = strchr(line, '\n');
+    if (!eol) {
+        return ERR_IO;
+    }
+    *eol = '\0';
+    if (sscanf(line, "%c %lu %ld %ld %lu %63s %62s", &entry->kind, &entry->rev,
+               &entry->when, &entry->prev, &entry->len, entry->key,
+               entry->user) != 7) {
+        return ERR_IO;
+    }
+    entry->header_len = (size_t)(eol - line) + 1;
+    if (!body) {
+        return ERR_NONE;
+    }
+
+    buffer_reset(body);
+    if (buffer_reserve(body, entry->len) != 0) {
+        return ERR_INTERNAL;
+    }
+    if (pread(fd, body->data, entry->len,
+              (off_t)(offset + (long)entry->header_len)) != (ssize_t)entry->len) {
+        return ERR_IO;
+    }
+    body->len = entry->len;
+    body->data[body->len] = '\0';
+    return ERR_NONE;
+}
+
+static struct hist_key *
+key_slot(const struct hist_log *log, const char *key)
+{
+    size_t mask;
+    size_t slot;
+
+    mask = log->size - 1;
+    for (slot = rec_hash(key, strlen(key), 0) & mask; log->keys[slot].key;
+         slot = (slot + 1) & mask) {
+        if (strcmp(log->keys[slot].key, key) == 0) {
+            break;
+        }
+    }
+    return &log->keys[slot];
+}
+
+static struct hist_key *
+key_find(const struct hist_log *log, const char *key)
+{
+    struct hist_key *slot;
+
+    if (!log->size) {
+        return NULL;
+    }
+    slot = key_slot(log, key);
+    return slot->key ? slot : NULL;
+}
+
+/* Record the newest entry of a key, growing the table at half full */
+static int
+key_put(struct hist_log *log, const char *key, long offset,
+        unsigned long rev, int checkpoint)
+{
+    struct hist_key *old;
+    struct hist_key *slot;
+    size_t old_size;
+    size_t i;
+
+    if ((log->count + 1) * 2 > log->size) {
+        old = log->keys;
+        old_size = log->size;
+        log->size = log->size ? log->size * 2 : 64;
+        log->keys = calloc(log->size, sizeof(*log->keys));
+        if (!log->keys) {
+            log->keys = old;
+            log->size = old_size;
+            return -1;
+        }
+        for (i = 0; i < old_size; i++) {
+            if (old[i].key) {
+                *key_slot(log, old[i].key) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    slot = key_slot(log, key);
+    if (!slot->key) {
+        slot->key = copy_text(key, strlen(key));
+        if (!slot->key) {
+            return -1;
+        }
+        log->count++;
+        slot->since_checkpoint = 0;
+    }
+    slot->offset = offset;
+    slot->rev = rev;
+    slot->since_checkpoint = checkpoint ? 0 : slot->since_checkpoint + 1;
+    return 0;
+}
+
+static void
+log_free(struct hist_log *log)
+{
+    size_t i;
+
+    for (i = 0; i < log->size; i++) {
+        free(log->keys[i].key);
+    }
+    free(log->keys);
+    free(log);
+}
+
+/* The project's history, indexing its file on first use */
+static struct hist_log *
+log_get(const char *project)
+{
+    struct hist_entry entry;
+    struct hist_log *log;
+    struct rec_store *store;
+    struct stat st;
+    long offset;
+    int fd;
+    int n;
+
+    for (log = logs; log; log = log->next) {
+        if (strcmp(log->name, project) == 0) {
+            return log;
+        }
+    }
+
+    store = rec_store_get(project);
+    if (!store) {
+        return NULL;
+    }
+    log = calloc(1, sizeof(*log));
+    if (!log) {
+        return NULL;
+    }
+    strcpy(log->name, store->name);
+    n = snprintf(log->path, sizeof(log->path), "%.*s%s",
+                 (int)(strlen(store->path) - strlen(REC_SUFFIX)), store->path,
+                 HISTORY_SUFFIX);
+    if (n < 0 || (size_t)n >= sizeof(log->path)) {
+        free(log);
+        return NULL;
+    }
+
+    /* Headers only: each one says how far to skip */
+    fd = open(log->path, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        for (offset = 0; offset < (long)st.st_size;
+             offset += (long)(entry.header_len + entry.len)) {
+            if (read_entry(fd, offset, &entry, NULL) != ERR_NONE ||
+                key_put(log, entry.key, offset, entry.rev,
+                        entry.kind == KIND_CHECKPOINT) != 0) {
+                break;
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    log->next = logs;
+    logs = log;
+    return log;
+}
+
+/* Rebuild the revision stored at offset */
+static int
+rebuild(int fd, long offset, struct hist_rev *rev)
+{
+    struct hist_entry entry;
+    struct hist_rev delta;
+    struct buffer body;
+    long chain[HISTORY_CHECKPOINT_EVERY * 4];
+    size_t depth;
+    int result;
+
+    /* Walk back to the nearest checkpoint */
+    depth = 0;
+    for (;;) {
+        if (depth == sizeof(chain) / sizeof(chain[0]) ||
+            read_entry(fd, offset, &entry, NULL) != ERR_NONE) {
+            return ERR_IO;
+        }
+        chain[depth++] = offset;
+        if (entry.kind == KIND_CHECKPOINT) {
+            break;
+        }
+        if (entry.prev < 0) {
+            return ERR_IO;
+        }
+        offset = entry.prev;
+    }
+
+    /* Then forward: the checkpoint and each delta in turn */
+    buffer_init(&body);
+    result = ERR_NONE;
+    while (result == ERR_NONE && depth > 0) {
+        result = read_entry(fd, chain[--depth], &entry, &body);
+        if (result != ERR_NONE) {
+            break;
+        }
+        memset(&delta, 0, sizeof(delta));
+        if (entry.kind == KIND_CHECKPOINT) {
+            rev_free(rev);
+            result = rev_parse(rev, body.data, body.len, 0) == 0 ?
+                ERR_NONE : ERR_INTERNAL;
+        } else if (rev_parse(&delta, body.data, body.len, 1) != 0 ||
+                   rev_apply(rev, &delta) != 0) {
+            result = ERR_INTERNAL;
+        }
+        rev_free(&delta);
+    }
+    buffer_free(&body);
+    return result;
+}
+
+static int
+write_entry(struct hist_log *log, int kind, const char *key, const char *user,
+            long when, const struct buffer *body)
+{
+    struct hist_key *slot;
+    struct buffer entry;
+    struct stat st;
+    unsigned long rev;
+    long prev;
+    int result;
+    int fd;
+
+    slot = key_find(log, key);
+    prev = slot ? slot->offset : -1;
+    rev = slot ? slot->rev + 1 : 1;
+
+    buffer_init(&entry);
+    if (buffer_appendf(&entry, "%c %lu %ld %ld %lu %s %s\n", kind, rev, when, prev,
+                       (unsigned long)body->len, key,
+                       user && valid_token(user) ? user : "-") != 0 ||
+        buffer_append(&entry, body->data ? body->data : "", body->len) != 0) {
+        buffer_free(&entry);
+        return ERR_INTERNAL;
+    }
+
+    fd = open(log->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        buffer_free(&entry);
+        return ERR_IO;
+    }
+    result = ERR_NONE;
+    if (fstat(fd, &st) != 0 ||
+        write(fd, entry.data, entry.len) != (ssize_t)entry.len || fsync(fd) != 0) {
+        result = ERR_IO;
+    }
+    close(fd);
+    buffer_free(&entry);
+
+    if (result == ERR_NONE &&
+        key_put(log, key, (long)st.st_size, rev, kind == KIND_CHECKPOINT) != 0) {
+        result = ERR_INTERNAL;
+    }
+    return result;
+}
+
+/* A resident record in .rec syntax */
+static int
+format_record(const struct rec_record *record, struct buffer *out)
+{
+    size_t i;
+
+    for (i = 0; i < record->nfields; i++) {
+        if (format_field(out, rec_field_name(record->fields[i].name),
+                         record->fields[i].value) != 0) {
+            return ERR_INTERNAL;
+        }
+    }
+    return ERR_NONE;
+}
+
+/* First sighting of a key that predates history: keep what it was */
+static int
+write_baseline(struct hist_log *log, const char *key)
+{
+    const struct rec_record *record;
+    struct rec_store *store;
+    struct buffer body;
+    int result;
+
+    store = rec_store_get(log->name);
+    record = store ? rec_store_find(store, key) : NULL;
+    if (!record) {
+        return ERR_NONE;
+    }
+
+    buffer_init(&body);
+    result = format_record(record, &body);
+    if (result == ERR_NONE) {
+        result = write_entry(log, KIND_CHECKPOINT, key, NULL, 0, &body);
+    }
+    buffer_free(&body);
+    return result;
+}
+
+/*
+ * history_baseline - Save a record's current fields before it is changed
+ * @project: Project name
+ * @text: The record as it will be, in .rec syntax; only its key is used
+ *
+ * Call while the record file still holds the old state: a record that
+ * predates history gets its fields saved as revision 1, with time 0.
+ * Does nothing once history has the key, or if the record is new.
+ *
+ * Returns ERR_NONE, ERR_PARAM if the text has no usable key, or an
+ * I/O or internal error code.
+ */
+int
+history_baseline(const char *project, const char *text)
+{
+    struct hist_log *log;
+    struct hist_rev next;
+    struct hist_field *key;
+    int result;
+
+    log = project && text ? log_get(project) : NULL;
+    if (!log) {
+        return ERR_PARAM;
+    }
+
+    memset(&next, 0, sizeof(next));
+    if (rev_parse(&next, text, strlen(text), 0) != 0) {
+        rev_free(&next);
+        return ERR_INTERNAL;
+    }
+    key = rev_find(&next, REC_KEY_FIELD);
+    if (!key || !valid_token(key->value)) {
+        result = ERR_PARAM;
+    } else {
+        result = key_find(log, key->value) ? ERR_NONE :
+                                             write_baseline(log, key->value);
+    }
+    rev_free(&next);
+    return result;
+}
+
+/*
+ * history_append - Add a revision of a record to its project's history
+ * @project: Project name
+ * @text: The record as accepted, in .rec syntax
+ * @user: Who made the change, or NULL
+ * @when: Time of the change, in seconds since the epoch
+ *
+ * Call history_baseline before the record file is rewritten; failing
+ * that, a record that predates history gets the store's fields saved
+ * first as revision 1. Revisions that change nothing are not stored.
+ *
+ * Returns ERR_NONE, ERR_PARAM if the text has no usable key, or an
+ * I/O or internal error code.
+ */
+int
+history_append(const char *project, const char *text, const char *user,
+               long when)
+{
+    struct hist_log *log;
+    struct hist_key *slot;
+    struct hist_rev next;
+    struct hist_rev prev;
+    struct hist_field *key;
+    struct buffer body;
+    int kind;
+    int fd;
+    int result;
+
+    log = project && text ? log_get(project) : NULL;
+    if (!log) {
+        return ERR_PARAM;
+    }
+
+    memset(&next, 0, sizeof(next));
+    memset(&prev, 0, sizeof(prev));
+    buffer_init(&body);
+    if (rev_parse(&next, text, strlen(text), 0) != 0) {
+        rev_free(&next);
+        return ERR_INTERNAL;
+    }
+    key = rev_find(&next, REC_KEY_FIELD);
+    if (!key || !valid_token(key->value)) {
+        rev_free(&next);
+        return ERR_PARAM;
+    }
+
+    result = key_find(log, key->value) ? ERR_NONE : write_baseline(log, key->value);
+    slot = key_find(log, key->value);
+    kind = KIND_CHECKPOINT;
+    if (result == ERR_NONE && slot) {
+        fd = open(log->path, O_RDONLY);
+        result = fd >= 0 ? rebuild(fd, slot->offset, &prev) : ERR_IO;
+        if (fd >= 0) {
+            close(fd);
+        }
+        /* Deltas address fields by name, so repeated names need a checkpoint */
+        if (slot->since_checkpoint + 1 < HISTORY_CHECKPOINT_EVERY &&
+            !rev_repeats(&prev) && !rev_repeats(&next)) {
+            kind = KIND_DELTA;
+        }
+    }
+
+    if (result == ERR_NONE && slot && rev_equal(&prev, &next)) {
+        /* Nothing changed */
+    } else if (result == ERR_NONE) {
+        result = kind == KIND_DELTA ? rev_delta(&prev, &next, &body) :
+                                      rev_format(&next, &body);
+        result = result == 0 ?
+            write_entry(log, kind, key->value, user, when, &body) : ERR_INTERNAL;
+    }
+
+    buffer_free(&body);
+    rev_free(&prev);
+    rev_free(&next);
+    return result;
+}
+
+/* Offset of the newest entry of key no later than when, or -1 */
+static long
+entry_at(int fd, long offset, long when)
+{
+    struct hist_entry entry;
+
+    while (offset >= 0) {
+        if (read_entry(fd, offset, &entry, NULL) != ERR_NONE) {
+            return -1;
+        }
+        if (entry.when <= when) {
+            return offset;
+        }
+        offset = entry.prev;
+    }
+    return -1;
+}
+
+/*
+ * history_at - Rebuild a record as it was at a point in time
+ * @project: Project name
+ * @key: Obligation_Number
+ * @when: Time in seconds since the epoch
+ * @out: Receives the record in .rec syntax
+ *
+ * Returns ERR_NONE, ERR_NOTFOUND if the key has no revision that old,
+ * or an I/O or internal error code.
+ */
+int
+history_at(const char *project, const char *key, long when, struct buffer *out)
+{
+    struct hist_log *log;
+    struct hist_key *slot;
+    struct hist_rev rev;
+    long offset;
+    int result;
+    int fd;
+
+    log = project ? log_get(project) : NULL;
+    slot = log && key ? key_find(log, key) : NULL;
+    if (!slot) {
+        return ERR_NOTFOUND;
+    }
+
+    fd = open(log->path, O_RDONLY);
+    if (fd < 0) {
+        return ERR_IO;
+    }
+    memset(&rev, 0, sizeof(rev));
+    offset = entry_at(fd, slot->offset, when);
+    result = offset < 0 ? ERR_NOTFOUND : rebuild(fd, offset, &rev);
+    close(fd);
+
+    if (result == ERR_NONE && rev_format(&rev, out) != 0) {
+        result = ERR_INTERNAL;
+    }
+    rev_free(&rev);
+    return result;
+}
+
+void
+history_shutdown(void)
+{
+    struct hist_log *log;
+
+    while (logs) {
+        log = logs;
+        logs = log->next;
+        log_free(log);
+    }
+}
+
+static int
+append_time(struct buffer *out, long when)
+{
+    struct tm tm;
+    time_t t;
+    char text[32];
+
+    t = (time_t)when;
+    if (!when || !gmtime_r(&t, &tm) ||
+        strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &tm) == 0) {
+        return buffer_append_str(out, "null");
+    }
+    return buffer_append_json(out, text);
+}
+
+/* Fields of a revision as a JSON object; removals are listed apart */
+static int
+append_fields(struct buffer *out, const struct hist_rev *rev, int removed)
+{
+    size_t i;
+    int first;
+
+    first = 1;
+    for (i = 0; i < rev->count; i++) {
+        if ((rev->fields[i].value == NULL) != removed) {
+            continue;
+        }
+        if (!first) {
+            buffer_append(out, ",", 1);
+        }
+        first = 0;
+        buffer_append_json(out, rev->fields[i].name);
+        if (!removed) {
+            buffer_append(out, ":", 1);
+            buffer_append_json(out, rev->fields[i].value);
+        }
+    }
+    return 0;
+}
+
+/* Every revision of a key, oldest first */
+static int
+history_json(const struct hist_log *log, const struct hist_key *slot,
+             struct buffer *out)
+{
+    struct hist_entry entry;
+    struct hist_rev rev;
+    struct buffer body;
+    long *offsets;
+    size_t count;
+    long offset;
+    int result;
+    int fd;
+
+    offsets = malloc((slot->rev + 1) * sizeof(*offsets));
+    fd = open(log->path, O_RDONLY);
+    if (!offsets || fd < 0) {
+        free(offsets);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return ERR_IO;
+    }
+
+    count = 0;
+    result = ERR_NONE;
+    for (offset = slot->offset; offset >= 0 && count <= slot->rev;
+         offset = entry.prev) {
+        if (read_entry(fd, offset, &entry, NULL) != ERR_NONE) {
+            result = ERR_IO;
+            break;
+        }
+        offsets[count++] = offset;
+    }
+
+    buffer_init(&body);
+    buffer_append_str(out, "\"revisions\":[");
+    while (result == ERR_NONE && count > 0) {
+        result = read_entry(fd, offsets[--count], &entry, &body);
+        memset(&rev, 0, sizeof(rev));
+        if (result == ERR_NONE &&
+            rev_parse(&rev, body.data, body.len, entry.kind == KIND_DELTA) != 0) {
+            result = ERR_INTERNAL;
+        }
+        if (result == ERR_NONE) {
+            buffer_appendf(out, "{\"revision\":%lu,\"time\":", entry.rev);
+            append_time(out, entry.when);
+            buffer_append_str(out, ",\"user\":");
+            buffer_append_json(out, entry.user[0] == '-' && !entry.user[1] ?
+                               "" : entry.user);
+            buffer_appendf(out, ",\"checkpoint\":%s,\"set\":{",
+                           entry.kind == KIND_CHECKPOINT ? "true" : "false");
+            append_fields(out, &rev, 0);
+            buffer_append_str(out, "},\"removed\":[");
+            append_fields(out, &rev, 1);
+            buffer_append_str(out, count ? "]}," : "]}");
+        }
+        rev_free(&rev);
+    }
+    buffer_append_str(out, "]");
+
+    buffer_free(&body);
+    free(offsets);
+    close(fd);
+    return result;
+}
+
+/* "YYYY-MM-DD" is the end of that UTC day; plain digits are epoch seconds */
+static long
+parse_when(const char *text)
+{
+    long days;
+
+    if (text[0] && strspn(text, "0123456789") == strlen(text) && strlen(text) > 8) {
+        return atol(text);
+    }
+    days = rec_parse_date(text);
+    if (days == REC_DATE_INVALID) {
+        return -1;
+    }
+    return days * 86400L + 86399L;
+}
+
+/*
+ * handle_records_request - Serve a record's history or a past version
+ * @client_socket: Socket to send response
+ * @uri: /api/records/<key>/history[?project=<name>] or
+ *       /api/records/<key>?at=<date or epoch>[&project=<name>]
+ *
+ * Without at, the current record is returned. A key with no history has
+ * not changed since history began, so its current record answers any at.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_records_request(int client_socket, const char *uri)
+{
+    const struct rec_record *record;
+    struct hist_log *log;
+    struct hist_key *slot;
+    struct rec_store *store;
+    struct hist_rev rev;
+    struct buffer text;
+    struct buffer json;
+    const char *path;
+    const char *query;
+    const char *slash;
+    char key[HISTORY_KEY_MAX];
+    char project[REC_NAME_MAX];
+    char at[32];
+    long when;
+    int listing;
+    int result;
+
+    path = uri + strlen(ENDPOINT_RECORDS);
+    query = strchr(path, '?');
+    slash = strchr(path, '/');
+    if (!query) {
+        query = path + strlen(path);
+    }
+    listing = slash && slash < query && strncmp(slash, "/history", 8) == 0 &&
+              slash + 8 == query;
+    if (slash && slash < query && !listing) {
+        return send_error_json(client_socket, "404 Not Found", "Not found");
+    }
+    url_decode(path, (size_t)((listing ? slash : query) - path), key, sizeof(key));
+    if (!valid_token(key)) {
+        return send_error_json(client_socket, "400 Bad Request", "Invalid key");
+    }
+    if (*query == '?') {
+        query++;
+    }
+    if (!get_query_param(query, "project", project, sizeof(project))) {
+        strcpy(project, "scjv");
+    }
+
+    store = rec_store_get(project);
+    log = store ? log_get(project) : NULL;
+    if (!log) {
+        return send_error_json(client_socket, "404 Not Found", "Unknown project");
+    }
+    slot = key_find(log, key);
+    record = rec_store_find(store, key);
+
+    buffer_init(&json);
+    buffer_init(&text);
+    memset(&rev, 0, sizeof(rev));
+    buffer_append_str(&json, "{\"project\":");
+    buffer_append_json(&json, store->name);
+    buffer_append_str(&json, ",\"key\":");
+    buffer_append_json(&json, key);
+    buffer_append_str(&json, ",");
+
+    if (listing) {
+        result = slot ? history_json(log, slot, &json) : ERR_NOTFOUND;
+    } else if (get_query_param(query, "at", at, sizeof(at)) && at[0]) {
+        when = parse_when(at);
+        buffer_append_str(&json, "\"at\":");
+        append_time(&json, when);
+        buffer_append_str(&json, ",");
+        result = when < 0 ? ERR_PARAM :
+                 slot ? history_at(project, key, when, &text) :
+                 record ? format_record(record, &text) : ERR_NOTFOUND;
+    } else {
+        result = record ? format_record(record, &text) : ERR_NOTFOUND;
+    }
+    if (!listing && result == ERR_NONE) {
+        if (rev_parse(&rev, text.data ? text.data : "", text.len, 0) != 0) {
+            result = ERR_INTERNAL;
+        }
+        buffer_append_str(&json, "\"record\":{");
+        append_fields(&json, &rev, 0);
+        buffer_append_str(&json, "}");
+    }
+    buffer_append_str(&json, "}");
+    rev_free(&rev);
+    buffer_free(&text);
+
+    if (result == ERR_PARAM) {
+        buffer_free(&json);
+        return send_error_json(client_socket, "400 Bad Request", "Invalid time");
+    }
+    if (result == ERR_NOTFOUND) {
+        buffer_free(&json);
+        return send_error_json(client_socket, "404 Not Found", "No such revision");
+    }
+    if (result != ERR_NONE) {
+        buffer_free(&json);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", "application/json",
+                           json.data, json.len);
+    buffer_free(&json);
+    return result;
+}
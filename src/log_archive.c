@@ -0,0 +1,621 @@
+/* filepath: src/log_archive.c */
+#include "../include/log_archive.h"
+#include "../include/buffer.h"
+#include "../include/lz.h"
+#include "../include/web_server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * Rotated logs are compressed by a thread of their own, so rotation is
+ * still only a chain of renames. The text is cut into frames of up to
+ * LOG_FRAME_SIZE bytes on line boundaries and each frame is compressed
+ * on its own with lz_compress. The frames are followed by an index and
+ * a trailer, all 32-bit little-endian:
+ *
+ *   frame...
+ *   raw-offset stored-offset raw-length stored-length     (per frame)
+ *   index-offset frame-count raw-size inode-low inode-high "LZF1"
+ *
+ * A reader finds the frames covering a byte range of the original text
+ * from the index and expands only those. The inode of the original file
+ * is kept, so indexes and cursors made from the plain file stay valid.
+ *
+ * The compressed file is written under a temporary name and renamed
+ * into place under archive_lock, which rotate_log also holds, so the
+ * chain never moves between the check and the rename.
+ */
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long compressed = 0;
+static unsigned long failed = 0;
+static unsigned long raw_bytes = 0;
+static unsigned long stored_bytes = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_wake = PTHREAD_COND_INITIALIZER;
+static char queue[LOG_ARCHIVE_QUEUE][LOG_ARCHIVE_NAME_MAX];
+static size_t queued = 0;
+static pthread_t compressor;
+static int running = 0;
+static int stopping = 0;
+
+static void
+put32(unsigned char *p, unsigned long value)
+{
+    p[0] = (unsigned char)(value & 0xff);
+    p[1] = (unsigned char)((value >> 8) & 0xff);
+    p[2] = (unsigned char)((value >> 16) & 0xff);
+    p[3] = (unsigned char)((value >> 24) & 0xff);
+}
+
+static unsigned long
+get32(const unsigned char *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static int
+write_all_fd(int fd, const char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int
+has_suffix(const char *path, const char *suffix)
+{
+    size_t len;
+    size_t slen;
+
+    len = strlen(path);
+    slen = strlen(suffix);
+    return len >= slen && strcmp(path + len - slen, suffix) == 0;
+}
+
+/* Frames of src into fd, then the index and trailer */
+static int
+write_frames(int src, const struct stat *st, int fd, off_t *stored)
+{
+    unsigned char entry[LOG_FRAME_TRAILER];
+    struct buffer block;
+    struct buffer index;
+    unsigned long ino;
+    off_t offset;
+    size_t count;
+    size_t len;
+    ssize_t n;
+    char *raw;
+    int result;
+
+    raw = malloc(LOG_FRAME_SIZE);
+    if (!raw) {
+        return ERR_INTERNAL;
+    }
+    buffer_init(&block);
+    buffer_init(&index);
+    result = ERR_NONE;
+    offset = 0;
+    count = 0;
+    *stored = 0;
+    while (result == ERR_NONE && offset < st->st_size) {
+        n = pread(src, raw, LOG_FRAME_SIZE, offset);
+        if (n <= 0) {
+            result = ERR_IO;
+            break;
+        }
+        len = (size_t)n;
+        if (offset + n < st->st_size) {
+            /* Frames end on a line unless a line is longer than a frame */
+            while (len > 0 && raw[len - 1] != '\n') {
+                len--;
+            }
+            if (len == 0) {
+                len = (size_t)n;
+            }
+        }
+
+        buffer_reset(&block);
+        if (lz_compress(raw, len, &block) != 0) {
+            result = ERR_INTERNAL;
+            break;
+        }
+        if (write_all_fd(fd, block.data, block.len) != 0) {
+            result = ERR_IO;
+            break;
+        }
+        put32(entry, (unsigned long)offset);
+        put32(entry + 4, (unsigned long)*stored);
+        put32(entry + 8, (unsigned long)len);
+        put32(entry + 12, (unsigned long)block.len);
+        if (buffer_append(&index, (const char *)entry, LOG_FRAME_ENTRY) != 0) {
+            result = ERR_INTERNAL;
+            break;
+        }
+        offset += (off_t)len;
+        *stored += (off_t)block.len;
+        count++;
+    }
+
+    if (result == ERR_NONE) {
+        ino = (unsigned long)st->st_ino;
+        put32(entry, (unsigned long)*stored);
+        put32(entry + 4, (unsigned long)count);
+        put32(entry + 8, (unsigned long)st->st_size);
+        put32(entry + 12, ino & 0xffffffffUL);
+        put32(entry + 16, (ino >> 16) >> 16);
+        memcpy(entry + 20, LOG_FRAME_MAGIC, 4);
+        if (buffer_append(&index, (const char *)entry, LOG_FRAME_TRAILER) != 0) {
+            result = ERR_INTERNAL;
+        } else if (write_all_fd(fd, index.data, index.len) != 0 || fsync(fd) != 0) {
+            result = ERR_IO;
+        }
+    }
+    free(raw);
+    buffer_free(&block);
+    buffer_free(&index);
+    return result;
+}
+
+/*
+ * log_archive_compress - Replace a rotated log with its compressed form
+ * @path: Rotated log; path.lz is written and path removed
+ *
+ * If path is rotated further while it is being compressed, the result is
+ * thrown away and path is left as it was.
+ *
+ * Returns ERR_NONE, ERR_PARAM for a file too large for the index,
+ * ERR_NOTFOUND if path moved, ERR_IO or ERR_INTERNAL.
+ */
+int
+log_archive_compress(const char *path)
+{
+    struct stat st;
+    struct stat now;
+    off_t stored;
+    char *out;
+    char *tmp;
+    size_t len;
+    int result;
+    int src;
+    int fd;
+
+    if (!path) {
+        return ERR_PARAM;
+    }
+    len = strlen(path) + sizeof(LOG_COMPRESSED_SUFFIX);
+    out = malloc(len * 2 + sizeof(".tmp"));
+    if (!out) {
+        return ERR_INTERNAL;
+    }
+    tmp = out + len;
+    sprintf(out, "%s%s", path, LOG_COMPRESSED_SUFFIX);
+    sprintf(tmp, "%s%s.tmp", path, LOG_COMPRESSED_SUFFIX);
+
+    src = open(path, O_RDONLY);
+    if (src < 0) {
+        free(out);
+        return errno == ENOENT ? ERR_NOTFOUND : ERR_IO;
+    }
+    result = ERR_NONE;
+    if (fstat(src, &st) != 0 || !S_ISREG(st.st_mode)) {
+        result = ERR_IO;
+    } else if ((unsigned long)st.st_size > 0xffffffffUL - LOG_FRAME_SIZE) {
+        result = ERR_PARAM;
+    }
+    if (result != ERR_NONE) {
+        close(src);
+        free(out);
+        return result;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        close(src);
+        free(out);
+        return ERR_IO;
+    }
+    result = write_frames(src, &st, fd, &stored);
+    close(fd);
+    close(src);
+
+    log_archive_lock();
+    if (result == ERR_NONE &&
+        (stat(path, &now) != 0 || now.st_ino != st.st_ino)) {
+        result = ERR_NOTFOUND;
+    }
+    if (result == ERR_NONE && rename(tmp, out) != 0) {
+        result = ERR_IO;
+    }
+    if (result == ERR_NONE) {
+        remove(path);
+        compressed++;
+        raw_bytes += (unsigned long)st.st_size;
+        stored_bytes += (unsigned long)stored;
+    } else {
+        remove(tmp);
+        failed++;
+    }
+    log_archive_unlock();
+    free(out);
+    return result;
+}
+
+/* Read and check the index of a compressed log */
+static int
+read_index(struct log_archive *archive, off_t file_size)
+{
+    unsigned char trailer[LOG_FRAME_TRAILER];
+    unsigned char *index;
+    struct log_frame *frame;
+    unsigned long index_offset;
+    size_t len;
+    size_t i;
+
+    if (file_size < LOG_FRAME_TRAILER ||
+        pread(archive->fd, trailer, sizeof(trailer),
+              file_size - LOG_FRAME_TRAILER) != (ssize_t)sizeof(trailer) ||
+        memcmp(trailer + 20, LOG_FRAME_MAGIC, 4) != 0) {
+        return ERR_IO;
+    }
+    index_offset = get32(trailer);
+    archive->count = get32(trailer + 4);
+    archive->size = (off_t)get32(trailer + 8);
+    archive->ino = (ino_t)(get32(trailer + 12) | ((get32(trailer + 16) << 16) << 16));
+    len = archive->count * LOG_FRAME_ENTRY;
+    if ((off_t)(index_offset + len + LOG_FRAME_TRAILER) != file_size) {
+        return ERR_IO;
+    }
+
+    index = malloc(len ? len : 1);
+    archive->frames = calloc(archive->count ? archive->count : 1,
+                             sizeof(*archive->frames));
+    if (!index || !archive->frames) {
+        free(index);
+        return ERR_INTERNAL;
+    }
+    if (pread(archive->fd, index, len, (off_t)index_offset) != (ssize_t)len) {
+        free(index);
+        return ERR_IO;
+    }
+    for (i = 0; i < archive->count; i++) {
+        frame = &archive->frames[i];
+        frame->raw = (off_t)get32(index + i * LOG_FRAME_ENTRY);
+        frame->stored = (off_t)get32(index + i * LOG_FRAME_ENTRY + 4);
+        frame->raw_len = get32(index + i * LOG_FRAME_ENTRY + 8);
+        frame->stored_len = get32(index + i * LOG_FRAME_ENTRY + 12);
+        if (frame->raw_len == 0 || frame->raw_len > LOG_FRAME_SIZE ||
+            frame->raw != (i ? frame[-1].raw + (off_t)frame[-1].raw_len : 0) ||
+            frame->stored != (i ? frame[-1].stored + (off_t)frame[-1].stored_len : 0) ||
+            frame->stored + (off_t)frame->stored_len > (off_t)index_offset) {
+            free(index);
+            return ERR_IO;
+        }
+    }
+    free(index);
+    if (archive->count ?
+        archive->frames[archive->count - 1].raw +
+        (off_t)archive->frames[archive->count - 1].raw_len != archive->size :
+        archive->size != 0) {
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/*
+ * log_archive_open - Open a log for reading
+ * @archive: Reader to set up
+ * @path: A log, or a compressed log if it ends in LOG_COMPRESSED_SUFFIX
+ *
+ * size and ino describe the original text either way.
+ *
+ * Returns ERR_NONE, ERR_NOTFOUND, ERR_IO if the file is not a log or is
+ * damaged, or ERR_INTERNAL.
+ */
+int
+log_archive_open(struct log_archive *archive, const char *path)
+{
+    struct stat st;
+    int result;
+
+    memset(archive, 0, sizeof(*archive));
+    archive->fd = open(path, O_RDONLY);
+    if (archive->fd < 0) {
+        return errno == ENOENT ? ERR_NOTFOUND : ERR_IO;
+    }
+    if (fstat(archive->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        log_archive_close(archive);
+        return ERR_IO;
+    }
+    if (!has_suffix(path, LOG_COMPRESSED_SUFFIX)) {
+        archive->size = st.st_size;
+        archive->ino = st.st_ino;
+        return ERR_NONE;
+    }
+    result = read_index(archive, st.st_size);
+    if (result != ERR_NONE) {
+        log_archive_close(archive);
+    }
+    return result;
+}
+
+/* Expand frame i into the cache */
+static int
+frame_load(struct log_archive *archive, size_t i)
+{
+    const struct log_frame *frame;
+    char *stored;
+    size_t written;
+
+    if (archive->cached == i + 1) {
+        return ERR_NONE;
+    }
+    frame = &archive->frames[i];
+    if (!archive->cache) {
+        archive->cache = malloc(LOG_FRAME_SIZE);
+        if (!archive->cache) {
+            return ERR_INTERNAL;
+        }
+    }
+    if (frame->stored_len > archive->stored_cap) {
+        stored = realloc(archive->stored, frame->stored_len);
+        if (!stored) {
+            return ERR_INTERNAL;
+        }
+        archive->stored = stored;
+        archive->stored_cap = frame->stored_len;
+    }
+    archive->cached = 0;
+    if (pread(archive->fd, archive->stored, frame->stored_len, frame->stored) !=
+        (ssize_t)frame->stored_len ||
+        lz_decompress(archive->stored, frame->stored_len, archive->cache,
+                      frame->raw_len, &written) != 0 ||
+        written != frame->raw_len) {
+        return ERR_IO;
+    }
+    archive->cached = i + 1;
+    return ERR_NONE;
+}
+
+/*
+ * log_archive_read - Read text by its offset in the original log
+ * @archive: Open reader
+ * @dst: Buffer to fill
+ * @len: Bytes wanted
+ * @offset: Offset in the original text
+ *
+ * Only the frames that hold the range are expanded; the last one is
+ * kept, so reading on from where the last read stopped is cheap.
+ *
+ * Returns the bytes read, 0 at the end, or -1 on error.
+ */
+ssize_t
+log_archive_read(struct log_archive *archive, char *dst, size_t len, off_t offset)
+{
+    const struct log_frame *frame;
+    size_t low;
+    size_t high;
+    size_t mid;
+    size_t done;
+    size_t part;
+    size_t skip;
+
+    if (!archive->frames) {
+        return pread(archive->fd, dst, len, offset);
+    }
+    if (offset < 0 || offset >= archive->size) {
+        return 0;
+    }
+
+    /* Last frame starting at or before offset */
+    low = 0;
+    high = archive->count;
+    while (high - low > 1) {
+        mid = low + (high - low) / 2;
+        if (archive->frames[mid].raw <= offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    done = 0;
+    for (; low < archive->count && done < len; low++) {
+        frame = &archive->frames[low];
+        if (frame_load(archive, low) != ERR_NONE) {
+            return done ? (ssize_t)done : -1;
+        }
+        skip = (size_t)(offset + (off_t)done - frame->raw);
+        part = frame->raw_len - skip;
+        if (part > len - done) {
+            part = len - done;
+        }
+        memcpy(dst + done, archive->cache + skip, part);
+        done += part;
+    }
+    return (ssize_t)done;
+}
+
+void
+log_archive_close(struct log_archive *archive)
+{
+    if (archive->fd >= 0) {
+        close(archive->fd);
+    }
+    free(archive->frames);
+    free(archive->cache);
+    free(archive->stored);
+    memset(archive, 0, sizeof(*archive));
+    archive->fd = -1;
+}
+
+/* Held across a rotation so the compressor never renames mid-chain */
+void
+log_archive_lock(void)
+{
+    pthread_mutex_lock(&archive_lock);
+}
+
+void
+log_archive_unlock(void)
+{
+    pthread_mutex_unlock(&archive_lock);
+}
+
+/* Compress every rotated copy of logname still stored plain */
+static void
+compress_log(const char *logname)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    int i;
+
+    for (i = 1; i <= LOG_MAX_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/%s.%d%s", LOG_DIR, logname, i,
+                 LOG_ARCHIVE_SUFFIX);
+        pthread_mutex_lock(&queue_lock);
+        if (stopping) {
+            pthread_mutex_unlock(&queue_lock);
+            return;
+        }
+        pthread_mutex_unlock(&queue_lock);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+            log_archive_compress(path);
+        }
+    }
+}
+
+static void *
+compressor_main(void *arg)
+{
+    char name[LOG_ARCHIVE_NAME_MAX];
+
+    UNUSED(arg);
+    pthread_mutex_lock(&queue_lock);
+    while (!stopping) {
+        if (queued == 0) {
+            pthread_cond_wait(&queue_wake, &queue_lock);
+            continue;
+        }
+        strcpy(name, queue[0]);
+        memmove(queue[0], queue[1], (queued - 1) * sizeof(queue[0]));
+        queued--;
+        pthread_mutex_unlock(&queue_lock);
+        compress_log(name);
+        pthread_mutex_lock(&queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+/*
+ * log_archive_start - Start the compressor thread
+ *
+ * Like the log writer it blocks every signal.
+ *
+ * Returns ERR_NONE, or ERR_INTERNAL if the thread could not be started.
+ */
+int
+log_archive_start(void)
+{
+    sigset_t all;
+    sigset_t old;
+    int result;
+
+    pthread_mutex_lock(&queue_lock);
+    if (running) {
+        pthread_mutex_unlock(&queue_lock);
+        return ERR_NONE;
+    }
+    stopping = 0;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    result = pthread_create(&compressor, NULL, compressor_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    running = result == 0;
+    pthread_mutex_unlock(&queue_lock);
+    return result == 0 ? ERR_NONE : ERR_INTERNAL;
+}
+
+/* Stop after the file being compressed; the rest wait for the next start */
+void
+log_archive_shutdown(void)
+{
+    pthread_mutex_lock(&queue_lock);
+    if (!running) {
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+    stopping = 1;
+    pthread_cond_signal(&queue_wake);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(compressor, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    running = 0;
+    queued = 0;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/*
+ * log_archive_queue - Have the rotated copies of a log compressed
+ * @logname: Log name, as given to rotate_log
+ *
+ * Does nothing if the compressor is not running.
+ */
+void
+log_archive_queue(const char *logname)
+{
+    size_t i;
+
+    if (!logname || strlen(logname) >= LOG_ARCHIVE_NAME_MAX) {
+        return;
+    }
+    pthread_mutex_lock(&queue_lock);
+    for (i = 0; i < queued && strcmp(queue[i], logname) != 0; i++) {
+    }
+    if (running && i == queued && queued < LOG_ARCHIVE_QUEUE) {
+        strcpy(queue[queued++], logname);
+        pthread_cond_signal(&queue_wake);
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/* Append the compressor's counters as a JSON object */
+int
+log_archive_stats(struct buffer *out)
+{
+    int result;
+
+    pthread_mutex_lock(&queue_lock);
+    result = buffer_appendf(out, "{\"running\":%s,\"queued\":%lu",
+                            running ? "true" : "false", (unsigned long)queued);
+    pthread_mutex_unlock(&queue_lock);
+    log_archive_lock();
+    if (result == 0) {
+        result = buffer_appendf(out, ",\"compressed\":%lu,\"failed\":%lu,"
+                                "\"raw_bytes\":%lu,\"stored_bytes\":%lu}",
+                                compressed, failed, raw_bytes, stored_bytes);
+    }
+    log_archive_unlock();
+    return result;
+}
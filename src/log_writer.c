@@ -0,0 +1,645 @@
+/* filepath: src/log_writer.c */
+#include "../include/log_writer.h"
+#include "../include/buffer.h"
+#include "../include/log_archive.h"
+#include "../include/web_server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/*
+ * Log lines are formatted by the thread that logs them straight into a
+ * ring owned by that thread, so logging takes no lock and makes no
+ * system call. One writer thread collects the rings, stamps the lines
+ * and appends them to files it keeps open with one writev per file and
+ * batch. File sizes are tracked in memory, so rotation needs no stat.
+ *
+ * Each ring has a single producer and a single consumer: the owner only
+ * moves tail, the writer only moves head and written. Both publish with
+ * a release store and read the other side with an acquire load, which
+ * costs no fence on x86. A thread that finds every ring taken shares
+ * the last one under a mutex.
+ *
+ * When the writer is not running, lines are written by the caller.
+ */
+struct log_entry {
+    time_t when;
+    size_t len;                         /* Bytes of line, with newline */
+    int file;
+    int flags;
+    char line[LOG_ENTRY_MAX];           /* Stamp is filled in when written */
+};
+
+struct log_ring {
+    struct log_entry entries[LOG_RING_SIZE];
+    unsigned long head;                 /* Next entry to write */
+    unsigned long tail;                 /* Next entry to fill */
+    unsigned long written;              /* Entries now in their file */
+    int owned;                          /* A thread fills this ring */
+    int index;
+};
+
+struct log_file {
+    off_t size;
+    ino_t ino;
+    time_t checked;                     /* Last look for a moved file */
+    const char *name;
+    unsigned long lines;
+    int fd;
+    int rotations;
+};
+
+/* Entry flag the writer sets, before written, on a line it could not write */
+#define LOG_ENTRY_FAILED 0x100
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+static struct log_file files[LOG_FILES] = {
+    { 0, 0, 0, "web", 0, -1, 0 },
+    { 0, 0, 0, "audit", 0, -1, 0 }
+};
+
+/* Rings live for the process; threads keep pointers to theirs */
+static struct log_ring *rings[LOG_RINGS_MAX + 1];
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Files and the stamp cache; held by the writer around each batch */
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t stamp_when = (time_t)-1;
+static char stamp_text[LOG_STAMP_LEN + 1];
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_done = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static int running = 0;
+static int stopping = 0;
+static int wake_pending = 0;
+static int policy = LOG_POLICY_DEFAULT;
+static unsigned long dropped = 0;
+
+/* Write every iovec, resuming after short writes */
+static int
+write_all(int fd, struct iovec *iov, int count)
+{
+    ssize_t n;
+
+    while (count > 0) {
+        n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERR_IO;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+    return ERR_NONE;
+}
+
+static void
+file_path(const struct log_file *f, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%s%s", LOG_DIR, f->name, LOG_SUFFIX);
+}
+
+static void
+file_close(struct log_file *f)
+{
+    if (f->fd >= 0) {
+        close(f->fd);
+        f->fd = -1;
+    }
+}
+
+static int
+file_open(struct log_file *f, time_t now)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    file_path(f, path, sizeof(path));
+    f->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (f->fd < 0) {
+        return ERR_IO;
+    }
+    if (fstat(f->fd, &st) != 0) {
+        file_close(f);
+        return ERR_IO;
+    }
+    f->size = st.st_size;
+    f->ino = st.st_ino;
+    f->checked = now;
+    return ERR_NONE;
+}
+
+/* Reopen a file that was moved or removed behind our back */
+static void
+file_check(struct log_file *f, time_t now)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (f->fd < 0 || now - f->checked < LOG_REOPEN_INTERVAL) {
+        return;
+    }
+    f->checked = now;
+    file_path(f, path, sizeof(path));
+    if (stat(path, &st) != 0 || st.st_ino != f->ino) {
+        file_close(f);
+    }
+}
+
+static void
+stamp(struct log_entry *entry)
+{
+    struct tm tm;
+
+    if (entry->when != stamp_when) {
+        memset(stamp_text, ' ', LOG_STAMP_LEN);
+        if (localtime_r(&entry->when, &tm)) {
+            strftime(stamp_text, sizeof(stamp_text), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        stamp_when = entry->when;
+    }
+    memcpy(entry->line, stamp_text, LOG_STAMP_LEN);
+}
+
+/*
+ * file_write - Append entries to one log file; file_lock is held
+ * @file: LOG_FILE_*
+ * @entries: Entries for that file, in order
+ * @count: Number of entries, at most LOG_BATCH_MAX
+ *
+ * Rotates first when the file has reached LOG_MAX_SIZE. A batch holding
+ * a LOG_WRITE_DURABLE entry is synced before it counts as written.
+ *
+ * Returns ERR_NONE or ERR_IO.
+ */
+static int
+file_write(int file, struct log_entry **entries, int count)
+{
+    struct iovec iov[LOG_BATCH_MAX];
+    struct log_file *f;
+    time_t now;
+    size_t bytes;
+    int durable;
+    int result;
+    int i;
+
+    f = &files[file];
+    now = time(NULL);
+    file_check(f, now);
+    if (f->fd >= 0 && f->size >= LOG_MAX_SIZE) {
+        file_close(f);
+        rotate_log(f->name);
+        f->rotations++;
+    }
+    if (f->fd < 0 && file_open(f, now) != ERR_NONE) {
+        return ERR_IO;
+    }
+
+    bytes = 0;
+    durable = 0;
+    for (i = 0; i < count; i++) {
+        stamp(entries[i]);
+        iov[i].iov_base = entries[i]->line;
+        iov[i].iov_len = entries[i]->len;
+        bytes += entries[i]->len;
+        durable |= entries[i]->flags & LOG_WRITE_DURABLE;
+    }
+    result = write_all(f->fd, iov, count);
+    if (result == ERR_NONE && durable && fdatasync(f->fd) != 0) {
+        result = ERR_IO;
+    }
+    if (result == ERR_NONE) {
+        f->size += (off_t)bytes;
+        f->lines += (unsigned long)count;
+    }
+    return result;
+}
+
+/*
+ * Take what the rings hold, up to a batch per file, and write it. Lines
+ * that could not be written are marked before the ring's written count
+ * moves past them, so a durable caller learns whether its line failed.
+ * Returns the number of entries taken.
+ */
+static unsigned long
+writer_drain(void)
+{
+    struct log_entry *batch[LOG_FILES][LOG_BATCH_MAX];
+    unsigned long ends[LOG_RINGS_MAX + 1];
+    struct log_ring *ring;
+    struct log_entry *entry;
+    unsigned long head;
+    unsigned long tail;
+    unsigned long moved;
+    int counts[LOG_FILES];
+    int result;
+    int full;
+    int i;
+    int j;
+
+    memset(counts, 0, sizeof(counts));
+    full = 0;
+    for (i = 0; i <= LOG_RINGS_MAX; i++) {
+        ring = LOAD(rings[i]);
+        ends[i] = ring ? ring->head : 0;
+        if (!ring || full) {
+            continue;
+        }
+        head = ring->head;
+        tail = LOAD(ring->tail);
+        while (head != tail) {
+            entry = &ring->entries[head & (LOG_RING_SIZE - 1)];
+            if (counts[entry->file] == LOG_BATCH_MAX) {
+                full = 1;
+                break;
+            }
+            batch[entry->file][counts[entry->file]++] = entry;
+            head++;
+        }
+        ends[i] = head;
+    }
+
+    pthread_mutex_lock(&file_lock);
+    for (i = 0; i < LOG_FILES; i++) {
+        if (counts[i] > 0) {
+            result = file_write(i, batch[i], counts[i]);
+            for (j = 0; result != ERR_NONE && j < counts[i]; j++) {
+                batch[i][j]->flags |= LOG_ENTRY_FAILED;
+            }
+        }
+    }
+    pthread_mutex_unlock(&file_lock);
+
+    /* Only now may the owners reuse the entries */
+    moved = 0;
+    for (i = 0; i <= LOG_RINGS_MAX; i++) {
+        ring = LOAD(rings[i]);
+        if (ring && ends[i] != ring->head) {
+            moved += ends[i] - ring->head;
+            STORE(ring->head, ends[i]);
+            STORE(ring->written, ends[i]);
+        }
+    }
+    return moved;
+}
+
+static void *
+writer_main(void *arg)
+{
+    struct timespec deadline;
+    unsigned long moved;
+
+    UNUSED(arg);
+    for (;;) {
+        moved = writer_drain();
+
+        pthread_mutex_lock(&writer_lock);
+        if (moved > 0) {
+            pthread_cond_broadcast(&writer_done);
+        } else if (stopping) {
+            pthread_mutex_unlock(&writer_lock);
+            break;
+        } else if (!wake_pending) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer_wake, &writer_lock, &deadline);
+        }
+        wake_pending = 0;
+        pthread_mutex_unlock(&writer_lock);
+    }
+    return NULL;
+}
+
+static void
+ring_disown(void *ring)
+{
+    STORE(((struct log_ring *)ring)->owned, 0);
+}
+
+static void
+ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_disown);
+}
+
+/* The calling thread's ring, claiming a free one on first use */
+static struct log_ring *
+ring_own(void)
+{
+    struct log_ring *ring;
+    int i;
+
+    ring = pthread_getspecific(ring_key);
+    if (ring) {
+        return ring;
+    }
+    for (i = 0; i < LOG_RINGS_MAX; i++) {
+        ring = LOAD(rings[i]);
+        if (!ring) {
+            ring = calloc(1, sizeof(*ring));
+            if (!ring) {
+                return NULL;
+            }
+            ring->owned = 1;
+            ring->index = i;
+            if (__sync_bool_compare_and_swap(&rings[i], NULL, ring)) {
+                break;
+            }
+            free(ring);
+            ring = LOAD(rings[i]);
+        }
+        if (__sync_bool_compare_and_swap(&ring->owned, 0, 1)) {
+            break;
+        }
+    }
+    if (i == LOG_RINGS_MAX) {
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static void
+writer_signal(void)
+{
+    pthread_mutex_lock(&writer_lock);
+    wake_pending = 1;
+    pthread_cond_signal(&writer_wake);
+    pthread_mutex_unlock(&writer_lock);
+}
+
+/*
+ * Wait for room in a full ring. Returns 0 if the line is to be dropped
+ * instead.
+ */
+static int
+ring_wait_space(struct log_ring *ring, int file, int flags)
+{
+    while (ring->tail - LOAD(ring->head) >= LOG_RING_SIZE) {
+        if (LOAD(policy) == LOG_POLICY_DROP && file != LOG_FILE_AUDIT &&
+            !(flags & LOG_WRITE_DURABLE)) {
+            __sync_fetch_and_add(&dropped, 1UL);
+            return 0;
+        }
+        pthread_mutex_lock(&writer_lock);
+        wake_pending = 1;
+        pthread_cond_signal(&writer_wake);
+        if (LOAD(running) && ring->tail - LOAD(ring->head) >= LOG_RING_SIZE) {
+            pthread_cond_wait(&writer_done, &writer_lock);
+        }
+        pthread_mutex_unlock(&writer_lock);
+        if (!LOAD(running)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Block until the writer has taken entry seq - 1 of ring. Returns
+ * ERR_NONE, ERR_IO if it could not be written, or ERR_INTERNAL if the
+ * writer stopped first.
+ */
+static int
+ring_wait_written(struct log_ring *ring, unsigned long seq)
+{
+    int written;
+
+    pthread_mutex_lock(&writer_lock);
+    wake_pending = 1;
+    pthread_cond_signal(&writer_wake);
+    while (LOAD(running) && (long)(LOAD(ring->written) - seq) < 0) {
+        pthread_cond_wait(&writer_done, &writer_lock);
+    }
+    written = (long)(LOAD(ring->written) - seq) >= 0;
+    pthread_mutex_unlock(&writer_lock);
+    if (!written) {
+        return ERR_INTERNAL;
+    }
+    if (ring->entries[(seq - 1) & (LOG_RING_SIZE - 1)].flags & LOG_ENTRY_FAILED) {
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+/*
+ * log_writer_start - Start the writer thread
+ *
+ * The writer blocks every signal, so SIGTERM and SIGINT still reach the
+ * server thread.
+ *
+ * Returns ERR_NONE, or ERR_INTERNAL if the thread could not be started.
+ */
+int
+log_writer_start(void)
+{
+    struct log_ring *ring;
+    sigset_t all;
+    sigset_t old;
+    int result;
+    int i;
+
+    if (LOAD(running)) {
+        return ERR_NONE;
+    }
+    pthread_once(&ring_key_once, ring_key_create);
+    if (!rings[LOG_RINGS_MAX]) {
+        ring = calloc(1, sizeof(*ring));
+        if (!ring) {
+            return ERR_INTERNAL;
+        }
+        ring->index = LOG_RINGS_MAX;
+        STORE(rings[LOG_RINGS_MAX], ring);
+    }
+
+    stopping = 0;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    result = pthread_create(&writer, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (result != 0) {
+        return ERR_INTERNAL;
+    }
+    STORE(running, 1);
+
+    /* Rotated copies left plain by an earlier run */
+    for (i = 0; i < LOG_FILES; i++) {
+        log_archive_queue(files[i].name);
+    }
+    return ERR_NONE;
+}
+
+/* Write out everything queued, stop the writer and close the files */
+void
+log_writer_shutdown(void)
+{
+    int i;
+
+    if (LOAD(running)) {
+        STORE(running, 0);
+        pthread_mutex_lock(&writer_lock);
+        stopping = 1;
+        pthread_cond_signal(&writer_wake);
+        pthread_cond_broadcast(&writer_done);
+        pthread_mutex_unlock(&writer_lock);
+        pthread_join(writer, NULL);
+    }
+
+    pthread_mutex_lock(&file_lock);
+    for (i = 0; i < LOG_FILES; i++) {
+        file_close(&files[i]);
+    }
+    pthread_mutex_unlock(&file_lock);
+}
+
+/* LOG_POLICY_DROP or LOG_POLICY_BLOCK for web log lines on a full ring */
+void
+log_writer_set_policy(int new_policy)
+{
+    STORE(policy, new_policy == LOG_POLICY_BLOCK ? LOG_POLICY_BLOCK
+                                                 : LOG_POLICY_DROP);
+}
+
+/*
+ * log_writer_printf - Queue one log line
+ * @file: LOG_FILE_WEB or LOG_FILE_AUDIT
+ * @flags: LOG_WRITE_DURABLE to return only once the line is in the file
+ * @fmt: Line after the timestamp, without the newline
+ *
+ * Lines longer than LOG_ENTRY_MAX are cut short. A durable line from a
+ * thread without a ring of its own is written by the caller, since other
+ * threads may reuse its entry of the shared ring.
+ *
+ * Returns ERR_NONE, ERR_PARAM, ERR_INTERNAL if the line was dropped, or
+ * ERR_IO if a line written by the caller, or a durable line, could not
+ * be written.
+ */
+int
+log_writer_printf(int file, int flags, const char *fmt, ...)
+{
+    struct log_entry local;
+    struct log_entry *entry;
+    struct log_ring *ring;
+    unsigned long seq;
+    va_list ap;
+    size_t room;
+    int shared;
+    int n;
+
+    if (file < 0 || file >= LOG_FILES || !fmt) {
+        return ERR_PARAM;
+    }
+
+    ring = NULL;
+    shared = 0;
+    if (LOAD(running)) {
+        ring = ring_own();
+        if (!ring && !(flags & LOG_WRITE_DURABLE)) {
+            pthread_mutex_lock(&shared_lock);
+            ring = rings[LOG_RINGS_MAX];
+            shared = 1;
+        }
+        if (ring && !ring_wait_space(ring, file, flags)) {
+            if (shared) {
+                pthread_mutex_unlock(&shared_lock);
+            }
+            return ERR_INTERNAL;
+        }
+    }
+    entry = ring ? &ring->entries[ring->tail & (LOG_RING_SIZE - 1)] : &local;
+
+    room = LOG_ENTRY_MAX - LOG_STAMP_LEN - 1;
+    va_start(ap, fmt);
+    n = vsnprintf(entry->line + LOG_STAMP_LEN, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        n = 0;
+    }
+    entry->len = LOG_STAMP_LEN + ((size_t)n < room ? (size_t)n : room - 1);
+    entry->line[entry->len++] = '\n';
+    entry->when = time(NULL);
+    entry->file = file;
+    entry->flags = flags;
+
+    if (!ring) {
+        pthread_mutex_lock(&file_lock);
+        n = file_write(file, &entry, 1);
+        pthread_mutex_unlock(&file_lock);
+        return n;
+    }
+
+    /* Publish the entry only once it is complete */
+    seq = ring->tail + 1;
+    STORE(ring->tail, seq);
+    if (shared) {
+        pthread_mutex_unlock(&shared_lock);
+    }
+
+    if (flags & LOG_WRITE_DURABLE) {
+        return ring_wait_written(ring, seq);
+    } else if (seq - LOAD(ring->head) >= LOG_RING_SIZE / 2) {
+        writer_signal();
+    }
+    return ERR_NONE;
+}
+
+/* Append the writer's counters as a JSON object */
+int
+log_writer_stats(struct buffer *out)
+{
+    int result;
+    int i;
+
+    result = buffer_appendf(out, "{\"running\":%s,\"policy\":\"%s\",\"dropped\":%lu",
+                            LOAD(running) ? "true" : "false",
+                            LOAD(policy) == LOG_POLICY_BLOCK ? "block" : "drop",
+                            LOAD(dropped));
+    pthread_mutex_lock(&file_lock);
+    for (i = 0; i < LOG_FILES && result == 0; i++) {
+        result = buffer_appendf(out, ",\"%s\":{\"lines\":%lu,\"size\":%ld,"
+                                "\"rotations\":%d}",
+                                files[i].name, files[i].lines,
+                                (long)files[i].size, files[i].rotations);
+    }
+    pthread_mutex_unlock(&file_lock);
+    if (result == 0) {
+        result = buffer_append_str(out, "}");
+    }
+    return result;
+}
+
+/* Web log lines dropped on a full ring so far */
+unsigned long
+log_writer_dropped(void)
+{
+    return LOAD(dropped);
+}
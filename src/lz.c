@@ -0,0 +1,214 @@
+/* filepath: src/lz.c */
+#include "../include/lz.h"
+#include "../include/buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Byte-oriented LZ77 in the style of an LZ4 block. Each sequence is a
+ * token whose high nibble is the literal count and low nibble the match
+ * length minus LZ_MIN_MATCH (15 in either means more length bytes
+ * follow, each adding up to 255), then the literals, then a two-byte
+ * little-endian offset back into the output. The last sequence has
+ * literals only. Record text is repetitive enough that a greedy single
+ * probe match finder does most of the work at memcpy-like speed.
+ */
+#define LZ_LAST_LITERALS 5          /* Tail always emitted as literals */
+
+static unsigned long
+read32(const unsigned char *p)
+{
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static size_t
+hash32(unsigned long value)
+{
+    return (size_t)(((value * 2654435761UL) & 0xffffffffUL) >> (32 - LZ_HASH_BITS));
+}
+
+static unsigned char *
+put_length(unsigned char *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static unsigned char *
+put_sequence(unsigned char *op, const unsigned char *literals, size_t nlit,
+             size_t offset, size_t match)
+{
+    unsigned char *token;
+
+    token = op++;
+    *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) {
+        op = put_length(op, nlit - 15);
+    }
+    memcpy(op, literals, nlit);
+    op += nlit;
+    if (!match) {
+        return op;
+    }
+
+    *op++ = (unsigned char)(offset & 0xff);
+    *op++ = (unsigned char)(offset >> 8);
+    match -= LZ_MIN_MATCH;
+    *token = (unsigned char)(*token | (match < 15 ? match : 15));
+    if (match >= 15) {
+        op = put_length(op, match - 15);
+    }
+    return op;
+}
+
+/*
+ * lz_compress - Compress a block and append it to a buffer
+ * @src: Data to compress
+ * @len: Length of src
+ * @out: Buffer the compressed bytes are appended to
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int
+lz_compress(const char *src, size_t len, struct buffer *out)
+{
+    const unsigned char *in;
+    unsigned char *start;
+    unsigned char *op;
+    size_t *table;
+    size_t anchor;
+    size_t limit;
+    size_t match;
+    size_t cand;
+    size_t pos;
+    size_t h;
+
+    if (buffer_reserve(out, LZ_BOUND(len)) != 0) {
+        return -1;
+    }
+    table = calloc((size_t)1 << LZ_HASH_BITS, sizeof(*table));
+    if (!table) {
+        return -1;
+    }
+
+    in = (const unsigned char *)src;
+    start = (unsigned char *)out->data + out->len;
+    op = start;
+    anchor = 0;
+    limit = len > LZ_LAST_LITERALS + LZ_MIN_MATCH ? len - LZ_LAST_LITERALS : 0;
+    pos = 0;
+    while (pos + LZ_MIN_MATCH <= limit) {
+        h = hash32(read32(in + pos));
+        cand = table[h];
+        table[h] = pos + 1;
+        if (!cand || pos - (cand - 1) > LZ_MAX_OFFSET ||
+            memcmp(in + cand - 1, in + pos, LZ_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+
+        cand--;
+        match = LZ_MIN_MATCH;
+        while (pos + match < limit && in[cand + match] == in[pos + match]) {
+            match++;
+        }
+        op = put_sequence(op, in + anchor, pos - anchor, pos - cand, match);
+        pos += match;
+        anchor = pos;
+    }
+    op = put_sequence(op, in + anchor, len - anchor, 0, 0);
+
+    free(table);
+    out->len += (size_t)(op - start);
+    out->data[out->len] = '\0';
+    return 0;
+}
+
+static int
+get_length(const unsigned char **ip, const unsigned char *end, size_t *len)
+{
+    unsigned char byte;
+
+    do {
+        if (*ip >= end) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/*
+ * lz_decompress - Expand a block produced by lz_compress
+ * @src: Compressed block
+ * @len: Length of src
+ * @dst: Output buffer
+ * @size: Size of dst
+ * @written: Set to the number of bytes produced
+ *
+ * Returns 0 on success, -1 if the block is corrupt or does not fit.
+ */
+int
+lz_decompress(const char *src, size_t len, char *dst, size_t size,
+              size_t *written)
+{
+    const unsigned char *ip;
+    const unsigned char *end;
+    unsigned char *op;
+    unsigned char *oend;
+    const unsigned char *from;
+    unsigned char token;
+    size_t nlit;
+    size_t match;
+    size_t offset;
+
+    ip = (const unsigned char *)src;
+    end = ip + len;
+    op = (unsigned char *)dst;
+    oend = op + size;
+    while (ip < end) {
+        token = *ip++;
+        nlit = (size_t)(token >> 4);
+        if (nlit == 15 && get_length(&ip, end, &nlit) != 0) {
+            return -1;
+        }
+        if (nlit > (size_t)(end - ip) || nlit > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        match = (size_t)(token & 15);
+        if (match == 15 && get_length(&ip, end, &match) != 0) {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (!offset || offset > (size_t)(op - (unsigned char *)dst) ||
+            match > (size_t)(oend - op)) {
+            return -1;
+        }
+
+        /* Byte by byte: the source may overlap what is being written */
+        for (from = op - offset; match > 0; match--) {
+            *op++ = *from++;
+        }
+    }
+
+    *written = (size_t)(op - (unsigned char *)dst);
+    return 0;
+}
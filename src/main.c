@@ -2,23 +2,50 @@
 /* C Standard Library headers */
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 /* POSIX headers */
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/socket.h>
 
 /* Local headers */
 #include "../include/web_server.h"
+#include "../include/archive.h"
+#include "../include/audit_store.h"
+#include "../include/diag.h"
+#include "../include/forecast.h"
+#include "../include/history.h"
+#include "../include/log_archive.h"
+#include "../include/log_writer.h"
+#include "../include/obligation_number.h"
+#include "../include/password.h"
+#include "../include/profile_store.h"
+#include "../include/query.h"
+#include "../include/rec_watch.h"
+#include "../include/result_cache.h"
+#include "../include/session.h"
+#include "../include/record_store.h"
+#include "../include/table.h"
+#include "../include/timer_wheel.h"
+#include "../include/trace.h"
+#include "../include/user_table.h"
+
+/* Poll timeout driving the one-second timer wheel tick */
+#define MAIN_LOOP_TICK_MS 1000
 
 static volatile sig_atomic_t server_running = 1;
+static volatile sig_atomic_t trace_dump_pending = 0;
 
 static void
 signal_handler(int sig)
 {
     if (sig == SIGTERM || sig == SIGINT) {
         server_running = 0;
+    } else if (sig == SIGUSR1) {
+        trace_dump_pending = 1;
     }
 }
 
@@ -26,8 +53,29 @@ int
 main(void)
 {
     struct sigaction sa;
+    struct pollfd pfds[3];
+    const char *level_name;
+    const char *sample;
     int server_fd;
     int client_fd;
+    int level;
+    int ready;
+
+    /* Diagnostics level, before any thread starts */
+    level_name = getenv(DIAG_LEVEL_ENV);
+    if (level_name) {
+        if (diag_parse_level(level_name, &level) == ERR_NONE) {
+            diag_set_level(level);
+        } else {
+            fprintf(stderr, "Unknown %s: %s\n", DIAG_LEVEL_ENV, level_name);
+        }
+    }
+
+    /* Request tracing, off unless asked for */
+    sample = getenv(TRACE_SAMPLE_ENV);
+    if (sample) {
+        trace_set_sample(strtoul(sample, NULL, 10));
+    }
 
     /* Setup signal handler */
     sa.sa_handler = signal_handler;
@@ -35,7 +83,8 @@ main(void)
     sa.sa_flags = 0;
 
     if (sigaction(SIGTERM, &sa, NULL) < 0 ||
-        sigaction(SIGINT, &sa, NULL) < 0) {
+        sigaction(SIGINT, &sa, NULL) < 0 ||
+        sigaction(SIGUSR1, &sa, NULL) < 0) {
         perror("Failed to setup signal handlers");
         return EXIT_FAILURE;
     }
@@ -49,8 +98,67 @@ main(void)
 
     printf("Server running on port %d...\n", DEFAULT_PORT);
 
+    /* Rotated logs are compressed off the server thread */
+    if (log_archive_start() != ERR_NONE) {
+        perror("Failed to start log compressor");
+    }
+
+    /* Log lines are written off the server thread */
+    if (log_writer_start() != ERR_NONE) {
+        perror("Failed to start log writer");
+    }
+
+    /* Background jobs run from the timer wheel */
+    timer_wheel_init((unsigned long)time(NULL));
+    forecast_start();
+    archive_start();
+    user_table_start();
+    profile_store_start();
+
+    /* Logins are verified off the server thread */
+    if (password_pool_start() != ERR_NONE) {
+        perror("Failed to start password workers");
+    }
+
+    /* Edits made to the .rec files outside the server */
+    if (rec_watch_init(RECORDS_DIR) != ERR_NONE) {
+        perror("Failed to watch records directory");
+    }
+
     /* Main server loop */
     while (server_running) {
+        pfds[0].fd = server_fd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = rec_watch_fd();
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        pfds[2].fd = password_pool_fd();
+        pfds[2].events = POLLIN;
+        pfds[2].revents = 0;
+        /* poll skips the descriptors that are -1 */
+        ready = poll(pfds, sizeof(pfds) / sizeof(pfds[0]), MAIN_LOOP_TICK_MS);
+
+        timer_wheel_advance((unsigned long)time(NULL));
+        if (trace_dump_pending) {
+            trace_dump_pending = 0;
+            if (trace_dump(TRACE_DUMP_FILE) != ERR_NONE) {
+                perror("Failed to dump traces");
+            }
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        if (pfds[1].revents & POLLIN) {
+            rec_watch_dispatch();
+        }
+        if (pfds[2].revents & POLLIN) {
+            password_pool_dispatch();
+        }
+        if (!(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+
         client_fd = accept(server_fd, NULL, NULL);
         if (client_fd < 0) {
             if (errno == EINTR) {
@@ -60,11 +168,29 @@ main(void)
             continue;
         }
 
-        handle_client(client_fd, WWW_ROOT);
-        close(client_fd);
+        if (handle_client(client_fd, WWW_ROOT) != HANDLE_DEFERRED) {
+            close(client_fd);
+        }
+
+        /* No request holds a store now, so cold projects can go */
+        rec_registry_trim(REC_MEMORY_BUDGET);
     }
 
     /* Cleanup */
+    rec_watch_shutdown();
+    password_pool_shutdown();
+    profile_store_shutdown();
+    user_table_shutdown();
+    session_clear();
+    audit_store_clear();
+    history_shutdown();
+    obligation_number_shutdown();
+    query_cache_clear();
+    table_cache_clear();
+    result_cache_clear();
+    rec_registry_shutdown();
+    log_writer_shutdown();
+    log_archive_shutdown();
     close(server_fd);
     return EXIT_SUCCESS;
 }
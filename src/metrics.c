@@ -0,0 +1,526 @@
+/* filepath: src/metrics.c */
+#include "../include/metrics.h"
+#include "../include/buffer.h"
+#include "../include/log_writer.h"
+#include "../include/query.h"
+#include "../include/result_cache.h"
+#include "../include/web_server.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Counters live in shards, one per thread, so recording a request or a
+ * lock wait touches only memory the thread owns: a relaxed load and
+ * store, no lock and no shared cache line. A scrape adds the shards up.
+ * Threads beyond METRICS_SHARDS_MAX share a last shard, updated with
+ * atomic adds; they do not time requests.
+ *
+ * Latencies go into log-linear histograms in the manner of HDR
+ * histograms: METRICS_SUB_BUCKETS buckets per power of two microseconds,
+ * so every bucket is within 25% of its bounds from 1 us to a minute.
+ */
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/* Routes, matched on the URI prefix, followed by the catch-alls */
+static const struct {
+    const char *prefix;
+    const char *name;
+} routes[] = {
+    { "/users", "users" },
+    { ENDPOINT_FORECAST, "forecast" },
+    { ENDPOINT_STATS, "stats" },
+    { ENDPOINT_METRICS, "metrics" },
+    { ENDPOINT_TRACE, "trace" },
+    { ENDPOINT_QUERY, "query" },
+    { ENDPOINT_RECORDS, "records" },
+    { ENDPOINT_PROJECTS, "projects" },
+    { ENDPOINT_TABLE, "table" },
+    { ENDPOINT_EXPORT, "export" },
+    { "/auth", "auth" },
+    { ENDPOINT_LOGOUT, "logout" },
+    { "/update", "update_user" },
+    { ENDPOINT_PROFILE, "profile" },
+    { ENDPOINT_AUDIT, "audit" },
+    { "/audit_log", "audit_log" },
+    { ENDPOINT_CREATE, "create_record" },
+    { ENDPOINT_UPDATE, "update_record" },
+    { ENDPOINT_NEXT_NUMBER, "next_number" }
+};
+
+#define ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+#define ROUTE_REC_FILE ((int)ROUTE_COUNT)       /* A .rec file */
+#define ROUTE_STATIC ((int)ROUTE_COUNT + 1)     /* Anything else under www */
+#define ROUTE_INVALID ((int)ROUTE_COUNT + 2)    /* Unreadable or unparsed */
+#define ROUTES ((int)ROUTE_COUNT + 3)
+
+static const char *const extra_routes[] = { "rec_file", "static", "invalid" };
+
+struct metrics_histogram {
+    unsigned long buckets[METRICS_BUCKETS];
+    unsigned long sum;                  /* Microseconds */
+    unsigned long count;
+};
+
+struct metrics_shard {
+    struct metrics_histogram latency[ROUTES];
+    struct metrics_histogram lock_wait;
+    unsigned long errors[ROUTES];
+    unsigned long bytes;
+    unsigned long opened;
+    unsigned long closed;
+    struct timespec start;              /* Request being handled */
+    int route;
+    int shared;
+    int owned;
+    int pad;
+};
+
+static struct metrics_shard *shards[METRICS_SHARDS_MAX + 1];
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+static void
+shard_disown(void *shard)
+{
+    __atomic_store_n(&((struct metrics_shard *)shard)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void
+shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_disown);
+}
+
+/* The calling thread's shard, claiming one on first use; NULL if out of memory */
+static struct metrics_shard *
+shard_own(void)
+{
+    struct metrics_shard *shard;
+    int i;
+
+    pthread_once(&shard_key_once, shard_key_create);
+    shard = pthread_getspecific(shard_key);
+    if (shard) {
+        return shard;
+    }
+    for (i = 0; i <= METRICS_SHARDS_MAX; i++) {
+        shard = __atomic_load_n(&shards[i], __ATOMIC_ACQUIRE);
+        if (!shard) {
+            shard = calloc(1, sizeof(*shard));
+            if (!shard) {
+                return NULL;
+            }
+            shard->owned = 1;
+            shard->shared = i == METRICS_SHARDS_MAX;
+            if (__sync_bool_compare_and_swap(&shards[i], NULL, shard)) {
+                break;
+            }
+            free(shard);
+            shard = __atomic_load_n(&shards[i], __ATOMIC_ACQUIRE);
+        }
+        if (shard->shared || __sync_bool_compare_and_swap(&shard->owned, 0, 1)) {
+            break;
+        }
+    }
+    if (!shard->shared) {
+        pthread_setspecific(shard_key, shard);
+    }
+    return shard;
+}
+
+/* Add to a counter of the caller's shard */
+static void
+count(const struct metrics_shard *shard, unsigned long *counter, unsigned long n)
+{
+    if (shard->shared) {
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(counter, LOAD(*counter) + n, __ATOMIC_RELAXED);
+    }
+}
+
+static size_t
+bucket_of(unsigned long us)
+{
+    unsigned long top;
+    size_t shift;
+    size_t bucket;
+
+    if (us < METRICS_SUB_BUCKETS) {
+        return (size_t)us;
+    }
+    shift = 0;
+    for (top = us; top >= 2 * METRICS_SUB_BUCKETS; top >>= 1) {
+        shift++;
+    }
+    bucket = (shift + 1) * METRICS_SUB_BUCKETS + (size_t)(top - METRICS_SUB_BUCKETS);
+    return bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1;
+}
+
+/* Exclusive upper bound of a bucket in microseconds */
+static unsigned long
+bucket_limit(size_t bucket)
+{
+    size_t shift;
+    unsigned long top;
+
+    if (bucket < 2 * METRICS_SUB_BUCKETS) {
+        return (unsigned long)bucket + 1;
+    }
+    shift = bucket / METRICS_SUB_BUCKETS - 1;
+    top = METRICS_SUB_BUCKETS + (unsigned long)(bucket % METRICS_SUB_BUCKETS);
+    return (top + 1) << shift;
+}
+
+static unsigned long
+elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    long us;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (long)(now.tv_sec - start->tv_sec) * 1000000L +
+         (now.tv_nsec - start->tv_nsec) / 1000L;
+    return us > 0 ? (unsigned long)us : 0;
+}
+
+static void
+observe(const struct metrics_shard *shard, struct metrics_histogram *h,
+        unsigned long us)
+{
+    count(shard, &h->buckets[bucket_of(us)], 1);
+    count(shard, &h->sum, us);
+    count(shard, &h->count, 1);
+}
+
+/* Start timing a request on this thread */
+void
+metrics_request_begin(void)
+{
+    struct metrics_shard *shard;
+
+    shard = shard_own();
+    if (!shard) {
+        return;
+    }
+    count(shard, &shard->opened, 1);
+    if (!shard->shared) {
+        shard->route = ROUTE_INVALID;
+        clock_gettime(CLOCK_MONOTONIC, &shard->start);
+    }
+}
+
+/* Name the route of the request being timed from its URI */
+void
+metrics_request_route(const char *uri)
+{
+    struct metrics_shard *shard;
+    size_t len;
+    size_t i;
+
+    shard = shard_own();
+    if (!shard || shard->shared || !uri) {
+        return;
+    }
+    for (i = 0; i < ROUTE_COUNT; i++) {
+        len = strlen(routes[i].prefix);
+        if (strncmp(uri, routes[i].prefix, len) == 0 &&
+            (routes[i].prefix[len - 1] == '/' || uri[len] == '\0' ||
+             uri[len] == '?')) {
+            shard->route = (int)i;
+            return;
+        }
+    }
+    shard->route = strstr(uri, ".rec") ? ROUTE_REC_FILE : ROUTE_STATIC;
+}
+
+/*
+ * metrics_request_end - Record the request being timed
+ * @result: What handle_client returned; below 0 counts as an error
+ *
+ * A deferred request stays in flight until metrics_connection_done.
+ */
+void
+metrics_request_end(int result)
+{
+    struct metrics_shard *shard;
+
+    shard = shard_own();
+    if (!shard) {
+        return;
+    }
+    if (result != HANDLE_DEFERRED) {
+        count(shard, &shard->closed, 1);
+    }
+    if (shard->shared) {
+        return;
+    }
+    observe(shard, &shard->latency[shard->route], elapsed_us(&shard->start));
+    if (result < 0) {
+        count(shard, &shard->errors[shard->route], 1);
+    }
+}
+
+/* A deferred request has been answered */
+void
+metrics_connection_done(void)
+{
+    struct metrics_shard *shard;
+
+    shard = shard_own();
+    if (shard) {
+        count(shard, &shard->closed, 1);
+    }
+}
+
+void
+metrics_bytes_sent(size_t bytes)
+{
+    struct metrics_shard *shard;
+
+    shard = shard_own();
+    if (shard) {
+        count(shard, &shard->bytes, (unsigned long)bytes);
+    }
+}
+
+/* Record how long a record file lock took, from when it was asked for */
+void
+metrics_lock_wait(const struct timespec *start)
+{
+    struct metrics_shard *shard;
+
+    shard = shard_own();
+    if (shard) {
+        observe(shard, &shard->lock_wait, elapsed_us(start));
+    }
+}
+
+static void
+merge_histogram(struct metrics_histogram *total, struct metrics_histogram *h)
+{
+    size_t i;
+
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        total->buckets[i] += LOAD(h->buckets[i]);
+    }
+    total->sum += LOAD(h->sum);
+    total->count += LOAD(h->count);
+}
+
+/* Add every shard up */
+static void
+merge(struct metrics_shard *total)
+{
+    struct metrics_shard *shard;
+    int i;
+    int r;
+
+    for (i = 0; i <= METRICS_SHARDS_MAX; i++) {
+        shard = __atomic_load_n(&shards[i], __ATOMIC_ACQUIRE);
+        if (!shard) {
+            continue;
+        }
+        for (r = 0; r < ROUTES; r++) {
+            merge_histogram(&total->latency[r], &shard->latency[r]);
+            total->errors[r] += LOAD(shard->errors[r]);
+        }
+        merge_histogram(&total->lock_wait, &shard->lock_wait);
+        total->bytes += LOAD(shard->bytes);
+        total->opened += LOAD(shard->opened);
+        total->closed += LOAD(shard->closed);
+    }
+}
+
+static const char *
+route_name(int route)
+{
+    return route < (int)ROUTE_COUNT ? routes[route].name
+                                    : extra_routes[route - (int)ROUTE_COUNT];
+}
+
+static int
+render_histogram(struct buffer *out, const char *name, const char *label,
+                 const struct metrics_histogram *h)
+{
+    const char *open;
+    const char *close;
+    const char *comma;
+    unsigned long cumulative;
+    unsigned long limit;
+    size_t i;
+    int result;
+
+    open = label[0] ? "{" : "";
+    close = label[0] ? "}" : "";
+    comma = label[0] ? "," : "";
+    cumulative = 0;
+    result = 0;
+    for (i = 0; i < METRICS_BUCKETS && result == 0; i++) {
+        cumulative += h->buckets[i];
+        limit = bucket_limit(i);
+        result = buffer_appendf(out, "%s_bucket{%s%sle=\"%lu.%06lu\"} %lu\n",
+                                name, label, comma, limit / 1000000UL,
+                                limit % 1000000UL, cumulative);
+    }
+    if (result == 0) {
+        result = buffer_appendf(out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n"
+                                "%s_sum%s%s%s %lu.%06lu\n"
+                                "%s_count%s%s%s %lu\n",
+                                name, label, comma, h->count,
+                                name, open, label, close,
+                                h->sum / 1000000UL, h->sum % 1000000UL,
+                                name, open, label, close, h->count);
+    }
+    return result;
+}
+
+static double
+hit_ratio(unsigned long hits, unsigned long misses)
+{
+    return hits + misses ? (double)hits / (double)(hits + misses) : 0.0;
+}
+
+/* Both caches, each metric family kept together as the format requires */
+static int
+render_caches(struct buffer *out)
+{
+    unsigned long plan_hits;
+    unsigned long plan_misses;
+    unsigned long hits;
+    unsigned long misses;
+    int result;
+
+    query_plan_counts(&plan_hits, &plan_misses);
+    result_cache_counts(&hits, &misses);
+    result = buffer_appendf(out,
+        "# HELP web_cache_lookups_total Cache lookups, by cache and result.\n"
+        "# TYPE web_cache_lookups_total counter\n"
+        "web_cache_lookups_total{cache=\"query_plan\",result=\"hit\"} %lu\n"
+        "web_cache_lookups_total{cache=\"query_plan\",result=\"miss\"} %lu\n"
+        "web_cache_lookups_total{cache=\"result\",result=\"hit\"} %lu\n"
+        "web_cache_lookups_total{cache=\"result\",result=\"miss\"} %lu\n",
+        plan_hits, plan_misses, hits, misses);
+    if (result == 0) {
+        result = buffer_appendf(out,
+            "# HELP web_cache_hit_ratio Share of lookups that hit.\n"
+            "# TYPE web_cache_hit_ratio gauge\n"
+            "web_cache_hit_ratio{cache=\"query_plan\"} %.4f\n"
+            "web_cache_hit_ratio{cache=\"result\"} %.4f\n",
+            hit_ratio(plan_hits, plan_misses), hit_ratio(hits, misses));
+    }
+    return result;
+}
+
+/*
+ * metrics_render - Append every metric in Prometheus text format
+ * @out: Buffer to append to
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int
+metrics_render(struct buffer *out)
+{
+    struct metrics_shard *total;
+    char labels[64];
+    int result;
+    int r;
+
+    total = calloc(1, sizeof(*total));
+    if (!total) {
+        return -1;
+    }
+    merge(total);
+
+    result = buffer_append_str(out,
+        "# HELP web_requests_total Requests handled, by route.\n"
+        "# TYPE web_requests_total counter\n");
+    for (r = 0; r < ROUTES && result == 0; r++) {
+        if (total->latency[r].count) {
+            result = buffer_appendf(out, "web_requests_total{route=\"%s\"} %lu\n",
+                                    route_name(r), total->latency[r].count);
+        }
+    }
+    if (result == 0) {
+        result = buffer_append_str(out,
+            "# HELP web_request_errors_total Requests whose handler failed, by route.\n"
+            "# TYPE web_request_errors_total counter\n");
+    }
+    for (r = 0; r < ROUTES && result == 0; r++) {
+        if (total->latency[r].count) {
+            result = buffer_appendf(out, "web_request_errors_total{route=\"%s\"} %lu\n",
+                                    route_name(r), total->errors[r]);
+        }
+    }
+    if (result == 0) {
+        result = buffer_append_str(out,
+            "# HELP web_request_duration_seconds Time to handle a request, by route.\n"
+            "# TYPE web_request_duration_seconds histogram\n");
+    }
+    for (r = 0; r < ROUTES && result == 0; r++) {
+        if (total->latency[r].count) {
+            snprintf(labels, sizeof(labels), "route=\"%s\"", route_name(r));
+            result = render_histogram(out, "web_request_duration_seconds", labels,
+                                      &total->latency[r]);
+        }
+    }
+
+    if (result == 0) {
+        result = buffer_appendf(out,
+            "# HELP web_connections_in_flight Connections accepted and not yet answered.\n"
+            "# TYPE web_connections_in_flight gauge\n"
+            "web_connections_in_flight %lu\n"
+            "# HELP web_response_bytes_total Response bytes written to clients.\n"
+            "# TYPE web_response_bytes_total counter\n"
+            "web_response_bytes_total %lu\n",
+            total->opened > total->closed ? total->opened - total->closed : 0,
+            total->bytes);
+    }
+    if (result == 0) {
+        result = buffer_append_str(out,
+            "# HELP web_record_lock_wait_seconds Time to take the lock on a record file.\n"
+            "# TYPE web_record_lock_wait_seconds histogram\n");
+    }
+    if (result == 0) {
+        result = render_histogram(out, "web_record_lock_wait_seconds", "",
+                                  &total->lock_wait);
+    }
+
+    if (result == 0) {
+        result = render_caches(out);
+    }
+    if (result == 0) {
+        result = buffer_appendf(out,
+            "# HELP web_log_lines_dropped_total Log lines dropped on a full ring.\n"
+            "# TYPE web_log_lines_dropped_total counter\n"
+            "web_log_lines_dropped_total %lu\n", log_writer_dropped());
+    }
+    free(total);
+    return result;
+}
+
+/*
+ * handle_metrics_request - Serve the metrics for a Prometheus scrape
+ * @client_socket: Socket to send response
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_metrics_request(int client_socket)
+{
+    struct buffer body;
+    int result;
+
+    buffer_init(&body);
+    if (metrics_render(&body) != 0) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", METRICS_CONTENT_TYPE,
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
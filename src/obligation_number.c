@@ -0,0 +1,307 @@
+/* filepath: src/obligation_number.c */
+#include "../include/obligation_number.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/*
+ * Numbers are handed out from in-memory blocks. Each block of
+ * OBLIGATION_BLOCK_SIZE numbers is reserved with a single write of the
+ * counter file under flock, so other processes sharing the file never
+ * receive the same number. Unused numbers of a block are skipped after a
+ * restart.
+ */
+struct number_block {
+    char prefix[OBLIGATION_PREFIX_MAX];
+    volatile long next;
+    volatile long limit;
+};
+
+static struct number_block blocks[OBLIGATION_MAX_PREFIXES];
+static volatile int block_count = 0;
+static char counter_path[256] = OBLIGATION_NUMBER_FILE;
+static int counter_fd = -1;
+static pthread_mutex_t refill_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The counter file as read and as rewritten; guarded by refill_lock */
+static char counter_data[OBLIGATION_MAX_PREFIXES * OBLIGATION_LINE_MAX];
+static char counter_out[OBLIGATION_MAX_PREFIXES * OBLIGATION_LINE_MAX];
+
+static int
+valid_prefix(const char *prefix)
+{
+    size_t i;
+
+    if (!prefix || !prefix[0]) {
+        return 0;
+    }
+    for (i = 0; prefix[i]; i++) {
+        if (i >= OBLIGATION_PREFIX_MAX - 1 ||
+            !(isupper((unsigned char)prefix[i]) || isdigit((unsigned char)prefix[i]))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+obligation_number_init(const char *path)
+{
+    size_t len;
+
+    if (!path) {
+        return ERR_PARAM;
+    }
+    len = strlen(path);
+    if (len >= sizeof(counter_path)) {
+        return ERR_PARAM;
+    }
+
+    obligation_number_shutdown();
+    memcpy(counter_path, path, len + 1);
+    return ERR_NONE;
+}
+
+void
+obligation_number_shutdown(void)
+{
+    pthread_mutex_lock(&refill_lock);
+    if (counter_fd >= 0) {
+        close(counter_fd);
+        counter_fd = -1;
+    }
+    block_count = 0;
+    pthread_mutex_unlock(&refill_lock);
+}
+
+/*
+ * obligation_number_prefix - Map a project to its obligation number prefix
+ * @project: Project name, or NULL for the default project
+ * @prefix: Output buffer
+ * @size: Size of the output buffer
+ *
+ * The SCJV register predates per-project prefixes and keeps "PCEMP";
+ * other projects use their upper-cased name (e.g. ms1180 -> MS1180).
+ */
+int
+obligation_number_prefix(const char *project, char *prefix, size_t size)
+{
+    size_t i;
+
+    if (!prefix || size < OBLIGATION_PREFIX_MAX) {
+        return ERR_PARAM;
+    }
+
+    if (!project || !project[0] || strcmp(project, "scjv") == 0) {
+        strcpy(prefix, OBLIGATION_DEFAULT_PREFIX);
+        return ERR_NONE;
+    }
+
+    for (i = 0; project[i] && i < OBLIGATION_PREFIX_MAX - 1; i++) {
+        prefix[i] = (char)toupper((unsigned char)project[i]);
+    }
+    prefix[i] = '\0';
+    return valid_prefix(prefix) && !project[i] ? ERR_NONE : ERR_PARAM;
+}
+
+/* First free number for a prefix the counter file has never seen */
+static long
+seed_from_project(const char *prefix, const char *project)
+{
+    struct rec_store *store;
+    const char *key;
+    size_t len;
+    size_t i;
+    long highest;
+    long value;
+
+    highest = 0;
+    store = project ? rec_store_get(project) : NULL;
+    len = strlen(prefix);
+    for (i = 0; store && i < store->count; i++) {
+        key = rec_get(store->records[i], REC_KEY_FIELD);
+        if (key && strncmp(key, prefix, len) == 0 && key[len] == '-') {
+            value = atol(key + len + 1);
+            if (value > highest) {
+                highest = value;
+            }
+        }
+    }
+    return highest + 1;
+}
+
+/* Reserve the next block for one prefix; caller holds refill_lock */
+static int
+reserve_block(struct number_block *block, const char *project)
+{
+    char *data;
+    char *out;
+    char *line;
+    char *eol;
+    size_t prefix_len;
+    size_t used;
+    ssize_t n;
+    long start;
+    int found;
+    int len;
+
+    data = counter_data;
+    out = counter_out;
+    if (counter_fd < 0) {
+        counter_fd = open(counter_path, O_RDWR | O_CREAT, 0644);
+        if (counter_fd < 0) {
+            return ERR_IO;
+        }
+    }
+
+    if (flock(counter_fd, LOCK_EX) != 0) {
+        return ERR_IO;
+    }
+
+    n = pread(counter_fd, data, sizeof(counter_data) - 1, 0);
+    if (n < 0) {
+        flock(counter_fd, LOCK_UN);
+        return ERR_IO;
+    }
+    data[n] = '\0';
+
+    /* Rewrite every "PREFIX-N" line, advancing ours by one block */
+    prefix_len = strlen(block->prefix);
+    used = 0;
+    found = 0;
+    start = 0;
+    for (line = data; *line; line = eol) {
+        eol = strchr(line, '\n');
+        eol = eol ? eol + 1 : line + strlen(line);
+
+        if (!found && strncmp(line, block->prefix, prefix_len) == 0 &&
+            line[prefix_len] == '-') {
+            found = 1;
+            start = atol(line + prefix_len + 1);
+            if (start < block->limit) {
+                start = block->limit;
+            }
+            len = snprintf(out + used, sizeof(counter_out) - used, "%s-%ld\n",
+                           block->prefix, start + OBLIGATION_BLOCK_SIZE);
+        } else if (line[0] != '\n') {
+            len = snprintf(out + used, sizeof(counter_out) - used, "%.*s",
+                           (int)(eol - line), line);
+        } else {
+            continue;
+        }
+        if (len < 0 || (size_t)len >= sizeof(counter_out) - used) {
+            flock(counter_fd, LOCK_UN);
+            return ERR_INTERNAL;
+        }
+        used += (size_t)len;
+    }
+
+    if (!found) {
+        start = seed_from_project(block->prefix, project);
+        len = snprintf(out + used, sizeof(counter_out) - used, "%s-%ld\n",
+                       block->prefix, start + OBLIGATION_BLOCK_SIZE);
+        if (len < 0 || (size_t)len >= sizeof(counter_out) - used) {
+            flock(counter_fd, LOCK_UN);
+            return ERR_INTERNAL;
+        }
+        used += (size_t)len;
+    }
+
+    /* One write per block; the file only shrinks if it held junk */
+    if (pwrite(counter_fd, out, used, 0) != (ssize_t)used ||
+        ((size_t)n > used && ftruncate(counter_fd, (off_t)used) != 0)) {
+        flock(counter_fd, LOCK_UN);
+        return ERR_IO;
+    }
+    flock(counter_fd, LOCK_UN);
+
+    /* Publish next before limit so readers never see a stale range */
+    block->next = start;
+    __sync_synchronize();
+    block->limit = start + OBLIGATION_BLOCK_SIZE;
+    return ERR_NONE;
+}
+
+static struct number_block *
+find_block(const char *prefix)
+{
+    struct number_block *block;
+    int i;
+
+    for (i = 0; i < block_count; i++) {
+        if (strcmp(blocks[i].prefix, prefix) == 0) {
+            return &blocks[i];
+        }
+    }
+
+    pthread_mutex_lock(&refill_lock);
+    for (i = 0; i < block_count; i++) {
+        if (strcmp(blocks[i].prefix, prefix) == 0) {
+            pthread_mutex_unlock(&refill_lock);
+            return &blocks[i];
+        }
+    }
+    if (block_count >= OBLIGATION_MAX_PREFIXES) {
+        pthread_mutex_unlock(&refill_lock);
+        return NULL;
+    }
+
+    block = &blocks[block_count];
+    strcpy(block->prefix, prefix);
+    block->next = 0;
+    block->limit = 0;
+    __sync_synchronize();
+    block_count++;
+    pthread_mutex_unlock(&refill_lock);
+    return block;
+}
+
+/*
+ * obligation_number_next - Allocate the next obligation number
+ * @prefix: Number prefix, e.g. "PCEMP"
+ * @project: Project whose records seed a new prefix, or NULL
+ *
+ * The common case is a single compare-and-swap on the in-memory block.
+ * Returns the number, or -1 on failure.
+ */
+long
+obligation_number_next(const char *prefix, const char *project)
+{
+    struct number_block *block;
+    long number;
+
+    if (!valid_prefix(prefix)) {
+        return -1;
+    }
+
+    block = find_block(prefix);
+    if (!block) {
+        return -1;
+    }
+
+    for (;;) {
+        number = block->next;
+        if (number < block->limit) {
+            if (__sync_bool_compare_and_swap(&block->next, number, number + 1)) {
+                return number;
+            }
+            continue;
+        }
+
+        /* Block exhausted: one caller refills, the rest retry */
+        pthread_mutex_lock(&refill_lock);
+        if (block->next >= block->limit &&
+            reserve_block(block, project) != ERR_NONE) {
+            pthread_mutex_unlock(&refill_lock);
+            return -1;
+        }
+        pthread_mutex_unlock(&refill_lock);
+    }
+}
@@ -0,0 +1,419 @@
+/* filepath: src/password.c */
+#include "../include/password.h"
+#include "../include/user_table.h"
+#include "../include/web_server.h"
+#include <crypt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Auth file passwords are SHA-512 crypt hashes, "$6$rounds=N$salt$hash".
+ * Lines still holding a plaintext password, or a hash with fewer rounds
+ * than PASSWORD_ROUNDS, keep working and are rehashed on the next
+ * successful login.
+ *
+ * Verifying is deliberately slow, so logins are handed to a small pool
+ * of worker threads. A finished job is queued back and the pipe read
+ * end becomes readable; the server thread then runs the job's done
+ * callback from password_pool_dispatch and closes the client. Requests
+ * that are not logins never wait behind a hash.
+ */
+#define PASSWORD_PREFIX "$6$"
+#define PASSWORD_ROUNDS_PREFIX "$6$rounds="
+#define PASSWORD_DUMMY_SALT "timingequalizer"
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_ready = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[PASSWORD_WORKERS];
+static struct password_job *queue_head = NULL;
+static struct password_job *queue_tail = NULL;
+static struct password_job *done_head = NULL;
+static size_t outstanding = 0;          /* Submitted and not yet dispatched */
+static size_t started = 0;
+static int stopping = 0;
+static int wake_fds[2] = { -1, -1 };
+
+/* Compare without stopping at the first difference */
+static int
+equal_constant_time(const char *a, const char *b)
+{
+    size_t len_a;
+    size_t len_b;
+    size_t i;
+    unsigned char diff;
+
+    len_a = strlen(a);
+    len_b = strlen(b);
+    diff = (unsigned char)(len_a != len_b);
+    for (i = 0; i < len_a && i < len_b; i++) {
+        diff = (unsigned char)(diff | (a[i] ^ b[i]));
+    }
+    return diff == 0;
+}
+
+/* crypt_r into out; each call has its own state, so any thread may hash */
+static int
+crypt_into(const char *password, const char *setting, char *out, size_t size)
+{
+    struct crypt_data *data;
+    const char *hash;
+    int result;
+
+    data = calloc(1, sizeof(*data));
+    if (!data) {
+        return ERR_INTERNAL;
+    }
+    hash = crypt_r(password, setting, data);
+    result = ERR_INTERNAL;
+    if (hash && strncmp(hash, PASSWORD_PREFIX, strlen(PASSWORD_PREFIX)) == 0 &&
+        strlen(hash) < size) {
+        strcpy(out, hash);
+        result = ERR_NONE;
+    }
+    memset(data, 0, sizeof(*data));
+    free(data);
+    return result;
+}
+
+/*
+ * password_hash - Hash a password with a fresh salt
+ * @password: Plaintext password
+ * @out: Output buffer for the crypt string
+ * @size: Size of out, PASSWORD_HASH_MAX is enough
+ *
+ * Returns ERR_NONE, ERR_PARAM, ERR_IO if no random salt could be read,
+ * or ERR_INTERNAL.
+ */
+int
+password_hash(const char *password, char *out, size_t size)
+{
+    static const char alphabet[] =
+        "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    unsigned char random[PASSWORD_SALT_LEN];
+    char setting[64];
+    char salt[PASSWORD_SALT_LEN + 1];
+    ssize_t n;
+    size_t i;
+    int fd;
+
+    if (!password || !out || size == 0) {
+        return ERR_PARAM;
+    }
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) {
+        return ERR_IO;
+    }
+    n = read(fd, random, sizeof(random));
+    close(fd);
+    if (n != (ssize_t)sizeof(random)) {
+        return ERR_IO;
+    }
+    for (i = 0; i < PASSWORD_SALT_LEN; i++) {
+        salt[i] = alphabet[random[i] & 0x3f];
+    }
+    salt[PASSWORD_SALT_LEN] = '\0';
+
+    snprintf(setting, sizeof(setting), PASSWORD_ROUNDS_PREFIX "%d$%s$",
+             PASSWORD_ROUNDS, salt);
+    return crypt_into(password, setting, out, size);
+}
+
+/*
+ * password_verify - Check a password against an auth file entry
+ * @password: Plaintext password from the client
+ * @stored: Hash, legacy plaintext password, or "" for no such user
+ *
+ * Returns 1 on a match, 0 otherwise.
+ */
+int
+password_verify(const char *password, const char *stored)
+{
+    char hash[PASSWORD_HASH_MAX];
+    char setting[64];
+
+    if (!password || !stored) {
+        return 0;
+    }
+    if (stored[0] == '\0') {
+        /* Unknown users take as long to fail as a wrong password */
+        snprintf(setting, sizeof(setting), PASSWORD_ROUNDS_PREFIX "%d$%s$",
+                 PASSWORD_ROUNDS, PASSWORD_DUMMY_SALT);
+        crypt_into(password, setting, hash, sizeof(hash));
+        return 0;
+    }
+    if (strncmp(stored, PASSWORD_PREFIX, strlen(PASSWORD_PREFIX)) != 0) {
+        return equal_constant_time(password, stored);
+    }
+    if (crypt_into(password, stored, hash, sizeof(hash)) != ERR_NONE) {
+        return 0;
+    }
+    return equal_constant_time(hash, stored);
+}
+
+/* Returns 1 if stored is plaintext or hashed with too few rounds */
+int
+password_needs_rehash(const char *stored)
+{
+    unsigned long rounds;
+
+    if (!stored || strncmp(stored, PASSWORD_PREFIX, strlen(PASSWORD_PREFIX)) != 0) {
+        return 1;
+    }
+    rounds = PASSWORD_DEFAULT_ROUNDS;
+    if (strncmp(stored, PASSWORD_ROUNDS_PREFIX,
+                strlen(PASSWORD_ROUNDS_PREFIX)) == 0) {
+        rounds = strtoul(stored + strlen(PASSWORD_ROUNDS_PREFIX), NULL, 10);
+    }
+    return rounds < PASSWORD_ROUNDS;
+}
+
+static void
+job_run(struct password_job *job)
+{
+    if (user_table_password(job->username, job->stored,
+                            sizeof(job->stored)) != ERR_NONE) {
+        job->stored[0] = '\0';
+    }
+    job->match = password_verify(job->password, job->stored);
+    if (job->match && password_needs_rehash(job->stored) &&
+        password_hash(job->password, job->rehash, sizeof(job->rehash)) != ERR_NONE) {
+        job->rehash[0] = '\0';
+    }
+    memset(job->password, 0, sizeof(job->password));
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct password_job *job;
+    char wake;
+
+    UNUSED(arg);
+    wake = 1;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!queue_head && !stopping) {
+            pthread_cond_wait(&pool_ready, &pool_lock);
+        }
+        if (stopping) {
+            break;
+        }
+        job = queue_head;
+        queue_head = job->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        job_run(job);
+
+        pthread_mutex_lock(&pool_lock);
+        job->next = done_head;
+        done_head = job;
+        if (write(wake_fds[1], &wake, 1) < 0) {
+            /* The pipe is full, so the server thread is already woken */
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+static void
+jobs_free(struct password_job *job)
+{
+    struct password_job *next;
+
+    for (; job; job = next) {
+        next = job->next;
+        close(job->client_socket);
+        memset(job, 0, sizeof(*job));
+        free(job);
+    }
+}
+
+/*
+ * password_pool_start - Start the login workers
+ *
+ * Workers block every signal, so SIGTERM and SIGINT still reach the
+ * server thread.
+ *
+ * Returns ERR_NONE, or ERR_INTERNAL if no worker could be started.
+ */
+int
+password_pool_start(void)
+{
+    sigset_t all;
+    sigset_t old;
+    size_t i;
+
+    if (started > 0) {
+        return ERR_NONE;
+    }
+    if (pipe(wake_fds) != 0) {
+        return ERR_INTERNAL;
+    }
+    fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    stopping = 0;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 0; i < PASSWORD_WORKERS; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            break;
+        }
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (started == 0) {
+        close(wake_fds[0]);
+        close(wake_fds[1]);
+        wake_fds[0] = -1;
+        wake_fds[1] = -1;
+        return ERR_INTERNAL;
+    }
+    return ERR_NONE;
+}
+
+/* Stop the workers; logins still pending are dropped with their clients */
+void
+password_pool_shutdown(void)
+{
+    size_t i;
+
+    if (started == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&pool_ready);
+    pthread_mutex_unlock(&pool_lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    started = 0;
+
+    jobs_free(queue_head);
+    jobs_free(done_head);
+    queue_head = NULL;
+    queue_tail = NULL;
+    done_head = NULL;
+    outstanding = 0;
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    wake_fds[0] = -1;
+    wake_fds[1] = -1;
+}
+
+/* Readable when finished logins are waiting; -1 without a pool */
+int
+password_pool_fd(void)
+{
+    return wake_fds[0];
+}
+
+/*
+ * password_pool_submit - Queue a login for verification
+ * @client_socket: Connection to answer; owned by the job on success
+ * @username: User logging in
+ * @password: Password given
+ * @done: Called on the server thread with the verified job
+ *
+ * Returns ERR_NONE if queued, ERR_IO if the pool is not running,
+ * ERR_PARAM for oversized input, or ERR_INTERNAL if the queue is full.
+ */
+int
+password_pool_submit(int client_socket, const char *username,
+                     const char *password,
+                     void (*done)(struct password_job *job))
+{
+    struct password_job *job;
+
+    if (started == 0) {
+        return ERR_IO;
+    }
+    if (!username || !password || !done ||
+        strlen(username) >= sizeof(job->username) ||
+        strlen(password) >= sizeof(job->password)) {
+        return ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (outstanding >= PASSWORD_QUEUE_MAX) {
+        pthread_mutex_unlock(&pool_lock);
+        return ERR_INTERNAL;
+    }
+    outstanding++;
+    pthread_mutex_unlock(&pool_lock);
+
+    job = calloc(1, sizeof(*job));
+    if (!job) {
+        pthread_mutex_lock(&pool_lock);
+        outstanding--;
+        pthread_mutex_unlock(&pool_lock);
+        return ERR_INTERNAL;
+    }
+    job->done = done;
+    job->client_socket = client_socket;
+    strcpy(job->username, username);
+    strcpy(job->password, password);
+
+    pthread_mutex_lock(&pool_lock);
+    if (queue_tail) {
+        queue_tail->next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+    pthread_cond_signal(&pool_ready);
+    pthread_mutex_unlock(&pool_lock);
+    return ERR_NONE;
+}
+
+/*
+ * password_pool_dispatch - Finish verified logins on the server thread
+ *
+ * Returns the number of jobs completed.
+ */
+long
+password_pool_dispatch(void)
+{
+    struct password_job *job;
+    struct password_job *next;
+    char drain[64];
+    long count;
+
+    if (wake_fds[0] < 0) {
+        return 0;
+    }
+    while (read(wake_fds[0], drain, sizeof(drain)) > 0) {
+        /* Wakeups carry no data */
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    job = done_head;
+    done_head = NULL;
+    pthread_mutex_unlock(&pool_lock);
+
+    count = 0;
+    for (; job; job = next) {
+        next = job->next;
+        job->done(job);
+        close(job->client_socket);
+        memset(job, 0, sizeof(*job));
+        free(job);
+        count++;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    outstanding -= (size_t)count;
+    pthread_mutex_unlock(&pool_lock);
+    return count;
+}
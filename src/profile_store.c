@@ -0,0 +1,510 @@
+/* filepath: src/profile_store.c */
+#include "../include/profile_store.h"
+#include "../include/buffer.h"
+#include "../include/diag.h"
+#include "../include/record_store.h"
+#include "../include/session.h"
+#include "../include/timer_wheel.h"
+#include "../include/web_server.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * User profiles, kept in memory behind an open-addressed index on
+ * username and persisted as one record per user in PROFILE_FILE.
+ * Updates change memory at once and are written out in batches: the
+ * whole file is rewritten to a temporary file and renamed over the old
+ * one, so readers of the file see either every update of a batch or
+ * none. A batch is written every PROFILE_FLUSH_INTERVAL seconds, when
+ * PROFILE_BATCH_MAX updates are pending, and at shutdown.
+ */
+#define PROFILE_FIELD_USERNAME "Username"
+#define PROFILE_FIELD_FULLNAME "Full_Name"
+#define PROFILE_FIELD_EMAIL "Email"
+#define PROFILE_FIELD_PROJECT "Project"
+
+static struct profile *profiles = NULL;
+static size_t *slots = NULL;            /* Profile index + 1; 0 is empty */
+static size_t slot_count = 0;
+static size_t profile_count = 0;
+static size_t pending = 0;              /* Updates not yet written */
+static int loaded = 0;
+static char store_path[256] = PROFILE_FILE;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timer flush_timer;
+
+static size_t
+profile_slot(const char *username)
+{
+    size_t i;
+
+    i = rec_hash(username, strlen(username), 0) & (slot_count - 1);
+    while (slots[i] && strcmp(profiles[slots[i] - 1].username, username) != 0) {
+        i = (i + 1) & (slot_count - 1);
+    }
+    return i;
+}
+
+/* Values are single lines that fit their field */
+static int
+value_valid(const char *value, size_t size)
+{
+    return strlen(value) < size && !strpbrk(value, "\r\n");
+}
+
+static int
+profile_valid(const struct profile *profile)
+{
+    return profile->username[0] != '\0' &&
+           value_valid(profile->username, sizeof(profile->username)) &&
+           value_valid(profile->fullname, sizeof(profile->fullname)) &&
+           value_valid(profile->email, sizeof(profile->email)) &&
+           value_valid(profile->project, sizeof(profile->project));
+}
+
+/* Insert or replace in memory; profile_lock is held and the store loaded */
+static int
+profile_apply(const struct profile *profile)
+{
+    size_t slot;
+
+    if (!profile_valid(profile)) {
+        return ERR_PARAM;
+    }
+    slot = profile_slot(profile->username);
+    if (!slots[slot]) {
+        if (profile_count >= PROFILE_MAX) {
+            return ERR_INTERNAL;
+        }
+        slots[slot] = ++profile_count;
+    }
+    profiles[slots[slot] - 1] = *profile;
+    pending++;
+    return ERR_NONE;
+}
+
+static void
+copy_value(char *out, size_t size, const char *value)
+{
+    out[0] = '\0';
+    if (value) {
+        strncpy(out, value, size - 1);
+        out[size - 1] = '\0';
+    }
+}
+
+/* Read PROFILE_FILE into memory; profile_lock is held */
+static int
+store_load(void)
+{
+    struct rec_record *record;
+    struct profile profile;
+    char *data;
+    char *p;
+    char *end;
+    size_t size;
+
+    profiles = calloc(PROFILE_MAX, sizeof(*profiles));
+    slot_count = PROFILE_MAX * 2;
+    slots = calloc(slot_count, sizeof(*slots));
+    if (!profiles || !slots) {
+        free(profiles);
+        free(slots);
+        profiles = NULL;
+        slots = NULL;
+        return ERR_INTERNAL;
+    }
+    profile_count = 0;
+    pending = 0;
+    loaded = 1;
+
+    /* No file yet is an empty store */
+    data = rec_read_file(store_path, &size);
+    if (!data) {
+        return ERR_NONE;
+    }
+
+    for (p = data; *p; p = end) {
+        end = strstr(p, "\n\n");
+        end = end ? end + 2 : p + strlen(p);
+        record = rec_parse_record(p, (size_t)(end - p));
+        if (!record) {
+            continue;
+        }
+        copy_value(profile.username, sizeof(profile.username),
+                   rec_get(record, PROFILE_FIELD_USERNAME));
+        copy_value(profile.fullname, sizeof(profile.fullname),
+                   rec_get(record, PROFILE_FIELD_FULLNAME));
+        copy_value(profile.email, sizeof(profile.email),
+                   rec_get(record, PROFILE_FIELD_EMAIL));
+        copy_value(profile.project, sizeof(profile.project),
+                   rec_get(record, PROFILE_FIELD_PROJECT));
+        free(record);
+        if (profile.username[0] != '\0') {
+            profile_apply(&profile);
+        }
+    }
+    free(data);
+    pending = 0;
+    return ERR_NONE;
+}
+
+static int
+store_ensure(void)
+{
+    return loaded ? ERR_NONE : store_load();
+}
+
+static void
+store_drop(void)
+{
+    free(profiles);
+    free(slots);
+    profiles = NULL;
+    slots = NULL;
+    slot_count = 0;
+    profile_count = 0;
+    pending = 0;
+    loaded = 0;
+}
+
+static int
+append_field(struct buffer *out, const char *name, const char *value)
+{
+    if (value[0] == '\0') {
+        return 0;
+    }
+    return buffer_appendf(out, "%s: %s\n", name, value);
+}
+
+/* Write every profile to a temporary file and rename it into place */
+static int
+store_write(void)
+{
+    struct buffer out;
+    char temp_path[sizeof(store_path) + 4];
+    size_t i;
+    FILE *fp;
+    int result;
+
+    buffer_init(&out);
+    result = buffer_append_str(&out, "%rec: Profile\n%key: "
+                               PROFILE_FIELD_USERNAME "\n");
+    for (i = 0; i < profile_count && result == 0; i++) {
+        result = buffer_append_str(&out, "\n");
+        if (result == 0) {
+            result = append_field(&out, PROFILE_FIELD_USERNAME,
+                                  profiles[i].username);
+        }
+        if (result == 0) {
+            result = append_field(&out, PROFILE_FIELD_FULLNAME,
+                                  profiles[i].fullname);
+        }
+        if (result == 0) {
+            result = append_field(&out, PROFILE_FIELD_EMAIL, profiles[i].email);
+        }
+        if (result == 0) {
+            result = append_field(&out, PROFILE_FIELD_PROJECT,
+                                  profiles[i].project);
+        }
+    }
+    if (result != 0) {
+        buffer_free(&out);
+        return ERR_INTERNAL;
+    }
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", store_path);
+    fp = fopen(temp_path, "w");
+    if (!fp) {
+        buffer_free(&out);
+        return ERR_IO;
+    }
+    result = fwrite(out.data, 1, out.len, fp) == out.len &&
+             fflush(fp) == 0 && fsync(fileno(fp)) == 0 ? ERR_NONE : ERR_IO;
+    if (fclose(fp) != 0) {
+        result = ERR_IO;
+    }
+    buffer_free(&out);
+
+    if (result == ERR_NONE && rename(temp_path, store_path) != 0) {
+        result = ERR_IO;
+    }
+    if (result != ERR_NONE) {
+        remove(temp_path);
+    }
+    return result;
+}
+
+/* Write the pending batch, if any; profile_lock is held */
+static int
+flush_locked(void)
+{
+    int result;
+
+    if (!loaded || pending == 0) {
+        return ERR_NONE;
+    }
+    result = store_write();
+    if (result == ERR_NONE) {
+        pending = 0;
+    }
+    return result;
+}
+
+/* Use a different store file; it is read again on next use */
+int
+profile_store_init(const char *path)
+{
+    size_t len;
+
+    if (!path) {
+        return ERR_PARAM;
+    }
+    len = strlen(path);
+    if (len >= sizeof(store_path)) {
+        return ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    flush_locked();
+    store_drop();
+    memcpy(store_path, path, len + 1);
+    pthread_mutex_unlock(&profile_lock);
+    return ERR_NONE;
+}
+
+static void
+flush_tick(void *arg)
+{
+    UNUSED(arg);
+    profile_store_flush();
+    timer_add(&flush_timer, PROFILE_FLUSH_INTERVAL);
+}
+
+/* Fold in any old updates log and write batches from the timer wheel */
+void
+profile_store_start(void)
+{
+    long imported;
+
+    imported = profile_store_import(PROFILE_UPDATES_LOG);
+    if (imported > 0) {
+        DIAG(LOG_INFO, ("Imported %ld profile updates from %s\n", imported,
+                        PROFILE_UPDATES_LOG));
+    }
+    timer_init(&flush_timer, flush_tick, NULL);
+    timer_add(&flush_timer, PROFILE_FLUSH_INTERVAL);
+}
+
+/* Write what is pending and release the store */
+void
+profile_store_shutdown(void)
+{
+    if (timer_pending(&flush_timer)) {
+        timer_del(&flush_timer);
+    }
+    pthread_mutex_lock(&profile_lock);
+    flush_locked();
+    store_drop();
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Copy a user's profile; ERR_NOTFOUND if there is none */
+int
+profile_store_get(const char *username, struct profile *profile)
+{
+    size_t slot;
+    int result;
+
+    if (!username || !profile || username[0] == '\0') {
+        return ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    result = store_ensure();
+    if (result == ERR_NONE) {
+        slot = profile_slot(username);
+        result = ERR_NOTFOUND;
+        if (slots[slot]) {
+            *profile = profiles[slots[slot] - 1];
+            result = ERR_NONE;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return result;
+}
+
+/*
+ * profile_store_update - Replace a user's profile
+ * @profile: New profile; every value a single line
+ *
+ * The change is visible to lookups at once and written with the next
+ * batch. Returns ERR_NONE, ERR_PARAM, or ERR_INTERNAL if the store is
+ * full.
+ */
+int
+profile_store_update(const struct profile *profile)
+{
+    int result;
+
+    if (!profile) {
+        return ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&profile_lock);
+    result = store_ensure();
+    if (result == ERR_NONE) {
+        result = profile_apply(profile);
+    }
+    if (result == ERR_NONE && pending >= PROFILE_BATCH_MAX) {
+        flush_locked();
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return result;
+}
+
+/* Write the pending batch now; ERR_IO if it could not be written */
+int
+profile_store_flush(void)
+{
+    int result;
+
+    pthread_mutex_lock(&profile_lock);
+    result = flush_locked();
+    pthread_mutex_unlock(&profile_lock);
+    return result;
+}
+
+/* Next '|' separated field of an updates log line, URL-decoded */
+static char *
+log_field(char **cursor, char *out, size_t size)
+{
+    char *start;
+    char *end;
+
+    start = *cursor;
+    end = start + strcspn(start, "|");
+    *cursor = *end ? end + 1 : end;
+    url_decode(start, (size_t)(end - start), out, size);
+    return out;
+}
+
+/*
+ * profile_store_import - Fold an updates log into the store
+ * @log_path: Log of "username|fullname|email|project" lines
+ *
+ * The log was written before profiles were stored, with values as the
+ * browser encoded them. Lines apply in order, so the last update of a
+ * user wins. Once the store is written the log is renamed with
+ * PROFILE_IMPORTED_SUFFIX, so it is only imported once.
+ *
+ * Returns the number of updates applied, 0 if there is no log, or
+ * ERR_IO or ERR_INTERNAL.
+ */
+long
+profile_store_import(const char *log_path)
+{
+    struct profile profile;
+    char imported_path[512];
+    char line[1024];
+    char *cursor;
+    long count;
+    FILE *fp;
+    int result;
+
+    if (!log_path) {
+        return ERR_PARAM;
+    }
+    fp = fopen(log_path, "r");
+    if (!fp) {
+        return 0;
+    }
+
+    count = 0;
+    pthread_mutex_lock(&profile_lock);
+    result = store_ensure();
+    while (result == ERR_NONE && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        cursor = line;
+        log_field(&cursor, profile.username, sizeof(profile.username));
+        log_field(&cursor, profile.fullname, sizeof(profile.fullname));
+        log_field(&cursor, profile.email, sizeof(profile.email));
+        log_field(&cursor, profile.project, sizeof(profile.project));
+        if (profile_apply(&profile) == ERR_NONE) {
+            count++;
+        }
+    }
+    fclose(fp);
+    if (result == ERR_NONE) {
+        result = flush_locked();
+    }
+    pthread_mutex_unlock(&profile_lock);
+    if (result != ERR_NONE) {
+        return result;
+    }
+
+    snprintf(imported_path, sizeof(imported_path), "%s" PROFILE_IMPORTED_SUFFIX,
+             log_path);
+    if (rename(log_path, imported_path) != 0) {
+        return ERR_IO;
+    }
+    return count;
+}
+
+/*
+ * handle_profile_request - Serve one user's profile as JSON
+ * @client_socket: Socket to send response
+ * @uri: Request URI, with an optional username= parameter
+ * @request: Raw request; without username= its session's user is used
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_profile_request(int client_socket, const char *uri, const char *request)
+{
+    struct profile profile;
+    struct buffer body;
+    char username[sizeof(profile.username)];
+    const char *query;
+    int result;
+
+    query = strchr(uri, '?');
+    if (!query || !get_query_param(query + 1, "username", username,
+                                   sizeof(username)) || username[0] == '\0') {
+        username[0] = '\0';
+        session_from_request(request, username, sizeof(username));
+    }
+    if (username[0] == '\0') {
+        return send_error_json(client_socket, "400 Bad Request",
+                               "Missing username");
+    }
+
+    result = profile_store_get(username, &profile);
+    if (result == ERR_NOTFOUND || result == ERR_PARAM) {
+        return send_error_json(client_socket, "404 Not Found",
+                               "No profile for user");
+    }
+
+    buffer_init(&body);
+    if (result != ERR_NONE ||
+        buffer_append_str(&body, "{\"username\":") != 0 ||
+        buffer_append_json(&body, profile.username) != 0 ||
+        buffer_append_str(&body, ",\"fullname\":") != 0 ||
+        buffer_append_json(&body, profile.fullname) != 0 ||
+        buffer_append_str(&body, ",\"email\":") != 0 ||
+        buffer_append_json(&body, profile.email) != 0 ||
+        buffer_append_str(&body, ",\"project\":") != 0 ||
+        buffer_append_json(&body, profile.project) != 0 ||
+        buffer_append_str(&body, "}") != 0) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", "application/json",
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
@@ -0,0 +1,1369 @@
+/* filepath: src/query.c */
+#include "../include/query.h"
+#include "../include/archive.h"
+#include "../include/buffer.h"
+#include "../include/result_cache.h"
+#include "../include/web_server.h"
+#include <ctype.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Selection expressions follow the recsel -e subset:
+ *
+ *   expr    := or ['?' expr ':' expr]
+ *   or      := and {('||' | '=>') and}
+ *   and     := compare {'&&' compare}
+ *   compare := sum {('=' | '!=' | '<' | '>' | '<=' | '>=' |
+ *                    '<<' | '>>' | '==' | '~') sum}
+ *   sum     := product {('+' | '-') product}
+ *   product := unary {('*' | '/' | '%') unary}
+ *   unary   := ('!' | '-') unary | primary
+ *   primary := number | 'string' | "string" | Field | '#' Field | '(' expr ')'
+ *
+ * '<<', '>>' and '==' compare dates, '~' matches a POSIX extended regex.
+ * The parser builds a small syntax tree which is compiled to bytecode for
+ * a stack machine; plans are cached by expression text.
+ */
+
+/* Tokens */
+#define TOK_END 0
+#define TOK_NUMBER 1
+#define TOK_STRING 2
+#define TOK_NAME 3
+#define TOK_HASH 4
+#define TOK_LPAREN 5
+#define TOK_RPAREN 6
+#define TOK_QUESTION 7
+#define TOK_COLON 8
+#define TOK_OR 9
+#define TOK_IMPLIES 10
+#define TOK_AND 11
+#define TOK_NOT 12
+#define TOK_PLUS 13
+#define TOK_MINUS 14
+#define TOK_STAR 15
+#define TOK_SLASH 16
+#define TOK_PERCENT 17
+#define TOK_EQ 18
+#define TOK_NE 19
+#define TOK_LT 20
+#define TOK_GT 21
+#define TOK_LE 22
+#define TOK_GE 23
+#define TOK_BEFORE 24
+#define TOK_AFTER 25
+#define TOK_SAMEDAY 26
+#define TOK_MATCH 27
+#define TOK_ERROR 28
+
+/* Opcodes; operands are 16-bit little-endian */
+#define QOP_END 0
+#define QOP_FIELD 1         /* field id: push first value or "" */
+#define QOP_COUNT 2         /* field id: push number of occurrences */
+#define QOP_STRING 3        /* constant index */
+#define QOP_NUMBER 4        /* constant index */
+#define QOP_FIELD_EQ 5      /* compare index: field = non-numeric literal */
+#define QOP_EQ 6
+#define QOP_NE 7
+#define QOP_LT 8
+#define QOP_GT 9
+#define QOP_LE 10
+#define QOP_GE 11
+#define QOP_BEFORE 12
+#define QOP_AFTER 13
+#define QOP_SAMEDAY 14
+#define QOP_MATCH 15        /* regex index */
+#define QOP_ADD 16
+#define QOP_SUB 17
+#define QOP_MUL 18
+#define QOP_DIV 19
+#define QOP_MOD 20
+#define QOP_NEG 21
+#define QOP_NOT 22
+#define QOP_BOOL 23
+#define QOP_AND 24          /* target: jump keeping a false top, else pop */
+#define QOP_OR 25           /* target: jump keeping a true top, else pop */
+#define QOP_JFALSE 26       /* target: pop, jump if false */
+#define QOP_JUMP 27         /* target */
+
+/* Syntax tree nodes that have no opcode of their own */
+#define NODE_IMPLIES 100
+#define NODE_TERNARY 101
+
+/* A fused "Field = 'literal'" test; codes are resolved per run */
+struct query_compare {
+    unsigned long field;
+    unsigned long string;
+};
+
+struct query_plan {
+    char *text;
+    unsigned long hash;
+    unsigned long last_used;
+    unsigned long field_names;
+    unsigned long unresolved;
+    struct buffer code;
+    char *strings[QUERY_MAX_CONSTANTS];
+    double numbers[QUERY_MAX_CONSTANTS];
+    regex_t regexes[QUERY_MAX_REGEXES];
+    struct query_compare compares[QUERY_MAX_CONSTANTS];
+    size_t pushdown[QUERY_MAX_PUSHDOWN];
+    size_t nstrings;
+    size_t nnumbers;
+    size_t nregexes;
+    size_t ncompares;
+    size_t npushdown;
+};
+
+struct query_node {
+    long op;
+    long a;
+    long b;
+    long c;
+};
+
+struct query_compiler {
+    struct query_node nodes[QUERY_MAX_NODES];
+    struct query_plan *plan;
+    const char *text;
+    const char *p;
+    const char *tok_start;
+    size_t tok_len;
+    double number;
+    long tok;
+    long nnodes;
+    long nesting;
+    long depth;
+    long max_depth;
+    long error;
+};
+
+/* Evaluation stack entry: a string, or a number when string is NULL */
+struct query_value {
+    double number;
+    const char *string;
+};
+
+/* Plan cache and counters; only touched from the main loop */
+static struct query_plan *plan_cache[QUERY_PLAN_CACHE_SIZE];
+static unsigned long plan_clock = 0;
+static unsigned long plan_hits = 0;
+static unsigned long plan_misses = 0;
+static unsigned long plan_evictions = 0;
+static unsigned long runs_by_access[3];
+
+static long parse_expr(struct query_compiler *c);
+
+static void
+fail(struct query_compiler *c)
+{
+    if (c->error < 0) {
+        c->error = (long)(c->tok_start - c->text);
+    }
+}
+
+static void
+next_token(struct query_compiler *c)
+{
+    static const struct {
+        const char *text;
+        long tok;
+    } operators[] = {
+        { "||", TOK_OR }, { "&&", TOK_AND }, { "=>", TOK_IMPLIES },
+        { "!=", TOK_NE }, { "<=", TOK_LE }, { ">=", TOK_GE },
+        { "<<", TOK_BEFORE }, { ">>", TOK_AFTER }, { "==", TOK_SAMEDAY },
+        { "(", TOK_LPAREN }, { ")", TOK_RPAREN }, { "?", TOK_QUESTION },
+        { ":", TOK_COLON }, { "!", TOK_NOT }, { "+", TOK_PLUS },
+        { "-", TOK_MINUS }, { "*", TOK_STAR }, { "/", TOK_SLASH },
+        { "%", TOK_PERCENT }, { "=", TOK_EQ }, { "<", TOK_LT },
+        { ">", TOK_GT }, { "~", TOK_MATCH }, { "#", TOK_HASH },
+        { NULL, TOK_ERROR }
+    };
+    const char *p;
+    char *end;
+    size_t len;
+    int i;
+
+    p = c->p;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    c->tok_start = p;
+
+    if (!*p) {
+        c->tok = TOK_END;
+        c->tok_len = 0;
+    } else if (isdigit((unsigned char)*p) ||
+               (*p == '.' && isdigit((unsigned char)p[1]))) {
+        c->number = strtod(p, &end);
+        c->tok = TOK_NUMBER;
+        c->tok_len = (size_t)(end - p);
+    } else if (isalpha((unsigned char)*p) || *p == '_') {
+        for (len = 1; isalnum((unsigned char)p[len]) || p[len] == '_'; len++) {
+            continue;
+        }
+        c->tok = TOK_NAME;
+        c->tok_len = len;
+    } else if (*p == '\'' || *p == '"') {
+        for (len = 1; p[len] && p[len] != *p; len++) {
+            if (p[len] == '\\' && p[len + 1]) {
+                len++;
+            }
+        }
+        c->tok = p[len] ? TOK_STRING : TOK_ERROR;
+        c->tok_len = p[len] ? len + 1 : len;
+    } else {
+        c->tok = TOK_ERROR;
+        c->tok_len = 1;
+        for (i = 0; operators[i].text; i++) {
+            len = strlen(operators[i].text);
+            if (strncmp(p, operators[i].text, len) == 0) {
+                c->tok = operators[i].tok;
+                c->tok_len = len;
+                break;
+            }
+        }
+    }
+    c->p = p + c->tok_len;
+}
+
+static long
+add_node(struct query_compiler *c, long op, long a, long b, long cc)
+{
+    struct query_node *node;
+
+    if (a < 0 || b < 0 || cc < 0 || c->error >= 0) {
+        fail(c);
+        return -1;
+    }
+    if (c->nnodes >= QUERY_MAX_NODES) {
+        fail(c);
+        return -1;
+    }
+    node = &c->nodes[c->nnodes];
+    node->op = op;
+    node->a = a;
+    node->b = b;
+    node->c = cc;
+    return c->nnodes++;
+}
+
+/* Copy the current string token without its quotes and escapes */
+static long
+add_string(struct query_compiler *c)
+{
+    struct query_plan *plan;
+    const char *src;
+    char *copy;
+    size_t len;
+    size_t i;
+    size_t n;
+
+    plan = c->plan;
+    if (plan->nstrings >= QUERY_MAX_CONSTANTS) {
+        fail(c);
+        return -1;
+    }
+    src = c->tok_start + 1;
+    len = c->tok_len - 2;
+    copy = malloc(len + 1);
+    if (!copy) {
+        fail(c);
+        return -1;
+    }
+    for (i = 0, n = 0; i < len; i++) {
+        if (src[i] == '\\' && i + 1 < len) {
+            i++;
+        }
+        copy[n++] = src[i];
+    }
+    copy[n] = '\0';
+    plan->strings[plan->nstrings] = copy;
+    return (long)plan->nstrings++;
+}
+
+static long
+parse_primary(struct query_compiler *c)
+{
+    struct query_plan *plan;
+    char name[REC_NAME_MAX];
+    long node;
+    long op;
+    int id;
+
+    plan = c->plan;
+    switch (c->tok) {
+    case TOK_NUMBER:
+        if (plan->nnumbers >= QUERY_MAX_CONSTANTS) {
+            fail(c);
+            return -1;
+        }
+        plan->numbers[plan->nnumbers] = c->number;
+        next_token(c);
+        return add_node(c, QOP_NUMBER, (long)plan->nnumbers++, 0, 0);
+
+    case TOK_STRING:
+        node = add_string(c);
+        next_token(c);
+        return add_node(c, QOP_STRING, node, 0, 0);
+
+    case TOK_HASH:
+    case TOK_NAME:
+        op = c->tok == TOK_HASH ? QOP_COUNT : QOP_FIELD;
+        if (c->tok == TOK_HASH) {
+            next_token(c);
+        }
+        if (c->tok != TOK_NAME || c->tok_len >= sizeof(name)) {
+            fail(c);
+            return -1;
+        }
+        memcpy(name, c->tok_start, c->tok_len);
+        name[c->tok_len] = '\0';
+        next_token(c);
+
+        /* Names no record uses yet are absent (empty, count 0) for now */
+        id = rec_field_lookup(name);
+        if (id < 0) {
+            plan->unresolved = 1;
+            if (op == QOP_COUNT) {
+                if (plan->nnumbers >= QUERY_MAX_CONSTANTS) {
+                    fail(c);
+                    return -1;
+                }
+                plan->numbers[plan->nnumbers] = 0;
+                return add_node(c, QOP_NUMBER, (long)plan->nnumbers++, 0, 0);
+            }
+            if (plan->nstrings >= QUERY_MAX_CONSTANTS ||
+                !(plan->strings[plan->nstrings] = calloc(1, 1))) {
+                fail(c);
+                return -1;
+            }
+            return add_node(c, QOP_STRING, (long)plan->nstrings++, 0, 0);
+        }
+        return add_node(c, op, id, 0, 0);
+
+    case TOK_LPAREN:
+        if (++c->nesting > QUERY_STACK_MAX) {
+            fail(c);
+            return -1;
+        }
+        next_token(c);
+        node = parse_expr(c);
+        if (c->tok != TOK_RPAREN) {
+            fail(c);
+            return -1;
+        }
+        c->nesting--;
+        next_token(c);
+        return node;
+
+    default:
+        fail(c);
+        return -1;
+    }
+}
+
+static long
+parse_unary(struct query_compiler *c)
+{
+    long op;
+
+    if (c->tok == TOK_NOT || c->tok == TOK_MINUS) {
+        op = c->tok == TOK_NOT ? QOP_NOT : QOP_NEG;
+        if (++c->nesting > QUERY_STACK_MAX) {
+            fail(c);
+            return -1;
+        }
+        next_token(c);
+        op = add_node(c, op, parse_unary(c), 0, 0);
+        c->nesting--;
+        return op;
+    }
+    return parse_primary(c);
+}
+
+static long
+parse_product(struct query_compiler *c)
+{
+    long left;
+    long op;
+
+    left = parse_unary(c);
+    while (c->tok == TOK_STAR || c->tok == TOK_SLASH || c->tok == TOK_PERCENT) {
+        op = c->tok == TOK_STAR ? QOP_MUL : c->tok == TOK_SLASH ? QOP_DIV : QOP_MOD;
+        next_token(c);
+        left = add_node(c, op, left, parse_unary(c), 0);
+    }
+    return left;
+}
+
+static long
+parse_sum(struct query_compiler *c)
+{
+    long left;
+    long op;
+
+    left = parse_product(c);
+    while (c->tok == TOK_PLUS || c->tok == TOK_MINUS) {
+        op = c->tok == TOK_PLUS ? QOP_ADD : QOP_SUB;
+        next_token(c);
+        left = add_node(c, op, left, parse_product(c), 0);
+    }
+    return left;
+}
+
+static long
+parse_compare(struct query_compiler *c)
+{
+    struct query_plan *plan;
+    char *pattern;
+    long left;
+    long op;
+
+    plan = c->plan;
+    left = parse_sum(c);
+    while (c->tok >= TOK_EQ && c->tok <= TOK_MATCH) {
+        op = QOP_EQ + (c->tok - TOK_EQ);
+        next_token(c);
+        if (op != QOP_MATCH) {
+            left = add_node(c, op, left, parse_sum(c), 0);
+            continue;
+        }
+
+        /* The pattern must be a literal so it is compiled once */
+        if (c->tok != TOK_STRING || plan->nregexes >= QUERY_MAX_REGEXES ||
+            add_string(c) < 0) {
+            fail(c);
+            return -1;
+        }
+        pattern = plan->strings[--plan->nstrings];
+        if (regcomp(&plan->regexes[plan->nregexes], pattern,
+                    REG_EXTENDED | REG_NOSUB) != 0) {
+            free(pattern);
+            fail(c);
+            return -1;
+        }
+        free(pattern);
+        next_token(c);
+        left = add_node(c, QOP_MATCH, left, (long)plan->nregexes++, 0);
+    }
+    return left;
+}
+
+static long
+parse_and(struct query_compiler *c)
+{
+    long left;
+
+    left = parse_compare(c);
+    while (c->tok == TOK_AND) {
+        next_token(c);
+        left = add_node(c, QOP_AND, left, parse_compare(c), 0);
+    }
+    return left;
+}
+
+static long
+parse_or(struct query_compiler *c)
+{
+    long left;
+    long op;
+
+    left = parse_and(c);
+    while (c->tok == TOK_OR || c->tok == TOK_IMPLIES) {
+        op = c->tok == TOK_OR ? QOP_OR : NODE_IMPLIES;
+        next_token(c);
+        left = add_node(c, op, left, parse_and(c), 0);
+    }
+    return left;
+}
+
+static long
+parse_expr(struct query_compiler *c)
+{
+    long cond;
+    long then;
+
+    cond = parse_or(c);
+    if (c->tok != TOK_QUESTION) {
+        return cond;
+    }
+    if (++c->nesting > QUERY_STACK_MAX) {
+        fail(c);
+        return -1;
+    }
+    next_token(c);
+    then = parse_expr(c);
+    if (c->tok != TOK_COLON) {
+        fail(c);
+        return -1;
+    }
+    next_token(c);
+    cond = add_node(c, NODE_TERNARY, cond, then, parse_expr(c));
+    c->nesting--;
+    return cond;
+}
+
+/* Append one opcode; effect is its net change of the stack depth */
+static void
+emit_op(struct query_compiler *c, int op, long effect)
+{
+    unsigned char byte;
+
+    byte = (unsigned char)op;
+    if (buffer_append(&c->plan->code, (const char *)&byte, 1) != 0) {
+        fail(c);
+    }
+    c->depth += effect;
+    if (c->depth > c->max_depth) {
+        c->max_depth = c->depth;
+    }
+}
+
+static size_t
+emit_u16(struct query_compiler *c, size_t value)
+{
+    unsigned char bytes[2];
+    size_t at;
+
+    at = c->plan->code.len;
+    bytes[0] = (unsigned char)(value & 0xff);
+    bytes[1] = (unsigned char)((value >> 8) & 0xff);
+    if (value > 0xffff ||
+        buffer_append(&c->plan->code, (const char *)bytes, 2) != 0) {
+        fail(c);
+    }
+    return at;
+}
+
+/* Point a forward jump at the current end of the program */
+static void
+patch_u16(struct query_compiler *c, size_t at)
+{
+    size_t target;
+
+    target = c->plan->code.len;
+    if (target > 0xffff || !c->plan->code.data) {
+        fail(c);
+        return;
+    }
+    c->plan->code.data[at] = (char)(target & 0xff);
+    c->plan->code.data[at + 1] = (char)((target >> 8) & 0xff);
+}
+
+static int
+is_number_text(const char *text, double *value)
+{
+    char *end;
+
+    if (!text[0]) {
+        return 0;
+    }
+    *value = strtod(text, &end);
+    return *end == '\0';
+}
+
+/*
+ * "Field = 'text'" with a non-numeric literal is always a string test,
+ * so it can compare dictionary codes and serve as an index predicate.
+ */
+static long
+fused_compare(struct query_compiler *c, const struct query_node *node)
+{
+    const struct query_node *left;
+    const struct query_node *right;
+    const struct query_node *tmp;
+    struct query_plan *plan;
+    double unused;
+
+    plan = c->plan;
+    left = &c->nodes[node->a];
+    right = &c->nodes[node->b];
+    if (left->op == QOP_STRING) {
+        tmp = left;
+        left = right;
+        right = tmp;
+    }
+    if (left->op != QOP_FIELD || right->op != QOP_STRING ||
+        is_number_text(plan->strings[right->a], &unused) ||
+        plan->ncompares >= QUERY_MAX_CONSTANTS) {
+        return -1;
+    }
+    plan->compares[plan->ncompares].field = (unsigned long)left->a;
+    plan->compares[plan->ncompares].string = (unsigned long)right->a;
+    return (long)plan->ncompares++;
+}
+
+/* Generate code for a node; conjunct is set along the top-level && chain */
+static void
+generate(struct query_compiler *c, long index, int conjunct)
+{
+    const struct query_node *node;
+    struct query_plan *plan;
+    size_t jump;
+    size_t skip;
+    long compare;
+
+    node = &c->nodes[index];
+    plan = c->plan;
+    switch (node->op) {
+    case QOP_FIELD:
+    case QOP_COUNT:
+    case QOP_STRING:
+    case QOP_NUMBER:
+        emit_op(c, (int)node->op, 1);
+        emit_u16(c, (size_t)node->a);
+        break;
+
+    case QOP_EQ:
+    case QOP_NE:
+        compare = fused_compare(c, node);
+        if (compare >= 0) {
+            emit_op(c, QOP_FIELD_EQ, 1);
+            emit_u16(c, (size_t)compare);
+            if (node->op == QOP_NE) {
+                emit_op(c, QOP_NOT, 0);
+            } else if (conjunct && plan->npushdown < QUERY_MAX_PUSHDOWN &&
+                       plan->strings[plan->compares[compare].string][0]) {
+                plan->pushdown[plan->npushdown++] = (size_t)compare;
+            }
+            break;
+        }
+        generate(c, node->a, 0);
+        generate(c, node->b, 0);
+        emit_op(c, (int)node->op, -1);
+        break;
+
+    case QOP_MATCH:
+        generate(c, node->a, 0);
+        emit_op(c, QOP_MATCH, 0);
+        emit_u16(c, (size_t)node->b);
+        break;
+
+    case QOP_NOT:
+    case QOP_NEG:
+        generate(c, node->a, 0);
+        emit_op(c, (int)node->op, 0);
+        break;
+
+    case QOP_AND:
+    case QOP_OR:
+    case NODE_IMPLIES:
+        generate(c, node->a, conjunct && node->op == QOP_AND);
+        if (node->op == NODE_IMPLIES) {
+            emit_op(c, QOP_NOT, 0);
+        }
+        emit_op(c, node->op == QOP_AND ? QOP_AND : QOP_OR, -1);
+        jump = emit_u16(c, 0);
+        generate(c, node->b, conjunct && node->op == QOP_AND);
+        emit_op(c, QOP_BOOL, 0);
+        patch_u16(c, jump);
+        break;
+
+    case NODE_TERNARY:
+        generate(c, node->a, 0);
+        emit_op(c, QOP_JFALSE, -1);
+        skip = emit_u16(c, 0);
+        generate(c, node->b, 0);
+        emit_op(c, QOP_JUMP, -1);
+        jump = emit_u16(c, 0);
+        patch_u16(c, skip);
+        generate(c, node->c, 0);
+        patch_u16(c, jump);
+        break;
+
+    default:
+        generate(c, node->a, 0);
+        generate(c, node->b, 0);
+        emit_op(c, (int)node->op, -1);
+        break;
+    }
+}
+
+static void
+plan_free(struct query_plan *plan)
+{
+    size_t i;
+
+    if (!plan) {
+        return;
+    }
+    for (i = 0; i < plan->nstrings; i++) {
+        free(plan->strings[i]);
+    }
+    for (i = 0; i < plan->nregexes; i++) {
+        regfree(&plan->regexes[i]);
+    }
+    buffer_free(&plan->code);
+    free(plan->text);
+    free(plan);
+}
+
+static struct query_plan *
+plan_build(const char *text, size_t len, unsigned long hash, size_t *error_at)
+{
+    struct query_compiler *c;
+    struct query_plan *plan;
+    long root;
+
+    c = calloc(1, sizeof(*c));
+    plan = calloc(1, sizeof(*plan));
+    if (!c || !plan || !(plan->text = malloc(len + 1))) {
+        free(c);
+        free(plan);
+        *error_at = 0;
+        return NULL;
+    }
+    memcpy(plan->text, text, len + 1);
+    plan->hash = hash;
+    plan->field_names = rec_field_count();
+    buffer_init(&plan->code);
+
+    c->plan = plan;
+    c->text = plan->text;
+    c->p = plan->text;
+    c->error = -1;
+    next_token(c);
+    root = parse_expr(c);
+    if (root >= 0 && c->tok != TOK_END) {
+        fail(c);
+    }
+    if (c->error < 0) {
+        generate(c, root, 1);
+        emit_op(c, QOP_END, 0);
+        if (c->max_depth > QUERY_STACK_MAX) {
+            c->tok_start = c->text;
+            fail(c);
+        }
+    }
+
+    if (c->error >= 0) {
+        *error_at = (size_t)c->error;
+        plan_free(plan);
+        plan = NULL;
+    }
+    free(c);
+    return plan;
+}
+
+/*
+ * query_compile - Compile a selection expression, or reuse its plan
+ * @text: Expression text, the cache key
+ * @error_at: Set to the offset of the first bad token on failure
+ *
+ * A cached plan that mentioned field names unknown at the time is
+ * recompiled once new names have been seen. The plan stays valid until
+ * the next call. Returns NULL on a syntax error.
+ */
+struct query_plan *
+query_compile(const char *text, size_t *error_at)
+{
+    struct query_plan *plan;
+    unsigned long hash;
+    size_t len;
+    size_t slot;
+    size_t i;
+
+    *error_at = 0;
+    if (!text || (len = strlen(text)) > QUERY_EXPR_MAX) {
+        return NULL;
+    }
+    hash = rec_hash(text, len, 0);
+
+    for (i = 0; i < QUERY_PLAN_CACHE_SIZE; i++) {
+        plan = plan_cache[i];
+        if (plan && plan->hash == hash && strcmp(plan->text, text) == 0) {
+            break;
+        }
+    }
+    if (i < QUERY_PLAN_CACHE_SIZE &&
+        !(plan->unresolved && plan->field_names != rec_field_count())) {
+        plan_hits++;
+        plan->last_used = ++plan_clock;
+        return plan;
+    }
+
+    /* Replace a stale copy, else take an empty or the least recently used slot */
+    slot = i;
+    if (slot == QUERY_PLAN_CACHE_SIZE) {
+        slot = 0;
+        for (i = 0; i < QUERY_PLAN_CACHE_SIZE && plan_cache[slot]; i++) {
+            if (!plan_cache[i] || plan_cache[i]->last_used < plan_cache[slot]->last_used) {
+                slot = i;
+            }
+        }
+    }
+
+    plan_misses++;
+    plan = plan_build(text, len, hash, error_at);
+    if (!plan) {
+        return NULL;
+    }
+    if (plan_cache[slot]) {
+        plan_evictions++;
+        plan_free(plan_cache[slot]);
+    }
+    plan->last_used = ++plan_clock;
+    plan_cache[slot] = plan;
+    return plan;
+}
+
+void
+query_cache_clear(void)
+{
+    size_t i;
+
+    for (i = 0; i < QUERY_PLAN_CACHE_SIZE; i++) {
+        plan_free(plan_cache[i]);
+        plan_cache[i] = NULL;
+    }
+}
+
+static int
+value_number(const struct query_value *value, double *number)
+{
+    if (!value->string) {
+        *number = value->number;
+        return 1;
+    }
+    return is_number_text(value->string, number);
+}
+
+static const char *
+value_string(const struct query_value *value, char *scratch, size_t size)
+{
+    if (value->string) {
+        return value->string;
+    }
+    snprintf(scratch, size, "%g", value->number);
+    return scratch;
+}
+
+static int
+value_true(const struct query_value *value)
+{
+    if (value->string) {
+        return value->string[0] != '\0';
+    }
+    return value->number < 0 || value->number > 0;
+}
+
+/* Numbers compare numerically when both sides are numeric, else as text */
+static int
+value_compare(const struct query_value *a, const struct query_value *b)
+{
+    char scratch_a[32];
+    char scratch_b[32];
+    double x;
+    double y;
+
+    if (value_number(a, &x) && value_number(b, &y)) {
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+    return strcmp(value_string(a, scratch_a, sizeof(scratch_a)),
+                  value_string(b, scratch_b, sizeof(scratch_b)));
+}
+
+static int
+field_equals(const struct query_plan *plan, const struct rec_record *record,
+             size_t compare, unsigned short code)
+{
+    const struct rec_field *field;
+    const char *literal;
+
+    field = rec_find_field(record, (unsigned short)plan->compares[compare].field);
+    literal = plan->strings[plan->compares[compare].string];
+    if (!field) {
+        return literal[0] == '\0';
+    }
+    if (code) {
+        return field->code == code;
+    }
+
+    /* A literal missing from the dictionary equals no interned value */
+    return !field->code && strcmp(field->value, literal) == 0;
+}
+
+/* Run the program against one record */
+static int
+plan_matches(const struct query_plan *plan, const struct rec_record *record,
+             const unsigned short *codes)
+{
+    struct query_value stack[QUERY_STACK_MAX];
+    const struct rec_field *field;
+    const unsigned char *code;
+    char scratch[32];
+    double x;
+    double y;
+    size_t operand;
+    size_t pc;
+    size_t sp;
+    size_t i;
+    long day_a;
+    long day_b;
+    int result;
+    int op;
+
+    code = (const unsigned char *)plan->code.data;
+    pc = 0;
+    sp = 0;
+    for (;;) {
+        op = code[pc++];
+        operand = 0;
+        if (op < QOP_EQ || op == QOP_MATCH || op >= QOP_AND) {
+            if (op != QOP_END) {
+                operand = (size_t)code[pc] | ((size_t)code[pc + 1] << 8);
+                pc += 2;
+            }
+        }
+
+        switch (op) {
+        case QOP_END:
+            return sp > 0 && value_true(&stack[sp - 1]);
+
+        case QOP_FIELD:
+            field = rec_find_field(record, (unsigned short)operand);
+            stack[sp].string = field ? field->value : "";
+            stack[sp++].number = 0;
+            break;
+
+        case QOP_COUNT:
+            stack[sp].string = NULL;
+            stack[sp].number = 0;
+            for (i = 0; i < record->nfields; i++) {
+                if (record->fields[i].name == operand) {
+                    stack[sp].number += 1;
+                }
+            }
+            sp++;
+            break;
+
+        case QOP_STRING:
+            stack[sp].string = plan->strings[operand];
+            stack[sp++].number = 0;
+            break;
+
+        case QOP_NUMBER:
+            stack[sp].string = NULL;
+            stack[sp++].number = plan->numbers[operand];
+            break;
+
+        case QOP_FIELD_EQ:
+            stack[sp].string = NULL;
+            stack[sp++].number = field_equals(plan, record, operand, codes[operand]);
+            break;
+
+        case QOP_EQ:
+        case QOP_NE:
+        case QOP_LT:
+        case QOP_GT:
+        case QOP_LE:
+        case QOP_GE:
+            result = value_compare(&stack[sp - 2], &stack[sp - 1]);
+            sp--;
+            stack[sp - 1].string = NULL;
+            stack[sp - 1].number = op == QOP_EQ ? result == 0 :
+                                   op == QOP_NE ? result != 0 :
+                                   op == QOP_LT ? result < 0 :
+                                   op == QOP_GT ? result > 0 :
+                                   op == QOP_LE ? result <= 0 : result >= 0;
+            break;
+
+        case QOP_BEFORE:
+        case QOP_AFTER:
+        case QOP_SAMEDAY:
+            day_a = rec_parse_date(stack[sp - 2].string);
+            day_b = rec_parse_date(stack[sp - 1].string);
+            sp--;
+            stack[sp - 1].string = NULL;
+            stack[sp - 1].number = day_a != REC_DATE_INVALID &&
+                                   day_b != REC_DATE_INVALID &&
+                                   (op == QOP_BEFORE ? day_a < day_b :
+                                    op == QOP_AFTER ? day_a > day_b :
+                                    day_a == day_b);
+            break;
+
+        case QOP_MATCH:
+            result = regexec(&plan->regexes[operand],
+                             value_string(&stack[sp - 1], scratch, sizeof(scratch)),
+                             0, NULL, 0) == 0;
+            stack[sp - 1].string = NULL;
+            stack[sp - 1].number = result;
+            break;
+
+        case QOP_ADD:
+        case QOP_SUB:
+        case QOP_MUL:
+        case QOP_DIV:
+        case QOP_MOD:
+            if (!value_number(&stack[sp - 2], &x)) {
+                x = 0;
+            }
+            if (!value_number(&stack[sp - 1], &y)) {
+                y = 0;
+            }
+            sp--;
+            stack[sp - 1].string = NULL;
+            if (op == QOP_ADD) {
+                stack[sp - 1].number = x + y;
+            } else if (op == QOP_SUB) {
+                stack[sp - 1].number = x - y;
+            } else if (op == QOP_MUL) {
+                stack[sp - 1].number = x * y;
+            } else if (op == QOP_DIV) {
+                stack[sp - 1].number = y < 0 || y > 0 ? x / y : 0;
+            } else {
+                stack[sp - 1].number = (long)y ? (double)((long)x % (long)y) : 0;
+            }
+            break;
+
+        case QOP_NEG:
+            if (!value_number(&stack[sp - 1], &x)) {
+                x = 0;
+            }
+            stack[sp - 1].string = NULL;
+            stack[sp - 1].number = -x;
+            break;
+
+        case QOP_NOT:
+        case QOP_BOOL:
+            result = value_true(&stack[sp - 1]);
+            stack[sp - 1].string = NULL;
+            stack[sp - 1].number = op == QOP_NOT ? !result : result;
+            break;
+
+        case QOP_AND:
+        case QOP_OR:
+            result = value_true(&stack[sp - 1]);
+            if (result == (op == QOP_OR)) {
+                stack[sp - 1].string = NULL;
+                stack[sp - 1].number = result;
+                pc = operand;
+            } else {
+                sp--;
+            }
+            break;
+
+        case QOP_JFALSE:
+            if (!value_true(&stack[--sp])) {
+                pc = operand;
+            }
+            break;
+
+        case QOP_JUMP:
+            pc = operand;
+            break;
+
+        default:
+            return 0;
+        }
+    }
+}
+
+/*
+ * query_run - Select the records of a store that satisfy a plan
+ * @plan: Compiled plan
+ * @store: Store to search
+ * @visit: Called with each match in file order; a negative return stops
+ * @arg: Passed to visit
+ * @access: Set to QUERY_ACCESS_SCAN, _KEY or _INDEX
+ *
+ * Top-level "Field = 'text'" conjuncts are pushed down: an Obligation_Number
+ * test becomes a key lookup unless the key repeats, and a test on an
+ * interned field walks only that value's postings. The whole expression
+ * is still evaluated on every candidate.
+ *
+ * Returns the number of matches.
+ */
+long
+query_run(const struct query_plan *plan, struct rec_store *store,
+          int (*visit)(void *arg, const struct rec_record *record),
+          void *arg, int *access)
+{
+    unsigned short codes[QUERY_MAX_CONSTANTS];
+    const struct query_compare *compare;
+    const struct rec_index *index;
+    const struct rec_record *record;
+    const size_t *positions;
+    unsigned short code;
+    size_t begin;
+    size_t end;
+    size_t best;
+    size_t i;
+    long matches;
+    int key_field;
+
+    for (i = 0; i < plan->ncompares; i++) {
+        codes[i] = rec_dict_lookup((unsigned short)plan->compares[i].field,
+                                   plan->strings[plan->compares[i].string]);
+    }
+
+    matches = 0;
+    key_field = rec_field_lookup(REC_KEY_FIELD);
+    positions = NULL;
+    begin = 0;
+    end = store->count;
+    best = store->count + 1;
+    *access = QUERY_ACCESS_SCAN;
+
+    for (i = 0; i < plan->npushdown; i++) {
+        compare = &plan->compares[plan->pushdown[i]];
+        if ((long)compare->field == key_field &&
+            !rec_store_key_repeated(store, plan->strings[compare->string])) {
+            *access = QUERY_ACCESS_KEY;
+            runs_by_access[QUERY_ACCESS_KEY]++;
+            record = rec_store_find(store, plan->strings[compare->string]);
+            if (record && plan_matches(plan, record, codes)) {
+                matches++;
+                visit(arg, record);
+            }
+            return matches;
+        }
+
+        index = rec_store_index(store, (unsigned short)compare->field);
+        if (!index) {
+            continue;
+        }
+        code = codes[plan->pushdown[i]];
+        if (code == 0 || code > index->codes) {
+            *access = QUERY_ACCESS_INDEX;
+            positions = index->positions;
+            begin = 0;
+            end = 0;
+            break;
+        }
+        if (index->starts[code] - index->starts[code - 1] < best) {
+            *access = QUERY_ACCESS_INDEX;
+            positions = index->positions;
+            begin = index->starts[code - 1];
+            end = index->starts[code];
+            best = end - begin;
+        }
+    }
+    runs_by_access[*access]++;
+
+    for (i = begin; i < end; i++) {
+        record = store->records[positions ? positions[i] : i];
+        if (plan_matches(plan, record, codes)) {
+            matches++;
+            if (visit(arg, record) < 0) {
+                break;
+            }
+        }
+    }
+    return matches;
+}
+
+/* Plan cache and access path counters as a JSON object */
+int
+query_stats(struct buffer *out)
+{
+    size_t plans;
+    size_t i;
+
+    plans = 0;
+    for (i = 0; i < QUERY_PLAN_CACHE_SIZE; i++) {
+        plans += plan_cache[i] ? 1 : 0;
+    }
+    return buffer_appendf(out,
+                          "{\"plans\":%lu,\"hits\":%lu,\"misses\":%lu,"
+                          "\"evictions\":%lu,\"scans\":%lu,\"key_lookups\":%lu,"
+                          "\"index_scans\":%lu}",
+                          (unsigned long)plans, plan_hits, plan_misses,
+                          plan_evictions, runs_by_access[QUERY_ACCESS_SCAN],
+                          runs_by_access[QUERY_ACCESS_KEY],
+                          runs_by_access[QUERY_ACCESS_INDEX]);
+}
+
+/* Plan cache hits and misses so far */
+void
+query_plan_counts(unsigned long *hits, unsigned long *misses)
+{
+    *hits = plan_hits;
+    *misses = plan_misses;
+}
+
+/* Streams matches as JSON objects, up to an optional limit */
+struct query_output {
+    struct chunked_writer *writer;
+    struct buffer *json;
+    struct buffer *capture;         /* Copy of the body for the cache */
+    long limit;
+    long written;
+};
+
+/* Stream a piece of the body, keeping a copy while it still fits the cache */
+static int
+emit(struct query_output *out, const char *data, size_t len)
+{
+    if (out->capture->data &&
+        (out->capture->len + len > RESULT_CACHE_MAX_ENTRY ||
+         buffer_append(out->capture, data, len) != 0)) {
+        buffer_free(out->capture);
+    }
+    return chunked_write(out->writer, data, len);
+}
+
+static int
+write_record(void *arg, const struct rec_record *record)
+{
+    struct query_output *out;
+    size_t i;
+
+    out = arg;
+    if (out->limit >= 0 && out->written >= out->limit) {
+        return 0;
+    }
+
+    buffer_reset(out->json);
+    buffer_append_str(out->json, out->written ? ",{" : "{");
+    for (i = 0; i < record->nfields; i++) {
+        if (i) {
+            buffer_append_str(out->json, ",");
+        }
+        buffer_append_json(out->json, rec_field_name(record->fields[i].name));
+        buffer_append_str(out->json, ":");
+        buffer_append_json(out->json, record->fields[i].value);
+    }
+    buffer_append_str(out->json, "}");
+    out->written++;
+    return emit(out, out->json->data, out->json->len);
+}
+
+/*
+ * handle_query_request - Run a selection expression over a project
+ * @client_socket: Socket to send response
+ * @uri: Request URI, /api/query?e=<expr>[&project=<name>][&limit=<n>]
+ *      [&archive=1]
+ *
+ * The project defaults to scjv. Matching records are streamed as JSON;
+ * count is the total number of matches even when limit cut the list.
+ * With archive=1 the project's archived records are searched as well,
+ * after the resident ones.
+ * Responses are cached against the store version, so repeated queries
+ * are answered without evaluation until the project changes.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_query_request(int client_socket, const char *uri)
+{
+    static const char *const access_names[] = { "scan", "key", "index" };
+    struct chunked_writer writer;
+    struct query_output out;
+    struct query_plan *plan;
+    struct rec_store *store;
+    struct rec_store *cold;
+    struct buffer json;
+    struct buffer capture;
+    struct buffer key;
+    const char *query;
+    char expression[QUERY_EXPR_MAX + 1];
+    char project[REC_NAME_MAX];
+    char value[32];
+    char message[64];
+    unsigned long version;
+    size_t error_at;
+    long matches;
+    int archived;
+    int access;
+    int cold_access;
+    int result;
+
+    query = strchr(uri, '?');
+    query = query ? query + 1 : "";
+
+    if (!get_query_param(query, "e", expression, sizeof(expression)) ||
+        !expression[0]) {
+        return send_error_json(client_socket, "400 Bad Request", "Missing expression");
+    }
+    if (!get_query_param(query, "project", project, sizeof(project))) {
+        strcpy(project, "scjv");
+    }
+
+    store = rec_store_get(project);
+    if (!store) {
+        return send_error_json(client_socket, "404 Not Found", "Unknown project");
+    }
+
+    out.limit = -1;
+    if (get_query_param(query, "limit", value, sizeof(value)) && value[0]) {
+        out.limit = atol(value);
+    }
+    archived = get_query_param(query, "archive", value, sizeof(value)) &&
+               strcmp(value, "1") == 0;
+
+    /* Everything that shapes the body is part of the key */
+    buffer_init(&key);
+    buffer_init(&capture);
+    version = store->version;
+    if (buffer_appendf(&key, "%s\n%ld\n%d\n", store->name, out.limit,
+                       archived) != 0 ||
+        buffer_append_str(&key, expression) != 0) {
+        buffer_free(&key);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    if (result_cache_begin(key.data, version, &capture) == RESULT_CACHE_HIT) {
+        result = send_response(client_socket, "200 OK", "application/json",
+                               capture.data, capture.len);
+        buffer_free(&capture);
+        buffer_free(&key);
+        return result;
+    }
+
+    plan = query_compile(expression, &error_at);
+    if (!plan) {
+        result_cache_finish(key.data, version, NULL, 0);
+        buffer_free(&key);
+        snprintf(message, sizeof(message), "Syntax error at offset %lu",
+                 (unsigned long)error_at);
+        return send_error_json(client_socket, "400 Bad Request", message);
+    }
+
+    out.written = 0;
+    out.writer = &writer;
+    out.json = &json;
+    out.capture = &capture;
+    buffer_init(&json);
+    buffer_reserve(&capture, 1);
+
+    if (chunked_begin(&writer, client_socket, "application/json", NULL) != 0) {
+        result_cache_finish(key.data, version, NULL, 0);
+        buffer_free(&key);
+        buffer_free(&json);
+        buffer_free(&capture);
+        return -1;
+    }
+    buffer_append_str(&json, "{\"project\":");
+    buffer_append_json(&json, store->name);
+    buffer_append_str(&json, ",\"expression\":");
+    buffer_append_json(&json, expression);
+    buffer_append_str(&json, ",\"records\":[");
+    emit(&out, json.data, json.len);
+
+    matches = query_run(plan, store, write_record, &out, &access);
+    cold = archived ? archive_open(store->name) : NULL;
+    if (cold) {
+        matches += query_run(plan, cold, write_record, &out, &cold_access);
+        rec_store_free(cold);
+    }
+
+    buffer_reset(&json);
+    buffer_appendf(&json, "],\"count\":%ld,\"access\":\"%s\"}",
+                   matches, access_names[access]);
+    emit(&out, json.data, json.len);
+    buffer_free(&json);
+
+    /* Only complete, successfully sent bodies are cached */
+    result = chunked_end(&writer);
+    result_cache_finish(key.data, version,
+                        result == 0 && !writer.error ? capture.data : NULL,
+                        capture.len);
+    buffer_free(&capture);
+    buffer_free(&key);
+    return result;
+}
@@ -0,0 +1,124 @@
+/* filepath: src/rec_watch.c */
+#include "../include/rec_watch.h"
+#include "../include/diag.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+/*
+ * Files in the records directory may be edited with recutils or an
+ * editor while the server runs. Both either rewrite the file in place or
+ * rename a new copy over it, so closing a written file and moving one in
+ * are the events watched. Each affected project that is loaded is synced
+ * against the file, which only parses the records whose text changed.
+ */
+static int watch_fd = -1;
+
+int
+rec_watch_init(const char *records_dir)
+{
+    rec_watch_shutdown();
+    if (!records_dir) {
+        return ERR_PARAM;
+    }
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd < 0) {
+        return ERR_IO;
+    }
+    if (inotify_add_watch(watch_fd, records_dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        rec_watch_shutdown();
+        return ERR_IO;
+    }
+    return ERR_NONE;
+}
+
+void
+rec_watch_shutdown(void)
+{
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+}
+
+/* Descriptor to poll for readability, or -1 if not watching */
+int
+rec_watch_fd(void)
+{
+    return watch_fd;
+}
+
+/* Project named by a "<project>.rec" event, or 0 for any other file */
+static int
+event_project(const char *name, char *project, size_t size)
+{
+    size_t len;
+    size_t suffix;
+
+    len = strlen(name);
+    suffix = strlen(REC_SUFFIX);
+    if (len <= suffix || len - suffix >= size ||
+        strcmp(name + len - suffix, REC_SUFFIX) != 0) {
+        return 0;
+    }
+    memcpy(project, name, len - suffix);
+    project[len - suffix] = '\0';
+    return rec_valid_project_name(project);
+}
+
+/*
+ * rec_watch_dispatch - Apply every pending change to the records directory
+ *
+ * Events for the same file arriving together are synced once.
+ * Returns the number of records re-indexed, or -1 on error.
+ */
+long
+rec_watch_dispatch(void)
+{
+    static char events[REC_WATCH_BUFFER];
+    struct inotify_event event;
+    char project[REC_NAME_MAX];
+    char last[REC_NAME_MAX];
+    size_t offset;
+    ssize_t n;
+    long changed;
+    long total;
+
+    if (watch_fd < 0) {
+        return 0;
+    }
+
+    total = 0;
+    last[0] = '\0';
+    for (;;) {
+        n = read(watch_fd, events, sizeof(events));
+        if (n < 0) {
+            return errno == EAGAIN || errno == EINTR ? total : -1;
+        }
+
+        for (offset = 0; offset + sizeof(event) <= (size_t)n;
+             offset += sizeof(event) + event.len) {
+            memcpy(&event, events + offset, sizeof(event));
+            if (!event.len ||
+                !event_project(events + offset + sizeof(event), project,
+                               sizeof(project)) ||
+                strcmp(project, last) == 0) {
+                continue;
+            }
+            strcpy(last, project);
+
+            changed = rec_store_sync(project);
+            if (changed > 0) {
+                DIAG(LOG_INFO, ("Re-indexed %s: %ld records changed\n", project,
+                                changed));
+                total += changed;
+            } else if (changed < 0) {
+                DIAG(LOG_ERROR, ("Failed to re-read %s%s\n", project, REC_SUFFIX));
+            }
+        }
+    }
+}
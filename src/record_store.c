@@ -0,0 +1,2095 @@
+/* filepath: src/record_store.c */
+#include "../include/record_store.h"
+#include "../include/buffer.h"
+#include "../include/web_server.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Registry state; stores are only touched from the main loop */
+static char registry_dir[256] = RECORDS_DIR;
+static struct rec_store *registry_head = NULL;
+static unsigned long registry_clock = 0;
+static unsigned long registry_loads = 0;
+static unsigned long registry_evictions = 0;
+
+/* Projects found in registry_dir, sorted by name, as of its last change */
+static struct rec_project projects[REC_MAX_PROJECTS];
+static size_t project_count = 0;
+static struct timespec projects_mtime;
+static int projects_scanned = 0;
+
+/* Source of store versions; never reused, even across reloads */
+static unsigned long store_generation = 0;
+
+/* Global field-name table shared by every store */
+static char *field_names[REC_MAX_FIELD_NAMES];
+static unsigned short field_name_count = 0;
+
+/*
+ * Low-cardinality fields whose values are interned. Each gets a global
+ * dictionary; a record field holding a dictionary value stores only its
+ * code and points at the shared copy instead of carrying the bytes.
+ */
+static const char *const interned_fields[] = {
+    "Project_Name",
+    "Primary_Environmental_Mechanism",
+    "Procedure",
+    "Environmental_Aspect",
+    "Accountability",
+    "Responsibility",
+    "ProjectPhase",
+    "Status",
+    "PersonEmail",
+    "Recurring_Obligation",
+    "Recurring_Frequency",
+    "Recurring_Status",
+    "Inspection",
+    "Inspection_Frequency",
+    "Site_or_Desktop",
+    "New_Control_Action_Required",
+    "Obligation_Type",
+    NULL
+};
+
+/* Value dictionary: codes are 1-based indexes into values, 0 is "none" */
+struct rec_dict {
+    char **values;
+    unsigned short *slots;
+    size_t count;
+    size_t size;
+    size_t bytes;
+};
+
+static struct rec_dict *field_dicts[REC_MAX_FIELD_NAMES];
+
+/* Scratch space reused while parsing records */
+static struct buffer scratch_values;
+static struct rec_field *scratch_fields = NULL;
+static size_t *scratch_offsets = NULL;
+static size_t scratch_capacity = 0;
+
+unsigned long
+rec_hash(const char *data, size_t len, unsigned long seed)
+{
+    unsigned long hash;
+    size_t i;
+
+    /* FNV-1a */
+    hash = seed ? seed : 2166136261UL;
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+int
+rec_field_id(const char *name)
+{
+    unsigned short i;
+    size_t len;
+
+    for (i = 0; i < field_name_count; i++) {
+        if (strcmp(field_names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    if (field_name_count >= REC_MAX_FIELD_NAMES) {
+        return -1;
+    }
+
+    len = strlen(name);
+    field_names[field_name_count] = malloc(len + 1);
+    if (!field_names[field_name_count]) {
+        return -1;
+    }
+    memcpy(field_names[field_name_count], name, len + 1);
+
+    /* A missing dictionary only means the field is stored inline */
+    for (i = 0; interned_fields[i]; i++) {
+        if (strcmp(interned_fields[i], name) == 0) {
+            field_dicts[field_name_count] = calloc(1, sizeof(struct rec_dict));
+            break;
+        }
+    }
+    return field_name_count++;
+}
+
+unsigned short
+rec_field_count(void)
+{
+    return field_name_count;
+}
+
+const char *
+rec_field_name(unsigned short id)
+{
+    return id < field_name_count ? field_names[id] : "";
+}
+
+/* Look up a field-name id without adding it to the table */
+int
+rec_field_lookup(const char *name)
+{
+    unsigned short i;
+
+    for (i = 0; i < field_name_count; i++) {
+        if (strcmp(field_names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *
+rec_get(const struct rec_record *record, const char *field)
+{
+    int id;
+    size_t i;
+
+    id = rec_field_lookup(field);
+    if (id < 0 || !record) {
+        return NULL;
+    }
+
+    for (i = 0; i < record->nfields; i++) {
+        if (record->fields[i].name == (unsigned short)id) {
+            return record->fields[i].value;
+        }
+    }
+    return NULL;
+}
+
+/* Same as rec_get for callers that resolved the field id once */
+const char *
+rec_get_id(const struct rec_record *record, unsigned short id)
+{
+    const struct rec_field *field;
+
+    field = rec_find_field(record, id);
+    return field ? field->value : NULL;
+}
+
+const struct rec_field *
+rec_find_field(const struct rec_record *record, unsigned short id)
+{
+    size_t i;
+
+    for (i = 0; i < record->nfields; i++) {
+        if (record->fields[i].name == id) {
+            return &record->fields[i];
+        }
+    }
+    return NULL;
+}
+
+/* Find the table slot for a value; the slot is empty if it is absent */
+static size_t
+dict_slot(const struct rec_dict *dict, const char *value, size_t len)
+{
+    const char *entry;
+    size_t mask;
+    size_t slot;
+
+    mask = dict->size - 1;
+    slot = rec_hash(value, len, 0) & mask;
+    while (dict->slots[slot]) {
+        entry = dict->values[dict->slots[slot] - 1];
+        if (strncmp(entry, value, len) == 0 && entry[len] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Double the table and the value array, keeping the load below 1/2 */
+static int
+dict_grow(struct rec_dict *dict)
+{
+    struct rec_dict grown;
+    size_t slot;
+    size_t i;
+
+    grown = *dict;
+    grown.size = dict->size ? dict->size * 2 : 64;
+    grown.slots = calloc(grown.size, sizeof(*grown.slots));
+    if (!grown.slots) {
+        return -1;
+    }
+    grown.values = realloc(dict->values, grown.size / 2 * sizeof(*grown.values));
+    if (!grown.values) {
+        free(grown.slots);
+        return -1;
+    }
+
+    for (i = 0; i < grown.count; i++) {
+        slot = dict_slot(&grown, grown.values[i], strlen(grown.values[i]));
+        grown.slots[slot] = (unsigned short)(i + 1);
+    }
+    free(dict->slots);
+    *dict = grown;
+    return 0;
+}
+
+/* Return the code for a value, adding it if there is room; 0 if not */
+static unsigned short
+dict_intern(struct rec_dict *dict, const char *value, size_t len)
+{
+    char *copy;
+    size_t slot;
+
+    if (dict->size) {
+        slot = dict_slot(dict, value, len);
+        if (dict->slots[slot]) {
+            return dict->slots[slot];
+        }
+    }
+
+    /* Past the limit the field is not low-cardinality after all */
+    if (dict->count >= REC_DICT_MAX_CODES) {
+        return 0;
+    }
+    if (dict->count + 1 > dict->size / 2 && dict_grow(dict) != 0) {
+        return 0;
+    }
+    slot = dict_slot(dict, value, len);
+
+    copy = malloc(len + 1);
+    if (!copy) {
+        return 0;
+    }
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    dict->values[dict->count++] = copy;
+    dict->bytes += len + 1;
+    dict->slots[slot] = (unsigned short)dict->count;
+    return dict->slots[slot];
+}
+
+/*
+ * rec_dict_lookup - Find the dictionary code of a field value
+ * @field: Field-name id
+ * @value: Value to look up
+ *
+ * Returns the code, or 0 if the field is not interned or the value has
+ * never been seen. Two fields with the same non-zero code are equal.
+ */
+unsigned short
+rec_dict_lookup(unsigned short field, const char *value)
+{
+    struct rec_dict *dict;
+
+    dict = field < REC_MAX_FIELD_NAMES ? field_dicts[field] : NULL;
+    if (!dict || !dict->size || !value) {
+        return 0;
+    }
+    return dict->slots[dict_slot(dict, value, strlen(value))];
+}
+
+/*
+ * rec_dict_stats - Describe interning across the loaded stores as JSON
+ * @out: Buffer the JSON object is appended to
+ *
+ * raw_bytes is what the interned values would take if every record kept
+ * its own copy; dictionary_bytes is what the shared copies take.
+ *
+ * Returns 0 on success, -1 on allocation failure
+ */
+int
+rec_dict_stats(struct buffer *out)
+{
+    unsigned long references[REC_MAX_FIELD_NAMES];
+    unsigned long raw[REC_MAX_FIELD_NAMES];
+    const struct rec_store *store;
+    const struct rec_field *field;
+    unsigned long inline_bytes;
+    unsigned long raw_total;
+    unsigned long dict_total;
+    size_t i;
+    size_t j;
+    unsigned short id;
+    int first;
+
+    memset(references, 0, sizeof(references));
+    memset(raw, 0, sizeof(raw));
+    inline_bytes = 0;
+    for (store = registry_head; store; store = store->next) {
+        for (i = 0; i < store->count; i++) {
+            for (j = 0; j < store->records[i]->nfields; j++) {
+                field = &store->records[i]->fields[j];
+                if (field->code) {
+                    references[field->name]++;
+                    raw[field->name] += field->len + 1UL;
+                } else {
+                    inline_bytes += field->len + 1UL;
+                }
+            }
+        }
+    }
+
+    buffer_append_str(out, "{\"fields\":[");
+    raw_total = 0;
+    dict_total = 0;
+    first = 1;
+    for (id = 0; id < field_name_count; id++) {
+        if (!field_dicts[id] || !field_dicts[id]->count) {
+            continue;
+        }
+        buffer_appendf(out, "%s{\"field\":", first ? "" : ",");
+        buffer_append_json(out, field_names[id]);
+        buffer_appendf(out, ",\"values\":%lu,\"references\":%lu,"
+                       "\"raw_bytes\":%lu,\"dictionary_bytes\":%lu}",
+                       (unsigned long)field_dicts[id]->count, references[id],
+                       raw[id], (unsigned long)field_dicts[id]->bytes);
+        raw_total += raw[id];
+        dict_total += field_dicts[id]->bytes;
+        first = 0;
+    }
+
+    /* Overall ratio of value bytes before and after interning */
+    return buffer_appendf(out, "],\"raw_bytes\":%lu,\"dictionary_bytes\":%lu,"
+                          "\"inline_bytes\":%lu,\"ratio\":%.2f}",
+                          raw_total, dict_total, inline_bytes,
+                          inline_bytes + dict_total ?
+                          (double)(inline_bytes + raw_total) /
+                          (double)(inline_bytes + dict_total) : 1.0);
+}
+
+/* Make room for at least need fields in the scratch arrays */
+static int
+scratch_grow(size_t need)
+{
+    struct rec_field *fields;
+    size_t *offsets;
+    size_t capacity;
+
+    if (need <= scratch_capacity) {
+        return 0;
+    }
+
+    capacity = scratch_capacity ? scratch_capacity * 2 : 32;
+    fields = realloc(scratch_fields, capacity * sizeof(*fields));
+    if (!fields) {
+        return -1;
+    }
+    scratch_fields = fields;
+
+    offsets = realloc(scratch_offsets, capacity * sizeof(*offsets));
+    if (!offsets) {
+        return -1;
+    }
+    scratch_offsets = offsets;
+    scratch_capacity = capacity;
+    return 0;
+}
+
+/*
+ * rec_parse_record - Parse one record's text into a standalone allocation
+ * @text: "Name: value" lines, optionally with "+ " continuation lines
+ * @len: Number of bytes of text to consider
+ *
+ * Comment (#) and descriptor (%) lines are skipped, as are lines that are
+ * not valid fields. Returns NULL if no fields were found or on error.
+ */
+struct rec_record *
+rec_parse_record(const char *text, size_t len)
+{
+    struct rec_record *record;
+    struct rec_field *fields;
+    const char *line;
+    const char *end;
+    const char *eol;
+    const char *colon;
+    const char *p;
+    struct rec_dict *dict;
+    char name[REC_NAME_MAX];
+    char *values;
+    size_t count;
+    size_t size;
+    size_t i;
+    size_t seg;
+    int id;
+
+    buffer_reset(&scratch_values);
+    count = 0;
+    end = text + len;
+
+    for (line = text; line < end; line = eol + 1) {
+        eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) {
+            eol = end;
+        }
+        seg = (size_t)(eol - line);
+        if (seg > 0 && line[seg - 1] == '\r') {
+            seg--;
+        }
+
+        if (seg == 0 || line[0] == '#' || line[0] == '%') {
+            continue;
+        }
+
+        /* Continuation line: fold into the previous value */
+        if (line[0] == '+') {
+            if (count == 0) {
+                continue;
+            }
+            p = line + 1;
+            if (p < line + seg && *p == ' ') {
+                p++;
+            }
+            scratch_values.len--; /* Drop previous terminator */
+            if (buffer_append(&scratch_values, "\n", 1) != 0 ||
+                buffer_append(&scratch_values, p, (size_t)(line + seg - p)) != 0 ||
+                buffer_append(&scratch_values, "", 1) != 0) {
+                return NULL;
+            }
+            scratch_fields[count - 1].len += (unsigned int)(line + seg - p) + 1;
+            continue;
+        }
+
+        /* Field line: name must be [A-Za-z0-9_]+ followed by ':' */
+        colon = memchr(line, ':', seg);
+        if (!colon || colon == line || (size_t)(colon - line) >= sizeof(name)) {
+            continue;
+        }
+        for (p = line; p < colon; p++) {
+            if (!isalnum((unsigned char)*p) && *p != '_') {
+                break;
+            }
+        }
+        if (p != colon) {
+            continue;
+        }
+
+        memcpy(name, line, (size_t)(colon - line));
+        name[colon - line] = '\0';
+        id = rec_field_id(name);
+        if (id < 0 || scratch_grow(count + 1) != 0) {
+            return NULL;
+        }
+
+        p = colon + 1;
+        if (p < line + seg && *p == ' ') {
+            p++;
+        }
+        scratch_fields[count].name = (unsigned short)id;
+        scratch_fields[count].code = 0;
+        scratch_fields[count].len = (unsigned int)(line + seg - p);
+        scratch_fields[count].value = NULL;
+        scratch_offsets[count] = scratch_values.len;
+        if (buffer_append(&scratch_values, p, (size_t)(line + seg - p)) != 0 ||
+            buffer_append(&scratch_values, "", 1) != 0) {
+            return NULL;
+        }
+        count++;
+    }
+
+    if (count == 0) {
+        return NULL;
+    }
+
+    /* Interned values are shared; only the rest are copied */
+    size = 0;
+    for (i = 0; i < count; i++) {
+        dict = field_dicts[scratch_fields[i].name];
+        scratch_fields[i].code = dict ?
+            dict_intern(dict, scratch_values.data + scratch_offsets[i],
+                        scratch_fields[i].len) : 0;
+        if (!scratch_fields[i].code) {
+            size += scratch_fields[i].len + 1;
+        }
+    }
+
+    /* Single allocation: record, field array, then value bytes */
+    record = malloc(sizeof(*record) + count * sizeof(*fields) + size);
+    if (!record) {
+        return NULL;
+    }
+    fields = (struct rec_field *)(record + 1);
+    values = (char *)(fields + count);
+
+    memset(record, 0, sizeof(*record));
+    record->fields = fields;
+    record->nfields = count;
+    record->hash = 0;
+    for (i = 0; i < count; i++) {
+        fields[i] = scratch_fields[i];
+        if (fields[i].code) {
+            fields[i].value = field_dicts[fields[i].name]->values[fields[i].code - 1];
+        } else {
+            memcpy(values, scratch_values.data + scratch_offsets[i],
+                   fields[i].len + 1);
+            fields[i].value = values;
+            values += fields[i].len + 1;
+        }
+        record->hash = rec_hash(rec_field_name(fields[i].name),
+                                strlen(rec_field_name(fields[i].name)) + 1,
+                                record->hash);
+        record->hash = rec_hash(fields[i].value, fields[i].len + 1,
+                                record->hash);
+    }
+    for (i = 0; i < REC_DUE_KINDS; i++) {
+        record->forecast_next[i] = REC_DATE_INVALID;
+    }
+
+    return record;
+}
+
+/*
+ * Key index: an open-addressed table mapping Obligation_Number to the
+ * position of its record (plus one, 0 marks an empty slot), fronted by a
+ * Bloom filter so keys that were never used are rejected without probing.
+ * When a key repeats in the file the later record wins and the slot is
+ * flagged, so callers that need every record with the key can tell.
+ */
+#define KEY_DUP ((size_t)1 << (sizeof(size_t) * CHAR_BIT - 1))
+#define KEY_POS(entry) (((entry) & ~KEY_DUP) - 1)
+
+/* Field ids are never reused, so the key field is looked up only once */
+static int key_field_id = -1;
+
+static int
+key_field(void)
+{
+    if (key_field_id < 0) {
+        key_field_id = rec_field_id(REC_KEY_FIELD);
+    }
+    return key_field_id;
+}
+
+static const char *
+record_key(const struct rec_record *record, unsigned long *hash)
+{
+    const char *key;
+
+    if (key_field() < 0) {
+        return NULL;
+    }
+    key = rec_get_id(record, (unsigned short)key_field_id);
+    if (!key || !key[0]) {
+        return NULL;
+    }
+    *hash = rec_hash(key, strlen(key), 0);
+    return key;
+}
+
+/* Three Bloom probes derived from one hash by double hashing */
+static size_t
+bloom_bit(const struct rec_store *store, unsigned long hash, unsigned int probe)
+{
+    unsigned long step;
+
+    step = (hash >> 17) | 1UL;
+    return (size_t)((hash + probe * step) % (store->bloom_size * 8));
+}
+
+static void
+bloom_add(struct rec_store *store, unsigned long hash)
+{
+    size_t bit;
+    unsigned int i;
+
+    for (i = 0; i < REC_BLOOM_PROBES; i++) {
+        bit = bloom_bit(store, hash, i);
+        store->bloom[bit / 8] = (unsigned char)(store->bloom[bit / 8] | (1U << (bit % 8)));
+    }
+}
+
+static int
+bloom_test(const struct rec_store *store, unsigned long hash)
+{
+    size_t bit;
+    unsigned int i;
+
+    for (i = 0; i < REC_BLOOM_PROBES; i++) {
+        bit = bloom_bit(store, hash, i);
+        if (!(store->bloom[bit / 8] & (1U << (bit % 8)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Slot holding key, or the empty slot where it would go */
+static size_t
+index_slot(const struct rec_store *store, const char *key, unsigned long hash)
+{
+    const char *other;
+    unsigned short id;
+    size_t mask;
+    size_t slot;
+
+    id = (unsigned short)key_field();
+    mask = store->key_size - 1;
+    for (slot = hash & mask; store->keys[slot]; slot = (slot + 1) & mask) {
+        other = rec_get_id(store->records[KEY_POS(store->keys[slot])], id);
+        if (other && strcmp(other, key) == 0) {
+            break;
+        }
+    }
+    return slot;
+}
+
+static void
+index_put(struct rec_store *store, size_t position)
+{
+    const char *key;
+    unsigned long hash;
+    size_t slot;
+
+    key = record_key(store->records[position], &hash);
+    if (!key) {
+        return;
+    }
+    slot = index_slot(store, key, hash);
+    if (!store->keys[slot]) {
+        store->key_count++;
+        store->keys[slot] = position + 1;
+    } else {
+        store->keys[slot] = (position + 1) | KEY_DUP;
+    }
+    bloom_add(store, hash);
+}
+
+/* Rebuild the table and filter for the current record count */
+static int
+index_rebuild(struct rec_store *store)
+{
+    unsigned char *bloom;
+    size_t *keys;
+    size_t size;
+    size_t i;
+
+    size = 64;
+    while (size < store->count * 2 + 2) {
+        size *= 2;
+    }
+
+    keys = calloc(size, sizeof(*keys));
+    bloom = calloc(size, 1);
+    if (!keys || !bloom) {
+        free(keys);
+        free(bloom);
+        return -1;
+    }
+
+    free(store->keys);
+    free(store->bloom);
+    store->keys = keys;
+    store->bloom = bloom;
+    store->key_size = size;
+    store->bloom_size = size;
+    store->key_count = 0;
+    for (i = 0; i < store->count; i++) {
+        index_put(store, i);
+    }
+    return 0;
+}
+
+static int
+store_push(struct rec_store *store, struct rec_record *record)
+{
+    struct rec_record **records;
+    size_t capacity;
+
+    if (store->count == store->capacity) {
+        capacity = store->capacity ? store->capacity * 2 : 64;
+        records = realloc(store->records, capacity * sizeof(*records));
+        if (!records) {
+            return -1;
+        }
+        store->records = records;
+        store->capacity = capacity;
+    }
+    store->records[store->count++] = record;
+
+    /* Keep the table at most half full; a rebuild indexes the new record */
+    if ((store->key_count + 1) * 2 <= store->key_size) {
+        index_put(store, store->count - 1);
+    } else if (index_rebuild(store) != 0) {
+        store->count--;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+store_free(struct rec_store *store)
+{
+    struct rec_index *index;
+    size_t i;
+
+    while (store->indexes) {
+        index = store->indexes;
+        store->indexes = index->next;
+        free(index->starts);
+        free(index->positions);
+        free(index);
+    }
+    if (store->order) {
+        free(store->order->positions);
+        free(store->order);
+    }
+    for (i = 0; i < store->count; i++) {
+        free(store->records[i]);
+    }
+    free(store->records);
+    free(store->keys);
+    free(store->bloom);
+    free(store->archived);
+    free(store->due);
+    free(store->header);
+    free(store);
+}
+
+/* Whole file, NUL-terminated; NULL if it cannot be read */
+char *
+rec_read_file(const char *path, size_t *size)
+{
+    struct stat st;
+    char *data;
+    ssize_t n;
+    size_t total;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    data = malloc((size_t)st.st_size + 1);
+    if (!data) {
+        close(fd);
+        return NULL;
+    }
+
+    total = 0;
+    while (total < (size_t)st.st_size) {
+        n = read(fd, data + total, (size_t)st.st_size - total);
+        if (n <= 0) {
+            break;
+        }
+        total += (size_t)n;
+    }
+    close(fd);
+
+    data[total] = '\0';
+    *size = total;
+    return data;
+}
+
+/* Length of the chunk at chunk, and where the one after it starts */
+const char *
+rec_next_chunk(const char *chunk, const char *end, size_t *len)
+{
+    const char *next;
+
+    /* Records are separated by blank lines */
+    next = strstr(chunk, "\n\n");
+    if (!next) {
+        *len = (size_t)(end - chunk);
+        return end;
+    }
+    *len = (size_t)(next - chunk) + 1;
+    return next + 2;
+}
+
+/* Parse .rec text: descriptor chunks form the header */
+static int
+store_parse(struct rec_store *store, const char *data, size_t size)
+{
+    struct buffer header;
+    struct rec_record *record;
+    const char *chunk;
+    const char *end;
+    const char *next;
+    size_t len;
+
+    buffer_init(&header);
+    end = data + size;
+    for (chunk = data; chunk < end; chunk = next) {
+        next = rec_next_chunk(chunk, end, &len);
+        if (chunk[0] == '%') {
+            buffer_append(&header, chunk, len);
+            continue;
+        }
+
+        record = rec_parse_record(chunk, len);
+        if (record) {
+            record->source = rec_hash(chunk, len, 0);
+        }
+        if (record && store_push(store, record) != 0) {
+            free(record);
+            buffer_free(&header);
+            return ERR_INTERNAL;
+        }
+    }
+
+    store->header = header.data;
+    return ERR_NONE;
+}
+
+static int
+store_load(struct rec_store *store)
+{
+    char *data;
+    size_t size;
+    int result;
+
+    data = rec_read_file(store->path, &size);
+    if (!data) {
+        return ERR_IO;
+    }
+    result = store_parse(store, data, size);
+    free(data);
+    return result;
+}
+
+/*
+ * Old records by source hash, for store_sync. Records that never came
+ * from the file (upserts) are filed under their content hash instead.
+ * Entries are positions plus one; a record is taken out when reused so
+ * repeated chunks each find their own copy.
+ */
+#define SYNC_KEY(record) ((record)->source ? (record)->source : (record)->hash)
+
+struct sync_table {
+    size_t *slots;
+    size_t mask;
+};
+
+static int
+sync_table_init(struct sync_table *table, const struct rec_store *store)
+{
+    size_t size;
+    size_t slot;
+    size_t i;
+
+    size = 64;
+    while (size < store->count * 2 + 2) {
+        size *= 2;
+    }
+    table->slots = calloc(size, sizeof(*table->slots));
+    if (!table->slots) {
+        return -1;
+    }
+    table->mask = size - 1;
+
+    for (i = 0; i < store->count; i++) {
+        slot = SYNC_KEY(store->records[i]) & table->mask;
+        while (table->slots[slot]) {
+            slot = (slot + 1) & table->mask;
+        }
+        table->slots[slot] = i + 1;
+    }
+    return 0;
+}
+
+static struct rec_record *
+sync_table_take(struct sync_table *table, struct rec_record **records,
+                unsigned long key, size_t *position)
+{
+    struct rec_record *record;
+    size_t slot;
+    size_t next;
+    size_t home;
+
+    for (slot = key & table->mask; table->slots[slot];
+         slot = (slot + 1) & table->mask) {
+        if (SYNC_KEY(records[table->slots[slot] - 1]) == key) {
+            break;
+        }
+    }
+    if (!table->slots[slot]) {
+        return NULL;
+    }
+    *position = table->slots[slot] - 1;
+    record = records[*position];
+    records[*position] = NULL;
+    table->slots[slot] = 0;
+
+    /* Backward-shift deletion keeps later probes reachable */
+    for (next = (slot + 1) & table->mask; table->slots[next];
+         next = (next + 1) & table->mask) {
+        home = SYNC_KEY(records[table->slots[next] - 1]) & table->mask;
+        if (((next - home) & table->mask) >= ((next - slot) & table->mask)) {
+            table->slots[slot] = table->slots[next];
+            table->slots[next] = 0;
+            slot = next;
+        }
+    }
+    return record;
+}
+
+/*
+ * Re-read the file and adopt its contents. Records whose text hashes the
+ * same as before are moved over as they are; only new or edited chunks
+ * are parsed. The version only moves if something changed or a record
+ * now sits at another position, since indexes and orders hold
+ * positions; caches survive the server's own writes being read back.
+ * Returns the number of records parsed or dropped, or -1.
+ */
+static long
+store_sync(struct rec_store *store)
+{
+    struct sync_table table;
+    struct buffer header;
+    struct rec_record **old;
+    struct rec_record *record;
+    struct rec_record *prior;
+    const char *chunk;
+    const char *end;
+    const char *next;
+    unsigned long source;
+    char *data;
+    size_t old_count;
+    size_t position;
+    size_t size;
+    size_t len;
+    size_t i;
+    long changed;
+    int moved;
+
+    data = rec_read_file(store->path, &size);
+    if (!data) {
+        return -1;
+    }
+    if (sync_table_init(&table, store) != 0) {
+        free(data);
+        return -1;
+    }
+
+    /* Detach the old records; the key index still points into them */
+    old = store->records;
+    old_count = store->count;
+    store->records = NULL;
+    store->count = 0;
+    store->capacity = 0;
+    store->key_count = 0;
+    if (store->keys) {
+        memset(store->keys, 0, store->key_size * sizeof(*store->keys));
+        memset(store->bloom, 0, store->bloom_size);
+    }
+
+    buffer_init(&header);
+    changed = 0;
+    moved = 0;
+    end = data + size;
+    for (chunk = data; chunk < end; chunk = next) {
+        next = rec_next_chunk(chunk, end, &len);
+        if (chunk[0] == '%') {
+            buffer_append(&header, chunk, len);
+            continue;
+        }
+
+        source = rec_hash(chunk, len, 0);
+        record = sync_table_take(&table, old, source, &position);
+        if (!record) {
+            record = rec_parse_record(chunk, len);
+            if (!record) {
+                continue;
+            }
+
+            /* Our own upsert read back: same fields, now with a source */
+            prior = sync_table_take(&table, old, record->hash, &position);
+            if (prior && !prior->source) {
+                free(record);
+                record = prior;
+                moved |= position != store->count;
+            } else {
+                changed += prior ? 2 : 1;
+                free(prior);
+            }
+            record->source = source;
+        } else {
+            moved |= position != store->count;
+        }
+        if (store_push(store, record) != 0) {
+            free(record);
+            changed = -1;
+            break;
+        }
+    }
+
+    /* Whatever was not taken is gone from the file */
+    for (i = 0; i < old_count; i++) {
+        if (old[i]) {
+            free(old[i]);
+            changed += changed >= 0 ? 1 : 0;
+        }
+    }
+    free(old);
+    free(table.slots);
+    free(data);
+
+    if ((header.data == NULL) != (store->header == NULL) ||
+        (header.data && strcmp(header.data, store->header) != 0)) {
+        changed += changed >= 0 ? 1 : 0;
+    }
+    free(store->header);
+    store->header = header.data;
+
+    if (changed != 0 || moved) {
+        store->version = ++store_generation;
+    }
+    return changed;
+}
+
+int
+rec_valid_project_name(const char *name)
+{
+    size_t i;
+
+    if (!name || !name[0]) {
+        return 0;
+    }
+    for (i = 0; name[i]; i++) {
+        if (i >= REC_NAME_MAX - 1 ||
+            (!isalnum((unsigned char)name[i]) && name[i] != '_' &&
+             name[i] != '-')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+rec_registry_init(const char *records_dir)
+{
+    size_t len;
+
+    if (!records_dir) {
+        return ERR_PARAM;
+    }
+    len = strlen(records_dir);
+    if (len >= sizeof(registry_dir)) {
+        return ERR_PARAM;
+    }
+
+    rec_registry_shutdown();
+    memcpy(registry_dir, records_dir, len + 1);
+    projects_scanned = 0;
+    project_count = 0;
+    return ERR_NONE;
+}
+
+void
+rec_registry_shutdown(void)
+{
+    struct rec_store *store;
+
+    while (registry_head) {
+        store = registry_head;
+        registry_head = store->next;
+        store_free(store);
+    }
+}
+
+struct rec_store *
+rec_registry_list(void)
+{
+    return registry_head;
+}
+
+/* Project_Name of the first record in the file's head, else the name */
+static void
+project_title(struct rec_project *project, const char *path)
+{
+    char head[4096];
+    const char *line;
+    const char *next;
+    const char *value;
+    size_t len;
+    ssize_t n;
+    int fd;
+
+    strcpy(project->title, project->name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    n = read(fd, head, sizeof(head) - 1);
+    close(fd);
+    if (n <= 0) {
+        return;
+    }
+    head[n] = '\0';
+
+    for (line = head; *line; line = next) {
+        next = strchr(line, '\n');
+        if (!next) {
+            return; /* Cut off by the end of the head */
+        }
+        next++;
+        if (strncmp(line, "Project_Name:", 13) != 0) {
+            continue;
+        }
+        for (value = line + 13; *value == ' '; value++) {
+        }
+        len = (size_t)(next - 1 - value);
+        if (len > 0 && len < sizeof(project->title)) {
+            memcpy(project->title, value, len);
+            project->title[len] = '\0';
+        }
+        return;
+    }
+}
+
+static int
+compare_projects(const void *left, const void *right)
+{
+    return strcmp(((const struct rec_project *)left)->name,
+                  ((const struct rec_project *)right)->name);
+}
+
+/* Re-read the directory listing if the directory changed since the last scan */
+static int
+registry_scan(void)
+{
+    char path[sizeof(registry_dir) + REC_NAME_MAX + sizeof(REC_SUFFIX)];
+    struct rec_project *project;
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+    size_t suffix;
+    size_t len;
+
+    if (stat(registry_dir, &st) != 0) {
+        return ERR_IO;
+    }
+    if (projects_scanned &&
+        st.st_mtim.tv_sec == projects_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == projects_mtime.tv_nsec) {
+        return ERR_NONE;
+    }
+
+    dir = opendir(registry_dir);
+    if (!dir) {
+        return ERR_IO;
+    }
+    projects_mtime = st.st_mtim;
+    projects_scanned = 1;
+    project_count = 0;
+    suffix = strlen(REC_SUFFIX);
+    while ((entry = readdir(dir)) != NULL && project_count < REC_MAX_PROJECTS) {
+        len = strlen(entry->d_name);
+        if (len <= suffix || len - suffix >= REC_NAME_MAX ||
+            strcmp(entry->d_name + len - suffix, REC_SUFFIX) != 0) {
+            continue;
+        }
+        project = &projects[project_count];
+        memcpy(project->name, entry->d_name, len - suffix);
+        project->name[len - suffix] = '\0';
+        snprintf(path, sizeof(path), "%s/%s", registry_dir, entry->d_name);
+        if (!rec_valid_project_name(project->name) || stat(path, &st) != 0 ||
+            !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        project->size = (unsigned long)st.st_size;
+        project_title(project, path);
+        project_count++;
+    }
+    closedir(dir);
+
+    qsort(projects, project_count, sizeof(projects[0]), compare_projects);
+    return ERR_NONE;
+}
+
+/*
+ * rec_registry_projects - Every project in the records directory
+ * @list: Set to the project array, sorted by name
+ *
+ * Only the directory is read; stores are loaded when a project is first
+ * used. The listing is refreshed when the directory changes.
+ *
+ * Returns the number of projects.
+ */
+size_t
+rec_registry_projects(const struct rec_project **list)
+{
+    if (registry_scan() != ERR_NONE) {
+        project_count = 0;
+    }
+    *list = projects;
+    return project_count;
+}
+
+/*
+ * rec_registry_find - Look up a project in the records directory
+ * @name: Project name
+ *
+ * Like rec_registry_projects, this never loads the store.
+ *
+ * Returns the project, or NULL if there is no <name>.rec file.
+ */
+const struct rec_project *
+rec_registry_find(const char *name)
+{
+    const struct rec_project *list;
+    struct rec_project key;
+    size_t count;
+
+    if (!rec_valid_project_name(name)) {
+        return NULL;
+    }
+    count = rec_registry_projects(&list);
+    strcpy(key.name, name);
+    return bsearch(&key, list, count, sizeof(*list), compare_projects);
+}
+
+/* Memory held by a store: records, their inline values and the indexes */
+static size_t
+store_bytes(struct rec_store *store)
+{
+    const struct rec_record *record;
+    struct rec_index *index;
+    size_t bytes;
+    size_t i;
+    size_t j;
+
+    if (store->bytes_version == store->version) {
+        return store->bytes;
+    }
+
+    bytes = sizeof(*store) + store->capacity * sizeof(*store->records) +
+            store->key_size * sizeof(*store->keys) + store->bloom_size +
+            store->due_count * sizeof(*store->due) +
+            (store->header ? strlen(store->header) + 1 : 0);
+    for (i = 0; i < store->count; i++) {
+        record = store->records[i];
+        bytes += sizeof(*record) + record->nfields * sizeof(*record->fields);
+        for (j = 0; j < record->nfields; j++) {
+            bytes += record->fields[j].code ? 0 : record->fields[j].len + 1;
+        }
+    }
+    for (index = store->indexes; index; index = index->next) {
+        bytes += sizeof(*index) + (index->codes + 1) * sizeof(*index->starts) +
+                 store->count * sizeof(*index->positions);
+    }
+    if (store->order) {
+        bytes += sizeof(*store->order) + store->count * sizeof(size_t);
+    }
+
+    store->bytes = bytes;
+    store->bytes_version = store->version;
+    return bytes;
+}
+
+/*
+ * rec_registry_trim - Evict least recently used stores over a budget
+ * @budget: Bytes the resident stores may take together
+ *
+ * The most recently used store always stays. Callers keep store
+ * pointers for the length of a request, so this only runs between
+ * requests; an evicted project is reloaded from its file on next use.
+ */
+void
+rec_registry_trim(size_t budget)
+{
+    struct rec_store **link;
+    struct rec_store **victim;
+    struct rec_store *store;
+    size_t total;
+    size_t count;
+
+    for (;;) {
+        total = 0;
+        count = 0;
+        victim = NULL;
+        for (link = &registry_head; *link; link = &(*link)->next) {
+            total += store_bytes(*link);
+            count++;
+            if (!victim || (*link)->used < (*victim)->used) {
+                victim = link;
+            }
+        }
+        if (total <= budget || count <= 1) {
+            return;
+        }
+
+        store = *victim;
+        *victim = store->next;
+        store_free(store);
+        registry_evictions++;
+    }
+}
+
+/* Projects, resident stores and their memory as a JSON object */
+int
+rec_registry_stats(struct buffer *out)
+{
+    const struct rec_project *list;
+    struct rec_store *store;
+    size_t projects_found;
+    size_t loaded;
+    size_t bytes;
+
+    projects_found = rec_registry_projects(&list);
+    loaded = 0;
+    bytes = 0;
+    for (store = registry_head; store; store = store->next) {
+        loaded++;
+        bytes += store_bytes(store);
+    }
+    return buffer_appendf(out,
+                          "{\"projects\":%lu,\"loaded\":%lu,\"bytes\":%lu,"
+                          "\"budget\":%lu,\"loads\":%lu,\"evictions\":%lu}",
+                          (unsigned long)projects_found, (unsigned long)loaded,
+                          (unsigned long)bytes, (unsigned long)REC_MEMORY_BUDGET,
+                          registry_loads, registry_evictions);
+}
+
+/*
+ * rec_store_get - Return the store for a project, loading it on first use
+ * @project: Project name, the basename of var/records/<project>.rec
+ *
+ * Returns NULL if the name is invalid or the file cannot be read.
+ */
+struct rec_store *
+rec_store_get(const char *project)
+{
+    struct rec_store *store;
+    int len;
+
+    if (!rec_valid_project_name(project)) {
+        return NULL;
+    }
+
+    for (store = registry_head; store; store = store->next) {
+        if (strcmp(store->name, project) == 0) {
+            store->used = ++registry_clock;
+            return store;
+        }
+    }
+
+    store = calloc(1, sizeof(*store));
+    if (!store) {
+        return NULL;
+    }
+    strcpy(store->name, project);
+    len = snprintf(store->path, sizeof(store->path), "%s/%s%s",
+                   registry_dir, project, REC_SUFFIX);
+    if (len < 0 || (size_t)len >= sizeof(store->path)) {
+        free(store);
+        return NULL;
+    }
+    store->forecast_day = REC_DATE_INVALID;
+
+    if (store_load(store) != ERR_NONE) {
+        store_free(store);
+        return NULL;
+    }
+
+    store->version = ++store_generation;
+    store->used = ++registry_clock;
+    store->next = registry_head;
+    registry_head = store;
+    registry_loads++;
+    return store;
+}
+
+/*
+ * rec_store_parse - Build a store from text, outside the registry
+ * @name: Project the records belong to
+ * @text: .rec text
+ * @len: Length of text
+ *
+ * Used for records that are not kept resident, such as archives. The
+ * caller releases the store with rec_store_free. Returns NULL on error.
+ */
+struct rec_store *
+rec_store_parse(const char *name, const char *text, size_t len)
+{
+    struct rec_store *store;
+
+    if (!rec_valid_project_name(name)) {
+        return NULL;
+    }
+    store = calloc(1, sizeof(*store));
+    if (!store) {
+        return NULL;
+    }
+    strcpy(store->name, name);
+    store->forecast_day = REC_DATE_INVALID;
+    if (store_parse(store, text, len) != ERR_NONE) {
+        store_free(store);
+        return NULL;
+    }
+    store->version = ++store_generation;
+    return store;
+}
+
+void
+rec_store_free(struct rec_store *store)
+{
+    if (store) {
+        store_free(store);
+    }
+}
+
+/*
+ * rec_store_find - Look up a record by its Obligation_Number
+ * @store: Store to search
+ * @key: Key value
+ *
+ * Keys the store has never seen are usually answered by the Bloom filter
+ * alone. Returns the record, or NULL if there is none.
+ */
+struct rec_record *
+rec_store_find(const struct rec_store *store, const char *key)
+{
+    unsigned long hash;
+    size_t slot;
+
+    if (!store->keys || !key || !key[0]) {
+        return NULL;
+    }
+
+    hash = rec_hash(key, strlen(key), 0);
+    if (!bloom_test(store, hash)) {
+        return NULL;
+    }
+    slot = index_slot(store, key, hash);
+    return store->keys[slot] ? store->records[KEY_POS(store->keys[slot])] : NULL;
+}
+
+/* Whether more than one record in the file carried this key */
+int
+rec_store_key_repeated(const struct rec_store *store, const char *key)
+{
+    unsigned long hash;
+    size_t slot;
+
+    if (!store->keys || !key || !key[0]) {
+        return 0;
+    }
+    hash = rec_hash(key, strlen(key), 0);
+    if (!bloom_test(store, hash)) {
+        return 0;
+    }
+    slot = index_slot(store, key, hash);
+    return (store->keys[slot] & KEY_DUP) != 0;
+}
+
+/*
+ * rec_store_upsert - Insert or replace a record by its key field
+ * @store: Target store
+ * @text: Record text as written to the .rec file
+ * @len: Length of text
+ *
+ * The cached forecast is carried over so unchanged inputs are not
+ * recomputed. Returns ERR_NONE, ERR_PARAM for text without a key, or
+ * ERR_INTERNAL on allocation failure.
+ */
+int
+rec_store_upsert(struct rec_store *store, const char *text, size_t len)
+{
+    struct rec_record *record;
+    struct rec_record *old;
+    const char *key;
+    unsigned long hash;
+    size_t slot;
+
+    record = rec_parse_record(text, len);
+    if (!record) {
+        return ERR_PARAM;
+    }
+
+    key = record_key(record, &hash);
+    if (!key) {
+        free(record);
+        return ERR_PARAM;
+    }
+
+    old = NULL;
+    slot = 0;
+    if (store->keys && bloom_test(store, hash)) {
+        slot = index_slot(store, key, hash);
+        old = store->keys[slot] ? store->records[KEY_POS(store->keys[slot])] : NULL;
+    }
+    if (old) {
+        record->forecast_inputs = old->forecast_inputs;
+        memcpy(record->forecast_next, old->forecast_next,
+               sizeof(record->forecast_next));
+        memcpy(record->forecast_days, old->forecast_days,
+               sizeof(record->forecast_days));
+        memcpy(record->forecast_months, old->forecast_months,
+               sizeof(record->forecast_months));
+        store->records[KEY_POS(store->keys[slot])] = record;
+        free(old);
+    } else if (store_push(store, record) != 0) {
+        free(record);
+        return ERR_INTERNAL;
+    }
+
+    store->version = ++store_generation;
+    return ERR_NONE;
+}
+
+/* Counting sort of record positions by the field's dictionary code */
+static int
+index_build(struct rec_index *index, const struct rec_store *store,
+            const struct rec_dict *dict)
+{
+    const struct rec_field *field;
+    size_t total;
+    size_t i;
+
+    free(index->starts);
+    free(index->positions);
+    index->codes = dict->count;
+    index->starts = calloc(index->codes + 1, sizeof(*index->starts));
+    index->positions = NULL;
+    if (!index->starts) {
+        return -1;
+    }
+
+    for (i = 0; i < store->count; i++) {
+        field = rec_find_field(store->records[i], (unsigned short)index->field);
+        if (field && !field->code) {
+            return -1; /* Some values were stored inline */
+        }
+        if (field) {
+            index->starts[field->code]++;
+        }
+    }
+    for (i = 1; i <= index->codes; i++) {
+        index->starts[i] += index->starts[i - 1];
+    }
+    total = index->starts[index->codes];
+
+    index->positions = malloc((total + 1) * sizeof(*index->positions));
+    if (!index->positions) {
+        return -1;
+    }
+    for (i = store->count; i > 0; i--) {
+        field = rec_find_field(store->records[i - 1], (unsigned short)index->field);
+        if (field) {
+            index->positions[--index->starts[field->code]] = i - 1;
+        }
+    }
+
+    /* Filling backwards left starts[c] at the start of bucket c */
+    memmove(index->starts, index->starts + 1, index->codes * sizeof(*index->starts));
+    index->starts[index->codes] = total;
+    return 0;
+}
+
+/*
+ * rec_store_index - Postings of an interned field for this store
+ * @store: Store to index
+ * @field: Field-name id
+ *
+ * Returns NULL if the field is not interned or some of the store's
+ * values for it did not fit the dictionary, so the postings would miss
+ * records.
+ */
+const struct rec_index *
+rec_store_index(struct rec_store *store, unsigned short field)
+{
+    struct rec_index *index;
+
+    if (field >= REC_MAX_FIELD_NAMES || !field_dicts[field]) {
+        return NULL;
+    }
+
+    for (index = store->indexes; index; index = index->next) {
+        if (index->field == field) {
+            break;
+        }
+    }
+    if (!index) {
+        index = calloc(1, sizeof(*index));
+        if (!index) {
+            return NULL;
+        }
+        index->field = field;
+        index->next = store->indexes;
+        store->indexes = index;
+    }
+
+    if (index->version != store->version ||
+        index->codes != field_dicts[field]->count) {
+        index->version = store->version;
+        if (index_build(index, store, field_dicts[field]) != 0) {
+            free(index->positions);
+            index->positions = NULL;
+        }
+    }
+    return index->positions ? index : NULL;
+}
+
+/*
+ * rec_natural_compare - Compare values the way people number things
+ * @a: First value
+ * @b: Second value
+ *
+ * Letters compare case-insensitively and digit runs by value, so
+ * "PCEMP-9" sorts before "PCEMP-10" and "pcemp-02" equals "PCEMP-2".
+ * Returns <0, 0 or >0 like strcmp.
+ */
+int
+rec_natural_compare(const char *a, const char *b)
+{
+    const char *da;
+    const char *db;
+    size_t la;
+    size_t lb;
+    int ca;
+    int cb;
+
+    while (*a && *b) {
+        if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+            while (*a == '0') {
+                a++;
+            }
+            while (*b == '0') {
+                b++;
+            }
+            for (da = a; isdigit((unsigned char)*da); da++) {
+            }
+            for (db = b; isdigit((unsigned char)*db); db++) {
+            }
+            la = (size_t)(da - a);
+            lb = (size_t)(db - b);
+            if (la != lb) {
+                return la < lb ? -1 : 1;
+            }
+            for (; a < da; a++, b++) {
+                if (*a != *b) {
+                    return *a < *b ? -1 : 1;
+                }
+            }
+            continue;
+        }
+        ca = tolower((unsigned char)*a);
+        cb = tolower((unsigned char)*b);
+        if (ca != cb) {
+            return ca < cb ? -1 : 1;
+        }
+        a++;
+        b++;
+    }
+    return *a ? 1 : (*b ? -1 : 0);
+}
+
+/*
+ * First word of a "%name: value" descriptor line in text. With type set,
+ * only lines of the "%rec: <type>" descriptor count. Returns 1 if found.
+ */
+static int
+descriptor_value(const char *text, const char *type, const char *name,
+                 char *out, size_t size)
+{
+    const char *line;
+    const char *next;
+    const char *value;
+    size_t type_len;
+    size_t len;
+    int in_type;
+
+    in_type = type == NULL;
+    type_len = type ? strlen(type) : 0;
+    len = strlen(name);
+    for (line = text; *line; line = next) {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+
+        if (type && strncmp(line, "%rec:", 5) == 0) {
+            for (value = line + 5; *value == ' '; value++) {
+            }
+            in_type = strncmp(value, type, type_len) == 0 &&
+                      (value[type_len] == '\n' || value[type_len] == ' ' ||
+                       !value[type_len]);
+            continue;
+        }
+        if (!in_type || strncmp(line, name, len) != 0) {
+            continue;
+        }
+
+        for (value = line + len; *value == ' '; value++) {
+        }
+        for (len = 0; value[len] && value[len] != ' ' && value[len] != '\n' &&
+             len + 1 < size; len++) {
+            out[len] = value[len];
+        }
+        out[len] = '\0';
+        return len > 0;
+    }
+    return 0;
+}
+
+/*
+ * Field the store is ordered on: its own %sort, else the %sort of its
+ * record type in the schema. -1 if neither declares one.
+ */
+static int
+store_sort_field(const struct rec_store *store)
+{
+    char schema_path[sizeof(registry_dir) + sizeof(REC_SCHEMA_FILE)];
+    char type[REC_NAME_MAX];
+    char field[REC_NAME_MAX];
+    char *schema;
+    size_t size;
+    int found;
+
+    if (store->header &&
+        descriptor_value(store->header, NULL, "%sort:", field, sizeof(field))) {
+        return rec_field_id(field);
+    }
+    if (!store->header ||
+        !descriptor_value(store->header, NULL, "%rec:", type, sizeof(type))) {
+        return -1;
+    }
+
+    snprintf(schema_path, sizeof(schema_path), "%s/%s", registry_dir,
+             REC_SCHEMA_FILE);
+    schema = rec_read_file(schema_path, &size);
+    if (!schema) {
+        return -1;
+    }
+    found = descriptor_value(schema, type, "%sort:", field, sizeof(field));
+    free(schema);
+    return found ? rec_field_id(field) : -1;
+}
+
+/* Sort key of one record while the order is built */
+struct order_key {
+    const char *value;
+    size_t position;
+};
+
+/* Equal values keep file order, so the order is total and stable */
+static int
+order_key_compare(const void *left, const void *right)
+{
+    const struct order_key *a;
+    const struct order_key *b;
+    int result;
+
+    a = left;
+    b = right;
+    result = rec_natural_compare(a->value, b->value);
+    if (result == 0) {
+        result = a->position < b->position ? -1 : 1;
+    }
+    return result;
+}
+
+static int
+order_build(struct rec_order *order, const struct rec_store *store)
+{
+    struct order_key *keys;
+    const char *value;
+    size_t count;
+    size_t i;
+
+    free(order->positions);
+    order->positions = malloc((store->count + 1) * sizeof(*order->positions));
+    keys = malloc((store->count + 1) * sizeof(*keys));
+    if (!order->positions || !keys) {
+        free(keys);
+        return -1;
+    }
+
+    count = 0;
+    for (i = 0; i < store->count; i++) {
+        value = rec_get_id(store->records[i], (unsigned short)order->field);
+        if (value && value[0]) {
+            keys[count].value = value;
+            keys[count].position = i;
+            count++;
+        }
+    }
+    qsort(keys, count, sizeof(*keys), order_key_compare);
+    for (i = 0; i < count; i++) {
+        order->positions[i] = keys[i].position;
+    }
+    order->count = count;
+    free(keys);
+    return 0;
+}
+
+/*
+ * rec_store_order - Records of a store in %sort order
+ * @store: Store to order
+ *
+ * The order is a sorted array of record positions. It is rebuilt only
+ * after the store changed, so a range scan or a page after a cursor
+ * costs one binary search plus the rows it returns.
+ *
+ * Returns NULL if the store declares no %sort field or on allocation
+ * failure.
+ */
+const struct rec_order *
+rec_store_order(struct rec_store *store)
+{
+    struct rec_order *order;
+    int field;
+
+    order = store->order;
+    if (order && order->version == store->version) {
+        return order->positions ? order : NULL;
+    }
+
+    field = store_sort_field(store);
+    if (field < 0) {
+        return NULL;
+    }
+    if (!order) {
+        order = calloc(1, sizeof(*order));
+        if (!order) {
+            return NULL;
+        }
+        store->order = order;
+    }
+
+    order->field = (unsigned long)field;
+    order->version = store->version;
+    if (order_build(order, store) != 0) {
+        free(order->positions);
+        order->positions = NULL;
+        order->count = 0;
+        return NULL;
+    }
+    return order;
+}
+
+/*
+ * rec_order_seek - Find where a value falls in a store's order
+ * @store: Store the order belongs to
+ * @order: Order from rec_store_order
+ * @value: Value of the sort field
+ * @after: Non-zero to skip records equal to value, as a keyset cursor does
+ *
+ * Returns the index into order->positions of the first record whose sort
+ * value is not less than (after: greater than) value; order->count if
+ * there is none.
+ */
+size_t
+rec_order_seek(const struct rec_store *store, const struct rec_order *order,
+               const char *value, int after)
+{
+    const char *current;
+    size_t low;
+    size_t high;
+    size_t mid;
+    int result;
+
+    low = 0;
+    high = order->count;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        current = rec_get_id(store->records[order->positions[mid]],
+                             (unsigned short)order->field);
+        result = rec_natural_compare(current, value);
+        if (result < 0 || (after && result == 0)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* Mirror a successful file write into the store if it is loaded */
+int
+rec_store_apply(const char *project, const char *text)
+{
+    struct rec_store *store;
+
+    if (!project || !text) {
+        return ERR_PARAM;
+    }
+
+    for (store = registry_head; store; store = store->next) {
+        if (strcmp(store->name, project) == 0) {
+            return rec_store_upsert(store, text, strlen(text));
+        }
+    }
+    return ERR_NONE;
+}
+
+/*
+ * rec_store_sync - Pick up changes made to a project file from outside
+ * @project: Project whose .rec file changed
+ *
+ * Stores that are not loaded are left alone; they read the new file on
+ * first use. Returns the number of records added, edited or removed
+ * (0 if the file matches the store), or -1 if it could not be re-read.
+ */
+long
+rec_store_sync(const char *project)
+{
+    struct rec_store *store;
+
+    if (!rec_valid_project_name(project)) {
+        return -1;
+    }
+    for (store = registry_head; store; store = store->next) {
+        if (strcmp(store->name, project) == 0) {
+            return store_sync(store);
+        }
+    }
+    return 0;
+}
+
+/* Howard Hinnant's days_from_civil */
+long
+rec_days_from_civil(int year, int month, int day)
+{
+    long y;
+    long era;
+    long yoe;
+    long doy;
+    long doe;
+
+    y = (long)year - (month <= 2 ? 1 : 0);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153L * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+void
+rec_civil_from_days(long days, int *year, int *month, int *day)
+{
+    long z;
+    long era;
+    long doe;
+    long yoe;
+    long doy;
+    long mp;
+    long y;
+
+    z = days + 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    y = yoe + era * 400;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *year = (int)(y + (*month <= 2 ? 1 : 0));
+}
+
+static int
+read_number(const char **p, int *digits)
+{
+    int value;
+
+    value = 0;
+    *digits = 0;
+    while (isdigit((unsigned char)**p) && *digits < 9) {
+        value = value * 10 + (**p - '0');
+        (*p)++;
+        (*digits)++;
+    }
+    return value;
+}
+
+/*
+ * rec_parse_date - Parse the date formats found in the record files
+ * @text: "YYYY-MM-DD[Thh:mm:ss...]", "YYYY/MM/DD" or "D/MM/YYYY"
+ *
+ * Returns days since the epoch, or REC_DATE_INVALID.
+ */
+long
+rec_parse_date(const char *text)
+{
+    const char *p;
+    int a;
+    int b;
+    int c;
+    int da;
+    int db;
+    int dc;
+    int year;
+    int month;
+    int day;
+
+    if (!text) {
+        return REC_DATE_INVALID;
+    }
+
+    p = text;
+    while (*p == ' ') {
+        p++;
+    }
+
+    a = read_number(&p, &da);
+    if (da == 0 || (*p != '-' && *p != '/')) {
+        return REC_DATE_INVALID;
+    }
+    p++;
+    b = read_number(&p, &db);
+    if (db == 0 || (*p != '-' && *p != '/')) {
+        return REC_DATE_INVALID;
+    }
+    p++;
+    c = read_number(&p, &dc);
+    if (dc == 0) {
+        return REC_DATE_INVALID;
+    }
+
+    if (da == 4) {
+        year = a;
+        month = b;
+        day = c;
+    } else if (dc == 4) {
+        year = c;
+        month = b;
+        day = a;
+    } else {
+        return REC_DATE_INVALID;
+    }
+
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+        return REC_DATE_INVALID;
+    }
+    return rec_days_from_civil(year, month, day);
+}
+
+long
+rec_today(void)
+{
+    time_t now;
+    struct tm tm;
+
+    now = time(NULL);
+    if (!localtime_r(&now, &tm)) {
+        return (long)(now / 86400);
+    }
+    return rec_days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+void
+rec_format_date(long days, char *out, size_t size)
+{
+    int year;
+    int month;
+    int day;
+
+    if (days == REC_DATE_INVALID) {
+        if (size > 0) {
+            out[0] = '\0';
+        }
+        return;
+    }
+    rec_civil_from_days(days, &year, &month, &day);
+    snprintf(out, size, "%04d-%02d-%02d", year, month, day);
+}
@@ -0,0 +1,278 @@
+/* filepath: src/result_cache.c */
+#include "../include/result_cache.h"
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Serialized responses keyed by request and tagged with the version of
+ * the store they were computed from. A version bump makes every entry of
+ * that store stale; stale entries are dropped when next looked up or when
+ * they reach the cold end of the LRU list.
+ *
+ * A miss makes the caller the leader for that key: an in-flight entry is
+ * published, and anyone asking for the same key and version meanwhile
+ * waits for the leader's result instead of computing it again.
+ */
+struct cache_entry {
+    char *key;
+    char *body;
+    size_t len;
+    unsigned long hash;
+    unsigned long version;
+    unsigned long in_flight;
+    struct cache_entry *chain;
+    struct cache_entry *prev;
+    struct cache_entry *next;
+};
+
+static struct cache_entry *buckets[RESULT_CACHE_BUCKETS];
+static struct cache_entry *lru_head = NULL;     /* Most recently used */
+static struct cache_entry *lru_tail = NULL;
+static size_t cache_entries = 0;
+static size_t cache_bytes = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_done = PTHREAD_COND_INITIALIZER;
+
+/* Counters, protected by cache_lock */
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+static unsigned long cache_coalesced = 0;
+static unsigned long cache_evictions = 0;
+static unsigned long cache_invalidations = 0;
+
+static void
+lru_unlink(struct cache_entry *entry)
+{
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        lru_head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        lru_tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void
+lru_push(struct cache_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = lru_head;
+    if (lru_head) {
+        lru_head->prev = entry;
+    }
+    lru_head = entry;
+    if (!lru_tail) {
+        lru_tail = entry;
+    }
+}
+
+static struct cache_entry *
+find_entry(const char *key, unsigned long hash)
+{
+    struct cache_entry *entry;
+
+    for (entry = buckets[hash % RESULT_CACHE_BUCKETS]; entry; entry = entry->chain) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Unlink from the table and the LRU list, then free; caller holds the lock */
+static void
+remove_entry(struct cache_entry *entry)
+{
+    struct cache_entry **link;
+
+    link = &buckets[entry->hash % RESULT_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+
+    if (!entry->in_flight) {
+        lru_unlink(entry);
+        cache_entries--;
+        cache_bytes -= entry->len;
+    }
+    free(entry->key);
+    free(entry->body);
+    free(entry);
+}
+
+/*
+ * result_cache_begin - Look up a response, or claim the right to compute it
+ * @key: Normalized request, including the project
+ * @version: Current version of the project's store
+ * @out: Receives a copy of the cached body on a hit
+ *
+ * Returns RESULT_CACHE_HIT, or RESULT_CACHE_MISS after which the caller
+ * must call result_cache_finish for the same key and version.
+ */
+int
+result_cache_begin(const char *key, unsigned long version, struct buffer *out)
+{
+    struct cache_entry *entry;
+    unsigned long hash;
+    size_t len;
+    int waited;
+
+    hash = rec_hash(key, strlen(key), 0);
+    waited = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (;;) {
+        entry = find_entry(key, hash);
+        if (entry && entry->in_flight && entry->version == version) {
+            /* Somebody is computing exactly this; wait for them */
+            waited = 1;
+            pthread_cond_wait(&cache_done, &cache_lock);
+            continue;
+        }
+        if (entry && !entry->in_flight && entry->version == version) {
+            buffer_reset(out);
+            if (buffer_append(out, entry->body, entry->len) != 0) {
+                /* Recompute; finish will find the entry already filled */
+                cache_misses++;
+                pthread_mutex_unlock(&cache_lock);
+                return RESULT_CACHE_MISS;
+            }
+            lru_unlink(entry);
+            lru_push(entry);
+            cache_hits++;
+            cache_coalesced += waited ? 1 : 0;
+            pthread_mutex_unlock(&cache_lock);
+            return RESULT_CACHE_HIT;
+        }
+        break;
+    }
+
+    /* Stale or absent: publish an in-flight entry and compute */
+    if (entry && !entry->in_flight) {
+        cache_invalidations++;
+        remove_entry(entry);
+        entry = NULL;
+    }
+    cache_misses++;
+    if (!entry) {
+        len = strlen(key);
+        entry = calloc(1, sizeof(*entry));
+        if (entry && (entry->key = malloc(len + 1)) != NULL) {
+            memcpy(entry->key, key, len + 1);
+            entry->hash = hash;
+            entry->version = version;
+            entry->in_flight = 1;
+            entry->chain = buckets[hash % RESULT_CACHE_BUCKETS];
+            buckets[hash % RESULT_CACHE_BUCKETS] = entry;
+        } else {
+            free(entry);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return RESULT_CACHE_MISS;
+}
+
+/*
+ * result_cache_finish - Publish the response computed after a miss
+ * @key: Key passed to result_cache_begin
+ * @version: Version passed to result_cache_begin
+ * @body: Serialized response, or NULL if it should not be cached
+ * @len: Length of body
+ *
+ * Waiters are released either way; the coldest entries are evicted to
+ * stay within RESULT_CACHE_MAX_ENTRIES and RESULT_CACHE_MAX_BYTES.
+ */
+void
+result_cache_finish(const char *key, unsigned long version,
+                    const char *body, size_t len)
+{
+    struct cache_entry *entry;
+
+    pthread_mutex_lock(&cache_lock);
+    entry = find_entry(key, rec_hash(key, strlen(key), 0));
+    if (entry && entry->in_flight && entry->version == version) {
+        if (!body || len > RESULT_CACHE_MAX_ENTRY ||
+            !(entry->body = malloc(len ? len : 1))) {
+            remove_entry(entry);
+        } else {
+            memcpy(entry->body, body, len);
+            entry->len = len;
+            entry->in_flight = 0;
+            lru_push(entry);
+            cache_entries++;
+            cache_bytes += len;
+
+            while (lru_tail && lru_tail != entry &&
+                   (cache_entries > RESULT_CACHE_MAX_ENTRIES ||
+                    cache_bytes > RESULT_CACHE_MAX_BYTES)) {
+                cache_evictions++;
+                remove_entry(lru_tail);
+            }
+        }
+    }
+    pthread_cond_broadcast(&cache_done);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void
+result_cache_clear(void)
+{
+    struct cache_entry *entry;
+    size_t i;
+
+    pthread_mutex_lock(&cache_lock);
+    for (i = 0; i < RESULT_CACHE_BUCKETS; i++) {
+        while (buckets[i]) {
+            entry = buckets[i];
+            buckets[i] = entry->chain;
+            free(entry->key);
+            free(entry->body);
+            free(entry);
+        }
+    }
+    lru_head = NULL;
+    lru_tail = NULL;
+    cache_entries = 0;
+    cache_bytes = 0;
+    pthread_cond_broadcast(&cache_done);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Counters and occupancy as a JSON object */
+int
+result_cache_stats(struct buffer *out)
+{
+    unsigned long lookups;
+    int result;
+
+    pthread_mutex_lock(&cache_lock);
+    lookups = cache_hits + cache_misses;
+    result = buffer_appendf(out,
+                            "{\"entries\":%lu,\"bytes\":%lu,\"hits\":%lu,"
+                            "\"misses\":%lu,\"hit_ratio\":%.3f,\"coalesced\":%lu,"
+                            "\"evictions\":%lu,\"invalidations\":%lu}",
+                            (unsigned long)cache_entries,
+                            (unsigned long)cache_bytes, cache_hits, cache_misses,
+                            lookups ? (double)cache_hits / (double)lookups : 0.0,
+                            cache_coalesced, cache_evictions, cache_invalidations);
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+/* Lookups that hit and missed so far */
+void
+result_cache_counts(unsigned long *hits, unsigned long *misses)
+{
+    pthread_mutex_lock(&cache_lock);
+    *hits = cache_hits;
+    *misses = cache_misses;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,443 @@
+/* filepath: src/session.c */
+#include "../include/session.h"
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+#include "../include/timer_wheel.h"
+#include "../include/web_server.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Logged-in users keyed by an opaque random token. The table is split
+ * into shards, each with its own lock, so lookups of different sessions
+ * do not contend. Tokens are kept as raw bytes; the hex form only exists
+ * on the wire.
+ *
+ * Each session owns a timer on the wheel. A lookup only moves the
+ * session's deadline forward; when the timer fires before the deadline
+ * it is re-armed for the remainder, so the request path never touches
+ * the wheel. Sessions are created, destroyed and expired on the server
+ * thread that drives the wheel; lookups may come from any thread.
+ */
+struct session {
+    struct session *next;
+    struct timer expiry;
+    unsigned long expires;          /* Tick the session ends, unless used */
+    unsigned long hash;
+    unsigned char id[SESSION_TOKEN_BYTES];
+    char username[SESSION_USER_MAX];
+};
+
+struct session_shard {
+    pthread_mutex_t lock;
+    struct session *buckets[SESSION_BUCKETS];
+    size_t count;
+    unsigned long created;
+    unsigned long expired;
+    unsigned long evicted;
+};
+
+static struct session_shard shards[SESSION_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void
+shards_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < SESSION_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+}
+
+static struct session_shard *
+shard_of(unsigned long hash)
+{
+    pthread_once(&shards_once, shards_init);
+    return &shards[hash & (SESSION_SHARDS - 1)];
+}
+
+static struct session **
+bucket_of(struct session_shard *shard, unsigned long hash)
+{
+    return &shard->buckets[(hash / SESSION_SHARDS) & (SESSION_BUCKETS - 1)];
+}
+
+static unsigned long
+id_hash(const unsigned char *id)
+{
+    return rec_hash((const char *)id, SESSION_TOKEN_BYTES, 0);
+}
+
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Decode exactly SESSION_TOKEN_LEN hex characters; 0 on bad input */
+static int
+token_decode(const char *token, unsigned char *id)
+{
+    size_t i;
+    int hi;
+    int lo;
+
+    for (i = 0; i < SESSION_TOKEN_BYTES; i++) {
+        hi = hex_digit(token[i * 2]);
+        lo = hi < 0 ? -1 : hex_digit(token[i * 2 + 1]);
+        if (lo < 0) {
+            return 0;
+        }
+        id[i] = (unsigned char)(hi * 16 + lo);
+    }
+    return 1;
+}
+
+static void
+token_encode(const unsigned char *id, char *token)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t i;
+
+    for (i = 0; i < SESSION_TOKEN_BYTES; i++) {
+        token[i * 2] = digits[id[i] >> 4];
+        token[i * 2 + 1] = digits[id[i] & 0x0f];
+    }
+    token[SESSION_TOKEN_LEN] = '\0';
+}
+
+static int
+random_id(unsigned char *id)
+{
+    ssize_t n;
+    int fd;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) {
+        return ERR_IO;
+    }
+    n = read(fd, id, SESSION_TOKEN_BYTES);
+    close(fd);
+    return n == SESSION_TOKEN_BYTES ? ERR_NONE : ERR_IO;
+}
+
+/* Unlink a session from its chain; the shard lock is held */
+static void
+session_unlink(struct session_shard *shard, struct session *session)
+{
+    struct session **link;
+
+    for (link = bucket_of(shard, session->hash); *link; link = &(*link)->next) {
+        if (*link == session) {
+            *link = session->next;
+            shard->count--;
+            return;
+        }
+    }
+}
+
+static struct session *
+session_find(struct session_shard *shard, const unsigned char *id,
+             unsigned long hash)
+{
+    struct session *session;
+
+    for (session = *bucket_of(shard, hash); session; session = session->next) {
+        if (session->hash == hash &&
+            memcmp(session->id, id, SESSION_TOKEN_BYTES) == 0) {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+/* Timer callback: end the session, or wait out a deadline moved by use */
+static void
+session_expire(void *arg)
+{
+    struct session *session;
+    struct session_shard *shard;
+    unsigned long now;
+
+    session = arg;
+    shard = shard_of(session->hash);
+    now = timer_wheel_now();
+
+    pthread_mutex_lock(&shard->lock);
+    if ((long)(session->expires - now) > 0) {
+        timer_add(&session->expiry, session->expires - now);
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    session_unlink(shard, session);
+    shard->expired++;
+    pthread_mutex_unlock(&shard->lock);
+    free(session);
+}
+
+/* A full shard gives up the session closest to its deadline */
+static void
+shard_evict(struct session_shard *shard)
+{
+    struct session *oldest;
+    struct session *session;
+    size_t i;
+
+    oldest = NULL;
+    for (i = 0; i < SESSION_BUCKETS; i++) {
+        for (session = shard->buckets[i]; session; session = session->next) {
+            if (!oldest || (long)(session->expires - oldest->expires) < 0) {
+                oldest = session;
+            }
+        }
+    }
+    if (oldest) {
+        session_unlink(shard, oldest);
+        timer_del(&oldest->expiry);
+        shard->evicted++;
+        free(oldest);
+    }
+}
+
+/*
+ * session_create - Start a session for an authenticated user
+ * @username: User the session belongs to
+ * @token: Output, the hex token to hand to the client
+ * @size: Size of token, at least SESSION_TOKEN_LEN + 1
+ *
+ * Returns ERR_NONE, ERR_PARAM, ERR_IO if no random bytes could be read,
+ * or ERR_INTERNAL.
+ */
+int
+session_create(const char *username, char *token, size_t size)
+{
+    struct session_shard *shard;
+    struct session *session;
+    size_t len;
+
+    if (!username || !token || size < SESSION_TOKEN_LEN + 1) {
+        return ERR_PARAM;
+    }
+    len = strlen(username);
+    if (len == 0 || len >= SESSION_USER_MAX) {
+        return ERR_PARAM;
+    }
+
+    session = calloc(1, sizeof(*session));
+    if (!session) {
+        return ERR_INTERNAL;
+    }
+    if (random_id(session->id) != ERR_NONE) {
+        free(session);
+        return ERR_IO;
+    }
+    memcpy(session->username, username, len + 1);
+    session->hash = id_hash(session->id);
+    session->expires = timer_wheel_now() + SESSION_TIMEOUT;
+    timer_init(&session->expiry, session_expire, session);
+    token_encode(session->id, token);
+
+    shard = shard_of(session->hash);
+    pthread_mutex_lock(&shard->lock);
+    if (shard->count >= SESSION_MAX / SESSION_SHARDS) {
+        shard_evict(shard);
+    }
+    session->next = *bucket_of(shard, session->hash);
+    *bucket_of(shard, session->hash) = session;
+    shard->count++;
+    shard->created++;
+    timer_add(&session->expiry, SESSION_TIMEOUT);
+    pthread_mutex_unlock(&shard->lock);
+    return ERR_NONE;
+}
+
+/*
+ * session_lookup - Resolve a token to its user and extend the session
+ * @token: Hex token from the client
+ * @username: Output buffer
+ * @size: Size of username
+ *
+ * Returns ERR_NONE, ERR_PARAM for a malformed token, or ERR_NOTFOUND.
+ */
+int
+session_lookup(const char *token, char *username, size_t size)
+{
+    unsigned char id[SESSION_TOKEN_BYTES];
+    struct session_shard *shard;
+    struct session *session;
+    unsigned long hash;
+    int result;
+
+    if (!token || !username || size == 0 || !token_decode(token, id)) {
+        return ERR_PARAM;
+    }
+
+    hash = id_hash(id);
+    shard = shard_of(hash);
+    result = ERR_NOTFOUND;
+    pthread_mutex_lock(&shard->lock);
+    session = session_find(shard, id, hash);
+    if (session) {
+        session->expires = timer_wheel_now() + SESSION_TIMEOUT;
+        strncpy(username, session->username, size - 1);
+        username[size - 1] = '\0';
+        result = ERR_NONE;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+/* The session cookie's value in a request, or NULL */
+static const char *
+request_token(const char *request)
+{
+    const char *line;
+    const char *end;
+    const char *p;
+    size_t name_len;
+
+    line = strstr(request, "\r\nCookie:");
+    if (!line) {
+        return NULL;
+    }
+    line += 9;
+    end = strstr(line, "\r\n");
+    if (!end) {
+        end = line + strlen(line);
+    }
+
+    name_len = strlen(SESSION_COOKIE);
+    for (p = line; p < end; p++) {
+        if ((p == line || p[-1] == ' ' || p[-1] == ';') &&
+            (size_t)(end - p) > name_len &&
+            strncmp(p, SESSION_COOKIE, name_len) == 0 && p[name_len] == '=') {
+            p += name_len + 1;
+            return end - p >= SESSION_TOKEN_LEN ? p : NULL;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * session_from_request - Authenticated user of a request
+ * @request: Raw request with headers
+ * @username: Output buffer, empty when there is no live session
+ * @size: Size of username
+ *
+ * Returns ERR_NONE or ERR_NOTFOUND.
+ */
+int
+session_from_request(const char *request, char *username, size_t size)
+{
+    const char *token;
+
+    if (!username || size == 0) {
+        return ERR_PARAM;
+    }
+    username[0] = '\0';
+    token = request ? request_token(request) : NULL;
+    if (!token || session_lookup(token, username, size) != ERR_NONE) {
+        username[0] = '\0';
+        return ERR_NOTFOUND;
+    }
+    return ERR_NONE;
+}
+
+/* End a session; ERR_NOTFOUND if the token is not live */
+int
+session_destroy(const char *token)
+{
+    unsigned char id[SESSION_TOKEN_BYTES];
+    struct session_shard *shard;
+    struct session *session;
+    unsigned long hash;
+
+    if (!token || !token_decode(token, id)) {
+        return ERR_PARAM;
+    }
+
+    hash = id_hash(id);
+    shard = shard_of(hash);
+    pthread_mutex_lock(&shard->lock);
+    session = session_find(shard, id, hash);
+    if (session) {
+        session_unlink(shard, session);
+        timer_del(&session->expiry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!session) {
+        return ERR_NOTFOUND;
+    }
+    free(session);
+    return ERR_NONE;
+}
+
+/* End the session a request's cookie names, if any */
+int
+session_destroy_request(const char *request)
+{
+    const char *token;
+
+    token = request ? request_token(request) : NULL;
+    return token ? session_destroy(token) : ERR_NOTFOUND;
+}
+
+void
+session_clear(void)
+{
+    struct session_shard *shard;
+    struct session *session;
+    size_t i;
+    size_t j;
+
+    pthread_once(&shards_once, shards_init);
+    for (i = 0; i < SESSION_SHARDS; i++) {
+        shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (j = 0; j < SESSION_BUCKETS; j++) {
+            while ((session = shard->buckets[j]) != NULL) {
+                shard->buckets[j] = session->next;
+                timer_del(&session->expiry);
+                free(session);
+            }
+        }
+        shard->count = 0;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+int
+session_stats(struct buffer *out)
+{
+    unsigned long totals[4];
+    size_t i;
+
+    pthread_once(&shards_once, shards_init);
+    memset(totals, 0, sizeof(totals));
+    for (i = 0; i < SESSION_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        totals[0] += (unsigned long)shards[i].count;
+        totals[1] += shards[i].created;
+        totals[2] += shards[i].expired;
+        totals[3] += shards[i].evicted;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return buffer_appendf(out,
+                          "{\"live\":%lu,\"created\":%lu,\"expired\":%lu,"
+                          "\"evicted\":%lu}",
+                          totals[0], totals[1], totals[2], totals[3]);
+}
@@ -0,0 +1,80 @@
+/* filepath: src/stats.c */
+#include "../include/stats.h"
+#include "../include/buffer.h"
+#include "../include/log_archive.h"
+#include "../include/log_writer.h"
+#include "../include/query.h"
+#include "../include/record_store.h"
+#include "../include/result_cache.h"
+#include "../include/session.h"
+#include "../include/web_server.h"
+
+/*
+ * handle_stats_request - Report internal data structure statistics
+ * @client_socket: Socket to send response
+ *
+ * Each subsystem contributes one member of the JSON object.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_stats_request(int client_socket)
+{
+    struct buffer body;
+    int result;
+
+    buffer_init(&body);
+    result = buffer_append_str(&body, "{\"interning\":");
+    if (result == 0) {
+        result = rec_dict_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, ",\"query\":");
+    }
+    if (result == 0) {
+        result = query_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, ",\"result_cache\":");
+    }
+    if (result == 0) {
+        result = result_cache_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, ",\"registry\":");
+    }
+    if (result == 0) {
+        result = rec_registry_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, ",\"sessions\":");
+    }
+    if (result == 0) {
+        result = session_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, ",\"logging\":");
+    }
+    if (result == 0) {
+        result = log_writer_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, ",\"compression\":");
+    }
+    if (result == 0) {
+        result = log_archive_stats(&body);
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, "}");
+    }
+
+    if (result != 0) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", "application/json",
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
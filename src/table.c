@@ -0,0 +1,575 @@
+/* filepath: src/table.c */
+#include "../include/table.h"
+#include "../include/record_store.h"
+#include "../include/web_server.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Project pages show one row per obligation with these columns. The rows
+ * are rendered here as HTML and streamed from the record store, so the
+ * browser neither downloads the whole .rec file nor parses it.
+ */
+static const char *const table_columns[] = {
+    "Procedure", "Environmental_Aspect", "Obligation_Number",
+    "Responsibility", "ProjectPhase", "Action_DueDate", "Status",
+    "Recurring_Obligation", "Recurring_Frequency"
+};
+
+#define TABLE_COLUMNS (sizeof(table_columns) / sizeof(table_columns[0]))
+#define TABLE_DUE_FIELD "Action_DueDate"
+
+/* due= row selections */
+#define TABLE_DUE_ALL 0
+#define TABLE_DUE_WARNING 1
+#define TABLE_DUE_OVERDUE 2
+
+/*
+ * Record positions of one store version sorted on one field, ascending.
+ * Records without the field follow the sorted ones in file order, so a
+ * descending walk reads the first filled positions backwards and still
+ * ends with the empty ones.
+ */
+struct table_order {
+    size_t *positions;
+    size_t count;
+    size_t filled;
+    unsigned long version;
+    unsigned long field;
+};
+
+/* Sort key of one record, extracted once before sorting */
+struct table_key {
+    const char *text;
+    long day;
+    size_t position;
+};
+
+/* Row selection of one request */
+struct table_filter {
+    char needles[TABLE_COLUMNS][TABLE_FILTER_MAX];
+    unsigned long fields[TABLE_COLUMNS];
+    long today;
+    int due;
+    int active;
+};
+
+static struct table_order orders[TABLE_ORDER_CACHE];
+static size_t order_clock = 0;
+
+void
+table_cache_clear(void)
+{
+    size_t i;
+
+    for (i = 0; i < TABLE_ORDER_CACHE; i++) {
+        free(orders[i].positions);
+        memset(&orders[i], 0, sizeof(orders[i]));
+    }
+    order_clock = 0;
+}
+
+/* Dates compare as dates in whatever format they were typed; ties keep file order */
+static int
+compare_keys(const void *left, const void *right)
+{
+    const struct table_key *a;
+    const struct table_key *b;
+    int result;
+
+    a = left;
+    b = right;
+    if (a->day != REC_DATE_INVALID && b->day != REC_DATE_INVALID) {
+        result = a->day < b->day ? -1 : (a->day > b->day ? 1 : 0);
+    } else {
+        result = rec_natural_compare(a->text, b->text);
+    }
+    if (result == 0) {
+        result = a->position < b->position ? -1 : 1;
+    }
+    return result;
+}
+
+/* Sort a store on one field, or reuse the order of an earlier request */
+static const struct table_order *
+table_order(const struct rec_store *store, unsigned short field)
+{
+    struct table_order *order;
+    struct table_key *keys;
+    const char *value;
+    size_t filled;
+    size_t empty;
+    size_t i;
+
+    for (i = 0; i < TABLE_ORDER_CACHE; i++) {
+        if (orders[i].positions && orders[i].version == store->version &&
+            orders[i].field == field) {
+            return &orders[i];
+        }
+    }
+
+    order = &orders[order_clock++ % TABLE_ORDER_CACHE];
+    free(order->positions);
+    memset(order, 0, sizeof(*order));
+
+    order->positions = malloc((store->count ? store->count : 1) * sizeof(size_t));
+    keys = malloc((store->count ? store->count : 1) * sizeof(*keys));
+    if (!order->positions || !keys) {
+        free(order->positions);
+        free(keys);
+        order->positions = NULL;
+        return NULL;
+    }
+
+    filled = 0;
+    for (i = 0; i < store->count; i++) {
+        value = rec_get_id(store->records[i], field);
+        if (value && value[0]) {
+            keys[filled].text = value;
+            keys[filled].day = rec_parse_date(value);
+            keys[filled].position = i;
+            filled++;
+        }
+    }
+    qsort(keys, filled, sizeof(*keys), compare_keys);
+
+    for (i = 0; i < filled; i++) {
+        order->positions[i] = keys[i].position;
+    }
+    empty = filled;
+    for (i = 0; i < store->count; i++) {
+        value = rec_get_id(store->records[i], field);
+        if (!value || !value[0]) {
+            order->positions[empty++] = i;
+        }
+    }
+    free(keys);
+
+    order->count = store->count;
+    order->filled = filled;
+    order->version = store->version;
+    order->field = field;
+    return order;
+}
+
+/* Position of the i-th record in the requested order */
+static size_t
+order_at(const struct table_order *order, size_t i, int descending)
+{
+    if (!order) {
+        return i;
+    }
+    if (descending && i < order->filled) {
+        return order->positions[order->filled - 1 - i];
+    }
+    return order->positions[i];
+}
+
+/* Days until the record's action is due, or REC_DATE_INVALID */
+static long
+days_until_due(const struct rec_record *record, long today)
+{
+    long day;
+
+    day = rec_parse_date(rec_get(record, TABLE_DUE_FIELD));
+    return day == REC_DATE_INVALID ? REC_DATE_INVALID : day - today;
+}
+
+/* Case-insensitive substring test */
+static int
+contains_text(const char *haystack, const char *needle)
+{
+    size_t i;
+
+    for (; *haystack; haystack++) {
+        for (i = 0; needle[i] && haystack[i] &&
+             tolower((unsigned char)haystack[i]) ==
+             tolower((unsigned char)needle[i]); i++) {
+        }
+        if (!needle[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Column filters match case-insensitive substrings, like the page used to */
+static int
+row_matches(const struct rec_record *record, const struct table_filter *filter)
+{
+    const char *value;
+    long days;
+    size_t i;
+
+    if (filter->due != TABLE_DUE_ALL) {
+        days = days_until_due(record, filter->today);
+        if (days == REC_DATE_INVALID ||
+            (filter->due == TABLE_DUE_OVERDUE && days >= 0) ||
+            (filter->due == TABLE_DUE_WARNING &&
+             (days < 0 || days > TABLE_WARNING_DAYS))) {
+            return 0;
+        }
+    }
+    for (i = 0; i < TABLE_COLUMNS; i++) {
+        if (!filter->needles[i][0]) {
+            continue;
+        }
+        value = rec_get_id(record, (unsigned short)filter->fields[i]);
+        if (!value || !contains_text(value, filter->needles[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Write text as HTML; folded continuation lines become line breaks */
+static void
+write_html(struct chunked_writer *writer, const char *value)
+{
+    const char *run;
+    const char *entity;
+
+    if (!value) {
+        return;
+    }
+    for (run = value; *value; value++) {
+        switch (*value) {
+        case '&':
+            entity = "&amp;";
+            break;
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '"':
+            entity = "&quot;";
+            break;
+        case '\'':
+            entity = "&#39;";
+            break;
+        case '\n':
+            entity = "<br>";
+            break;
+        default:
+            continue;
+        }
+        chunked_write(writer, run, (size_t)(value - run));
+        chunked_write(writer, entity, strlen(entity));
+        run = value + 1;
+    }
+    chunked_write(writer, run, (size_t)(value - run));
+}
+
+static void
+write_row(struct chunked_writer *writer, const struct rec_record *record,
+          const struct table_filter *filter)
+{
+    long days;
+    size_t i;
+
+    chunked_write(writer, "<tr data-key=\"", 14);
+    write_html(writer, rec_get(record, REC_KEY_FIELD));
+    days = days_until_due(record, filter->today);
+    if (days != REC_DATE_INVALID && days < 0) {
+        chunked_write(writer, "\" class=\"overdue", 16);
+    } else if (days != REC_DATE_INVALID && days <= TABLE_WARNING_DAYS) {
+        chunked_write(writer, "\" class=\"warning", 16);
+    }
+    chunked_write(writer, "\">", 2);
+    for (i = 0; i < TABLE_COLUMNS; i++) {
+        chunked_write(writer, "<td>", 4);
+        write_html(writer, rec_get_id(record, (unsigned short)filter->fields[i]));
+        chunked_write(writer, "</td>", 5);
+    }
+    chunked_write(writer, "</tr>\n", 6);
+}
+
+/* Read due= and f0..f8= from the query; returns ERR_PARAM on bad values */
+static int
+parse_filter(const char *query, struct table_filter *filter)
+{
+    char name[8];
+    char value[16];
+    int id;
+    size_t i;
+
+    memset(filter, 0, sizeof(*filter));
+    filter->today = rec_today();
+    filter->due = TABLE_DUE_ALL;
+    if (get_query_param(query, "due", value, sizeof(value)) && value[0] &&
+        strcmp(value, "all") != 0) {
+        if (strcmp(value, "warning") == 0) {
+            filter->due = TABLE_DUE_WARNING;
+        } else if (strcmp(value, "overdue") == 0) {
+            filter->due = TABLE_DUE_OVERDUE;
+        } else {
+            return ERR_PARAM;
+        }
+        filter->active = 1;
+    }
+
+    for (i = 0; i < TABLE_COLUMNS; i++) {
+        id = rec_field_id(table_columns[i]);
+        if (id < 0) {
+            return ERR_INTERNAL;
+        }
+        filter->fields[i] = (unsigned long)id;
+        snprintf(name, sizeof(name), "f%lu", (unsigned long)i);
+        if (get_query_param(query, name, filter->needles[i],
+                            sizeof(filter->needles[i])) &&
+            filter->needles[i][0]) {
+            filter->active = 1;
+        }
+    }
+    return ERR_NONE;
+}
+
+/*
+ * Rows of one request in walking order. With keys set the walk covers
+ * keys->positions[begin .. end), the store's %sort order, so ranges and
+ * cursors cost a binary search; otherwise it covers every record through
+ * a cached sort, or in file order when sorted is NULL.
+ */
+struct table_walk {
+    const struct rec_order *keys;
+    const struct table_order *sorted;
+    size_t begin;
+    size_t end;
+    int descending;
+    int pad;
+};
+
+static size_t
+walk_position(const struct table_walk *walk, size_t i)
+{
+    if (walk->keys) {
+        return walk->keys->positions[walk->descending ? walk->end - 1 - i :
+                                     walk->begin + i];
+    }
+    return order_at(walk->sorted, i, walk->descending);
+}
+
+/*
+ * Choose the walk for sort=, from=, to= and after=. Ranges and cursors
+ * are on the %sort field; sorting on it uses the store's own order as
+ * long as every record has the field, and a cached sort on it when some
+ * do not. Returns ERR_PARAM for a range on
+ * a store or field without one, ERR_INTERNAL if sorting failed.
+ */
+static int
+plan_walk(struct rec_store *store, const char *query, struct table_walk *walk)
+{
+    const struct rec_order *keys;
+    char sort[REC_NAME_MAX];
+    char from[TABLE_FILTER_MAX];
+    char to[TABLE_FILTER_MAX];
+    char after[TABLE_FILTER_MAX];
+    char value[8];
+    size_t bound;
+    int ranged;
+    int field;
+
+    memset(walk, 0, sizeof(*walk));
+    walk->descending = get_query_param(query, "order", value, sizeof(value)) &&
+                       strcmp(value, "desc") == 0;
+    get_query_param(query, "from", from, sizeof(from));
+    get_query_param(query, "to", to, sizeof(to));
+    get_query_param(query, "after", after, sizeof(after));
+    ranged = from[0] || to[0] || after[0];
+
+    field = -1;
+    if (get_query_param(query, "sort", sort, sizeof(sort)) && sort[0]) {
+        field = rec_field_lookup(sort);
+        if (field < 0) {
+            return ERR_NOTFOUND;
+        }
+    }
+
+    keys = rec_store_order(store);
+    if (keys && (field < 0 || (unsigned long)field == keys->field) &&
+        (ranged || keys->count == store->count)) {
+        walk->keys = keys;
+        walk->end = keys->count;
+        if (from[0]) {
+            walk->begin = rec_order_seek(store, keys, from, 0);
+        }
+        if (to[0]) {
+            walk->end = rec_order_seek(store, keys, to, 1);
+        }
+        if (after[0] && !walk->descending) {
+            bound = rec_order_seek(store, keys, after, 1);
+            walk->begin = bound > walk->begin ? bound : walk->begin;
+        } else if (after[0]) {
+            bound = rec_order_seek(store, keys, after, 0);
+            walk->end = bound < walk->end ? bound : walk->end;
+        }
+        if (walk->end < walk->begin) {
+            walk->end = walk->begin;
+        }
+        return ERR_NONE;
+    }
+    if (ranged) {
+        return ERR_PARAM;
+    }
+
+    /* Some records lack the %sort field: they follow the sorted ones */
+    if (field < 0 && keys) {
+        field = (int)keys->field;
+    }
+    walk->end = store->count;
+    if (field >= 0) {
+        walk->sorted = table_order(store, (unsigned short)field);
+        if (!walk->sorted) {
+            return ERR_INTERNAL;
+        }
+    }
+    return ERR_NONE;
+}
+
+/*
+ * handle_table_request - Stream one page of a project's obligations table
+ * @client_socket: Socket to send response
+ * @uri: Request URI, /api/table?project=<name>[&sort=<Field>][&order=desc]
+ *      [&page=<n>][&size=<n>][&from=<key>][&to=<key>][&after=<key>]
+ *      [&due=warning|overdue][&f<column>=<text>...]
+ *
+ * The body is the page's <tr> rows, written into HTTP_CHUNK_SIZE chunks
+ * as they are rendered, so the first screenful reaches the browser
+ * before the rest of the page is built. Without sort= rows follow the
+ * project's %sort field, or file order if it declares none. from= and
+ * to= bound the %sort field inclusively; after= continues past a cursor
+ * instead of counting pages. X-Next-Cursor gives the cursor for the
+ * following page, X-Total-Count the number of matching rows for the
+ * pager unless a filtered cursor walk would have to count them all.
+ * Rows due within TABLE_WARNING_DAYS carry class "warning", late ones
+ * "overdue".
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_table_request(int client_socket, const char *uri)
+{
+    struct table_filter filter;
+    struct table_walk walk;
+    struct chunked_writer writer;
+    struct rec_store *store;
+    struct rec_record *record;
+    const char *query;
+    const char *cursor;
+    size_t *rows;
+    char project[REC_NAME_MAX];
+    char value[32];
+    char headers[256];
+    size_t total;
+    size_t skip;
+    size_t count;
+    size_t used;
+    size_t i;
+    long page;
+    long size;
+    int keyset;
+    int result;
+    int len;
+
+    query = strchr(uri, '?');
+    query = query ? query + 1 : "";
+
+    if (!get_query_param(query, "project", project, sizeof(project))) {
+        strcpy(project, "scjv");
+    }
+    store = rec_store_get(project);
+    if (!store) {
+        return send_error_json(client_socket, "404 Not Found", "Unknown project");
+    }
+
+    page = 1;
+    if (get_query_param(query, "page", value, sizeof(value)) && value[0]) {
+        page = atol(value);
+    }
+    size = TABLE_PAGE_SIZE;
+    if (get_query_param(query, "size", value, sizeof(value)) && value[0]) {
+        size = atol(value);
+    }
+    if (page < 1 || size < 1 || size > TABLE_PAGE_MAX) {
+        return send_error_json(client_socket, "400 Bad Request", "Invalid page");
+    }
+    keyset = get_query_param(query, "after", value, sizeof(value)) && value[0];
+
+    result = parse_filter(query, &filter);
+    if (result == ERR_NONE) {
+        result = plan_walk(store, query, &walk);
+    }
+    switch (result) {
+    case ERR_NONE:
+        break;
+    case ERR_NOTFOUND:
+        return send_error_json(client_socket, "400 Bad Request",
+                               "Unknown sort field");
+    case ERR_PARAM:
+        return send_error_json(client_socket, "400 Bad Request",
+                               "Invalid filter");
+    default:
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+
+    /* Pick the page's rows first: the headers describe them */
+    rows = malloc(((size_t)size + 1) * sizeof(*rows));
+    if (!rows) {
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    skip = keyset ? 0 : (size_t)(page - 1) * (size_t)size;
+    count = 0;
+    total = 0;
+    for (i = 0; i < walk.end - walk.begin; i++) {
+        record = store->records[walk_position(&walk, i)];
+        if (filter.active && !row_matches(record, &filter)) {
+            continue;
+        }
+        total++;
+        if (skip) {
+            skip--;
+        } else if (count <= (size_t)size) {
+            rows[count++] = walk_position(&walk, i);
+        } else if (keyset || !filter.active) {
+            break;
+        }
+    }
+
+    used = 0;
+    len = 0;
+    if (!keyset || !filter.active) {
+        len = snprintf(headers, sizeof(headers), "X-Total-Count: %lu\r\n",
+                       (unsigned long)(filter.active ? total :
+                                       walk.end - walk.begin));
+    }
+    used += len > 0 ? (size_t)len : 0;
+    cursor = count > (size_t)size && walk.keys ?
+        rec_get_id(store->records[rows[size - 1]], (unsigned short)walk.keys->field) :
+        NULL;
+    if (cursor && !strpbrk(cursor, "\r\n") &&
+        strlen(cursor) < TABLE_FILTER_MAX) {
+        len = snprintf(headers + used, sizeof(headers) - used,
+                       "X-Next-Cursor: %s\r\n", cursor);
+        used += len > 0 ? (size_t)len : 0;
+    }
+    snprintf(headers + used, sizeof(headers) - used,
+             "Cache-Control: no-cache\r\nX-Page: %ld\r\nX-Page-Size: %ld\r\n",
+             page, size);
+
+    if (chunked_begin(&writer, client_socket, "text/html; charset=utf-8",
+                      headers) != 0) {
+        free(rows);
+        return -1;
+    }
+    for (i = 0; i < count && i < (size_t)size && !writer.error; i++) {
+        write_row(&writer, store->records[rows[i]], &filter);
+    }
+    free(rows);
+    return chunked_end(&writer);
+}
@@ -0,0 +1,215 @@
+/* filepath: src/timer_wheel.c */
+#include "../include/timer_wheel.h"
+#include <stddef.h>
+#include <time.h>
+
+/* Wheel state: base is the next tick still to be processed */
+static struct {
+    struct timer slots[TIMER_LEVELS][TIMER_SLOTS];
+    unsigned long base;
+    int ready;
+    int pad;
+} wheel;
+
+static void
+list_init(struct timer *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void
+list_add_tail(struct timer *head, struct timer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void
+list_unlink(struct timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = NULL;
+    t->prev = NULL;
+}
+
+static void
+wheel_setup(unsigned long now)
+{
+    int level;
+    int slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            list_init(&wheel.slots[level][slot]);
+        }
+    }
+    wheel.base = now;
+    wheel.ready = 1;
+}
+
+/* Place a timer in the level whose span covers its remaining delay */
+static void
+wheel_insert(struct timer *t)
+{
+    unsigned long delta;
+    unsigned long expires;
+    unsigned int shift;
+    int level;
+
+    if ((long)(t->expires - wheel.base) < 0) {
+        /* Already due: run on the next processed tick */
+        list_add_tail(&wheel.slots[0][wheel.base & TIMER_SLOT_MASK], t);
+        return;
+    }
+
+    expires = t->expires;
+    delta = expires - wheel.base;
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (delta < (1UL << (TIMER_SLOT_BITS * (unsigned int)(level + 1)))) {
+            break;
+        }
+    }
+
+    /* Clamp delays beyond the wheel horizon to the last slot */
+    if (level == TIMER_LEVELS - 1 &&
+        delta >= (1UL << (TIMER_SLOT_BITS * TIMER_LEVELS))) {
+        expires = wheel.base + (1UL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+        t->expires = expires;
+    }
+
+    shift = TIMER_SLOT_BITS * (unsigned int)level;
+    list_add_tail(&wheel.slots[level][(expires >> shift) & TIMER_SLOT_MASK], t);
+}
+
+/* Move every timer of one upper-level slot down the hierarchy */
+static unsigned long
+wheel_cascade(int level, unsigned long index)
+{
+    struct timer pending;
+    struct timer *head;
+    struct timer *t;
+
+    head = &wheel.slots[level][index];
+    if (head->next == head) {
+        return index;
+    }
+
+    /* Detach the whole slot before re-inserting */
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+
+    while (pending.next != &pending) {
+        t = pending.next;
+        list_unlink(t);
+        wheel_insert(t);
+    }
+
+    return index;
+}
+
+void
+timer_wheel_init(unsigned long now)
+{
+    wheel_setup(now);
+}
+
+unsigned long
+timer_wheel_now(void)
+{
+    if (!wheel.ready) {
+        wheel_setup((unsigned long)time(NULL));
+    }
+    return wheel.base;
+}
+
+void
+timer_init(struct timer *t, void (*fn)(void *arg), void *arg)
+{
+    t->next = NULL;
+    t->prev = NULL;
+    t->fn = fn;
+    t->arg = arg;
+    t->expires = 0;
+}
+
+int
+timer_pending(const struct timer *t)
+{
+    return t->next != NULL;
+}
+
+void
+timer_add(struct timer *t, unsigned long delay)
+{
+    if (!wheel.ready) {
+        wheel_setup((unsigned long)time(NULL));
+    }
+    if (timer_pending(t)) {
+        list_unlink(t);
+    }
+    t->expires = wheel.base + delay;
+    wheel_insert(t);
+}
+
+void
+timer_del(struct timer *t)
+{
+    if (timer_pending(t)) {
+        list_unlink(t);
+    }
+}
+
+/* Process every tick up to and including now, running expired timers */
+void
+timer_wheel_advance(unsigned long now)
+{
+    struct timer expired;
+    struct timer *head;
+    struct timer *t;
+    unsigned long index;
+    int level;
+
+    if (!wheel.ready) {
+        wheel_setup(now);
+    }
+
+    while ((long)(now - wheel.base) >= 0) {
+        index = wheel.base & TIMER_SLOT_MASK;
+
+        /* Refill level 0 from the upper levels when it wraps */
+        level = 1;
+        while (index == 0 && level < TIMER_LEVELS) {
+            index = wheel_cascade(level,
+                (wheel.base >> (TIMER_SLOT_BITS * (unsigned int)level)) &
+                TIMER_SLOT_MASK);
+            level++;
+        }
+        index = wheel.base & TIMER_SLOT_MASK;
+        wheel.base++;
+
+        head = &wheel.slots[0][index];
+        if (head->next == head) {
+            continue;
+        }
+
+        /* Detach the slot so callbacks may safely re-arm themselves */
+        expired.next = head->next;
+        expired.prev = head->prev;
+        expired.next->prev = &expired;
+        expired.prev->next = &expired;
+        list_init(head);
+
+        while (expired.next != &expired) {
+            t = expired.next;
+            list_unlink(t);
+            t->fn(t->arg);
+        }
+    }
+}
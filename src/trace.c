@@ -0,0 +1,343 @@
+/* filepath: src/trace.c */
+#include "../include/trace.h"
+#include "../include/buffer.h"
+#include "../include/web_server.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * One request in trace_every is traced: the phases it goes through are
+ * timed into a ring owned by the thread that handles it, each span a
+ * name, a start, a duration and the request it belongs to. A dump turns
+ * every ring into Chrome trace JSON, which chrome://tracing and
+ * Perfetto load as one track per thread.
+ *
+ * A ring is written by its owner and read only by a dump, so its lock
+ * is never contended. Spans outside a sampled request, and on threads
+ * past TRACE_RINGS_MAX, are not recorded.
+ */
+unsigned long trace_every = 0;
+
+struct trace_event {
+    const char *name;
+    unsigned long start;                /* Nanoseconds, CLOCK_MONOTONIC */
+    unsigned long duration;
+    unsigned long request;
+    char detail[TRACE_DETAIL_MAX];
+};
+
+struct trace_ring {
+    struct trace_event events[TRACE_RING_SIZE];
+    pthread_mutex_t lock;
+    unsigned long head;                 /* Spans ever recorded */
+    unsigned long seen;                 /* Requests begun on this thread */
+    unsigned long request;              /* Request being traced, or 0 */
+    struct timespec start;
+    char detail[TRACE_DETAIL_MAX];
+    int owned;
+    int index;
+};
+
+static struct trace_ring *rings[TRACE_RINGS_MAX];
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static unsigned long next_request = 0;
+
+static void
+ring_disown(void *ring)
+{
+    __atomic_store_n(&((struct trace_ring *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void
+ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_disown);
+}
+
+/* The calling thread's ring, if it has one */
+static struct trace_ring *
+ring_get(void)
+{
+    pthread_once(&ring_key_once, ring_key_create);
+    return pthread_getspecific(ring_key);
+}
+
+/* The calling thread's ring, claiming a free one on first use */
+static struct trace_ring *
+ring_own(void)
+{
+    struct trace_ring *ring;
+    int i;
+
+    ring = ring_get();
+    if (ring) {
+        return ring;
+    }
+    for (i = 0; i < TRACE_RINGS_MAX; i++) {
+        ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (!ring) {
+            ring = calloc(1, sizeof(*ring));
+            if (!ring) {
+                return NULL;
+            }
+            pthread_mutex_init(&ring->lock, NULL);
+            ring->owned = 1;
+            ring->index = i;
+            if (__sync_bool_compare_and_swap(&rings[i], NULL, ring)) {
+                break;
+            }
+            pthread_mutex_destroy(&ring->lock);
+            free(ring);
+            ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        }
+        if (__sync_bool_compare_and_swap(&ring->owned, 0, 1)) {
+            break;
+        }
+    }
+    if (i == TRACE_RINGS_MAX) {
+        return NULL;
+    }
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static unsigned long
+nanoseconds(const struct timespec *ts)
+{
+    return (unsigned long)ts->tv_sec * 1000000000UL + (unsigned long)ts->tv_nsec;
+}
+
+static void
+record(struct trace_ring *ring, const char *name, const struct timespec *start,
+       const char *detail)
+{
+    struct trace_event *event;
+    struct timespec now;
+    unsigned long from;
+    unsigned long to;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    from = nanoseconds(start);
+    to = nanoseconds(&now);
+
+    pthread_mutex_lock(&ring->lock);
+    event = &ring->events[ring->head % TRACE_RING_SIZE];
+    event->name = name;
+    event->start = from;
+    event->duration = to > from ? to - from : 0;
+    event->request = ring->request;
+    strcpy(event->detail, detail);
+    ring->head++;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ * trace_set_sample - Trace one request in every
+ * @every: Sampling interval; 1 traces every request and 0 none
+ *
+ * Set before the server starts, like the diagnostics level.
+ */
+void
+trace_set_sample(unsigned long every)
+{
+    trace_every = every;
+}
+
+/* Decide whether the request this thread starts now is traced */
+void
+trace_request_begin(void)
+{
+    struct trace_ring *ring;
+
+    if (__builtin_expect(trace_every == 0, 1)) {
+        return;
+    }
+    ring = ring_own();
+    if (!ring || ring->seen++ % trace_every != 0) {
+        return;
+    }
+    ring->request = __sync_add_and_fetch(&next_request, 1);
+    ring->detail[0] = '\0';
+    clock_gettime(CLOCK_MONOTONIC, &ring->start);
+}
+
+/* Keep the URI of the request being traced, cut to TRACE_DETAIL_MAX */
+void
+trace_request_uri(const char *uri)
+{
+    struct trace_ring *ring;
+
+    if (__builtin_expect(trace_every == 0, 1)) {
+        return;
+    }
+    ring = ring_get();
+    if (ring && ring->request && uri) {
+        strncpy(ring->detail, uri, sizeof(ring->detail) - 1);
+        ring->detail[sizeof(ring->detail) - 1] = '\0';
+    }
+}
+
+/* Record the whole request, if it was traced */
+void
+trace_request_end(void)
+{
+    struct trace_ring *ring;
+
+    if (__builtin_expect(trace_every == 0, 1)) {
+        return;
+    }
+    ring = ring_get();
+    if (ring && ring->request) {
+        record(ring, "request", &ring->start, ring->detail);
+        ring->request = 0;
+    }
+}
+
+/* Called by TRACE_BEGIN; leaves span->name NULL unless the request is traced */
+void
+trace_span_begin(struct trace_span *span, const char *name)
+{
+    struct trace_ring *ring;
+
+    ring = ring_get();
+    if (ring && ring->request) {
+        span->name = name;
+        clock_gettime(CLOCK_MONOTONIC, &span->start);
+    }
+}
+
+/* Called by TRACE_END */
+void
+trace_span_end(const struct trace_span *span)
+{
+    struct trace_ring *ring;
+
+    ring = ring_get();
+    if (ring && ring->request) {
+        record(ring, span->name, &span->start, "");
+    }
+}
+
+static int
+render_event(struct buffer *out, const struct trace_event *event, int tid,
+             int first)
+{
+    int result;
+
+    result = buffer_appendf(out,
+                            "%s{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\","
+                            "\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,\"pid\":%ld,"
+                            "\"tid\":%d,\"args\":{\"request\":%lu",
+                            first ? "" : ",\n", event->name,
+                            event->start / 1000UL, event->start % 1000UL,
+                            event->duration / 1000UL, event->duration % 1000UL,
+                            (long)getpid(), tid, event->request);
+    if (result == 0 && event->detail[0]) {
+        result = buffer_append_str(out, ",\"uri\":");
+        if (result == 0) {
+            result = buffer_append_json(out, event->detail);
+        }
+    }
+    if (result == 0) {
+        result = buffer_append_str(out, "}}");
+    }
+    return result;
+}
+
+/*
+ * trace_render - Append the spans in every ring as Chrome trace JSON
+ * @out: Buffer to append to
+ *
+ * Returns 0 on success, -1 on allocation failure.
+ */
+int
+trace_render(struct buffer *out)
+{
+    struct trace_ring *ring;
+    unsigned long from;
+    unsigned long i;
+    int first;
+    int result;
+    int r;
+
+    first = 1;
+    result = buffer_append_str(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (r = 0; r < TRACE_RINGS_MAX && result == 0; r++) {
+        ring = __atomic_load_n(&rings[r], __ATOMIC_ACQUIRE);
+        if (!ring) {
+            continue;
+        }
+        pthread_mutex_lock(&ring->lock);
+        from = ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE : 0;
+        for (i = from; i < ring->head && result == 0; i++) {
+            result = render_event(out, &ring->events[i % TRACE_RING_SIZE],
+                                  ring->index, first);
+            first = 0;
+        }
+        pthread_mutex_unlock(&ring->lock);
+    }
+    if (result == 0) {
+        result = buffer_append_str(out, "\n]}\n");
+    }
+    return result;
+}
+
+/*
+ * trace_dump - Write the spans in every ring to a file
+ * @path: File to replace
+ *
+ * Returns ERR_NONE, ERR_INTERNAL if out of memory or ERR_IO.
+ */
+int
+trace_dump(const char *path)
+{
+    struct buffer out;
+    FILE *fp;
+    int result;
+
+    buffer_init(&out);
+    if (trace_render(&out) != 0) {
+        buffer_free(&out);
+        return ERR_INTERNAL;
+    }
+    result = ERR_IO;
+    fp = fopen(path, "w");
+    if (fp) {
+        if (fwrite(out.data, 1, out.len, fp) == out.len) {
+            result = ERR_NONE;
+        }
+        if (fclose(fp) != 0) {
+            result = ERR_IO;
+        }
+    }
+    buffer_free(&out);
+    return result;
+}
+
+/*
+ * handle_trace_request - Serve the recent traces for a trace viewer
+ * @client_socket: Socket to send response
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_trace_request(int client_socket)
+{
+    struct buffer body;
+    int result;
+
+    buffer_init(&body);
+    if (trace_render(&body) != 0) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", "application/json",
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
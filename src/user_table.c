@@ -0,0 +1,517 @@
+/* filepath: src/user_table.c */
+#include "../include/user_table.h"
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+#include "../include/timer_wheel.h"
+#include "../include/web_server.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * The auth file parsed once into an open-addressed hash on username,
+ * with the /users body serialized from the same read. A snapshot is
+ * never modified after it is built: a reload builds a new one and swaps
+ * it in under the write lock, so lookups from any thread only take the
+ * read lock and never touch the file. Rewrites of the file and reloads
+ * are serialized by reload_lock. The file's stamp is checked from
+ * the timer wheel, not on the login path.
+ */
+struct user_snapshot {
+    struct user_entry *entries;
+    size_t *slots;                  /* Entry index + 1; 0 is empty */
+    size_t count;
+    size_t size;                    /* Slot count, a power of two */
+    char *users;
+    size_t users_len;
+};
+
+/* What the loaded snapshot was read from */
+struct user_stamp {
+    struct timespec mtime;
+    unsigned long size;
+    unsigned long inode;
+};
+
+static struct user_snapshot *table = NULL;
+static struct user_stamp table_stamp;
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static char table_path[256] = AUTH_FILE;
+static struct timer check_timer;
+
+/*
+ * user_table_parse_line - Split one auth file line into an entry
+ * @line: Line without comments; modified in place
+ * @entry: Output entry, cleared first
+ *
+ * Format: Username:Password:UID:GID:FullName:HomeDir:Shell[:IsAdmin]
+ * Returns the number of fields found.
+ */
+int
+user_table_parse_line(char *line, struct user_entry *entry)
+{
+    char *token;
+    char *saveptr;
+    int fields;
+
+    memset(entry, 0, sizeof(*entry));
+    line[strcspn(line, "\r\n")] = '\0';
+
+    fields = 0;
+    for (token = strtok_r(line, ":", &saveptr); token && fields < 8;
+         token = strtok_r(NULL, ":", &saveptr)) {
+        switch (fields) {
+        case 0:
+            strncpy(entry->username, token, sizeof(entry->username) - 1);
+            break;
+        case 1:
+            strncpy(entry->password, token, sizeof(entry->password) - 1);
+            break;
+        case 2:
+            entry->uid = atoi(token);
+            break;
+        case 3:
+            entry->gid = atoi(token);
+            break;
+        case 4:
+            strncpy(entry->fullname, token, sizeof(entry->fullname) - 1);
+            break;
+        case 5:
+            strncpy(entry->homedir, token, sizeof(entry->homedir) - 1);
+            break;
+        case 6:
+            strncpy(entry->shell, token, sizeof(entry->shell) - 1);
+            break;
+        default:
+            entry->is_admin = atoi(token);
+            break;
+        }
+        fields++;
+    }
+    return fields;
+}
+
+static void
+snapshot_free(struct user_snapshot *snapshot)
+{
+    if (snapshot) {
+        free(snapshot->entries);
+        free(snapshot->slots);
+        free(snapshot->users);
+        free(snapshot);
+    }
+}
+
+/* Slot of username: its entry's, or the empty one it would go in */
+static size_t
+snapshot_slot(const struct user_snapshot *snapshot, const char *username)
+{
+    size_t i;
+
+    i = rec_hash(username, strlen(username), 0) & (snapshot->size - 1);
+    while (snapshot->slots[i] &&
+           strcmp(snapshot->entries[snapshot->slots[i] - 1].username,
+                  username) != 0) {
+        i = (i + 1) & (snapshot->size - 1);
+    }
+    return i;
+}
+
+/* The first line for a username wins, as it did for the file scan */
+static int
+snapshot_add(struct user_snapshot *snapshot, const struct user_entry *entry)
+{
+    size_t slot;
+
+    if (snapshot->count >= USER_TABLE_MAX) {
+        return -1;
+    }
+    slot = snapshot_slot(snapshot, entry->username);
+    if (snapshot->slots[slot]) {
+        return 0;
+    }
+    snapshot->entries[snapshot->count++] = *entry;
+    snapshot->slots[slot] = snapshot->count;
+    return 0;
+}
+
+/*
+ * /users lists every non-comment line as written, except that the
+ * password field reads "x", as in /etc/passwd, and ":0" is added when
+ * the line does not end in an IsAdmin flag. /users needs no login, so
+ * the hashes must never leave the server.
+ */
+static int
+snapshot_build(struct user_snapshot *snapshot, char *data)
+{
+    struct user_entry entry;
+    struct buffer users;
+    char *password;
+    char *rest;
+    char *line;
+    char *next;
+    size_t len;
+
+    snapshot->size = 1;
+    while (snapshot->size < USER_TABLE_MAX * 2) {
+        snapshot->size <<= 1;
+    }
+    snapshot->entries = malloc(USER_TABLE_MAX * sizeof(*snapshot->entries));
+    snapshot->slots = calloc(snapshot->size, sizeof(*snapshot->slots));
+    if (!snapshot->entries || !snapshot->slots) {
+        return -1;
+    }
+
+    buffer_init(&users);
+    buffer_reserve(&users, 1);
+    for (line = data; *line; line = next) {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        len = strcspn(line, "\n");
+        if (line[0] == '#' || len == 0) {
+            continue;
+        }
+
+        password = memchr(line, ':', len);
+        password = password ? password + 1 : line + len;
+        rest = memchr(password, ':', (size_t)(line + len - password));
+        if (buffer_append(&users, line, (size_t)(password - line)) != 0 ||
+            (rest && (buffer_append_str(&users, "x") != 0 ||
+                      buffer_append(&users, rest, (size_t)(line + len - rest)) != 0)) ||
+            buffer_append_str(&users, len >= 2 && line[len - 2] == ':' ?
+                                      "\n" : ":0\n") != 0) {
+            buffer_free(&users);
+            return -1;
+        }
+
+        line[len] = '\0';
+        if (user_table_parse_line(line, &entry) >= 2 &&
+            snapshot_add(snapshot, &entry) != 0) {
+            break;
+        }
+    }
+
+    snapshot->users = users.data;
+    snapshot->users_len = users.len;
+    return snapshot->users ? 0 : -1;
+}
+
+/* Install a snapshot, or none; the previous one is freed */
+static void
+table_swap(struct user_snapshot *snapshot, const struct user_stamp *stamp)
+{
+    struct user_snapshot *old;
+
+    pthread_rwlock_wrlock(&table_lock);
+    old = table;
+    table = snapshot;
+    if (stamp) {
+        table_stamp = *stamp;
+    } else {
+        memset(&table_stamp, 0, sizeof(table_stamp));
+    }
+    pthread_rwlock_unlock(&table_lock);
+    snapshot_free(old);
+}
+
+/* Load the file if it changed since the loaded copy; reload_lock is held */
+static int
+table_reload(void)
+{
+    struct user_snapshot *snapshot;
+    struct user_stamp stamp;
+    struct stat st;
+    char *data;
+    size_t size;
+    int result;
+
+    if (stat(table_path, &st) != 0) {
+        table_swap(NULL, NULL);
+        return ERR_IO;
+    }
+
+    memset(&stamp, 0, sizeof(stamp));
+    stamp.mtime = st.st_mtim;
+    stamp.size = (unsigned long)st.st_size;
+    stamp.inode = (unsigned long)st.st_ino;
+    if (table && memcmp(&stamp, &table_stamp, sizeof(stamp)) == 0) {
+        return 0;
+    }
+
+    data = rec_read_file(table_path, &size);
+    snapshot = data ? calloc(1, sizeof(*snapshot)) : NULL;
+    result = snapshot && snapshot_build(snapshot, data) == 0 ? 1 : ERR_INTERNAL;
+    free(data);
+    if (result != 1) {
+        snapshot_free(snapshot);
+        table_swap(NULL, NULL);
+        return data ? ERR_INTERNAL : ERR_IO;
+    }
+
+    table_swap(snapshot, &stamp);
+    return 1;
+}
+
+/*
+ * user_table_refresh - Reload the user table if the auth file changed
+ *
+ * The file's mtime, size and inode are compared with those of the
+ * loaded copy. A file that cannot be read leaves no users, so logins
+ * fail as they did when the file was read on every attempt.
+ *
+ * Returns 1 if reloaded, 0 if unchanged, ERR_IO or ERR_INTERNAL on error.
+ */
+int
+user_table_refresh(void)
+{
+    int result;
+
+    pthread_mutex_lock(&reload_lock);
+    result = table_reload();
+    pthread_mutex_unlock(&reload_lock);
+    return result;
+}
+
+/* Copy the auth file into out with username's password replaced */
+static int
+replace_password(const char *data, const char *username, const char *hash,
+                 struct buffer *out)
+{
+    const char *line;
+    const char *next;
+    const char *rest;
+    size_t name_len;
+    int found;
+
+    name_len = strlen(username);
+    found = 0;
+    for (line = data; *line; line = next) {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+
+        if (found || line[0] == '#' || strncmp(line, username, name_len) != 0 ||
+            line[name_len] != ':') {
+            if (buffer_append(out, line, (size_t)(next - line)) != 0) {
+                return ERR_INTERNAL;
+            }
+            continue;
+        }
+
+        /* Keep everything after the password field as written */
+        rest = line + name_len + 1;
+        rest += strcspn(rest, ":\n");
+        if (buffer_append(out, line, name_len + 1) != 0 ||
+            buffer_append_str(out, hash) != 0 ||
+            buffer_append(out, rest, (size_t)(next - rest)) != 0) {
+            return ERR_INTERNAL;
+        }
+        found = 1;
+    }
+    return found ? ERR_NONE : ERR_NOTFOUND;
+}
+
+/*
+ * user_table_set_password - Store a new password hash for a user
+ * @username: User whose first line is changed
+ * @hash: Replacement for the password field
+ *
+ * The file is rewritten through a temporary file and a rename, keeping
+ * its mode, and the table reloaded.
+ *
+ * Returns ERR_NONE, ERR_PARAM, ERR_NOTFOUND, ERR_IO or ERR_INTERNAL.
+ */
+int
+user_table_set_password(const char *username, const char *hash)
+{
+    struct buffer out;
+    struct stat st;
+    char temp_path[sizeof(table_path) + 4];
+    char *data;
+    size_t size;
+    FILE *fp;
+    int result;
+
+    if (!username || !hash || username[0] == '\0' || strchr(hash, ':') ||
+        strchr(hash, '\n')) {
+        return ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&reload_lock);
+    data = rec_read_file(table_path, &size);
+    if (!data || stat(table_path, &st) != 0) {
+        free(data);
+        pthread_mutex_unlock(&reload_lock);
+        return ERR_IO;
+    }
+
+    buffer_init(&out);
+    result = replace_password(data, username, hash, &out);
+    free(data);
+
+    if (result == ERR_NONE) {
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", table_path);
+        fp = fopen(temp_path, "w");
+        result = ERR_IO;
+        if (fp) {
+            if ((out.len == 0 || fwrite(out.data, 1, out.len, fp) == out.len) &&
+                fchmod(fileno(fp), st.st_mode & 07777) == 0 &&
+                fflush(fp) == 0 && fsync(fileno(fp)) == 0) {
+                result = ERR_NONE;
+            }
+            if (fclose(fp) != 0) {
+                result = ERR_IO;
+            }
+            if (result == ERR_NONE && rename(temp_path, table_path) != 0) {
+                result = ERR_IO;
+            }
+            if (result != ERR_NONE) {
+                remove(temp_path);
+            }
+        }
+    }
+    buffer_free(&out);
+
+    if (result == ERR_NONE) {
+        table_reload();
+    }
+    pthread_mutex_unlock(&reload_lock);
+    return result;
+}
+
+/* Read-lock a loaded table, loading it on first use; 0 if there is none */
+static int
+table_acquire(void)
+{
+    pthread_rwlock_rdlock(&table_lock);
+    if (table) {
+        return 1;
+    }
+    pthread_rwlock_unlock(&table_lock);
+
+    user_table_refresh();
+    pthread_rwlock_rdlock(&table_lock);
+    if (table) {
+        return 1;
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return 0;
+}
+
+/* Set the auth file; the table is loaded again on next use */
+int
+user_table_init(const char *path)
+{
+    size_t len;
+
+    if (!path) {
+        return ERR_PARAM;
+    }
+    len = strlen(path);
+    if (len >= sizeof(table_path)) {
+        return ERR_PARAM;
+    }
+
+    pthread_mutex_lock(&reload_lock);
+    memcpy(table_path, path, len + 1);
+    table_swap(NULL, NULL);
+    pthread_mutex_unlock(&reload_lock);
+    return ERR_NONE;
+}
+
+void
+user_table_shutdown(void)
+{
+    if (timer_pending(&check_timer)) {
+        timer_del(&check_timer);
+    }
+    pthread_mutex_lock(&reload_lock);
+    table_swap(NULL, NULL);
+    pthread_mutex_unlock(&reload_lock);
+}
+
+static void
+check_tick(void *arg)
+{
+    UNUSED(arg);
+    user_table_refresh();
+    timer_add(&check_timer, USER_TABLE_CHECK_INTERVAL);
+}
+
+/* Load the table and watch the auth file from the timer wheel */
+void
+user_table_start(void)
+{
+    user_table_refresh();
+    timer_init(&check_timer, check_tick, NULL);
+    timer_add(&check_timer, USER_TABLE_CHECK_INTERVAL);
+}
+
+/* Copy a user's entry; ERR_NOTFOUND if there is no such user */
+int
+user_table_find(const char *username, struct user_entry *entry)
+{
+    size_t slot;
+    int result;
+
+    if (!username || !entry) {
+        return ERR_PARAM;
+    }
+    if (!table_acquire()) {
+        return ERR_IO;
+    }
+    slot = snapshot_slot(table, username);
+    result = ERR_NOTFOUND;
+    if (table->slots[slot]) {
+        *entry = table->entries[table->slots[slot] - 1];
+        result = ERR_NONE;
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return result;
+}
+
+/* Copy a user's stored password; "" and ERR_NOTFOUND if there is none */
+int
+user_table_password(const char *username, char *out, size_t size)
+{
+    const char *stored;
+    size_t slot;
+    int result;
+
+    if (!username || !out || size == 0) {
+        return ERR_PARAM;
+    }
+    out[0] = '\0';
+    if (!table_acquire()) {
+        return ERR_IO;
+    }
+    slot = snapshot_slot(table, username);
+    result = ERR_NOTFOUND;
+    if (table->slots[slot]) {
+        stored = table->entries[table->slots[slot] - 1].password;
+        result = strlen(stored) < size ? ERR_NONE : ERR_PARAM;
+        if (result == ERR_NONE) {
+            strcpy(out, stored);
+        }
+    }
+    pthread_rwlock_unlock(&table_lock);
+    return result;
+}
+
+/* Append the serialized /users body; ERR_IO if the file is unreadable */
+int
+user_table_users(struct buffer *out)
+{
+    int result;
+
+    if (!table_acquire()) {
+        return ERR_IO;
+    }
+    result = buffer_append(out, table->users, table->users_len) == 0 ?
+             ERR_NONE : ERR_INTERNAL;
+    pthread_rwlock_unlock(&table_lock);
+    return result;
+}
@@ -1,4 +1,25 @@
 #include "../include/web_server.h"
+#include "../include/archive.h"
+#include "../include/audit_store.h"
+#include "../include/buffer.h"
+#include "../include/diag.h"
+#include "../include/export.h"
+#include "../include/forecast.h"
+#include "../include/history.h"
+#include "../include/log_archive.h"
+#include "../include/log_writer.h"
+#include "../include/metrics.h"
+#include "../include/obligation_number.h"
+#include "../include/password.h"
+#include "../include/profile_store.h"
+#include "../include/query.h"
+#include "../include/record_store.h"
+#include "../include/session.h"
+#include "../include/stats.h"
+#include "../include/table.h"
+#include "../include/trace.h"
+#include "../include/user_table.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,8 +52,10 @@ check_log_size(const char *filename)
 int
 rotate_log(const char *logname)
 {
+    static const char *const suffixes[] = { "", LOG_COMPRESSED_SUFFIX };
     char oldpath[PATH_MAX];
     char newpath[PATH_MAX];
+    int j;
     int i;
 
     /* Parameter validation */
@@ -40,18 +63,22 @@ rotate_log(const char *logname)
         return ERR_PARAM;
     }
 
-    /* Remove oldest log if exists */
-    snprintf(oldpath, sizeof(oldpath), "%s/%s.%d%s",
-             LOG_DIR, logname, LOG_MAX_FILES, LOG_ARCHIVE_SUFFIX);
-    remove(oldpath);
-
-    /* Rotate existing logs */
-    for (i = LOG_MAX_FILES - 1; i > 0; i--) {
-        snprintf(oldpath, sizeof(oldpath), "%s/%s.%d%s",
-                LOG_DIR, logname, i, LOG_ARCHIVE_SUFFIX);
-        snprintf(newpath, sizeof(newpath), "%s/%s.%d%s",
-                LOG_DIR, logname, i + 1, LOG_ARCHIVE_SUFFIX);
-        rename(oldpath, newpath);
+    /* Rotated copies may be plain or compressed; both move along */
+    log_archive_lock();
+    for (j = 0; j < (int)(sizeof(suffixes) / sizeof(suffixes[0])); j++) {
+        /* Remove oldest log if exists */
+        snprintf(oldpath, sizeof(oldpath), "%s/%s.%d%s%s",
+                 LOG_DIR, logname, LOG_MAX_FILES, LOG_ARCHIVE_SUFFIX, suffixes[j]);
+        remove(oldpath);
+
+        /* Rotate existing logs */
+        for (i = LOG_MAX_FILES - 1; i > 0; i--) {
+            snprintf(oldpath, sizeof(oldpath), "%s/%s.%d%s%s",
+                    LOG_DIR, logname, i, LOG_ARCHIVE_SUFFIX, suffixes[j]);
+            snprintf(newpath, sizeof(newpath), "%s/%s.%d%s%s",
+                    LOG_DIR, logname, i + 1, LOG_ARCHIVE_SUFFIX, suffixes[j]);
+            rename(oldpath, newpath);
+        }
     }
 
     /* Rotate current log to .1 */
@@ -59,57 +86,36 @@ rotate_log(const char *logname)
              LOG_DIR, logname, LOG_SUFFIX);
     snprintf(newpath, sizeof(newpath), "%s/%s.1%s",
              LOG_DIR, logname, LOG_ARCHIVE_SUFFIX);
-
-    if (rename(oldpath, newpath) != 0) {
+    i = rename(oldpath, newpath);
+    log_archive_unlock();
+    if (i != 0) {
         return ERR_IO;
     }
 
+    /* Compressed off this thread, if the compressor runs */
+    log_archive_queue(logname);
     return ERR_NONE;
 }
 
-/* Modify log_message() to handle rotation */
+/*
+ * log_message - Queue a line for the web log
+ * @severity: LOG_* level
+ * @username: User the line is about
+ * @action: What was done
+ * @message: Details
+ *
+ * Returns ERR_NONE, ERR_PARAM, or the log writer's error.
+ */
 int
 log_message(int severity, const char *username, const char *action, const char *message)
 {
-    FILE *fp;
-    time_t now;
-    char timestamp[32];
-    char logpath[PATH_MAX];
-    int ret;
-
     /* Validate parameters */
     if (!username || !action || !message) {
         return ERR_PARAM;
     }
 
-    /* Format timestamp */
-    now = time(NULL);
-    if (strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S",
-                localtime(&now)) == 0) {
-        return ERR_INTERNAL;
-    }
-
-    /* Check log size and rotate if needed */
-    snprintf(logpath, sizeof(logpath), "%s/web%s", LOG_DIR, LOG_SUFFIX);
-    if (check_log_size(logpath)) {
-        ret = rotate_log("web");
-        if (ret != ERR_NONE) {
-            return ret;
-        }
-    }
-
-    /* Open log file in append mode */
-    fp = fopen(logpath, "a");
-    if (!fp) {
-        return ERR_IO;
-    }
-
-    /* Write log entry */
-    fprintf(fp, "%s|%d|%s|%s|%s\n",
-            timestamp, severity, username, action, message);
-
-    fclose(fp);
-    return ERR_NONE;
+    return log_writer_printf(LOG_FILE_WEB, 0, "|%d|%s|%s|%s",
+                             severity, username, action, message);
 }
 
 int
@@ -118,8 +124,6 @@ parse_auth_file(const char *filename, struct user_entry *entries, size_t max_ent
     FILE *fp;
     char line[512];
     size_t count = 0;
-    char *token;
-    char *saveptr;
 
     fp = fopen(filename, "r");
     if (!fp) {
@@ -132,143 +136,61 @@ parse_auth_file(const char *filename, struct user_entry *entries, size_t max_ent
             continue;
         }
 
-        /* Parse line fields */
-        token = strtok_r(line, ":", &saveptr);
-        if (!token) continue;
-        strncpy(entries[count].username, token, sizeof(entries[count].username) - 1);
-
-        token = strtok_r(NULL, ":", &saveptr);
-        if (!token) continue;
-        strncpy(entries[count].password, token, sizeof(entries[count].password) - 1);
-
-        /* Parse remaining fields */
-        token = strtok_r(NULL, ":", &saveptr);
-        if (!token) continue;
-        entries[count].uid = atoi(token);
-
-        token = strtok_r(NULL, ":", &saveptr);
-        if (!token) continue;
-        entries[count].gid = atoi(token);
-
-        token = strtok_r(NULL, ":", &saveptr);
-        if (!token) continue;
-        strncpy(entries[count].fullname, token, sizeof(entries[count].fullname) - 1);
-
-        token = strtok_r(NULL, ":", &saveptr);
-        if (!token) continue;
-        strncpy(entries[count].homedir, token, sizeof(entries[count].homedir) - 1);
-
-        token = strtok_r(NULL, ":", &saveptr);
-        if (!token) continue;
-        strncpy(entries[count].shell, token, sizeof(entries[count].shell) - 1);
-
-        token = strtok_r(NULL, ":", &saveptr);
-        entries[count].is_admin = token ? atoi(token) : 0;
-
-        count++;
+        /* Only complete lines count; IsAdmin is optional */
+        if (user_table_parse_line(line, &entries[count]) >= 7) {
+            count++;
+        }
     }
 
     fclose(fp);
     return (int)count;
 }
 
-/* Similarly modify log_audit() to use rotation */
+/* Audit lines are in the file before the request goes on */
 static int
 log_audit(const char *username, const char *action)
 {
-    FILE *fp;
-    time_t now;
-    char timestamp[32];
-    char logpath[PATH_MAX];
-    int ret;
-
     if (!username || !action) {
         return -1;
     }
 
-    /* Construct log path */
-    snprintf(logpath, sizeof(logpath), "%s/audit%s", LOG_DIR, LOG_SUFFIX);
-
-    /* Check log size and rotate if needed */
-    if (check_log_size(logpath) == 1) {
-        ret = rotate_log("audit");
-        if (ret != ERR_NONE) {
-            return ret;
-        }
-    }
-
-    /* Open log file with exclusive lock */
-    fp = fopen(logpath, "a");
-    if (!fp) {
-        return -1;
-    }
-
-    /* Get timestamp */
-    now = time(NULL);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S",
-             localtime(&now));
-
-    /* Lock file for writing */
-    ret = flock(fileno(fp), LOCK_EX);
-    if (ret == 0) {
-        fprintf(fp, "%s|%s|%s\n", timestamp, username, action);
-        flock(fileno(fp), LOCK_UN);
-    }
-
-    fclose(fp);
-    return ret;
+    return log_writer_printf(LOG_FILE_AUDIT, LOG_WRITE_DURABLE, "|%s|%s",
+                             username, action);
 }
 
+/*
+ * check_auth - Verify a login on the calling thread
+ * @username: User logging in
+ * @password: Password given
+ *
+ * A stored password that is plaintext or hashed with too few rounds is
+ * replaced by a fresh hash. Logins from clients go through the password
+ * pool instead; this is its fallback when the pool is not running.
+ *
+ * Returns 1 if the credentials match, 0 otherwise.
+ */
 int
 check_auth(const char *username, const char *password)
 {
-    FILE *fp;
-    char line[MAX_BUFFER_SIZE];
-    char file_user[256];
-    char file_pass[256];
-    char *token;
+    char stored[PASSWORD_HASH_MAX];
+    char hash[PASSWORD_HASH_MAX];
 
     if (!username || !password) {
         return 0;
     }
-
-    fp = fopen(AUTH_FILE, "r");
-    if (!fp) {
+    if (user_table_password(username, stored, sizeof(stored)) != ERR_NONE) {
+        stored[0] = '\0';
+    }
+    if (!password_verify(password, stored)) {
         return 0;
     }
 
-    while (fgets(line, sizeof(line), fp)) {
-        /* Skip comments and empty lines */
-        if (line[0] == '#' || line[0] == '\n') {
-            continue;
-        }
-
-        /* Parse line - username is first field, password is second */
-        token = strtok(line, ":");
-        if (!token) {
-            continue;
-        }
-        strncpy(file_user, token, sizeof(file_user) - 1);
-        file_user[sizeof(file_user) - 1] = '\0';
-
-        token = strtok(NULL, ":");
-        if (!token) {
-            continue;
-        }
-        strncpy(file_pass, token, sizeof(file_pass) - 1);
-        file_pass[sizeof(file_pass) - 1] = '\0';
-
-        /* Compare credentials */
-        if (strcmp(username, file_user) == 0 &&
-            strcmp(password, file_pass) == 0) {
-            log_audit(username, ACTION_LOGIN);
-            fclose(fp);
-            return 1;
-        }
+    if (password_needs_rehash(stored) &&
+        password_hash(password, hash, sizeof(hash)) == ERR_NONE) {
+        user_table_set_password(username, hash);
     }
-
-    fclose(fp);
-    return 0;
+    log_audit(username, ACTION_LOGIN);
+    return 1;
 }
 
 void
@@ -308,13 +230,435 @@ parse_query_string(const char *query, char *username, char *password)
     free(query_copy);
 }
 
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * url_decode - Decode a URL-encoded string ('+' and %XX escapes)
+ * @src: Encoded text, not necessarily NUL-terminated
+ * @len: Number of bytes of src to decode
+ * @out: Output buffer; may be src itself, decoding never grows the text
+ * @size: Size of the output buffer
+ *
+ * Returns the decoded length; the output is truncated to fit
+ */
+size_t
+url_decode(const char *src, size_t len, char *out, size_t size)
+{
+    size_t i;
+    size_t n;
+    int hi;
+    int lo;
+
+    if (!src || !out || size == 0) {
+        return 0;
+    }
+
+    for (i = 0, n = 0; i < len && n < size - 1; i++) {
+        if (src[i] == '+') {
+            out[n++] = ' ';
+        } else if (src[i] == '%' && i + 2 < len &&
+                   (hi = hex_value(src[i + 1])) >= 0 &&
+                   (lo = hex_value(src[i + 2])) >= 0) {
+            out[n++] = (char)(hi * 16 + lo);
+            i += 2;
+        } else {
+            out[n++] = src[i];
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/*
+ * get_query_param - Extract and URL-decode one query string parameter
+ * @query: Query string without the leading '?'
+ * @name: Parameter name
+ * @value: Output buffer
+ * @size: Size of the output buffer
+ *
+ * Returns 1 if the parameter was present, 0 otherwise
+ */
+int
+get_query_param(const char *query, const char *name, char *value, size_t size)
+{
+    const char *p;
+    const char *end;
+    size_t name_len;
+
+    if (!query || !name || !value || size == 0) {
+        return 0;
+    }
+
+    name_len = strlen(name);
+    p = query;
+    while (*p) {
+        end = strchr(p, '&');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        if (strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            p += name_len + 1;
+            url_decode(p, (size_t)(end - p), value, size);
+            return 1;
+        }
+
+        /* Skip to the next parameter */
+        if (!*end) {
+            break;
+        }
+        p = end + 1;
+    }
+
+    value[0] = '\0';
+    return 0;
+}
+
+static int
+write_all(int fd, const char *data, size_t length)
+{
+    struct trace_span span;
+    ssize_t written;
+
+    TRACE_BEGIN(span, "write");
+    while (length > 0) {
+        written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TRACE_END(span);
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+        metrics_bytes_sent((size_t)written);
+    }
+    TRACE_END(span);
+    return 0;
+}
+
+static int send_printf(int client_socket, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* dprintf for responses written piecemeal, counting the bytes sent */
+static int
+send_printf(int client_socket, const char *fmt, ...)
+{
+    va_list ap;
+    int sent;
+
+    va_start(ap, fmt);
+    sent = vdprintf(client_socket, fmt, ap);
+    va_end(ap);
+    if (sent > 0) {
+        metrics_bytes_sent((size_t)sent);
+    }
+    return sent;
+}
+
+/*
+ * send_response - Send a complete response with a known body length
+ * @client_socket: Socket to send response
+ * @status: Status code and reason, e.g. "200 OK"
+ * @content_type: Value of the Content-Type header
+ * @body: Response body
+ * @length: Length of body in bytes
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+send_response(int client_socket, const char *status, const char *content_type,
+              const char *body, size_t length)
+{
+    struct trace_span span;
+    int sent;
+
+    TRACE_BEGIN(span, "write");
+    sent = dprintf(client_socket,
+                   "HTTP/1.0 %s\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %lu\r\n"
+                   "Access-Control-Allow-Origin: *\r\n\r\n",
+                   status, content_type, (unsigned long)length);
+    TRACE_END(span);
+    if (sent < 0) {
+        return -1;
+    }
+    metrics_bytes_sent((size_t)sent);
+    return write_all(client_socket, body, length);
+}
+
+/* Send a JSON error body; always returns -1 so handlers can return it */
+int
+send_error_json(int client_socket, const char *status, const char *message)
+{
+    char body[256];
+    int len;
+
+    len = snprintf(body, sizeof(body),
+                   "{\"status\":\"error\",\"message\":\"%s\"}", message);
+    if (len > 0 && (size_t)len < sizeof(body)) {
+        send_response(client_socket, status, "application/json", body, (size_t)len);
+    }
+    return -1;
+}
+
+/*
+ * chunked_begin - Start a streamed HTTP/1.1 response
+ * @writer: Writer state, typically on the caller's stack
+ * @client_socket: Socket to send response
+ * @content_type: Value of the Content-Type header
+ * @extra_headers: Additional "Name: value\r\n" lines, or NULL
+ *
+ * The body is sent with chunked transfer encoding in chunks of at most
+ * HTTP_CHUNK_SIZE bytes, so the length never has to be known up front.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+chunked_begin(struct chunked_writer *writer, int client_socket,
+              const char *content_type, const char *extra_headers)
+{
+    int sent;
+
+    writer->fd = client_socket;
+    writer->len = 0;
+    writer->error = 0;
+
+    sent = dprintf(client_socket,
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Transfer-Encoding: chunked\r\n"
+                   "Connection: close\r\n"
+                   "Access-Control-Allow-Origin: *\r\n"
+                   "%s\r\n",
+                   content_type, extra_headers ? extra_headers : "");
+    if (sent < 0) {
+        writer->error = 1;
+        return -1;
+    }
+    metrics_bytes_sent((size_t)sent);
+    return 0;
+}
+
+/* Send the buffered chunk: fixed-width size line, data and CRLF in one write */
+static int
+chunked_flush(struct chunked_writer *writer)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *chunk;
+    size_t len;
+
+    len = writer->len;
+    if (len == 0 || writer->error) {
+        return writer->error ? -1 : 0;
+    }
+
+    chunk = writer->data;
+    chunk[0] = hex[(len >> 12) & 0xf];
+    chunk[1] = hex[(len >> 8) & 0xf];
+    chunk[2] = hex[(len >> 4) & 0xf];
+    chunk[3] = hex[len & 0xf];
+    chunk[4] = '\r';
+    chunk[5] = '\n';
+    chunk[HTTP_CHUNK_HEADER + len] = '\r';
+    chunk[HTTP_CHUNK_HEADER + len + 1] = '\n';
+
+    writer->len = 0;
+    if (write_all(writer->fd, chunk, HTTP_CHUNK_HEADER + len + 2) != 0) {
+        writer->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * chunked_write - Append body bytes to a streamed response
+ * @writer: Writer started with chunked_begin
+ * @data: Bytes to send
+ * @length: Number of bytes
+ *
+ * Returns 0 on success, -1 once the client has gone away
+ */
+int
+chunked_write(struct chunked_writer *writer, const char *data, size_t length)
+{
+    size_t room;
+
+    while (length > 0 && !writer->error) {
+        room = HTTP_CHUNK_SIZE - writer->len;
+        if (room > length) {
+            room = length;
+        }
+        memcpy(writer->data + HTTP_CHUNK_HEADER + writer->len, data, room);
+        writer->len += room;
+        data += room;
+        length -= room;
+        if (writer->len == HTTP_CHUNK_SIZE) {
+            chunked_flush(writer);
+        }
+    }
+    return writer->error ? -1 : 0;
+}
+
+/* Flush the last chunk and send the terminating zero-length chunk */
+int
+chunked_end(struct chunked_writer *writer)
+{
+    if (chunked_flush(writer) != 0 ||
+        write_all(writer->fd, "0\r\n\r\n", 5) != 0) {
+        writer->error = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Check a new record's key against the key index, then the archive */
+static int
+duplicate_key(const char *project, const char *text)
+{
+    struct rec_store *store;
+    struct rec_record *record;
+    const char *key;
+    int found;
+
+    store = rec_store_get(project);
+    record = store ? rec_parse_record(text, strlen(text)) : NULL;
+    if (!record) {
+        return 0;
+    }
+    key = rec_get(record, REC_KEY_FIELD);
+    found = key && (rec_store_find(store, key) != NULL ||
+                    archive_find(project, key, NULL) == ERR_NONE);
+    free(record);
+    return found;
+}
+
+/*
+ * User of a request's session cookie, or an empty string. The
+ * X-Username header clients still send is not trusted.
+ */
+static void
+request_username(const char *data, char *username, size_t size)
+{
+    session_from_request(data, username, size);
+}
+
+/* Answer a successful login with a new session cookie */
+static int
+send_login(int client_socket, const char *username)
+{
+    char token[SESSION_TOKEN_LEN + 1];
+
+    if (session_create(username, token, sizeof(token)) != ERR_NONE) {
+        send_printf(client_socket,
+                    "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+        return -1;
+    }
+    send_printf(client_socket,
+                "HTTP/1.0 200 OK\r\n"
+                "Set-Cookie: " SESSION_COOKIE "=%s; Path=/; Max-Age=%d; "
+                "HttpOnly; SameSite=Strict\r\n\r\n",
+                token, SESSION_TIMEOUT);
+    return 0;
+}
+
+/* Finish a login verified on the password pool, on the server thread */
+static void
+login_done(struct password_job *job)
+{
+    char current[PASSWORD_HASH_MAX];
+
+    /* The request handle_client deferred ends here */
+    metrics_connection_done();
+    if (!job->match) {
+        send_printf(job->client_socket, "HTTP/1.0 401 Unauthorized\r\n\r\n");
+        return;
+    }
+
+    /* Of several logins verified against the same old entry, one rehashes */
+    if (job->rehash[0] != '\0' &&
+        user_table_password(job->username, current, sizeof(current)) == ERR_NONE &&
+        strcmp(current, job->stored) == 0) {
+        user_table_set_password(job->username, job->rehash);
+    }
+    log_audit(job->username, ACTION_LOGIN);
+    send_login(job->client_socket, job->username);
+}
+
+/*
+ * handle_login - Answer /auth, verifying on the password pool
+ * @client_socket: Socket to send response; kept open if deferred
+ * @username: User logging in
+ * @password: Password given
+ *
+ * Returns HANDLE_DEFERRED once the pool owns the socket, otherwise 0
+ * or -1 after answering here.
+ */
+static int
+handle_login(int client_socket, const char *username, const char *password)
+{
+    switch (password_pool_submit(client_socket, username, password,
+                                 login_done)) {
+    case ERR_NONE:
+        return HANDLE_DEFERRED;
+    case ERR_INTERNAL:
+        /* Too many logins in flight; the rest of the server is unaffected */
+        send_printf(client_socket, "HTTP/1.0 503 Service Unavailable\r\n"
+                                   "Retry-After: 1\r\n\r\n");
+        return -1;
+    case ERR_IO:
+        break;
+    default:
+        send_printf(client_socket, "HTTP/1.0 401 Unauthorized\r\n\r\n");
+        return 0;
+    }
+
+    /* No pool: verify here */
+    if (check_auth(username, password)) {
+        DIAG(LOG_INFO, ("Auth successful\n"));
+        return send_login(client_socket, username);
+    }
+    DIAG(LOG_INFO, ("Auth failed\n"));
+    send_printf(client_socket, "HTTP/1.0 401 Unauthorized\r\n\r\n");
+    return 0;
+}
+
+/* End the request's session and have the client drop its cookie */
+static int
+send_logout(int client_socket, const char *data)
+{
+    char username[SESSION_USER_MAX];
+
+    if (session_from_request(data, username, sizeof(username)) == ERR_NONE) {
+        log_audit(username, ACTION_LOGOUT);
+    }
+    session_destroy_request(data);
+    send_printf(client_socket,
+                "HTTP/1.0 200 OK\r\n"
+                "Set-Cookie: " SESSION_COOKIE "=; Path=/; Max-Age=0; "
+                "HttpOnly; SameSite=Strict\r\n\r\n");
+    return 0;
+}
+
 int
 handle_create_record(int client_socket, const char *data)
 {
     char username[256];
     const char *body;
-    const char *username_header;
-    size_t i;
     int result;
 
     /* Response messages */
@@ -344,21 +688,12 @@ handle_create_record(int client_socket, const char *data)
     }
 
     /* Extract username from header */
-    username_header = strstr(data, "X-Username: ");
-    if (username_header) {
-        username_header += 11; /* Skip "X-Username: " */
-        for (i = 0; i < sizeof(username) - 1 && username_header[i] != '\r' && username_header[i] != '\n'; i++) {
-            username[i] = username_header[i];
-        }
-        username[i] = '\0';
-    } else {
-        username[0] = '\0';
-    }
+    request_username(data, username, sizeof(username));
 
     /* Find start of request body */
     body = strstr(data, "\r\n\r\n");
     if (body == NULL || strlen(body) < 5) {
-        write(client_socket, error_response, strlen(error_response));
+        write_all(client_socket, error_response, strlen(error_response));
         return ERR_PARAM;
     }
     body += 4; /* Skip CRLN CRLN */
@@ -366,18 +701,30 @@ handle_create_record(int client_socket, const char *data)
     /* Basic validation of record format */
     if (strstr(body, "Project_Name") == NULL ||
         strstr(body, "Obligation") == NULL) {
-        write(client_socket, error_response, strlen(error_response));
+        write_all(client_socket, error_response, strlen(error_response));
         return ERR_PARAM;
     }
 
+    /* %unique: Obligation_Number, answered without touching the file */
+    if (duplicate_key("scjv", body)) {
+        log_message(LOG_WARN, username, "CREATE_RECORD", "Duplicate obligation number");
+        send_error_json(client_socket, "409 Conflict",
+                        "Obligation_Number already exists");
+        return ERR_EXISTS;
+    }
+
     /* Create the record */
+    history_baseline("scjv", body);
     result = create_record_in_file(body);
 
     if (result == 0) {
+        history_append("scjv", body, username, (long)time(NULL));
+        rec_store_apply("scjv", body);
+
         /* Log success */
         log_message(LOG_INFO, username, "CREATE_RECORD", "Record created successfully");
         log_audit(username, "Record created");
-        write(client_socket, success_response, strlen(success_response));
+        write_all(client_socket, success_response, strlen(success_response));
         return 0;
     }
 
@@ -385,13 +732,16 @@ handle_create_record(int client_socket, const char *data)
     log_message(LOG_ERROR, username, "CREATE_RECORD", "Failed to create record");
 
     /* Send error response */
-    write(client_socket, server_error, strlen(server_error));
+    write_all(client_socket, server_error, strlen(server_error));
     return -1;
 }
 
 int
 create_record_in_file(const char *data)
 {
+    struct trace_span lock_span;
+    struct trace_span span;
+    struct timespec wait;
     FILE *fp;
     int ret = ERR_NONE;
     char filepath[PATH_MAX];
@@ -412,23 +762,32 @@ create_record_in_file(const char *data)
     }
 
     /* Open file with exclusive lock */
+    TRACE_BEGIN(span, "file_io");
     fp = fopen(filepath, "a");
     if (!fp) {
+        TRACE_END(span);
         return ERR_IO;
     }
 
     /* Get exclusive lock */
+    clock_gettime(CLOCK_MONOTONIC, &wait);
+    TRACE_BEGIN(lock_span, "flock");
     if (flock(fileno(fp), LOCK_EX) == 0) {
+        TRACE_END(lock_span);
+        metrics_lock_wait(&wait);
+
         /* Write record */
         if (fprintf(fp, "%s\n", data) < 0) {
             ret = ERR_IO;
         }
         flock(fileno(fp), LOCK_UN);
     } else {
+        TRACE_END(lock_span);
         ret = ERR_IO;
     }
 
     fclose(fp);
+    TRACE_END(span);
     return ret;
 }
 
@@ -530,7 +889,10 @@ update_record_in_file(FILE *fp, const char *data)
 int
 handle_update_record(int client_socket, const char *data)
 {
+    struct trace_span span;
+    struct timespec wait;
     FILE *fp;
+    char username[64];
     const char *body;
     int result;
 
@@ -546,10 +908,15 @@ handle_update_record(int client_socket, const char *data)
     }
 
     /* Get exclusive lock */
+    clock_gettime(CLOCK_MONOTONIC, &wait);
+    TRACE_BEGIN(span, "flock");
     if (flock(fileno(fp), LOCK_EX) != 0) {
+        TRACE_END(span);
         fclose(fp);
         return ERR_IO;
     }
+    TRACE_END(span);
+    metrics_lock_wait(&wait);
 
     /* Find request body */
     body = strstr(data, "\r\n\r\n");
@@ -560,22 +927,33 @@ handle_update_record(int client_socket, const char *data)
     }
     body += 4;
 
+    /* Keep the record as it was before the file is rewritten */
+    history_baseline("scjv", body);
+
     /* Update record */
+    TRACE_BEGIN(span, "file_io");
     result = update_record_in_file(fp, body);
+    TRACE_END(span);
 
     /* Cleanup */
     flock(fileno(fp), LOCK_UN);
     fclose(fp);
 
+    if (result == 0) {
+        request_username(data, username, sizeof(username));
+        history_append("scjv", body, username, (long)time(NULL));
+        rec_store_apply("scjv", body);
+    }
+
     /* Send response */
     if (result == 0) {
-        dprintf(client_socket,
+        send_printf(client_socket,
             "HTTP/1.0 200 OK\r\n"
             "Content-Type: application/json\r\n"
             "Access-Control-Allow-Origin: *\r\n\r\n"
             "{\"status\":\"success\"}\r\n");
     } else {
-        dprintf(client_socket,
+        send_printf(client_socket,
             "HTTP/1.0 500 Internal Server Error\r\n"
             "Content-Type: application/json\r\n"
             "Access-Control-Allow-Origin: *\r\n\r\n"
@@ -585,9 +963,62 @@ handle_update_record(int client_socket, const char *data)
     return result;
 }
 
+/* Whether uri is "/<project>.html" for a project in the records directory */
+static int
+is_project_page(const char *uri)
+{
+    const struct rec_project *projects;
+    const char *dot;
+    size_t count;
+    size_t len;
+    size_t i;
+
+    if (uri[0] != '/') {
+        return 0;
+    }
+    dot = strchr(uri + 1, '.');
+    if (!dot || strcmp(dot, ".html") != 0) {
+        return 0;
+    }
+    len = (size_t)(dot - uri - 1);
+    count = rec_registry_projects(&projects);
+    for (i = 0; i < count; i++) {
+        if (strncmp(projects[i].name, uri + 1, len) == 0 &&
+            projects[i].name[len] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-int
-handle_client(int client_socket, const char *www_root)
+/* Read a /update query and apply it; username and fullname are required */
+static int
+handle_update_request(int client_socket, const char *query)
+{
+    struct profile profile;
+
+    if (!get_query_param(query, "username", profile.username,
+                         sizeof(profile.username)) ||
+        !get_query_param(query, "fullname", profile.fullname,
+                         sizeof(profile.fullname)) ||
+        profile.username[0] == '\0' || profile.fullname[0] == '\0') {
+        send_printf(client_socket, "HTTP/1.0 400 Bad Request\r\n\r\n");
+        return -1;
+    }
+    if (!get_query_param(query, "email", profile.email, sizeof(profile.email))) {
+        profile.email[0] = '\0';
+    }
+    if (!get_query_param(query, "project", profile.project,
+                         sizeof(profile.project))) {
+        profile.project[0] = '\0';
+    }
+    return handle_update_user(client_socket, profile.username, profile.fullname,
+                              profile.email, profile.project);
+}
+
+/* Read one request and answer it; handle_client times it */
+static int
+handle_request(int client_socket, const char *www_root)
 {
     char buf[MAX_BUFFER_SIZE];
     char method[16];
@@ -595,127 +1026,148 @@ handle_client(int client_socket, const char *www_root)
     char filepath[512];
     char username[256] = {0};  /* Initialize to zero */
     char password[256] = {0};  /* Initialize to zero */
-    char fullname[256] = {0};  /* Initialize to zero */
-    char email[256] = {0};     /* Initialize to zero */
-    char project[256] = {0};   /* Initialize to zero */
     char line[1024];
     const char *filename;
     char *query;
-    char *query_copy;
-    char *token;
-    char *saveptr;
-    char *value;
+    struct trace_span span;
     ssize_t bytes_read;
     struct stat st;
     int file_fd;
     ssize_t read_bytes;
     ssize_t write_result;
     FILE *fp;
+    int fields;
     int result;
 
     /* Initialize pointers */
     filename = NULL;
     query = NULL;
-    query_copy = NULL;
-    token = NULL;
-    saveptr = NULL;
-    value = NULL;
     file_fd = -1;
 
     /* Read HTTP request */
+    TRACE_BEGIN(span, "read");
     bytes_read = read(client_socket, buf, sizeof(buf) - 1);
+    TRACE_END(span);
     if (bytes_read <= 0) {
-        fprintf(stderr, "Error: Failed to read request\n");
+        DIAG(LOG_ERROR, ("Error: Failed to read request\n"));
         return -1;
     }
     buf[bytes_read] = '\0';
-    fprintf(stderr, "Received request: %s\n", buf);
+    DIAG(LOG_DEBUG, ("Received request: %s\n", buf));
 
     /* Parse HTTP request */
-    if (sscanf(buf, "%15s %255s", method, uri) != 2) {
-        fprintf(stderr, "Error: Failed to parse request\n");
-        dprintf(client_socket, "HTTP/1.0 400 Bad Request\r\n\r\n");
+    TRACE_BEGIN(span, "parse");
+    fields = sscanf(buf, "%15s %255s", method, uri);
+    TRACE_END(span);
+    if (fields != 2) {
+        DIAG(LOG_WARN, ("Error: Failed to parse request\n"));
+        send_printf(client_socket, "HTTP/1.0 400 Bad Request\r\n\r\n");
         return -1;
     }
-    fprintf(stderr, "Method: %s, URI: %s\n", method, uri);
+    DIAG(LOG_DEBUG, ("Method: %s, URI: %s\n", method, uri));
+    metrics_request_route(uri);
+    trace_request_uri(uri);
 
     /* Update method check to allow POST */
     if (strcmp(method, "GET") != 0 && strcmp(method, "POST") != 0) {
-        dprintf(client_socket, "HTTP/1.0 405 Method Not Allowed\r\n\r\n");
+        send_printf(client_socket, "HTTP/1.0 405 Method Not Allowed\r\n\r\n");
         return -1;
     }
 
     /* Handle users request - Add this check before file serving */
     if (strcmp(uri, "/users") == 0) {
-        fprintf(stderr, "Handling /users request\n");
+        DIAG(LOG_DEBUG, ("Handling /users request\n"));
         result = handle_users_request(client_socket);
-        fprintf(stderr, "Users request handled with result: %d\n", result);
+        DIAG(LOG_DEBUG, ("Users request handled with result: %d\n", result));
         return result;
     }
 
+    /* Handle obligation forecast calendar */
+    if (strncmp(uri, ENDPOINT_FORECAST, strlen(ENDPOINT_FORECAST)) == 0) {
+        return handle_forecast_request(client_socket, uri);
+    }
+
+    /* Handle data structure introspection */
+    if (strcmp(uri, ENDPOINT_METRICS) == 0) {
+        return handle_metrics_request(client_socket);
+    }
+
+    if (strcmp(uri, ENDPOINT_TRACE) == 0) {
+        return handle_trace_request(client_socket);
+    }
+
+    if (strcmp(uri, ENDPOINT_STATS) == 0) {
+        return handle_stats_request(client_socket);
+    }
+
+    /* Handle selection-expression queries */
+    if (strncmp(uri, ENDPOINT_QUERY, strlen(ENDPOINT_QUERY)) == 0) {
+        return handle_query_request(client_socket, uri);
+    }
+
+    /* Handle record history and point-in-time reads */
+    if (strncmp(uri, ENDPOINT_RECORDS, strlen(ENDPOINT_RECORDS)) == 0) {
+        return handle_records_request(client_socket, uri);
+    }
+
+    /* Handle the project list */
+    if (strcmp(uri, ENDPOINT_PROJECTS) == 0) {
+        return handle_projects_request(client_socket);
+    }
+
+    /* Handle server-rendered obligations tables */
+    if (strncmp(uri, ENDPOINT_TABLE, strlen(ENDPOINT_TABLE)) == 0) {
+        return handle_table_request(client_socket, uri);
+    }
+
+    /* Handle streamed CSV export */
+    if (strncmp(uri, ENDPOINT_EXPORT, strlen(ENDPOINT_EXPORT)) == 0) {
+        return handle_export_request(client_socket, uri);
+    }
+
     /* Handle authentication requests */
     if (strncmp(uri, "/auth?", 6) == 0) {
         query = uri + 6;
         parse_query_string(query, username, password);
-        fprintf(stderr, "Auth request - username: %s\n", username);
+        DIAG(LOG_DEBUG, ("Auth request - username: %s\n", username));
+        return handle_login(client_socket, username, password);
+    }
 
-        if (check_auth(username, password)) {
-            fprintf(stderr, "Auth successful\n");
-            dprintf(client_socket, "HTTP/1.0 200 OK\r\n\r\n");
-        } else {
-            fprintf(stderr, "Auth failed\n");
-            dprintf(client_socket, "HTTP/1.0 401 Unauthorized\r\n\r\n");
-        }
-        return 0;
+    if (strcmp(uri, ENDPOINT_LOGOUT) == 0) {
+        return send_logout(client_socket, buf);
     }
 
     /* Handle user update requests */
     if (strncmp(uri, "/update?", 8) == 0) {
-        query = uri + 8;
-        query_copy = strdup(query);
-
-        if (query_copy) {
-            token = strtok_r(query_copy, "&", &saveptr);
-            while (token) {
-                value = strchr(token, '=');
-                if (value) {
-                    *value++ = '\0';
-                    if (strcmp(token, "username") == 0) {
-                        strncpy(username, value, sizeof(username) - 1);
-                    } else if (strcmp(token, "fullname") == 0) {
-                        strncpy(fullname, value, sizeof(fullname) - 1);
-                    } else if (strcmp(token, "email") == 0) {
-                        strncpy(email, value, sizeof(email) - 1);
-                    } else if (strcmp(token, "project") == 0) {
-                        strncpy(project, value, sizeof(project) - 1);
-                    }
-                }
-                token = strtok_r(NULL, "&", &saveptr);
-            }
-            free(query_copy);
+        return handle_update_request(client_socket, uri + 8);
+    }
 
-            if (username[0] && fullname[0]) {
-                return handle_update_user(client_socket, username, fullname,
-                                       email, project);
-            }
-        }
-        dprintf(client_socket, "HTTP/1.0 400 Bad Request\r\n\r\n");
-        return -1;
+    if (strncmp(uri, ENDPOINT_PROFILE, strlen(ENDPOINT_PROFILE)) == 0 &&
+        (uri[strlen(ENDPOINT_PROFILE)] == '\0' ||
+         uri[strlen(ENDPOINT_PROFILE)] == '?')) {
+        return handle_profile_request(client_socket, uri, buf);
+    }
+
+    if (strncmp(uri, ENDPOINT_AUDIT, strlen(ENDPOINT_AUDIT)) == 0 &&
+        (uri[strlen(ENDPOINT_AUDIT)] == '\0' ||
+         uri[strlen(ENDPOINT_AUDIT)] == '?')) {
+        return handle_audit_request(client_socket, uri);
     }
 
     /* Handle audit log requests */
     if (strcmp(uri, "/audit_log") == 0) {
         fp = fopen("var/log/audit.log", "r");
         if (!fp) {
-            dprintf(client_socket, "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+            send_printf(client_socket,
+                        "HTTP/1.0 500 Internal Server Error\r\n\r\n");
             return -1;
         }
 
-        dprintf(client_socket, "HTTP/1.0 200 OK\r\n");
-        dprintf(client_socket, "Content-Type: text/plain\r\n\r\n");
+        send_printf(client_socket, "HTTP/1.0 200 OK\r\n");
+        send_printf(client_socket, "Content-Type: text/plain\r\n\r\n");
 
         while (fgets(line, sizeof(line), fp)) {
-            write(client_socket, line, strlen(line));
+            write_all(client_socket, line, strlen(line));
         }
 
         fclose(fp);
@@ -724,7 +1176,7 @@ handle_client(int client_socket, const char *www_root)
 
     /* Handle .rec file requests */
     if (strstr(uri, ".rec") != NULL) {
-        fprintf(stderr, "Received .rec file request for URI: %s\n", uri);
+        DIAG(LOG_DEBUG, ("Received .rec file request for URI: %s\n", uri));
 
         filename = strrchr(uri, '/');
         if (filename) {
@@ -735,34 +1187,39 @@ handle_client(int client_socket, const char *www_root)
 
         /* Construct full path */
         if (snprintf(filepath, sizeof(filepath), "var/records/%s", filename) >= (int)sizeof(filepath)) {
-            dprintf(client_socket, "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+            send_printf(client_socket,
+                        "HTTP/1.0 500 Internal Server Error\r\n\r\n");
             return -1;
         }
 
-        fprintf(stderr, "Attempting to serve .rec file: %s\n", filepath);
+        DIAG(LOG_DEBUG, ("Attempting to serve .rec file: %s\n", filepath));
 
         /* Open and send .rec file */
         file_fd = open(filepath, O_RDONLY);
         if (file_fd < 0) {
-            fprintf(stderr, "Error opening file %s: %s\n", filepath, strerror(errno));
-            dprintf(client_socket, "HTTP/1.0 404 Not Found\r\n\r\n");
+            DIAG(LOG_INFO, ("Error opening file %s: %s\n", filepath, strerror(errno)));
+            send_printf(client_socket, "HTTP/1.0 404 Not Found\r\n\r\n");
             return -1;
         }
 
         /* Send HTTP headers */
-        dprintf(client_socket,
+        send_printf(client_socket,
             "HTTP/1.0 200 OK\r\n"
             "Content-Type: text/plain\r\n"
             "Access-Control-Allow-Origin: *\r\n\r\n");
 
         /* Send file contents */
+        TRACE_BEGIN(span, "file_io");
         while ((read_bytes = read(file_fd, buf, sizeof(buf))) > 0) {
             write_result = write(client_socket, buf, (size_t)read_bytes);
             if (write_result < 0 || write_result != read_bytes) {
+                TRACE_END(span);
                 close(file_fd);
                 return -1;
             }
+            metrics_bytes_sent((size_t)write_result);
         }
+        TRACE_END(span);
 
         close(file_fd);
         return 0;
@@ -778,33 +1235,34 @@ handle_client(int client_socket, const char *www_root)
         /* For profile page, serve the static file regardless of query params */
         if (snprintf(filepath, sizeof(filepath), "%s/profile.html", www_root) >=
             (int)sizeof(filepath)) {
-            fprintf(stderr, "Error: Path too long for profile.html\n");
+            DIAG(LOG_WARN, ("Error: Path too long for profile.html\n"));
             return -1;
         }
     } else if (strcmp(uri, "/") == 0) {
         if (snprintf(filepath, sizeof(filepath), "%s/index.html", www_root) >= (int)sizeof(filepath)) {
-            fprintf(stderr, "Error: Path too long for index.html\n");
+            DIAG(LOG_WARN, ("Error: Path too long for index.html\n"));
             return -1;
         }
     } else {
         if (snprintf(filepath, sizeof(filepath), "%s%s", www_root, uri) >= (int)sizeof(filepath)) {
-            fprintf(stderr, "Error: Path too long: %s%s\n", www_root, uri);
+            DIAG(LOG_WARN, ("Error: Path too long: %s%s\n", www_root, uri));
             return -1;
         }
     }
-    fprintf(stderr, "Attempting to serve file: %s\n", filepath);
+    DIAG(LOG_DEBUG, ("Attempting to serve file: %s\n", filepath));
 
-    /* Handle project views */
-    if (strncmp(uri, "/scjv.html", 9) == 0 ||
-        strncmp(uri, "/ms1180.html", 11) == 0 ||
-        strncmp(uri, "/w6946.html", 10) == 0) {
-        /* Extract username from cookie if present */
-        value = strstr(buf, "Cookie:");  /* Reuse value pointer */
-        if (value) {
-            parse_query_string(value, username, password);
-            if (username[0] != '\0') {
-                log_audit(username, ACTION_VIEW_PROJECT);
-            }
+    /* Handle project views: /<project>.html for any registered project */
+    if (is_project_page(uri)) {
+        /* Projects without a page of their own share the generic one */
+        if (stat(filepath, &st) < 0 &&
+            snprintf(filepath, sizeof(filepath), "%s/%s", www_root,
+                     PROJECT_PAGE) >= (int)sizeof(filepath)) {
+            return -1;
+        }
+        /* Attribute the view to the session's user */
+        request_username(buf, username, sizeof(username));
+        if (username[0] != '\0') {
+            log_audit(username, ACTION_VIEW_PROJECT);
         }
     }
 
@@ -818,130 +1276,202 @@ handle_client(int client_socket, const char *www_root)
 
     /* Add handler for get_next_number endpoint */
     if (strncmp(uri, ENDPOINT_NEXT_NUMBER, strlen(ENDPOINT_NEXT_NUMBER)) == 0) {
-        return handle_next_number(client_socket);
+        return handle_next_number(client_socket, uri);
     }
 
     /* Check if file exists and is readable */
     if (stat(filepath, &st) < 0 || !S_ISREG(st.st_mode)) {
-        fprintf(stderr, "Error: File not found or not regular: %s\n", filepath);
-        dprintf(client_socket, "HTTP/1.0 404 Not Found\r\n\r\n");
+        DIAG(LOG_INFO, ("Error: File not found or not regular: %s\n", filepath));
+        send_printf(client_socket, "HTTP/1.0 404 Not Found\r\n\r\n");
         return -1;
     }
 
     file_fd = open(filepath, O_RDONLY);
     if (file_fd < 0) {
-        dprintf(client_socket, "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+        send_printf(client_socket,
+                    "HTTP/1.0 500 Internal Server Error\r\n\r\n");
         return -1;
     }
 
     /* Send HTTP response */
-    dprintf(client_socket, "HTTP/1.0 200 OK\r\n");
-    dprintf(client_socket, "Access-Control-Allow-Origin: *\r\n");
-    dprintf(client_socket, "Access-Control-Allow-Methods: GET, POST\r\n");
-    dprintf(client_socket, "Access-Control-Allow-Headers: Content-Type, X-Username\r\n");
-    dprintf(client_socket, "\r\n");
+    send_printf(client_socket, "HTTP/1.0 200 OK\r\n");
+    send_printf(client_socket, "Access-Control-Allow-Origin: *\r\n");
+    send_printf(client_socket, "Access-Control-Allow-Methods: GET, POST\r\n");
+    send_printf(client_socket,
+                "Access-Control-Allow-Headers: Content-Type, X-Username\r\n");
+    send_printf(client_socket, "\r\n");
 
     /* Send file contents */
+    TRACE_BEGIN(span, "file_io");
     while ((read_bytes = read(file_fd, buf, sizeof(buf))) > 0) {
         write_result = write(client_socket, buf, (size_t)read_bytes);
         if (write_result < 0 || write_result != read_bytes) {
+            TRACE_END(span);
             close(file_fd);
             return -1;
         }
+        metrics_bytes_sent((size_t)write_result);
     }
+    TRACE_END(span);
 
     close(file_fd);
     return 0;
 }
 
+/*
+ * handle_client - Handle one client request
+ * @client_socket: Socket of the accepted connection
+ * @www_root: Directory static files are served from
+ *
+ * Returns 0 on success, -1 on failure, or HANDLE_DEFERRED if the socket
+ * was handed on and must not be closed.
+ */
 int
-handle_users_request(int client_socket)
+handle_client(int client_socket, const char *www_root)
 {
-    FILE *fp;
-    char line[512];
-    char *newline;
+    int result;
 
-    /* Send basic headers */
-    dprintf(client_socket, "HTTP/1.0 200 OK\r\n"
-                          "Content-Type: text/plain\r\n\r\n");
+    metrics_request_begin();
+    trace_request_begin();
+    result = handle_request(client_socket, www_root);
+    trace_request_end();
+    metrics_request_end(result);
+    return result;
+}
 
-    /* Open and read auth file directly */
-    fp = fopen(AUTH_FILE, "r");
-    if (!fp) {
-        fprintf(stderr, "Error: Could not open %s\n", AUTH_FILE);
-        dprintf(client_socket, "ERROR");
-        return -1;
-    }
+/*
+ * handle_projects_request - List the projects in the records directory
+ * @client_socket: Socket to send response
+ *
+ * Reading the list does not load any project; loaded tells which ones
+ * are resident at the moment.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int
+handle_projects_request(int client_socket)
+{
+    const struct rec_project *projects;
+    struct rec_store *store;
+    struct buffer body;
+    size_t count;
+    size_t i;
+    int loaded;
+    int result;
 
-    /* Send each valid line */
-    while (fgets(line, sizeof(line), fp)) {
-        /* Skip comments and empty lines */
-        if (line[0] == '#' || line[0] == '\n') {
-            continue;
+    count = rec_registry_projects(&projects);
+    buffer_init(&body);
+    result = buffer_append_str(&body, "{\"projects\":[");
+    for (i = 0; i < count && result == 0; i++) {
+        loaded = 0;
+        for (store = rec_registry_list(); store; store = store->next) {
+            loaded |= strcmp(store->name, projects[i].name) == 0;
         }
+        result = buffer_append_str(&body, i ? ",{\"name\":" : "{\"name\":");
+        result |= buffer_append_json(&body, projects[i].name);
+        result |= buffer_append_str(&body, ",\"title\":");
+        result |= buffer_append_json(&body, projects[i].title);
+        result |= buffer_appendf(&body, ",\"size\":%lu,\"loaded\":%s}",
+                                 projects[i].size, loaded ? "true" : "false");
+    }
+    if (result == 0) {
+        result = buffer_append_str(&body, "]}");
+    }
 
-        /* Remove trailing newline if present */
-        newline = strchr(line, '\n');
-        if (newline) {
-            *newline = '\0';
-        }
+    if (result != 0) {
+        buffer_free(&body);
+        return send_error_json(client_socket, "500 Internal Server Error",
+                               "Server error");
+    }
+    result = send_response(client_socket, "200 OK", "application/json",
+                           body.data, body.len);
+    buffer_free(&body);
+    return result;
+}
 
-        /* If line doesn't end with :0 or :1, append :0 */
-        if (line[strlen(line) - 2] != ':') {
-            dprintf(client_socket, "%s:0\n", line);
-        } else {
-            dprintf(client_socket, "%s\n", line);
-        }
+int
+handle_users_request(int client_socket)
+{
+    struct buffer users;
+    int result;
+
+    /* Send basic headers */
+    send_printf(client_socket, "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain\r\n\r\n");
+
+    /* Lines are serialized once per change of the auth file */
+    buffer_init(&users);
+    result = user_table_users(&users);
+    if (result != ERR_NONE) {
+        DIAG(LOG_ERROR, ("Error: Could not open %s\n", AUTH_FILE));
+        send_printf(client_socket, "ERROR");
+        buffer_free(&users);
+        return -1;
     }
 
-    fclose(fp);
-    return 0;
+    if (users.len > 0 && write_all(client_socket, users.data, users.len) != 0) {
+        result = -1;
+    }
+    buffer_free(&users);
+    return result;
 }
 
 /*
- * handle_update_user - Updates user information and logs the changes
+ * handle_update_user - Updates a user's profile
  * @client_socket: Socket to send response
  * @username: User's login name
  * @fullname: User's full name
  * @email: User's email address
  * @project: User's project designation
  *
+ * The profile is stored at once and written to disk with the next batch.
+ *
  * Returns 0 on success, -1 on failure
  */
 int
 handle_update_user(int client_socket, const char *username, const char *fullname,
                   const char *email, const char *project)
 {
-    FILE *fp;
-    char temp_path[PATH_MAX];
+    struct user_entry entry;
+    struct profile profile;
     int result;
 
-    /* Mark parameters as used to prevent warnings */
-    UNUSED(email);
-    UNUSED(project);
-
     /* Validate parameters */
-    if (!username || !fullname || !email || !project) {
+    if (!username || !fullname || !email || !project ||
+        strlen(username) >= sizeof(profile.username) ||
+        strlen(fullname) >= sizeof(profile.fullname) ||
+        strlen(email) >= sizeof(profile.email) ||
+        strlen(project) >= sizeof(profile.project)) {
+        send_printf(client_socket, "HTTP/1.0 400 Bad Request\r\n\r\n");
         return -1;
     }
 
-    /* Create log entry */
-    result = snprintf(temp_path, sizeof(temp_path), "var/log/updates.log");
-    if (result < 0 || (size_t)result >= sizeof(temp_path)) {
+    /* Only users that can log in have a profile */
+    result = user_table_find(username, &entry);
+    if (result == ERR_NOTFOUND) {
+        send_printf(client_socket, "HTTP/1.0 404 Not Found\r\n\r\n");
         return -1;
     }
 
-    fp = fopen(temp_path, "a");
-    if (!fp) {
+    strcpy(profile.username, username);
+    strcpy(profile.fullname, fullname);
+    strcpy(profile.email, email);
+    strcpy(profile.project, project);
+    if (result == ERR_NONE) {
+        result = profile_store_update(&profile);
+    }
+    if (result == ERR_PARAM) {
+        send_printf(client_socket, "HTTP/1.0 400 Bad Request\r\n\r\n");
+        return -1;
+    }
+    if (result != ERR_NONE) {
+        send_printf(client_socket,
+                    "HTTP/1.0 500 Internal Server Error\r\n\r\n");
         return -1;
     }
-
-    /* Write update record */
-    fprintf(fp, "%s|%s|%s|%s\n", username, fullname, email, project);
-    fclose(fp);
 
     /* Send success response */
-    dprintf(client_socket, "HTTP/1.0 200 OK\r\n\r\n");
+    send_printf(client_socket, "HTTP/1.0 200 OK\r\n\r\n");
     return 0;
 }
 
@@ -989,80 +1519,66 @@ setup_server(int port)
     return server_socket;
 }
 
-/* filepath: /home/appuser/fork-web-app/src/web_server.c */
-
+/* Allocate the next number of the default (PCEMP) sequence */
 int
 get_next_obligation_number(void)
 {
-    FILE *fp;
-    char number_str[32];
-    char *prefix;
-    int number;
-    int ret;
-
-    /* Open with exclusive lock for atomic read/write */
-    fp = fopen("/home/appuser/fork-web-app/var/records/obligation_number.txt", "r+");
-    if (!fp) {
-        return -1;
-    }
-
-    /* Get exclusive lock */
-    if (flock(fileno(fp), LOCK_EX) != 0) {
-        fclose(fp);
-        return -1;
-    }
-
-    /* Read current number */
-    if (fgets(number_str, sizeof(number_str), fp) == NULL) {
-        flock(fileno(fp), LOCK_UN);
-        fclose(fp);
-        return -1;
-    }
-
-    /* Find prefix */
-    prefix = strstr(number_str, "PCEMP-");
-    if (!prefix) {
-        flock(fileno(fp), LOCK_UN);
-        fclose(fp);
-        return -1;
-    }
-
-    /* Convert to number */
-    number = atoi(prefix + 6);
-    if (number <= 0) {
-        flock(fileno(fp), LOCK_UN);
-        fclose(fp);
-        return -1;
-    }
-
-    /* Write incremented number */
-    rewind(fp);
-    ret = fprintf(fp, "PCEMP-%d\n", number + 1);
-    fflush(fp);
-
-    /* Release lock and close */
-    flock(fileno(fp), LOCK_UN);
-    fclose(fp);
+    return (int)obligation_number_next(OBLIGATION_DEFAULT_PREFIX, "scjv");
+}
 
-    return ret < 0 ? -1 : number;
+/* Send a plain text error from /get_next_number; always returns -1 */
+static int
+send_number_error(int client_socket, const char *status, const char *message)
+{
+    send_printf(client_socket,
+        "HTTP/1.0 %s\r\n"
+        "Content-Type: text/plain\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Access-Control-Allow-Headers: X-Username\r\n"
+        "\r\n"
+        "%s", status, message);
+    return -1;
 }
 
+/*
+ * handle_next_number - Serve the next obligation number
+ * @client_socket: Socket to send response
+ * @uri: Request URI; an optional project= selects the sequence
+ *
+ * Without project= the number comes from the default (PCEMP) sequence.
+ * Otherwise the project must have a .rec file in the records directory,
+ * so clients cannot start sequences of their own.
+ *
+ * Returns 0 on success, -1 on failure
+ */
 int
-handle_next_number(int client_socket)
+handle_next_number(int client_socket, const char *uri)
 {
-    int number;
+    char project[REC_NAME_MAX];
+    char prefix[OBLIGATION_PREFIX_MAX];
     char response[256];
+    const char *query;
+    long number;
+
+    query = strchr(uri, '?');
+    query = query ? query + 1 : "";
 
-    number = get_next_obligation_number();
+    if (!get_query_param(query, "project", project, sizeof(project)) ||
+        !project[0]) {
+        strcpy(project, "scjv");
+    } else if (!rec_registry_find(project)) {
+        return send_number_error(client_socket, "400 Bad Request",
+                                 "Unknown project");
+    }
+    if (obligation_number_prefix(project, prefix, sizeof(prefix)) != ERR_NONE) {
+        return send_number_error(client_socket, "400 Bad Request",
+                                 "Project has no obligation number prefix");
+    }
+
+    number = obligation_number_next(prefix, project);
     if (number < 0) {
-        dprintf(client_socket,
-            "HTTP/1.0 500 Internal Server Error\r\n"
-            "Content-Type: text/plain\r\n"
-            "Access-Control-Allow-Origin: *\r\n"
-            "Access-Control-Allow-Headers: X-Username\r\n"
-            "\r\n"
-            "Error getting obligation number");
-        return -1;
+        return send_number_error(client_socket, "500 Internal Server Error",
+                                 "Error getting obligation number");
     }
 
     snprintf(response, sizeof(response),
@@ -1071,8 +1587,8 @@ handle_next_number(int client_socket)
         "Access-Control-Allow-Origin: *\r\n"
         "Access-Control-Allow-Headers: X-Username\r\n"
         "\r\n"
-        "PCEMP-%d", number);
+        "%s-%02ld", prefix, number);
 
-    write(client_socket, response, strlen(response));
+    write_all(client_socket, response, strlen(response));
     return 0;
 }
@@ -0,0 +1,229 @@
+/* filepath: test/test_archive.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/archive.h"
+#include "../include/buffer.h"
+#include "../include/lz.h"
+#include "../include/record_store.h"
+
+#define TEST_ARCHIVE_REC "test/archive.rec"
+#define TEST_ARCHIVE_SEGMENT "test/archive.archive"
+#define TEST_ARCHIVE_INDEX "test/archive.archive.idx"
+
+int
+archive_suite_setup(void)
+{
+    char date[16];
+    FILE *fp;
+
+    fp = fopen(TEST_ARCHIVE_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+
+    /* Only A-01 was closed long enough ago to move */
+    rec_format_date(rec_today() - 1, date, sizeof(date));
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Obligation_Number: A-01\n"
+        "Status: Closed\n"
+        "Close_Out_Date: 2000-01-01\n"
+        "\n"
+        "Obligation_Number: A-02\n"
+        "Status: Closed\n"
+        "Close_Out_Date: %s\n"
+        "\n"
+        "Obligation_Number: A-03\n"
+        "Status: In Progress\n", date);
+    fclose(fp);
+
+    archive_set_age(ARCHIVE_AGE_DAYS);
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+archive_suite_teardown(void)
+{
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_ARCHIVE_REC);
+    remove(TEST_ARCHIVE_SEGMENT);
+    remove(TEST_ARCHIVE_INDEX);
+    return 0;
+}
+
+static void
+test_lz_round_trip(void)
+{
+    struct buffer packed;
+    char text[4096];
+    char unpacked[4096];
+    size_t written;
+    size_t i;
+
+    for (i = 0; i < sizeof(text); i++) {
+        text[i] = i % 700 < 350 ? "Status: Closed\n"[i % 15] : (char)(rand() & 0x7f);
+    }
+
+    buffer_init(&packed);
+    CU_ASSERT_EQUAL(lz_compress(text, sizeof(text), &packed), 0);
+    CU_ASSERT(packed.len < sizeof(text));
+    CU_ASSERT_EQUAL(lz_decompress(packed.data, packed.len, unpacked,
+                                  sizeof(unpacked), &written), 0);
+    CU_ASSERT_EQUAL(written, sizeof(text));
+    CU_ASSERT_EQUAL(memcmp(text, unpacked, sizeof(text)), 0);
+
+    /* Output that does not fit is rejected, not overrun */
+    CU_ASSERT_EQUAL(lz_decompress(packed.data, packed.len, unpacked,
+                                  sizeof(unpacked) / 2, &written), -1);
+    buffer_free(&packed);
+}
+
+static void
+test_archive_project(void)
+{
+    struct rec_store *store;
+    char *data;
+    size_t size;
+
+    store = rec_store_get("archive");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+    CU_ASSERT_EQUAL(store->count, 3);
+
+    CU_ASSERT_EQUAL(archive_project("archive"), 1);
+    CU_ASSERT_EQUAL(store->count, 2);
+    CU_ASSERT_PTR_NULL(rec_store_find(store, "A-01"));
+    CU_ASSERT_PTR_NOT_NULL(rec_store_find(store, "A-02"));
+
+    data = rec_read_file(TEST_ARCHIVE_REC, &size);
+    CU_ASSERT_PTR_NOT_NULL(data);
+    if (data) {
+        CU_ASSERT_PTR_NULL(strstr(data, "A-01"));
+        CU_ASSERT_PTR_NOT_NULL(strstr(data, "%rec: Project"));
+        free(data);
+    }
+
+    /* Nothing else is old enough */
+    CU_ASSERT_EQUAL(archive_project("archive"), 0);
+}
+
+static void
+test_archive_find(void)
+{
+    struct buffer out;
+
+    buffer_init(&out);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-01", &out), ERR_NONE);
+    CU_ASSERT_PTR_NOT_NULL(out.data);
+    if (out.data) {
+        CU_ASSERT_PTR_NOT_NULL(strstr(out.data, "Close_Out_Date: 2000-01-01"));
+    }
+    CU_ASSERT_EQUAL(archive_find("archive", "A-01", NULL), ERR_NONE);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-03", NULL), ERR_NOTFOUND);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-0", NULL), ERR_NOTFOUND);
+    buffer_free(&out);
+}
+
+static void
+test_archive_query(void)
+{
+    int test_client[2];
+    char request[BUFFER_SIZE];
+    char response[BUFFER_SIZE];
+    ssize_t n;
+    int len;
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+
+    /* Archived records are only searched when asked for */
+    len = snprintf(request, sizeof(request),
+                   "GET /api/query?project=archive&archive=1&"
+                   "e=Status+%%3D+%%27Closed%%27 HTTP/1.1\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"A-01\""));
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"count\":2"));
+    }
+
+    len = snprintf(request, sizeof(request),
+                   "GET /api/query?project=archive&"
+                   "e=Status+%%3D+%%27Closed%%27 HTTP/1.1\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NULL(strstr(response, "\"A-01\""));
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"count\":1"));
+    }
+
+    close(test_client[0]);
+    close(test_client[1]);
+}
+
+static void
+test_archive_keys(void)
+{
+    char *data;
+    size_t size;
+
+    /* Keys are read from the index once, so losing it loses nothing */
+    CU_ASSERT_EQUAL(archive_find("archive", "A-01", NULL), ERR_NONE);
+    CU_ASSERT_EQUAL(remove(TEST_ARCHIVE_INDEX), 0);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-01", NULL), ERR_NONE);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-02", NULL), ERR_NOTFOUND);
+
+    /* A later pass adds its keys to the file and to memory */
+    archive_set_age(0);
+    CU_ASSERT_EQUAL(archive_project("archive"), 1);
+    archive_set_age(ARCHIVE_AGE_DAYS);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-02", NULL), ERR_NONE);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-01", NULL), ERR_NONE);
+    CU_ASSERT_EQUAL(archive_find("archive", "A-03", NULL), ERR_NOTFOUND);
+
+    data = rec_read_file(TEST_ARCHIVE_INDEX, &size);
+    CU_ASSERT_PTR_NOT_NULL(data);
+    if (data) {
+        CU_ASSERT_EQUAL(strncmp(data, "A-02 ", 5), 0);
+        free(data);
+    }
+}
+
+int
+init_archive_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test LZ Round Trip", test_lz_round_trip) == NULL) ||
+        (CU_add_test(suite, "Test Archive Project", test_archive_project) == NULL) ||
+        (CU_add_test(suite, "Test Archive Find", test_archive_find) == NULL) ||
+        (CU_add_test(suite, "Test Archive Query", test_archive_query) == NULL) ||
+        (CU_add_test(suite, "Test Archive Keys", test_archive_keys) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
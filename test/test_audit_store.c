@@ -0,0 +1,316 @@
+/* filepath: test/test_audit_store.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/audit_store.h"
+#include "../include/log_archive.h"
+
+#define TEST_AUDIT_DIR "test/audit"
+#define TEST_AUDIT_LINES 300        /* Lines per day and file */
+
+static int
+write_day(const char *name, int day, const char *mode)
+{
+    char path[128];
+    FILE *fp;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s", TEST_AUDIT_DIR, name);
+    fp = fopen(path, mode);
+    if (!fp) {
+        return -1;
+    }
+    for (i = 0; i < TEST_AUDIT_LINES; i++) {
+        fprintf(fp, "2024-01-%02d %02d:%02d:%02d|%s|%s\n", day,
+                i / 3600, i / 60 % 60, i % 60,
+                i % 100 == 7 ? "carol" : (i % 2 ? "alice" : "bob"),
+                i % 3 == 0 ? "Logged in" : "Viewed project");
+    }
+    fclose(fp);
+    return 0;
+}
+
+static int
+append_text(const char *text)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_AUDIT_DIR "/audit" LOG_SUFFIX, "a");
+    if (!fp) {
+        return -1;
+    }
+    fputs(text, fp);
+    fclose(fp);
+    return 0;
+}
+
+static void
+remove_files(void)
+{
+    char path[128];
+    int i;
+
+    for (i = 1; i <= LOG_MAX_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/audit.%d%s", TEST_AUDIT_DIR, i,
+                 LOG_ARCHIVE_SUFFIX);
+        remove(path);
+        strcat(path, LOG_COMPRESSED_SUFFIX);
+        remove(path);
+    }
+    remove(TEST_AUDIT_DIR "/audit" LOG_SUFFIX);
+}
+
+int
+audit_store_suite_setup(void)
+{
+    mkdir(TEST_AUDIT_DIR, 0755);
+    remove_files();
+    if (write_day("audit.2" LOG_ARCHIVE_SUFFIX, 1, "w") != 0 ||
+        write_day("audit.1" LOG_ARCHIVE_SUFFIX, 2, "w") != 0 ||
+        write_day("audit" LOG_SUFFIX, 3, "w") != 0) {
+        return -1;
+    }
+    return audit_store_init(TEST_AUDIT_DIR) == ERR_NONE ? 0 : -1;
+}
+
+int
+audit_store_suite_teardown(void)
+{
+    audit_store_init(LOG_DIR);
+    remove_files();
+    rmdir(TEST_AUDIT_DIR);
+    return 0;
+}
+
+/* Fetch one page; returns the entries on it and copies the next cursor */
+static long
+fetch(const char *query, char *next, size_t next_size, char *first_time)
+{
+    static char response[256 * 1024];
+    char uri[256];
+    char *p;
+    char *end;
+    long count;
+
+    next[0] = '\0';
+    snprintf(uri, sizeof(uri), "%s?%s", ENDPOINT_AUDIT, query);
+    test_get(uri, response, sizeof(response));
+
+    if (!strstr(response, "200 OK")) {
+        return -1;
+    }
+    count = 0;
+    for (p = strstr(response, "{\"time\":"); p; p = strstr(p + 1, "{\"time\":")) {
+        if (count++ == 0 && first_time) {
+            memcpy(first_time, p + 9, 19);
+            first_time[19] = '\0';
+        }
+    }
+    p = strstr(response, "\"next\":\"");
+    if (p) {
+        p += 8;
+        end = strchr(p, '"');
+        if (end && (size_t)(end - p) < next_size) {
+            memcpy(next, p, (size_t)(end - p));
+            next[end - p] = '\0';
+        }
+    }
+    return count;
+}
+
+/* Follow cursors through every page; returns the entries seen */
+static long
+fetch_all(const char *filter, long size, long *pages)
+{
+    char query[256];
+    char next[64];
+    char first[20];
+    char last_first[20];
+    long total;
+    long count;
+
+    total = 0;
+    *pages = 0;
+    next[0] = '\0';
+    last_first[0] = '\0';
+    do {
+        snprintf(query, sizeof(query), "%s&size=%ld%s%s", filter, size,
+                 next[0] ? "&cursor=" : "", next);
+        count = fetch(query, next, sizeof(next), first);
+        if (count < 0) {
+            return -1;
+        }
+        if (count > 0) {
+            /* Oldest first, across files */
+            CU_ASSERT(strcmp(first, last_first) >= 0);
+            strcpy(last_first, first);
+        }
+        total += count;
+        (*pages)++;
+    } while (next[0] && *pages < 100);
+    return total;
+}
+
+static void
+test_audit_pages(void)
+{
+    char next[64];
+    char first[20];
+    long pages;
+
+    CU_ASSERT_EQUAL(fetch("size=10", next, sizeof(next), first), 10);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-01 00:00:00");
+    CU_ASSERT(next[0] != '\0');
+
+    /* Pages run through the rotated files into the live log */
+    CU_ASSERT_EQUAL(fetch_all("", 128, &pages), TEST_AUDIT_LINES * 3);
+    CU_ASSERT_EQUAL(pages, (TEST_AUDIT_LINES * 3 + 127) / 128);
+
+    CU_ASSERT_EQUAL(fetch("size=0", next, sizeof(next), NULL), -1);
+    CU_ASSERT_EQUAL(fetch("cursor=nonsense", next, sizeof(next), NULL), -1);
+}
+
+static void
+test_audit_filters(void)
+{
+    char next[64];
+    char first[20];
+    long pages;
+
+    /* carol is on three lines of each file */
+    CU_ASSERT_EQUAL(fetch("user=carol", next, sizeof(next), first), 9);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-01 00:00:07");
+    CU_ASSERT_STRING_EQUAL(next, "");
+    CU_ASSERT_EQUAL(fetch_all("user=carol", 2, &pages), 9);
+    CU_ASSERT_EQUAL(fetch("user=car", next, sizeof(next), NULL), 0);
+    CU_ASSERT_EQUAL(fetch("user=nobody", next, sizeof(next), NULL), 0);
+
+    /* Dates may be cut short; both ends are inclusive */
+    CU_ASSERT_EQUAL(fetch_all("from=2024-01-02&to=2024-01-02", 1000, &pages),
+                    TEST_AUDIT_LINES);
+    CU_ASSERT_EQUAL(fetch("from=2024-01-02%2000:01&size=1", next, sizeof(next),
+                          first), 1);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-02 00:01:00");
+    CU_ASSERT_EQUAL(fetch_all("to=2024-01-01%2000:00:09", 1000, &pages), 10);
+
+    CU_ASSERT_EQUAL(fetch_all("action=Logged&user=bob", 1000, &pages),
+                    3 * (TEST_AUDIT_LINES / 6));
+}
+
+static void
+test_audit_growth(void)
+{
+    char next[64];
+    long pages;
+
+    CU_ASSERT_EQUAL(fetch_all("from=2024-01-04", 1000, &pages), 0);
+
+    /* Lines added later are indexed on the next query */
+    CU_ASSERT_EQUAL(write_day("audit" LOG_SUFFIX, 4, "a"), 0);
+    CU_ASSERT_EQUAL(fetch_all("from=2024-01-04", 1000, &pages), TEST_AUDIT_LINES);
+    CU_ASSERT_EQUAL(fetch("user=carol&from=2024-01-04", next, sizeof(next), NULL), 3);
+
+    /* A line still being written is left for later */
+    CU_ASSERT_EQUAL(append_text("2024-01-05 00:00:00|dave|Log"), 0);
+    CU_ASSERT_EQUAL(fetch_all("", 1000, &pages), TEST_AUDIT_LINES * 4);
+    CU_ASSERT_EQUAL(append_text("ged in\n"), 0);
+    CU_ASSERT_EQUAL(fetch_all("user=dave", 1000, &pages), 1);
+    CU_ASSERT_EQUAL(fetch_all("", 1000, &pages), TEST_AUDIT_LINES * 4 + 1);
+}
+
+static void
+test_audit_rotation(void)
+{
+    char next[64];
+    char cursor[64];
+    char query[128];
+    char first[20];
+    long pages;
+
+    /* Take a cursor in the live log, then rotate under it */
+    CU_ASSERT_EQUAL(fetch("from=2024-01-03&size=5", cursor, sizeof(cursor), first), 5);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-03 00:00:00");
+    CU_ASSERT_EQUAL(rename(TEST_AUDIT_DIR "/audit.2" LOG_ARCHIVE_SUFFIX,
+                           TEST_AUDIT_DIR "/audit.3" LOG_ARCHIVE_SUFFIX), 0);
+    CU_ASSERT_EQUAL(rename(TEST_AUDIT_DIR "/audit.1" LOG_ARCHIVE_SUFFIX,
+                           TEST_AUDIT_DIR "/audit.2" LOG_ARCHIVE_SUFFIX), 0);
+    CU_ASSERT_EQUAL(rename(TEST_AUDIT_DIR "/audit" LOG_SUFFIX,
+                           TEST_AUDIT_DIR "/audit.1" LOG_ARCHIVE_SUFFIX), 0);
+    CU_ASSERT_EQUAL(write_day("audit" LOG_SUFFIX, 6, "w"), 0);
+
+    /* The cursor follows its file to the new name */
+    snprintf(query, sizeof(query), "size=1&cursor=%s", cursor);
+    CU_ASSERT_EQUAL(fetch(query, next, sizeof(next), first), 1);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-03 00:00:05");
+    CU_ASSERT_EQUAL(fetch_all("", 1000, &pages), TEST_AUDIT_LINES * 5 + 1);
+
+    /* Once its file is gone the trail starts over from the oldest */
+    remove(TEST_AUDIT_DIR "/audit.1" LOG_ARCHIVE_SUFFIX);
+    CU_ASSERT_EQUAL(fetch(query, next, sizeof(next), first), 1);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-01 00:00:00");
+    CU_ASSERT_EQUAL(fetch_all("", 1000, &pages), TEST_AUDIT_LINES * 3);
+}
+
+static void
+test_audit_compressed(void)
+{
+    char next[64];
+    char cursor[64];
+    char query[128];
+    char first[20];
+    long pages;
+
+    /* Compressing a file under a cursor keeps the cursor and the index */
+    CU_ASSERT_EQUAL(fetch("size=5", cursor, sizeof(cursor), first), 5);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-01 00:00:00");
+    CU_ASSERT_EQUAL(log_archive_compress(TEST_AUDIT_DIR "/audit.3" LOG_ARCHIVE_SUFFIX),
+                    ERR_NONE);
+    CU_ASSERT_EQUAL(log_archive_compress(TEST_AUDIT_DIR "/audit.2" LOG_ARCHIVE_SUFFIX),
+                    ERR_NONE);
+    CU_ASSERT_EQUAL(access(TEST_AUDIT_DIR "/audit.3" LOG_ARCHIVE_SUFFIX, F_OK), -1);
+
+    snprintf(query, sizeof(query), "size=1&cursor=%s", cursor);
+    CU_ASSERT_EQUAL(fetch(query, next, sizeof(next), first), 1);
+    CU_ASSERT_STRING_EQUAL(first, "2024-01-01 00:00:05");
+    CU_ASSERT_EQUAL(fetch_all("", 100, &pages), TEST_AUDIT_LINES * 3);
+    CU_ASSERT_EQUAL(fetch("user=carol", next, sizeof(next), first), 9);
+    CU_ASSERT_EQUAL(fetch_all("from=2024-01-02&to=2024-01-02", 7, &pages),
+                    TEST_AUDIT_LINES);
+
+    /* A fresh index is built from the compressed files alone */
+    audit_store_clear();
+    CU_ASSERT_EQUAL(fetch_all("action=Logged&user=bob", 1000, &pages),
+                    3 * (TEST_AUDIT_LINES / 6));
+    CU_ASSERT_EQUAL(fetch_all("", 1000, &pages), TEST_AUDIT_LINES * 3);
+}
+
+int
+init_audit_store_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Audit Pages", test_audit_pages) == NULL) ||
+        (CU_add_test(suite, "Test Audit Filters", test_audit_filters) == NULL) ||
+        (CU_add_test(suite, "Test Audit Growth", test_audit_growth) == NULL) ||
+        (CU_add_test(suite, "Test Audit Rotation", test_audit_rotation) == NULL) ||
+        (CU_add_test(suite, "Test Audit Compressed", test_audit_compressed) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
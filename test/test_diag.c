@@ -0,0 +1,138 @@
+/* filepath: test/test_diag.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/diag.h"
+#include "../include/record_store.h"
+
+#define TEST_DIAG_FILE "test/diag.out"
+
+static int evaluated = 0;
+
+int
+diag_suite_setup(void)
+{
+    return 0;
+}
+
+int
+diag_suite_teardown(void)
+{
+    diag_set_level(DIAG_LEVEL_DEFAULT);
+    remove(TEST_DIAG_FILE);
+    return 0;
+}
+
+static int
+touch(void)
+{
+    return ++evaluated;
+}
+
+static void
+test_diag_levels(void)
+{
+    int level;
+
+    CU_ASSERT(DIAG_RANK(LOG_NONE) < DIAG_RANK(LOG_ERROR));
+    CU_ASSERT(DIAG_RANK(LOG_ERROR) == DIAG_RANK(LOG_FATAL));
+    CU_ASSERT(DIAG_RANK(LOG_ERROR) < DIAG_RANK(LOG_WARN));
+    CU_ASSERT(DIAG_RANK(LOG_WARN) < DIAG_RANK(LOG_INFO));
+    CU_ASSERT(DIAG_RANK(LOG_INFO) < DIAG_RANK(LOG_DEBUG));
+
+    CU_ASSERT_EQUAL(diag_parse_level("debug", &level), ERR_NONE);
+    CU_ASSERT_EQUAL(level, LOG_DEBUG);
+    CU_ASSERT_EQUAL(diag_parse_level("none", &level), ERR_NONE);
+    CU_ASSERT_EQUAL(level, LOG_NONE);
+    CU_ASSERT_EQUAL(diag_parse_level("loud", &level), ERR_PARAM);
+    CU_ASSERT_EQUAL(diag_parse_level(NULL, &level), ERR_PARAM);
+
+    CU_ASSERT_EQUAL(diag_set_level(LOG_INFO), ERR_NONE);
+    CU_ASSERT_EQUAL(diag_get_level(), LOG_INFO);
+    CU_ASSERT_EQUAL(diag_set_level(LOG_AUTH), ERR_PARAM);
+    CU_ASSERT_EQUAL(diag_get_level(), LOG_INFO);
+}
+
+static void
+test_diag_disabled(void)
+{
+    /* Disabled levels do not even evaluate their arguments */
+    evaluated = 0;
+    CU_ASSERT_EQUAL(diag_set_level(LOG_WARN), ERR_NONE);
+    CU_ASSERT(!DIAG_ENABLED(LOG_INFO));
+    CU_ASSERT(!DIAG_ENABLED(LOG_DEBUG));
+    DIAG(LOG_DEBUG, ("unused %d\n", touch()));
+    DIAG(LOG_INFO, ("unused %d\n", touch()));
+    CU_ASSERT_EQUAL(evaluated, 0);
+
+    CU_ASSERT_EQUAL(diag_set_level(LOG_NONE), ERR_NONE);
+    CU_ASSERT(!DIAG_ENABLED(LOG_ERROR));
+    DIAG(LOG_ERROR, ("unused %d\n", touch()));
+    CU_ASSERT_EQUAL(evaluated, 0);
+}
+
+static void
+test_diag_output(void)
+{
+    char *data;
+    size_t size;
+    int saved;
+    int fd;
+
+    fd = open(TEST_DIAG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CU_ASSERT(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    fflush(stderr);
+    saved = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+    close(fd);
+
+    /* Enabled levels print, up to the one set */
+    CU_ASSERT_EQUAL(diag_set_level(LOG_DEBUG), ERR_NONE);
+    CU_ASSERT(DIAG_ENABLED(LOG_DEBUG) == (DIAG_RANK(LOG_LEVEL_MAX) >= DIAG_RANK(LOG_DEBUG)));
+    DIAG(LOG_WARN, ("warned %d\n", 1));
+    CU_ASSERT_EQUAL(diag_set_level(LOG_ERROR), ERR_NONE);
+    DIAG(LOG_WARN, ("warned %d\n", 2));
+    DIAG(LOG_ERROR, ("failed %s\n", "here"));
+
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    data = rec_read_file(TEST_DIAG_FILE, &size);
+    CU_ASSERT(data != NULL);
+    if (data) {
+        CU_ASSERT_STRING_EQUAL(data, "warned 1\nfailed here\n");
+        free(data);
+    }
+}
+
+int
+init_diag_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Diag Levels", test_diag_levels) == NULL) ||
+        (CU_add_test(suite, "Test Diag Disabled", test_diag_disabled) == NULL) ||
+        (CU_add_test(suite, "Test Diag Output", test_diag_output) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+/* filepath: test/test_export.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/export.h"
+#include "../include/record_store.h"
+
+#define TEST_EXPORT_REC "test/export.rec"
+
+int
+export_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_EXPORT_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Project_Name: Export\n"
+        "Obligation_Number: EXPORT-01\n"
+        "Status: In Progress\n"
+        "Obligation: Keep records, and report \"promptly\"\n"
+        "\n"
+        "Project_Name: Export\n"
+        "Obligation_Number: EXPORT-02\n"
+        "Status: Complete\n"
+        "Supporting_Information: First line\n"
+        "+ Second line\n");
+    fclose(fp);
+
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+export_suite_teardown(void)
+{
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_EXPORT_REC);
+    return 0;
+}
+
+static void
+test_chunked_writer(void)
+{
+    struct chunked_writer writer;
+    char payload[5000];
+    char response[8192];
+    int test_client[2];
+    size_t used;
+    ssize_t n;
+    char *body;
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    memset(payload, 'x', sizeof(payload));
+
+    CU_ASSERT_EQUAL(chunked_begin(&writer, test_client[1], "text/plain", NULL), 0);
+    CU_ASSERT_EQUAL(chunked_write(&writer, payload, sizeof(payload)), 0);
+    CU_ASSERT_EQUAL(chunked_end(&writer), 0);
+    close(test_client[1]);
+
+    used = 0;
+    while (used < sizeof(response) - 1 &&
+           (n = read(test_client[0], response + used,
+                     sizeof(response) - 1 - used)) > 0) {
+        used += (size_t)n;
+    }
+    response[used] = '\0';
+    close(test_client[0]);
+
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Transfer-Encoding: chunked\r\n"));
+    body = strstr(response, "\r\n\r\n");
+    CU_ASSERT_PTR_NOT_NULL(body);
+    if (!body) {
+        return;
+    }
+
+    /* A full chunk, the 904-byte remainder, then the terminator */
+    body += 4;
+    CU_ASSERT_EQUAL(strncmp(body, "1000\r\n", 6), 0);
+    body += 6 + HTTP_CHUNK_SIZE;
+    CU_ASSERT_EQUAL(strncmp(body, "\r\n0388\r\n", 8), 0);
+    body += 8 + sizeof(payload) - HTTP_CHUNK_SIZE;
+    CU_ASSERT_STRING_EQUAL(body, "\r\n0\r\n\r\n");
+}
+
+static void
+test_export_csv(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/export?project=export&format=csv",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "filename=\"export.csv\""));
+
+    /* Columns in order of first appearance, CRLF row endings */
+    CU_ASSERT_PTR_NOT_NULL(strstr(response,
+        "Project_Name,Obligation_Number,Status,Obligation,"
+        "Supporting_Information\r\n"));
+
+    /* Quotes are doubled, separators and line breaks are quoted */
+    CU_ASSERT_PTR_NOT_NULL(strstr(response,
+        "Export,EXPORT-01,In Progress,"
+        "\"Keep records, and report \"\"promptly\"\"\",\r\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response,
+        "Export,EXPORT-02,Complete,,\"First line\nSecond line\"\r\n"));
+}
+
+static void
+test_export_filters(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/export?project=export&Status=In+Progress",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "EXPORT-01"));
+    CU_ASSERT_PTR_NULL(strstr(response, "EXPORT-02"));
+
+    /* A missing field matches an empty filter value */
+    CU_ASSERT_EQUAL(test_get("/api/export?project=export&Obligation=",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NULL(strstr(response, "EXPORT-01"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "EXPORT-02"));
+}
+
+static void
+test_export_errors(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/export?project=missing",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "404 Not Found"));
+
+    CU_ASSERT_EQUAL(test_get("/api/export?project=export&format=xls",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+
+    CU_ASSERT_EQUAL(test_get("/api/export?project=export&No_Such_Field=1",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Invalid filter"));
+}
+
+int
+init_export_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Chunked Writer", test_chunked_writer) == NULL) ||
+        (CU_add_test(suite, "Test Export CSV", test_export_csv) == NULL) ||
+        (CU_add_test(suite, "Test Export Filters", test_export_filters) == NULL) ||
+        (CU_add_test(suite, "Test Export Errors", test_export_errors) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+/* filepath: test/test_forecast.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/forecast.h"
+#include "../include/record_store.h"
+#include "../include/timer_wheel.h"
+
+#define TEST_FORECAST_REC "test/forecast.rec"
+
+static int timer_fired[3];
+
+static void
+count_timer(void *arg)
+{
+    int *slot;
+
+    slot = arg;
+    (*slot)++;
+}
+
+int
+forecast_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_FORECAST_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Project_Name: Test\n"
+        "Obligation_Number: TEST-01\n"
+        "Status: In Progress\n"
+        "Action_DueDate: 1/01/2020\n"
+        "Recurring_Obligation: Yes\n"
+        "Recurring_Frequency: Weekly\n"
+        "Recurring_Status: Active\n"
+        "Inspection: No\n"
+        "\n"
+        "Project_Name: Test\n"
+        "Obligation_Number: TEST-02\n"
+        "Status: Not Started\n"
+        "Supporting_Information: First line\n"
+        "+ Second line\n"
+        "Inspection: Yes\n"
+        "Inspection_Frequency: As required\n");
+    fclose(fp);
+
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+forecast_suite_teardown(void)
+{
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_FORECAST_REC);
+    return 0;
+}
+
+static void
+test_timer_wheel(void)
+{
+    struct timer near;
+    struct timer mid;
+    struct timer far;
+
+    memset(timer_fired, 0, sizeof(timer_fired));
+    timer_wheel_init(1000);
+    timer_init(&near, count_timer, &timer_fired[0]);
+    timer_init(&mid, count_timer, &timer_fired[1]);
+    timer_init(&far, count_timer, &timer_fired[2]);
+
+    timer_add(&near, 1);
+    timer_add(&mid, 70);
+    timer_add(&far, 5000);
+
+    timer_wheel_advance(1001);
+    CU_ASSERT_EQUAL(timer_fired[0], 1);
+    CU_ASSERT_EQUAL(timer_fired[1], 0);
+
+    timer_wheel_advance(1069);
+    CU_ASSERT_EQUAL(timer_fired[1], 0);
+    timer_wheel_advance(1070);
+    CU_ASSERT_EQUAL(timer_fired[1], 1);
+
+    timer_wheel_advance(5999);
+    CU_ASSERT_EQUAL(timer_fired[2], 0);
+    timer_wheel_advance(6000);
+    CU_ASSERT_EQUAL(timer_fired[2], 1);
+
+    /* Deleted timers never fire */
+    timer_add(&near, 10);
+    timer_del(&near);
+    timer_wheel_advance(6020);
+    CU_ASSERT_EQUAL(timer_fired[0], 1);
+}
+
+static void
+test_date_parsing(void)
+{
+    char date[16];
+
+    CU_ASSERT_EQUAL(rec_parse_date("1970-01-01"), 0);
+    CU_ASSERT_EQUAL(rec_parse_date("2024/12/10"),
+                    rec_days_from_civil(2024, 12, 10));
+    CU_ASSERT_EQUAL(rec_parse_date("1/08/2024"),
+                    rec_days_from_civil(2024, 8, 1));
+    CU_ASSERT_EQUAL(rec_parse_date("2025-01-01T00:00:00+08:00"),
+                    rec_days_from_civil(2025, 1, 1));
+    CU_ASSERT_EQUAL(rec_parse_date(""), REC_DATE_INVALID);
+    CU_ASSERT_EQUAL(rec_parse_date("1/13/2024"), REC_DATE_INVALID);
+
+    rec_format_date(rec_days_from_civil(2024, 2, 29), date, sizeof(date));
+    CU_ASSERT_STRING_EQUAL(date, "2024-02-29");
+
+    /* Month arithmetic clamps to the end of the month */
+    CU_ASSERT_EQUAL(forecast_add_months(rec_days_from_civil(2024, 1, 31), 1),
+                    rec_days_from_civil(2024, 2, 29));
+}
+
+static void
+test_frequency_parsing(void)
+{
+    int days;
+    int months;
+
+    CU_ASSERT_EQUAL(forecast_parse_frequency("Weekly", &days, &months), 1);
+    CU_ASSERT_EQUAL(days, 7);
+    CU_ASSERT_EQUAL(forecast_parse_frequency("Quarterly", &days, &months), 1);
+    CU_ASSERT_EQUAL(months, 3);
+    CU_ASSERT_EQUAL(forecast_parse_frequency("30", &days, &months), 1);
+    CU_ASSERT_EQUAL(days, 30);
+    CU_ASSERT_EQUAL(forecast_parse_frequency("As required", &days, &months), 0);
+    CU_ASSERT_EQUAL(forecast_parse_frequency(NULL, &days, &months), 0);
+}
+
+static void
+test_forecast_refresh(void)
+{
+    struct rec_store *store;
+    const char *update;
+    long today;
+
+    store = rec_store_get("forecast");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+    CU_ASSERT_EQUAL(store->count, 2);
+    CU_ASSERT_STRING_EQUAL(rec_get(store->records[1], "Supporting_Information"),
+                           "First line\nSecond line");
+
+    /* First pass computes everything; only the weekly series is due */
+    CU_ASSERT_EQUAL(forecast_refresh(store), 2);
+    CU_ASSERT_EQUAL(store->due_count, 1);
+    today = rec_today();
+    CU_ASSERT(store->due[0].day >= today && store->due[0].day < today + 7);
+    CU_ASSERT_EQUAL((store->due[0].day - rec_days_from_civil(2020, 1, 1)) % 7, 0);
+
+    /* Nothing changed: nothing recomputed */
+    CU_ASSERT_EQUAL(forecast_refresh(store), 0);
+
+    /* Changing one record's inputs recomputes only that record */
+    update = "Project_Name: Test\n"
+             "Obligation_Number: TEST-02\n"
+             "Status: Not Started\n"
+             "Inspection: Yes\n"
+             "Inspection_Frequency: Monthly\n";
+    CU_ASSERT_EQUAL(rec_store_upsert(store, update, strlen(update)), ERR_NONE);
+    CU_ASSERT_EQUAL(store->count, 2);
+    CU_ASSERT_EQUAL(forecast_refresh(store), 1);
+    CU_ASSERT_EQUAL(store->due_count, 2);
+}
+
+static void
+test_forecast_endpoint(void)
+{
+    int test_client[2];
+    char request[BUFFER_SIZE];
+    char response[BUFFER_SIZE];
+    ssize_t n;
+    int len;
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+
+    len = snprintf(request, sizeof(request),
+                   "GET /api/forecast?project=forecast&months=1 HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"obligation\":\"TEST-01\""));
+    }
+
+    /* Unknown projects are rejected */
+    len = snprintf(request, sizeof(request),
+                   "GET /api/forecast?project=missing HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), -1);
+
+    close(test_client[0]);
+    close(test_client[1]);
+}
+
+int
+init_forecast_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Timer Wheel", test_timer_wheel) == NULL) ||
+        (CU_add_test(suite, "Test Date Parsing", test_date_parsing) == NULL) ||
+        (CU_add_test(suite, "Test Frequency Parsing", test_frequency_parsing) == NULL) ||
+        (CU_add_test(suite, "Test Forecast Refresh", test_forecast_refresh) == NULL) ||
+        (CU_add_test(suite, "Test Forecast Endpoint", test_forecast_endpoint) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
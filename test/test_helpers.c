@@ -0,0 +1,73 @@
+/* filepath: test/test_helpers.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+
+/*
+ * test_exchange - Run one raw request through handle_client
+ * @request: Whole request, with headers and any body
+ * @response: Receives the response, NUL-terminated
+ * @size: Size of response; a longer response is cut short
+ *
+ * Returns what handle_client returned, or -2 if the request could not
+ * be sent.
+ */
+int
+test_exchange(const char *request, char *response, size_t size)
+{
+    int test_client[2];
+    size_t used;
+    ssize_t n;
+    int result;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, test_client) != 0) {
+        return -2;
+    }
+    if (write(test_client[0], request, strlen(request)) !=
+        (ssize_t)strlen(request)) {
+        close(test_client[0]);
+        close(test_client[1]);
+        return -2;
+    }
+    result = handle_client(test_client[1], TEST_WWW_ROOT);
+    close(test_client[1]);
+
+    used = 0;
+    while (used < size - 1 &&
+           (n = read(test_client[0], response + used, size - 1 - used)) > 0) {
+        used += (size_t)n;
+    }
+    response[used] = '\0';
+    close(test_client[0]);
+    return result;
+}
+
+/* test_get - test_exchange a bare GET of uri */
+int
+test_get(const char *uri, char *response, size_t size)
+{
+    char request[BUFFER_SIZE];
+    int len;
+
+    len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\n\r\n", uri);
+    if (len < 0 || (size_t)len >= sizeof(request)) {
+        return -2;
+    }
+    return test_exchange(request, response, size);
+}
@@ -0,0 +1,247 @@
+/* filepath: test/test_history.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/buffer.h"
+#include "../include/history.h"
+#include "../include/record_store.h"
+
+#define TEST_HISTORY_REC "test/history.rec"
+#define TEST_HISTORY_LOG "test/history.history"
+#define TEST_HISTORY_T0 1700000000L
+
+int
+history_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_HISTORY_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Obligation_Number: H-01\n"
+        "Status: Not Started\n"
+        "Comments: Original\n");
+    fclose(fp);
+
+    remove(TEST_HISTORY_LOG);
+    history_shutdown();
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+history_suite_teardown(void)
+{
+    history_shutdown();
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_HISTORY_REC);
+    remove(TEST_HISTORY_LOG);
+    return 0;
+}
+
+static void
+test_history_revisions(void)
+{
+    struct buffer out;
+    char text[256];
+    int i;
+
+    /* Ten edits; the pre-existing record becomes revision 1 */
+    for (i = 1; i <= 10; i++) {
+        snprintf(text, sizeof(text),
+                 "Obligation_Number: H-01\n"
+                 "Status: Edit %d\n"
+                 "%s",
+                 i, i < 5 ? "Comments: Line one\n+ line two\n" : "");
+        CU_ASSERT_EQUAL(history_append("history", text, "tester",
+                                       TEST_HISTORY_T0 + i * 100), ERR_NONE);
+    }
+
+    buffer_init(&out);
+    CU_ASSERT_EQUAL(history_at("history", "H-01", 0, &out), ERR_NONE);
+    CU_ASSERT(out.data && strstr(out.data, "Status: Not Started\n") != NULL);
+    CU_ASSERT(out.data && strstr(out.data, "Comments: Original\n") != NULL);
+
+    buffer_reset(&out);
+    CU_ASSERT_EQUAL(history_at("history", "H-01", TEST_HISTORY_T0 + 350, &out),
+                    ERR_NONE);
+    CU_ASSERT(out.data && strstr(out.data, "Status: Edit 3\n") != NULL);
+    CU_ASSERT(out.data && strstr(out.data, "Comments: Line one\n+ line two\n") != NULL);
+
+    /* Past the checkpoint at revision 9, and after the field was removed */
+    buffer_reset(&out);
+    CU_ASSERT_EQUAL(history_at("history", "H-01", TEST_HISTORY_T0 + 5000, &out),
+                    ERR_NONE);
+    CU_ASSERT(out.data && strstr(out.data, "Status: Edit 10\n") != NULL);
+    CU_ASSERT(out.data && strstr(out.data, "Comments") == NULL);
+
+    CU_ASSERT_EQUAL(history_at("history", "H-99", TEST_HISTORY_T0, &out),
+                    ERR_NOTFOUND);
+    buffer_free(&out);
+}
+
+static void
+test_history_reload(void)
+{
+    struct buffer out;
+    const char *same;
+
+    /* Re-index from the file, as after a restart */
+    history_shutdown();
+    buffer_init(&out);
+    CU_ASSERT_EQUAL(history_at("history", "H-01", TEST_HISTORY_T0 + 650, &out),
+                    ERR_NONE);
+    CU_ASSERT(out.data && strstr(out.data, "Status: Edit 6\n") != NULL);
+    buffer_free(&out);
+
+    /* A revision that changes nothing is not stored */
+    same = "Obligation_Number: H-01\nStatus: Edit 10\n";
+    CU_ASSERT_EQUAL(history_append("history", same, NULL, TEST_HISTORY_T0 + 9000),
+                    ERR_NONE);
+    CU_ASSERT_EQUAL(history_append("history", "Status: Keyless\n", NULL, 0),
+                    ERR_PARAM);
+}
+
+/* Rewrite the record file with H-02 in the given state, as an edit would */
+static int
+write_second(const char *status)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_HISTORY_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Obligation_Number: H-01\n"
+        "Status: Not Started\n\n"
+        "Obligation_Number: H-02\n"
+        "Status: %s\n", status);
+    return fclose(fp);
+}
+
+static void
+test_history_baseline(void)
+{
+    const char *text;
+    struct buffer out;
+
+    /* The store is not resident and the file is rewritten before append */
+    text = "Obligation_Number: H-02\nStatus: Edited\n";
+    CU_ASSERT_EQUAL(write_second("Original"), 0);
+    CU_ASSERT_EQUAL(rec_registry_init("test"), ERR_NONE);
+    CU_ASSERT_EQUAL(history_baseline("history", text), ERR_NONE);
+    CU_ASSERT_EQUAL(write_second("Edited"), 0);
+    CU_ASSERT_EQUAL(rec_registry_init("test"), ERR_NONE);
+    CU_ASSERT_EQUAL(history_append("history", text, "tester", TEST_HISTORY_T0),
+                    ERR_NONE);
+
+    buffer_init(&out);
+    CU_ASSERT_EQUAL(history_at("history", "H-02", 0, &out), ERR_NONE);
+    CU_ASSERT(out.data && strstr(out.data, "Status: Original\n") != NULL);
+    buffer_reset(&out);
+    CU_ASSERT_EQUAL(history_at("history", "H-02", TEST_HISTORY_T0, &out), ERR_NONE);
+    CU_ASSERT(out.data && strstr(out.data, "Status: Edited\n") != NULL);
+    buffer_free(&out);
+
+    CU_ASSERT_EQUAL(history_baseline("history", "Status: Keyless\n"), ERR_PARAM);
+}
+
+static void
+test_history_endpoint(void)
+{
+    int test_client[2];
+    char request[BUFFER_SIZE];
+    char response[BUFFER_SIZE * 4];
+    ssize_t n;
+    size_t total;
+    int len;
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+
+    len = snprintf(request, sizeof(request),
+                   "GET /api/records/H-01/history?project=history HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    total = 0;
+    while (total < sizeof(response) - 1 &&
+           (n = recv(test_client[0], response + total, sizeof(response) - 1 - total,
+                     MSG_DONTWAIT)) > 0) {
+        total += (size_t)n;
+    }
+    response[total] = '\0';
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"revision\":11,"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"user\":\"tester\""));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"removed\":[\"Comments\"]"));
+    CU_ASSERT_PTR_NULL(strstr(response, "\"revision\":12,"));
+
+    len = snprintf(request, sizeof(request),
+                   "GET /api/records/H-01?project=history&at=%ld HTTP/1.0\r\n\r\n",
+                   TEST_HISTORY_T0 + 250);
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"Status\":\"Edit 2\""));
+    }
+
+    /* A bare date is the end of that day in UTC, whatever the local zone */
+    len = snprintf(request, sizeof(request),
+                   "GET /api/records/H-01?project=history&at=2023-11-14 HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"at\":\"2023-11-14T23:59:59Z\""));
+    }
+
+    len = snprintf(request, sizeof(request),
+                   "GET /api/records/H-01/bogus?project=history HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), -1);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "404"));
+    }
+
+    close(test_client[0]);
+    close(test_client[1]);
+}
+
+int
+init_history_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test History Revisions", test_history_revisions) == NULL) ||
+        (CU_add_test(suite, "Test History Reload", test_history_reload) == NULL) ||
+        (CU_add_test(suite, "Test History Baseline", test_history_baseline) == NULL) ||
+        (CU_add_test(suite, "Test History Endpoint", test_history_endpoint) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+/* filepath: test/test_log_archive.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/buffer.h"
+#include "../include/log_archive.h"
+#include "../include/record_store.h"
+
+#define TEST_ARCHIVE_LOG "test/archive.1" LOG_ARCHIVE_SUFFIX
+#define TEST_ARCHIVE_LZ TEST_ARCHIVE_LOG LOG_COMPRESSED_SUFFIX
+#define TEST_ARCHIVE_NAME "archive-test"
+#define TEST_ARCHIVE_LINES 6000
+
+static void
+remove_files(void)
+{
+    char path[128];
+    int i;
+
+    remove(TEST_ARCHIVE_LOG);
+    remove(TEST_ARCHIVE_LZ);
+    snprintf(path, sizeof(path), "%s/%s%s", LOG_DIR, TEST_ARCHIVE_NAME, LOG_SUFFIX);
+    remove(path);
+    for (i = 1; i <= LOG_MAX_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/%s.%d%s", LOG_DIR, TEST_ARCHIVE_NAME, i,
+                 LOG_ARCHIVE_SUFFIX);
+        remove(path);
+        strcat(path, LOG_COMPRESSED_SUFFIX);
+        remove(path);
+    }
+}
+
+static int
+write_log(const char *path)
+{
+    FILE *fp;
+    int i;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    for (i = 0; i < TEST_ARCHIVE_LINES; i++) {
+        fprintf(fp, "2024-02-01 %02d:%02d:%02d|user%d|Viewed project %d\n",
+                i / 3600, i / 60 % 60, i % 60, i % 17, i);
+    }
+    fclose(fp);
+    return 0;
+}
+
+int
+log_archive_suite_setup(void)
+{
+    mkdir(LOG_DIR, 0755);
+    remove_files();
+    return 0;
+}
+
+int
+log_archive_suite_teardown(void)
+{
+    log_archive_shutdown();
+    remove_files();
+    return 0;
+}
+
+static void
+test_log_archive_roundtrip(void)
+{
+    struct log_archive archive;
+    struct stat plain;
+    struct stat packed;
+    char *text;
+    char *out;
+    size_t size;
+    size_t offset;
+    ssize_t n;
+
+    CU_ASSERT_EQUAL(write_log(TEST_ARCHIVE_LOG), 0);
+    CU_ASSERT_EQUAL(stat(TEST_ARCHIVE_LOG, &plain), 0);
+    text = rec_read_file(TEST_ARCHIVE_LOG, &size);
+    CU_ASSERT(text != NULL && size > 2 * LOG_FRAME_SIZE);
+    if (!text) {
+        return;
+    }
+
+    CU_ASSERT_EQUAL(log_archive_compress(TEST_ARCHIVE_LOG), ERR_NONE);
+    CU_ASSERT_EQUAL(access(TEST_ARCHIVE_LOG, F_OK), -1);
+    CU_ASSERT_EQUAL(stat(TEST_ARCHIVE_LZ, &packed), 0);
+    CU_ASSERT(packed.st_size < plain.st_size / 2);
+
+    /* The reader sees the original text, inode and all */
+    CU_ASSERT_EQUAL(log_archive_open(&archive, TEST_ARCHIVE_LZ), ERR_NONE);
+    CU_ASSERT_EQUAL(archive.size, (off_t)size);
+    CU_ASSERT(archive.ino == plain.st_ino);
+    CU_ASSERT(archive.count > 2);
+    out = malloc(size + 1);
+    CU_ASSERT(out != NULL);
+    if (out) {
+        CU_ASSERT_EQUAL(log_archive_read(&archive, out, size + 1, 0), (ssize_t)size);
+        CU_ASSERT(memcmp(out, text, size) == 0);
+
+        /* Ranges across frame boundaries, in any order */
+        for (offset = size - 1000; offset > 7919; offset -= 7919) {
+            n = log_archive_read(&archive, out, 1000, (off_t)offset);
+            CU_ASSERT_EQUAL(n, 1000);
+            CU_ASSERT(memcmp(out, text + offset, 1000) == 0);
+        }
+        CU_ASSERT_EQUAL(log_archive_read(&archive, out, 10, (off_t)size), 0);
+        free(out);
+    }
+    log_archive_close(&archive);
+
+    /* Frames hold whole lines */
+    CU_ASSERT_EQUAL(log_archive_open(&archive, TEST_ARCHIVE_LZ), ERR_NONE);
+    CU_ASSERT(archive.frames && text[archive.frames[1].raw - 1] == '\n');
+    log_archive_close(&archive);
+    free(text);
+}
+
+static void
+test_log_archive_damaged(void)
+{
+    struct log_archive archive;
+    struct stat st;
+
+    CU_ASSERT_EQUAL(log_archive_open(&archive, "test/no-such-file"), ERR_NOTFOUND);
+    CU_ASSERT_EQUAL(log_archive_open(&archive, "test"), ERR_IO);
+    CU_ASSERT_EQUAL(log_archive_compress("test/no-such-file"), ERR_NOTFOUND);
+
+    /* A plain file reads as itself */
+    CU_ASSERT_EQUAL(write_log(TEST_ARCHIVE_LOG), 0);
+    CU_ASSERT_EQUAL(stat(TEST_ARCHIVE_LOG, &st), 0);
+    CU_ASSERT_EQUAL(log_archive_open(&archive, TEST_ARCHIVE_LOG), ERR_NONE);
+    CU_ASSERT_EQUAL(archive.size, st.st_size);
+    CU_ASSERT(archive.frames == NULL);
+    log_archive_close(&archive);
+
+    /* A cut short compressed file is refused */
+    CU_ASSERT_EQUAL(stat(TEST_ARCHIVE_LZ, &st), 0);
+    CU_ASSERT_EQUAL(truncate(TEST_ARCHIVE_LZ, st.st_size - 1), 0);
+    CU_ASSERT_EQUAL(log_archive_open(&archive, TEST_ARCHIVE_LZ), ERR_IO);
+}
+
+static void
+test_log_archive_background(void)
+{
+    struct timespec pause;
+    struct buffer stats;
+    char path[128];
+    char lz[128];
+    int i;
+
+    /* Rotation leaves compression to the compressor thread */
+    CU_ASSERT_EQUAL(log_archive_start(), ERR_NONE);
+    snprintf(path, sizeof(path), "%s/%s%s", LOG_DIR, TEST_ARCHIVE_NAME, LOG_SUFFIX);
+    CU_ASSERT_EQUAL(write_log(path), 0);
+    CU_ASSERT_EQUAL(rotate_log(TEST_ARCHIVE_NAME), ERR_NONE);
+    snprintf(lz, sizeof(lz), "%s/%s.1%s%s", LOG_DIR, TEST_ARCHIVE_NAME,
+             LOG_ARCHIVE_SUFFIX, LOG_COMPRESSED_SUFFIX);
+    pause.tv_sec = 0;
+    pause.tv_nsec = 10000000L;
+    for (i = 0; i < 500 && access(lz, F_OK) != 0; i++) {
+        nanosleep(&pause, NULL);
+    }
+    CU_ASSERT_EQUAL(access(lz, F_OK), 0);
+
+    buffer_init(&stats);
+    CU_ASSERT_EQUAL(log_archive_stats(&stats), 0);
+    CU_ASSERT(stats.data != NULL && strstr(stats.data, "\"running\":true") != NULL);
+    buffer_free(&stats);
+    log_archive_shutdown();
+}
+
+static void
+test_log_archive_rotation(void)
+{
+    char path[128];
+
+    /* Compressed copies move along the chain with the plain ones */
+    snprintf(path, sizeof(path), "%s/%s%s", LOG_DIR, TEST_ARCHIVE_NAME, LOG_SUFFIX);
+    CU_ASSERT_EQUAL(write_log(path), 0);
+    CU_ASSERT_EQUAL(rotate_log(TEST_ARCHIVE_NAME), ERR_NONE);
+    snprintf(path, sizeof(path), "%s/%s.1%s", LOG_DIR, TEST_ARCHIVE_NAME,
+             LOG_ARCHIVE_SUFFIX);
+    CU_ASSERT_EQUAL(access(path, F_OK), 0);
+    strcat(path, LOG_COMPRESSED_SUFFIX);
+    CU_ASSERT_EQUAL(access(path, F_OK), -1);
+    snprintf(path, sizeof(path), "%s/%s.2%s%s", LOG_DIR, TEST_ARCHIVE_NAME,
+             LOG_ARCHIVE_SUFFIX, LOG_COMPRESSED_SUFFIX);
+    CU_ASSERT_EQUAL(access(path, F_OK), 0);
+
+    /* Without the compressor running the copy stays plain */
+    log_archive_queue(TEST_ARCHIVE_NAME);
+    snprintf(path, sizeof(path), "%s/%s.1%s", LOG_DIR, TEST_ARCHIVE_NAME,
+             LOG_ARCHIVE_SUFFIX);
+    CU_ASSERT_EQUAL(access(path, F_OK), 0);
+}
+
+int
+init_log_archive_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Log Archive Roundtrip", test_log_archive_roundtrip) == NULL) ||
+        (CU_add_test(suite, "Test Log Archive Damaged", test_log_archive_damaged) == NULL) ||
+        (CU_add_test(suite, "Test Log Archive Background", test_log_archive_background) == NULL) ||
+        (CU_add_test(suite, "Test Log Archive Rotation", test_log_archive_rotation) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,227 @@
+/* filepath: test/test_log_writer.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX headers */
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/buffer.h"
+#include "../include/log_writer.h"
+#include "../include/record_store.h"
+
+#define TEST_WEB_LOG LOG_DIR "/web" LOG_SUFFIX
+#define TEST_AUDIT_LOG LOG_DIR "/audit" LOG_SUFFIX
+#define TEST_LOG_THREADS 4
+#define TEST_LOG_LINES 1000
+
+int
+log_writer_suite_setup(void)
+{
+    mkdir(LOG_DIR, 0755);
+    return 0;
+}
+
+int
+log_writer_suite_teardown(void)
+{
+    log_writer_shutdown();
+    log_writer_set_policy(LOG_POLICY_DEFAULT);
+    return 0;
+}
+
+/* Lines of path containing marker */
+static long
+count_lines(const char *path, const char *marker)
+{
+    char *data;
+    char *p;
+    size_t size;
+    long count;
+
+    data = rec_read_file(path, &size);
+    if (!data) {
+        return -1;
+    }
+    count = 0;
+    for (p = strstr(data, marker); p; p = strstr(p + 1, marker)) {
+        count++;
+    }
+    free(data);
+    return count;
+}
+
+static void *
+log_thread(void *arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LOG_LINES; i++) {
+        log_message(LOG_INFO, (const char *)arg, "THREAD_TEST", "burst line");
+    }
+    return NULL;
+}
+
+static void
+test_log_writer_inline(void)
+{
+    char *data;
+    char *line;
+    size_t size;
+
+    /* Without the writer the caller writes the line itself */
+    CU_ASSERT_EQUAL(log_message(LOG_WARN, "inline-user", "INLINE_TEST", "hello"),
+                    ERR_NONE);
+    data = rec_read_file(TEST_WEB_LOG, &size);
+    CU_ASSERT(data != NULL);
+    if (!data) {
+        return;
+    }
+    line = strstr(data, "|2|inline-user|INLINE_TEST|hello\n");
+    CU_ASSERT(line != NULL && line - data >= LOG_STAMP_LEN);
+    if (line && line - data >= LOG_STAMP_LEN) {
+        line -= LOG_STAMP_LEN;
+        CU_ASSERT(line == data || line[-1] == '\n');
+        CU_ASSERT(line[4] == '-' && line[10] == ' ' && line[13] == ':');
+    }
+    free(data);
+
+    CU_ASSERT_EQUAL(log_writer_printf(LOG_FILES, 0, "|x"), ERR_PARAM);
+    CU_ASSERT_EQUAL(log_message(LOG_INFO, "u", "a", NULL), ERR_PARAM);
+}
+
+static void
+test_log_writer_durable(void)
+{
+    long before;
+
+    CU_ASSERT_EQUAL(log_writer_start(), ERR_NONE);
+    before = count_lines(TEST_AUDIT_LOG, "|durable-user|");
+    if (before < 0) {
+        before = 0;
+    }
+
+    /* Audit lines are in the file when the call returns */
+    CU_ASSERT_EQUAL(log_writer_printf(LOG_FILE_AUDIT, LOG_WRITE_DURABLE,
+                                      "|%s|%s", "durable-user", "Logged in"),
+                    ERR_NONE);
+    CU_ASSERT_EQUAL(count_lines(TEST_AUDIT_LOG, "|durable-user|"), before + 1);
+
+    /* Other lines are written by shutdown at the latest */
+    CU_ASSERT_EQUAL(log_message(LOG_INFO, "queued-user", "QUEUED_TEST", "later"),
+                    ERR_NONE);
+    log_writer_shutdown();
+    CU_ASSERT(count_lines(TEST_WEB_LOG, "|queued-user|QUEUED_TEST|later\n") >= 1);
+}
+
+static void
+test_log_writer_durable_failure(void)
+{
+    /* A directory in place of the audit log makes every open fail */
+    log_writer_shutdown();
+    CU_ASSERT_EQUAL(rename(TEST_AUDIT_LOG, TEST_AUDIT_LOG ".keep"), 0);
+    CU_ASSERT_EQUAL(mkdir(TEST_AUDIT_LOG, 0755), 0);
+
+    CU_ASSERT_EQUAL(log_writer_start(), ERR_NONE);
+    CU_ASSERT_EQUAL(log_writer_printf(LOG_FILE_AUDIT, LOG_WRITE_DURABLE,
+                                      "|%s|%s", "failed-user", "Logged in"),
+                    ERR_IO);
+    log_writer_shutdown();
+    CU_ASSERT_EQUAL(log_writer_printf(LOG_FILE_AUDIT, LOG_WRITE_DURABLE,
+                                      "|%s|%s", "failed-user", "Logged in"),
+                    ERR_IO);
+
+    CU_ASSERT_EQUAL(rmdir(TEST_AUDIT_LOG), 0);
+    CU_ASSERT_EQUAL(rename(TEST_AUDIT_LOG ".keep", TEST_AUDIT_LOG), 0);
+}
+
+static void
+test_log_writer_threads(void)
+{
+    pthread_t threads[TEST_LOG_THREADS];
+    char names[TEST_LOG_THREADS][32];
+    char marker[48];
+    int i;
+
+    /* Blocking on a full ring keeps every line */
+    log_writer_set_policy(LOG_POLICY_BLOCK);
+    CU_ASSERT_EQUAL(log_writer_start(), ERR_NONE);
+    for (i = 0; i < TEST_LOG_THREADS; i++) {
+        snprintf(names[i], sizeof(names[i]), "thread-%d-%ld", i, (long)time(NULL));
+        CU_ASSERT_EQUAL(pthread_create(&threads[i], NULL, log_thread, names[i]), 0);
+    }
+    for (i = 0; i < TEST_LOG_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    log_writer_shutdown();
+
+    for (i = 0; i < TEST_LOG_THREADS; i++) {
+        snprintf(marker, sizeof(marker), "|%s|THREAD_TEST|", names[i]);
+        CU_ASSERT_EQUAL(count_lines(TEST_WEB_LOG, marker), TEST_LOG_LINES);
+    }
+    log_writer_set_policy(LOG_POLICY_DEFAULT);
+}
+
+static void
+test_log_writer_long_line(void)
+{
+    char message[LOG_ENTRY_MAX * 2];
+    struct buffer stats;
+    char *data;
+    char *line;
+    char *end;
+    size_t size;
+
+    /* Long lines are cut short but still end the line */
+    memset(message, 'x', sizeof(message) - 1);
+    message[sizeof(message) - 1] = '\0';
+    CU_ASSERT_EQUAL(log_message(LOG_INFO, "long-user", "LONG_TEST", message),
+                    ERR_NONE);
+    data = rec_read_file(TEST_WEB_LOG, &size);
+    CU_ASSERT(data != NULL);
+    if (data) {
+        line = strstr(data, "|long-user|LONG_TEST|");
+        CU_ASSERT(line != NULL);
+        end = line ? strchr(line, '\n') : NULL;
+        CU_ASSERT(end != NULL);
+        if (end) {
+            CU_ASSERT((size_t)(end - line) + LOG_STAMP_LEN + 1 <= LOG_ENTRY_MAX);
+        }
+        free(data);
+    }
+
+    buffer_init(&stats);
+    CU_ASSERT_EQUAL(log_writer_stats(&stats), 0);
+    CU_ASSERT(stats.data != NULL && strstr(stats.data, "\"web\":{\"lines\":") != NULL);
+    buffer_free(&stats);
+}
+
+int
+init_log_writer_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Log Writer Inline", test_log_writer_inline) == NULL) ||
+        (CU_add_test(suite, "Test Log Writer Durable", test_log_writer_durable) == NULL) ||
+        (CU_add_test(suite, "Test Log Writer Durable Failure",
+                     test_log_writer_durable_failure) == NULL) ||
+        (CU_add_test(suite, "Test Log Writer Threads", test_log_writer_threads) == NULL) ||
+        (CU_add_test(suite, "Test Log Writer Long Line", test_log_writer_long_line) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
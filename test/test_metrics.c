@@ -0,0 +1,238 @@
+/* filepath: test/test_metrics.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX headers */
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/buffer.h"
+#include "../include/metrics.h"
+#include "../include/web_server.h"
+
+#define TEST_METRICS_THREADS 4
+#define TEST_METRICS_REQUESTS 250   /* Per thread */
+
+int
+metrics_suite_setup(void)
+{
+    return 0;
+}
+
+int
+metrics_suite_teardown(void)
+{
+    return 0;
+}
+
+/* The value of the sample whose name and labels are series; 0 if absent */
+static unsigned long
+sample(const char *series)
+{
+    struct buffer out;
+    unsigned long value;
+    size_t len;
+    char *p;
+
+    buffer_init(&out);
+    value = 0;
+    len = strlen(series);
+    if (metrics_render(&out) == 0) {
+        for (p = out.data; p; p = strchr(p, '\n')) {
+            p += p[0] == '\n';
+            if (strncmp(p, series, len) == 0 && p[len] == ' ') {
+                value = strtoul(p + len + 1, NULL, 10);
+                break;
+            }
+        }
+    }
+    buffer_free(&out);
+    return value;
+}
+
+static void
+request(const char *uri, int result)
+{
+    metrics_request_begin();
+    metrics_request_route(uri);
+    metrics_request_end(result);
+}
+
+static void *
+request_thread(void *arg)
+{
+    int i;
+
+    UNUSED(arg);
+    for (i = 0; i < TEST_METRICS_REQUESTS; i++) {
+        request(ENDPOINT_STATS, 0);
+        metrics_bytes_sent(10);
+    }
+    return NULL;
+}
+
+static void
+test_metrics_routes(void)
+{
+    unsigned long query;
+    unsigned long records;
+    unsigned long rec_file;
+    unsigned long errors;
+
+    query = sample("web_requests_total{route=\"query\"}");
+    records = sample("web_requests_total{route=\"records\"}");
+    rec_file = sample("web_requests_total{route=\"rec_file\"}");
+    errors = sample("web_request_errors_total{route=\"query\"}");
+
+    request(ENDPOINT_QUERY "?q=status", 0);
+    request(ENDPOINT_QUERY, -1);
+    request(ENDPOINT_RECORDS "test/3", 0);
+    request("/test.rec", 0);
+    request("/api/queryx", 0);
+
+    CU_ASSERT_EQUAL(sample("web_requests_total{route=\"query\"}"), query + 2);
+    CU_ASSERT_EQUAL(sample("web_request_errors_total{route=\"query\"}"), errors + 1);
+    CU_ASSERT_EQUAL(sample("web_requests_total{route=\"records\"}"), records + 1);
+    CU_ASSERT_EQUAL(sample("web_requests_total{route=\"rec_file\"}"), rec_file + 1);
+    CU_ASSERT_EQUAL(sample("web_request_duration_seconds_count{route=\"query\"}"),
+                    query + 2);
+}
+
+static void
+test_metrics_threads(void)
+{
+    pthread_t threads[TEST_METRICS_THREADS];
+    unsigned long stats;
+    unsigned long bytes;
+    int i;
+
+    stats = sample("web_requests_total{route=\"stats\"}");
+    bytes = sample("web_response_bytes_total");
+    for (i = 0; i < TEST_METRICS_THREADS; i++) {
+        CU_ASSERT_EQUAL(pthread_create(&threads[i], NULL, request_thread, NULL), 0);
+    }
+    for (i = 0; i < TEST_METRICS_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* Every thread's shard is counted once the threads are gone */
+    CU_ASSERT_EQUAL(sample("web_requests_total{route=\"stats\"}"),
+                    stats + TEST_METRICS_THREADS * TEST_METRICS_REQUESTS);
+    CU_ASSERT_EQUAL(sample("web_response_bytes_total"),
+                    bytes + TEST_METRICS_THREADS * TEST_METRICS_REQUESTS * 10);
+}
+
+static void
+test_metrics_response_bytes(void)
+{
+    static const char *requests[] = {
+        "GET /users HTTP/1.0\r\n\r\n",
+        "DELETE /users HTTP/1.0\r\n\r\n",
+        "BOGUS\r\n\r\n"
+    };
+    char response[MAX_BUFFER_SIZE * 4];
+    unsigned long bytes;
+    size_t i;
+
+    /* Responses written piecemeal count as well as send_response ones */
+    for (i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+        bytes = sample("web_response_bytes_total");
+        test_exchange(requests[i], response, sizeof(response));
+        CU_ASSERT(response[0] != '\0');
+        CU_ASSERT_EQUAL(sample("web_response_bytes_total") - bytes,
+                        strlen(response));
+    }
+}
+
+static void
+test_metrics_histograms(void)
+{
+    struct timespec start;
+    struct timespec pause;
+    unsigned long count;
+    unsigned long below;
+    unsigned long in_flight;
+
+    /* A 3 ms wait lands above the 2 ms bucket; a slow wake may go past 4 ms */
+    count = sample("web_record_lock_wait_seconds_count");
+    below = sample("web_record_lock_wait_seconds_bucket{le=\"0.002048\"}");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pause.tv_sec = 0;
+    pause.tv_nsec = 3000000L;
+    nanosleep(&pause, NULL);
+    metrics_lock_wait(&start);
+    CU_ASSERT_EQUAL(sample("web_record_lock_wait_seconds_count"), count + 1);
+    CU_ASSERT_EQUAL(sample("web_record_lock_wait_seconds_bucket{le=\"+Inf\"}"),
+                    count + 1);
+    CU_ASSERT_EQUAL(sample("web_record_lock_wait_seconds_bucket{le=\"0.002048\"}"),
+                    below);
+    CU_ASSERT(sample("web_record_lock_wait_seconds_bucket{le=\"0.000001\"}") <=
+              sample("web_record_lock_wait_seconds_bucket{le=\"0.000002\"}"));
+
+    /* A deferred request stays in flight until it is answered */
+    in_flight = sample("web_connections_in_flight");
+    request(ENDPOINT_LOGOUT, HANDLE_DEFERRED);
+    CU_ASSERT_EQUAL(sample("web_connections_in_flight"), in_flight + 1);
+    metrics_connection_done();
+    CU_ASSERT_EQUAL(sample("web_connections_in_flight"), in_flight);
+}
+
+static void
+test_metrics_scrape(void)
+{
+    char response[64 * 1024];
+    int test_client[2];
+    size_t used;
+    ssize_t n;
+
+    request(ENDPOINT_METRICS, 0);
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    CU_ASSERT_EQUAL(handle_metrics_request(test_client[1]), 0);
+    close(test_client[1]);
+
+    /* Only the start is needed; the rest is drained */
+    used = 0;
+    while ((n = read(test_client[0], response + used,
+                     sizeof(response) - 1 - used)) > 0) {
+        used += (size_t)n;
+        if (used == sizeof(response) - 1) {
+            used = sizeof(response) / 2;
+        }
+    }
+    response[used] = '\0';
+    close(test_client[0]);
+
+    CU_ASSERT(strstr(response, "200 OK") != NULL);
+    CU_ASSERT(strstr(response, METRICS_CONTENT_TYPE) != NULL);
+    CU_ASSERT(strstr(response, "# TYPE web_requests_total counter") != NULL);
+    CU_ASSERT(strstr(response, "web_requests_total{route=\"metrics\"}") != NULL);
+}
+
+int
+init_metrics_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Metrics Routes", test_metrics_routes) == NULL) ||
+        (CU_add_test(suite, "Test Metrics Threads", test_metrics_threads) == NULL) ||
+        (CU_add_test(suite, "Test Metrics Response Bytes",
+                     test_metrics_response_bytes) == NULL) ||
+        (CU_add_test(suite, "Test Metrics Histograms", test_metrics_histograms) == NULL) ||
+        (CU_add_test(suite, "Test Metrics Scrape", test_metrics_scrape) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+/* filepath: test/test_obligation_number.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/obligation_number.h"
+
+#define TEST_NUMBER_FILE "test/obligation_number.txt"
+
+int
+obligation_number_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_NUMBER_FILE, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp, "PCEMP-240");
+    fclose(fp);
+
+    return obligation_number_init(TEST_NUMBER_FILE) == ERR_NONE ? 0 : -1;
+}
+
+int
+obligation_number_suite_teardown(void)
+{
+    obligation_number_init(OBLIGATION_NUMBER_FILE);
+    remove(TEST_NUMBER_FILE);
+    return 0;
+}
+
+static void
+read_counter_file(char *data, size_t size)
+{
+    FILE *fp;
+    size_t n;
+
+    data[0] = '\0';
+    fp = fopen(TEST_NUMBER_FILE, "r");
+    if (fp) {
+        n = fread(data, 1, size - 1, fp);
+        data[n] = '\0';
+        fclose(fp);
+    }
+}
+
+static void
+test_block_reservation(void)
+{
+    char data[256];
+    long number;
+    long i;
+
+    /* Numbers continue from the counter file */
+    CU_ASSERT_EQUAL(obligation_number_next("PCEMP", NULL), 240);
+    CU_ASSERT_EQUAL(obligation_number_next("PCEMP", NULL), 241);
+
+    /* A whole block is reserved durably up front */
+    read_counter_file(data, sizeof(data));
+    CU_ASSERT_STRING_EQUAL(data, "PCEMP-340\n");
+
+    /* Exhausting the block reserves the next one */
+    for (i = 242; i < 340; i++) {
+        number = obligation_number_next("PCEMP", NULL);
+        CU_ASSERT_EQUAL(number, i);
+    }
+    CU_ASSERT_EQUAL(obligation_number_next("PCEMP", NULL), 340);
+    read_counter_file(data, sizeof(data));
+    CU_ASSERT_STRING_EQUAL(data, "PCEMP-440\n");
+}
+
+static void
+test_restart_uniqueness(void)
+{
+    long before;
+    long after;
+
+    before = obligation_number_next("PCEMP", NULL);
+
+    /* A restarted allocator skips the rest of the reserved block */
+    CU_ASSERT_EQUAL(obligation_number_init(TEST_NUMBER_FILE), ERR_NONE);
+    after = obligation_number_next("PCEMP", NULL);
+    CU_ASSERT(after > before);
+    CU_ASSERT_EQUAL(after, 440);
+}
+
+static void
+test_project_prefixes(void)
+{
+    char prefix[OBLIGATION_PREFIX_MAX];
+    char data[256];
+
+    CU_ASSERT_EQUAL(obligation_number_prefix("scjv", prefix, sizeof(prefix)), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(prefix, "PCEMP");
+    CU_ASSERT_EQUAL(obligation_number_prefix("ms1180", prefix, sizeof(prefix)), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(prefix, "MS1180");
+    CU_ASSERT_EQUAL(obligation_number_prefix("../x", prefix, sizeof(prefix)), ERR_PARAM);
+
+    /* Independent sequences share one counter file */
+    CU_ASSERT_EQUAL(obligation_number_next("W6946", NULL), 1);
+    CU_ASSERT_EQUAL(obligation_number_next("W6946", NULL), 2);
+    read_counter_file(data, sizeof(data));
+    CU_ASSERT_PTR_NOT_NULL(strstr(data, "PCEMP-540\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(data, "W6946-101\n"));
+
+    CU_ASSERT_EQUAL(obligation_number_next("bad prefix", NULL), -1);
+}
+
+static void
+test_next_number_request(void)
+{
+    char response[1024];
+    char data[256];
+
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_NEXT_NUMBER "?project=ms1180", response,
+                             sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\r\n\r\nMS1180-"));
+
+    /* Without a project the default sequence is used; prefix= is ignored */
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_NEXT_NUMBER "?prefix=JUNK", response,
+                             sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\r\n\r\nPCEMP-"));
+
+    /* Projects without a .rec file are client errors and start nothing */
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_NEXT_NUMBER "?project=nosuch", response,
+                             sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_NEXT_NUMBER "?project=../scjv", response,
+                             sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+
+    read_counter_file(data, sizeof(data));
+    CU_ASSERT_PTR_NOT_NULL(strstr(data, "MS1180-"));
+    CU_ASSERT_PTR_NULL(strstr(data, "JUNK"));
+    CU_ASSERT_PTR_NULL(strstr(data, "NOSUCH"));
+}
+
+int
+init_obligation_number_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Block Reservation", test_block_reservation) == NULL) ||
+        (CU_add_test(suite, "Test Restart Uniqueness", test_restart_uniqueness) == NULL) ||
+        (CU_add_test(suite, "Test Project Prefixes", test_project_prefixes) == NULL) ||
+        (CU_add_test(suite, "Test Next Number Request", test_next_number_request) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,227 @@
+/* filepath: test/test_password.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/password.h"
+#include "../include/record_store.h"
+#include "../include/session.h"
+#include "../include/user_table.h"
+
+#define TEST_PASSWORD_USERS "test/password.passwd"
+
+static int jobs_done;
+static int last_match;
+static int last_rehash;
+
+int
+password_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_PASSWORD_USERS, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs("# Users\n"
+          "plain:pw:1000:1000:Plain User:/home/plain:/bin/sh:1\n"
+          "pooled:pw2:1001:1001:Pooled User:/home/pooled:/bin/sh\n", fp);
+    fclose(fp);
+    return user_table_init(TEST_PASSWORD_USERS) == ERR_NONE ? 0 : -1;
+}
+
+int
+password_suite_teardown(void)
+{
+    password_pool_shutdown();
+    session_clear();
+    user_table_init(AUTH_FILE);
+    remove(TEST_PASSWORD_USERS);
+    return 0;
+}
+
+static void
+record_job(struct password_job *job)
+{
+    jobs_done++;
+    last_match = job->match;
+    last_rehash = job->rehash[0] != '\0';
+}
+
+/* Wait for finished logins and complete them as the main loop would */
+static long
+wait_dispatch(void)
+{
+    struct pollfd pfd;
+
+    pfd.fd = password_pool_fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 5000) != 1) {
+        return 0;
+    }
+    return password_pool_dispatch();
+}
+
+static void
+test_password_hash(void)
+{
+    char hash[PASSWORD_HASH_MAX];
+    char again[PASSWORD_HASH_MAX];
+    char prefix[32];
+
+    CU_ASSERT_EQUAL(password_hash("correct horse", hash, sizeof(hash)), ERR_NONE);
+    snprintf(prefix, sizeof(prefix), "$6$rounds=%d$", PASSWORD_ROUNDS);
+    CU_ASSERT_EQUAL(strncmp(hash, prefix, strlen(prefix)), 0);
+    CU_ASSERT(strchr(hash, ':') == NULL);
+
+    CU_ASSERT_EQUAL(password_verify("correct horse", hash), 1);
+    CU_ASSERT_EQUAL(password_verify("correct horsE", hash), 0);
+    CU_ASSERT_EQUAL(password_verify("", hash), 0);
+
+    /* Salted: the same password hashes differently each time */
+    CU_ASSERT_EQUAL(password_hash("correct horse", again, sizeof(again)), ERR_NONE);
+    CU_ASSERT(strcmp(hash, again) != 0);
+    CU_ASSERT_EQUAL(password_verify("correct horse", again), 1);
+
+    CU_ASSERT_EQUAL(password_hash("x", hash, 16), ERR_INTERNAL);
+}
+
+static void
+test_password_legacy(void)
+{
+    char hash[PASSWORD_HASH_MAX];
+
+    /* Plaintext entries still log in, and want a hash */
+    CU_ASSERT_EQUAL(password_verify("secret", "secret"), 1);
+    CU_ASSERT_EQUAL(password_verify("secre", "secret"), 0);
+    CU_ASSERT_EQUAL(password_needs_rehash("secret"), 1);
+
+    /* No such user never matches */
+    CU_ASSERT_EQUAL(password_verify("", ""), 0);
+
+    /* Hashes below the configured cost are upgraded */
+    CU_ASSERT_EQUAL(password_needs_rehash("$6$saltsalt$abc"), 1);
+    CU_ASSERT_EQUAL(password_needs_rehash("$6$rounds=1000$salt$abc"), 1);
+    CU_ASSERT_EQUAL(password_hash("pw", hash, sizeof(hash)), ERR_NONE);
+    CU_ASSERT_EQUAL(password_needs_rehash(hash), 0);
+}
+
+static void
+test_password_rehash_on_login(void)
+{
+    struct user_entry entry;
+    char *data;
+    size_t size;
+
+    CU_ASSERT_EQUAL(check_auth("plain", "wrong"), 0);
+    CU_ASSERT_EQUAL(user_table_find("plain", &entry), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(entry.password, "pw");
+
+    /* The first good login replaces the plaintext with a hash */
+    CU_ASSERT_EQUAL(check_auth("plain", "pw"), 1);
+    CU_ASSERT_EQUAL(user_table_find("plain", &entry), ERR_NONE);
+    CU_ASSERT_EQUAL(strncmp(entry.password, "$6$", 3), 0);
+    CU_ASSERT_EQUAL(password_needs_rehash(entry.password), 0);
+    CU_ASSERT_EQUAL(check_auth("plain", "pw"), 1);
+
+    /* Every other field and line is kept as written */
+    data = rec_read_file(TEST_PASSWORD_USERS, &size);
+    CU_ASSERT(data != NULL);
+    if (data) {
+        CU_ASSERT_EQUAL(strncmp(data, "# Users\nplain:$6$", 17), 0);
+        CU_ASSERT_PTR_NOT_NULL(strstr(data,
+            ":1000:1000:Plain User:/home/plain:/bin/sh:1\n"
+            "pooled:pw2:1001:1001:Pooled User:/home/pooled:/bin/sh\n"));
+        free(data);
+    }
+
+    CU_ASSERT_EQUAL(user_table_set_password("nobody", "x"), ERR_NOTFOUND);
+    CU_ASSERT_EQUAL(user_table_set_password("plain", "a:b"), ERR_PARAM);
+}
+
+static void
+test_password_pool(void)
+{
+    char stored[PASSWORD_HASH_MAX];
+    char response[1024];
+    char request[128];
+    int test_client[2];
+    ssize_t n;
+
+    /* Without workers logins are verified inline */
+    CU_ASSERT_EQUAL(password_pool_fd(), -1);
+    CU_ASSERT_EQUAL(password_pool_submit(-1, "pooled", "pw2", record_job),
+                    ERR_IO);
+
+    CU_ASSERT_EQUAL(password_pool_start(), ERR_NONE);
+    CU_ASSERT(password_pool_fd() >= 0);
+
+    jobs_done = 0;
+    CU_ASSERT_EQUAL(password_pool_submit(dup(0), "pooled", "wrong", record_job),
+                    ERR_NONE);
+    CU_ASSERT_EQUAL(wait_dispatch(), 1);
+    CU_ASSERT_EQUAL(jobs_done, 1);
+    CU_ASSERT_EQUAL(last_match, 0);
+    CU_ASSERT_EQUAL(last_rehash, 0);
+
+    /* handle_client hands /auth over and keeps the socket open */
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    snprintf(request, sizeof(request),
+             "GET /auth?username=pooled&password=pw2 HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, strlen(request)) ==
+              (ssize_t)strlen(request));
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), HANDLE_DEFERRED);
+    CU_ASSERT_EQUAL(wait_dispatch(), 1);
+
+    /* Dispatch answered and closed the client */
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    response[n > 0 ? n : 0] = '\0';
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Set-Cookie: " SESSION_COOKIE "="));
+    CU_ASSERT_EQUAL(read(test_client[0], response, sizeof(response)), 0);
+    close(test_client[0]);
+
+    /* The worker rehashed the plaintext entry, once */
+    CU_ASSERT_EQUAL(user_table_password("pooled", stored, sizeof(stored)), ERR_NONE);
+    CU_ASSERT_EQUAL(strncmp(stored, "$6$", 3), 0);
+    CU_ASSERT_EQUAL(password_pool_submit(dup(0), "pooled", "pw2", record_job),
+                    ERR_NONE);
+    CU_ASSERT_EQUAL(wait_dispatch(), 1);
+    CU_ASSERT_EQUAL(last_match, 1);
+    CU_ASSERT_EQUAL(last_rehash, 0);
+
+    password_pool_shutdown();
+    CU_ASSERT_EQUAL(password_pool_fd(), -1);
+}
+
+int
+init_password_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Password Hash", test_password_hash) == NULL) ||
+        (CU_add_test(suite, "Test Password Legacy", test_password_legacy) == NULL) ||
+        (CU_add_test(suite, "Test Password Rehash On Login", test_password_rehash_on_login) == NULL) ||
+        (CU_add_test(suite, "Test Password Pool", test_password_pool) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
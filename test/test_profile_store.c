@@ -0,0 +1,231 @@
+/* filepath: test/test_profile_store.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/profile_store.h"
+#include "../include/record_store.h"
+#include "../include/user_table.h"
+
+#define TEST_PROFILE_FILE "test/profiles.rec"
+#define TEST_PROFILE_LOG "test/updates.log"
+#define TEST_PROFILE_USERS "test/profile.passwd"
+
+static void
+remove_files(void)
+{
+    remove(TEST_PROFILE_FILE);
+    remove(TEST_PROFILE_LOG);
+    remove(TEST_PROFILE_LOG PROFILE_IMPORTED_SUFFIX);
+}
+
+int
+profile_store_suite_setup(void)
+{
+    FILE *fp;
+
+    remove_files();
+    fp = fopen(TEST_PROFILE_USERS, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs("erin:pw:1000:1000:Erin E:/home/erin:/bin/sh\n", fp);
+    fclose(fp);
+    if (user_table_init(TEST_PROFILE_USERS) != ERR_NONE) {
+        return -1;
+    }
+    return profile_store_init(TEST_PROFILE_FILE) == ERR_NONE ? 0 : -1;
+}
+
+int
+profile_store_suite_teardown(void)
+{
+    profile_store_init(PROFILE_FILE);
+    user_table_init(AUTH_FILE);
+    remove_files();
+    remove(TEST_PROFILE_USERS);
+    return 0;
+}
+
+static void
+set_profile(struct profile *profile, const char *username,
+            const char *fullname, const char *email, const char *project)
+{
+    strcpy(profile->username, username);
+    strcpy(profile->fullname, fullname);
+    strcpy(profile->email, email);
+    strcpy(profile->project, project);
+}
+
+static void
+test_profile_update(void)
+{
+    struct profile profile;
+    struct profile found;
+
+    CU_ASSERT_EQUAL(profile_store_get("alice", &found), ERR_NOTFOUND);
+
+    set_profile(&profile, "alice", "Alice A", "alice@example.com", "W6946");
+    CU_ASSERT_EQUAL(profile_store_update(&profile), ERR_NONE);
+    CU_ASSERT_EQUAL(profile_store_get("alice", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.fullname, "Alice A");
+    CU_ASSERT_STRING_EQUAL(found.project, "W6946");
+
+    /* A later update replaces the whole profile */
+    set_profile(&profile, "alice", "Alice B", "", "MS1180");
+    CU_ASSERT_EQUAL(profile_store_update(&profile), ERR_NONE);
+    CU_ASSERT_EQUAL(profile_store_get("alice", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.fullname, "Alice B");
+    CU_ASSERT_STRING_EQUAL(found.email, "");
+
+    /* Values that would break the record file are refused */
+    set_profile(&profile, "alice", "Alice\nEmail: x", "", "");
+    CU_ASSERT_EQUAL(profile_store_update(&profile), ERR_PARAM);
+    set_profile(&profile, "", "Nobody", "", "");
+    CU_ASSERT_EQUAL(profile_store_update(&profile), ERR_PARAM);
+    CU_ASSERT_EQUAL(profile_store_get("alice", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.fullname, "Alice B");
+}
+
+static void
+test_profile_flush(void)
+{
+    struct profile profile;
+    struct profile found;
+    char username[16];
+    char *data;
+    size_t size;
+    int i;
+
+    /* Updates wait for the batch */
+    remove(TEST_PROFILE_FILE);
+    set_profile(&profile, "bob", "Bob B", "bob@example.com", "W6946");
+    CU_ASSERT_EQUAL(profile_store_update(&profile), ERR_NONE);
+    CU_ASSERT_EQUAL(access(TEST_PROFILE_FILE, F_OK), -1);
+
+    CU_ASSERT_EQUAL(profile_store_flush(), ERR_NONE);
+    data = rec_read_file(TEST_PROFILE_FILE, &size);
+    CU_ASSERT(data != NULL);
+    if (data) {
+        CU_ASSERT_PTR_NOT_NULL(strstr(data, "Username: bob\n"
+                                            "Full_Name: Bob B\n"
+                                            "Email: bob@example.com\n"));
+        free(data);
+    }
+    CU_ASSERT_EQUAL(access(TEST_PROFILE_FILE ".tmp", F_OK), -1);
+
+    /* A full batch is written without waiting */
+    remove(TEST_PROFILE_FILE);
+    for (i = 0; i < PROFILE_BATCH_MAX; i++) {
+        snprintf(username, sizeof(username), "user%d", i);
+        set_profile(&profile, username, "Batch User", "", "");
+        CU_ASSERT_EQUAL(profile_store_update(&profile), ERR_NONE);
+    }
+    CU_ASSERT_EQUAL(access(TEST_PROFILE_FILE, F_OK), 0);
+
+    /* Everything comes back from the file */
+    CU_ASSERT_EQUAL(profile_store_init(TEST_PROFILE_FILE), ERR_NONE);
+    CU_ASSERT_EQUAL(profile_store_get("bob", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.email, "bob@example.com");
+    CU_ASSERT_STRING_EQUAL(found.project, "W6946");
+    CU_ASSERT_EQUAL(profile_store_get("user0", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.fullname, "Batch User");
+    CU_ASSERT_STRING_EQUAL(found.project, "");
+}
+
+static void
+test_profile_import(void)
+{
+    struct profile found;
+    FILE *fp;
+
+    /* Old log lines hold the values as the browser encoded them */
+    fp = fopen(TEST_PROFILE_LOG, "w");
+    CU_ASSERT_PTR_NOT_NULL(fp);
+    if (!fp) {
+        return;
+    }
+    fputs("carol|Carol%20C|carol%40example.com|W6946\n"
+          "dave|Dave D||\n"
+          "carol|Carol%20Second|c2%40example.com|SCJV%20-%20Pilbara%20Ports\n"
+          "|No User||\n", fp);
+    fclose(fp);
+
+    CU_ASSERT_EQUAL(profile_store_import(TEST_PROFILE_LOG), 3);
+    CU_ASSERT_EQUAL(profile_store_get("carol", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.fullname, "Carol Second");
+    CU_ASSERT_STRING_EQUAL(found.email, "c2@example.com");
+    CU_ASSERT_STRING_EQUAL(found.project, "SCJV - Pilbara Ports");
+    CU_ASSERT_EQUAL(profile_store_get("dave", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.email, "");
+
+    /* The import is written at once and the log is kept aside */
+    CU_ASSERT_EQUAL(access(TEST_PROFILE_LOG, F_OK), -1);
+    CU_ASSERT_EQUAL(access(TEST_PROFILE_LOG PROFILE_IMPORTED_SUFFIX, F_OK), 0);
+    CU_ASSERT_EQUAL(profile_store_import(TEST_PROFILE_LOG), 0);
+    CU_ASSERT_EQUAL(profile_store_init(TEST_PROFILE_FILE), ERR_NONE);
+    CU_ASSERT_EQUAL(profile_store_get("carol", &found), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(found.fullname, "Carol Second");
+}
+
+static void
+test_profile_endpoint(void)
+{
+    char response[1024];
+
+    CU_ASSERT_EQUAL(test_exchange("GET /update?username=erin&fullname=Erin%20E"
+                                  "&email=erin%40example.com&project=W6946 "
+                                  "HTTP/1.0\r\n\r\n", response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+
+    CU_ASSERT_EQUAL(test_exchange("GET " ENDPOINT_PROFILE "?username=erin "
+                                  "HTTP/1.0\r\n\r\n", response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "{\"username\":\"erin\","
+                                            "\"fullname\":\"Erin E\","
+                                            "\"email\":\"erin@example.com\","
+                                            "\"project\":\"W6946\"}"));
+
+    /* Only known users get a profile */
+    test_exchange("GET /update?username=mallory&fullname=M HTTP/1.0\r\n\r\n",
+                  response, sizeof(response));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "404 Not Found"));
+    test_exchange("GET /update?username=erin HTTP/1.0\r\n\r\n",
+                  response, sizeof(response));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+
+    test_exchange("GET " ENDPOINT_PROFILE "?username=mallory HTTP/1.0\r\n\r\n",
+                  response, sizeof(response));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "404 Not Found"));
+    test_exchange("GET " ENDPOINT_PROFILE " HTTP/1.0\r\n\r\n",
+                  response, sizeof(response));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+}
+
+int
+init_profile_store_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Profile Update", test_profile_update) == NULL) ||
+        (CU_add_test(suite, "Test Profile Flush", test_profile_flush) == NULL) ||
+        (CU_add_test(suite, "Test Profile Import", test_profile_import) == NULL) ||
+        (CU_add_test(suite, "Test Profile Endpoint", test_profile_endpoint) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
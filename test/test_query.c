@@ -0,0 +1,230 @@
+/* filepath: test/test_query.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/query.h"
+#include "../include/record_store.h"
+
+#define TEST_QUERY_REC "test/query.rec"
+
+int
+query_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_QUERY_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Obligation_Number: Q-01\n"
+        "Status: In Progress\n"
+        "ProjectPhase: Construction\n"
+        "Action_DueDate: 1/06/2024\n"
+        "Recurring_Frequency: 7\n"
+        "Evidence: photo\n"
+        "Evidence: report\n"
+        "\n"
+        "Obligation_Number: Q-02\n"
+        "Status: In Progress\n"
+        "ProjectPhase: Operation\n"
+        "Action_DueDate: 2025-03-01\n"
+        "Recurring_Frequency: 30\n"
+        "\n"
+        "Obligation_Number: Q-03\n"
+        "Status: Completed\n"
+        "ProjectPhase: Construction\n"
+        "Action_DueDate: 2024/12/31\n"
+        "\n"
+        "Obligation_Number: Q-03\n"
+        "Status: Not Started\n"
+        "ProjectPhase: Construction\n");
+    fclose(fp);
+
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+query_suite_teardown(void)
+{
+    query_cache_clear();
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_QUERY_REC);
+    return 0;
+}
+
+static int
+count_match(void *arg, const struct rec_record *record)
+{
+    (void)record;
+    (*(long *)arg)++;
+    return 0;
+}
+
+/* Number of records matching an expression, or -1 if it does not compile */
+static long
+select_count(const char *expression, int *access)
+{
+    struct query_plan *plan;
+    struct rec_store *store;
+    size_t error_at;
+    long visited;
+    long matches;
+    int unused;
+
+    store = rec_store_get("query");
+    plan = query_compile(expression, &error_at);
+    if (!store || !plan) {
+        return -1;
+    }
+    visited = 0;
+    matches = query_run(plan, store, count_match, &visited,
+                        access ? access : &unused);
+    return matches == visited ? matches : -2;
+}
+
+static void
+test_query_compile(void)
+{
+    struct query_plan *plan;
+    size_t error_at;
+
+    plan = query_compile("Status = 'In Progress'", &error_at);
+    CU_ASSERT_PTR_NOT_NULL(plan);
+
+    /* Repeated expressions reuse the cached plan */
+    CU_ASSERT_PTR_EQUAL(query_compile("Status = 'In Progress'", &error_at), plan);
+
+    CU_ASSERT_PTR_NULL(query_compile("Status = = 'x'", &error_at));
+    CU_ASSERT_EQUAL(error_at, 9);
+    CU_ASSERT_PTR_NULL(query_compile("(Status = 'x'", &error_at));
+    CU_ASSERT_PTR_NULL(query_compile("Status = 'unterminated", &error_at));
+    CU_ASSERT_PTR_NULL(query_compile("Status ~ Status", &error_at));
+    CU_ASSERT_PTR_NULL(query_compile("", &error_at));
+}
+
+static void
+test_query_operators(void)
+{
+    CU_ASSERT_EQUAL(select_count("Status = 'In Progress'", NULL), 2);
+    CU_ASSERT_EQUAL(select_count("Status != 'In Progress'", NULL), 2);
+    CU_ASSERT_EQUAL(select_count("Recurring_Frequency > 10", NULL), 1);
+    CU_ASSERT_EQUAL(select_count("Recurring_Frequency * 2 = 14", NULL), 1);
+    CU_ASSERT_EQUAL(select_count("Action_DueDate << '2025-01-01'", NULL), 2);
+    CU_ASSERT_EQUAL(select_count("Action_DueDate == '31/12/2024'", NULL), 1);
+    CU_ASSERT_EQUAL(select_count("Obligation_Number ~ '^Q-0[12]$'", NULL), 2);
+    CU_ASSERT_EQUAL(select_count("#Evidence = 2", NULL), 1);
+    CU_ASSERT_EQUAL(select_count("#Recurring_Frequency && !(Status = 'Completed')", NULL), 2);
+    CU_ASSERT_EQUAL(select_count("Status = 'Completed' => ProjectPhase = 'Operation'", NULL), 3);
+    CU_ASSERT_EQUAL(select_count("Recurring_Frequency ? Recurring_Frequency < 10 : 1", NULL), 3);
+
+    /* Fields no record has are empty */
+    CU_ASSERT_EQUAL(select_count("No_Such_Field = ''", NULL), 4);
+    CU_ASSERT_EQUAL(select_count("#No_Such_Field", NULL), 0);
+}
+
+static void
+test_query_pushdown(void)
+{
+    int access;
+
+    /* Interned field: postings, same answer as a scan */
+    CU_ASSERT_EQUAL(select_count("ProjectPhase = 'Construction' && Status != 'Completed'",
+                                 &access), 2);
+    CU_ASSERT_EQUAL(access, QUERY_ACCESS_INDEX);
+    CU_ASSERT_EQUAL(select_count("!(ProjectPhase != 'Construction') && Status != 'Completed'",
+                                 &access), 2);
+    CU_ASSERT_EQUAL(access, QUERY_ACCESS_SCAN);
+
+    /* Values no record holds need no scan at all */
+    CU_ASSERT_EQUAL(select_count("Status = 'Never used'", &access), 0);
+    CU_ASSERT_EQUAL(access, QUERY_ACCESS_INDEX);
+
+    /* Unique key: one lookup; a repeated key must see both records */
+    CU_ASSERT_EQUAL(select_count("Obligation_Number = 'Q-02'", &access), 1);
+    CU_ASSERT_EQUAL(access, QUERY_ACCESS_KEY);
+    CU_ASSERT_EQUAL(select_count("Obligation_Number = 'Q-03'", &access), 2);
+    CU_ASSERT_EQUAL(access, QUERY_ACCESS_SCAN);
+
+    /* Only top-level conjuncts are pushed down */
+    CU_ASSERT_EQUAL(select_count("Status = 'Completed' || Obligation_Number = 'Q-01'",
+                                 &access), 2);
+    CU_ASSERT_EQUAL(access, QUERY_ACCESS_SCAN);
+}
+
+static void
+test_query_endpoint(void)
+{
+    int test_client[2];
+    char request[BUFFER_SIZE];
+    char response[BUFFER_SIZE];
+    size_t used;
+    ssize_t n;
+    int len;
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    len = snprintf(request, sizeof(request),
+                   "GET /api/query?project=query&limit=1&"
+                   "e=Status+%%3D+%%27In+Progress%%27 HTTP/1.1\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    close(test_client[1]);
+
+    used = 0;
+    while (used < sizeof(response) - 1 &&
+           (n = read(test_client[0], response + used,
+                     sizeof(response) - 1 - used)) > 0) {
+        used += (size_t)n;
+    }
+    response[used] = '\0';
+    close(test_client[0]);
+
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"Obligation_Number\":\"Q-01\""));
+    CU_ASSERT_PTR_NULL(strstr(response, "\"Q-02\""));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"count\":2,\"access\":\"index\""));
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    len = snprintf(request, sizeof(request),
+                   "GET /api/query?project=query&e=Status+%%3D HTTP/1.1\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), -1);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "Syntax error at offset 8"));
+    }
+    close(test_client[0]);
+    close(test_client[1]);
+}
+
+int
+init_query_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Query Compile", test_query_compile) == NULL) ||
+        (CU_add_test(suite, "Test Query Operators", test_query_operators) == NULL) ||
+        (CU_add_test(suite, "Test Query Pushdown", test_query_pushdown) == NULL) ||
+        (CU_add_test(suite, "Test Query Endpoint", test_query_endpoint) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
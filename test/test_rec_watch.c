@@ -0,0 +1,252 @@
+/* filepath: test/test_rec_watch.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <poll.h>
+#include <unistd.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/record_store.h"
+#include "../include/rec_watch.h"
+
+#define TEST_WATCH_REC "test/watch.rec"
+#define TEST_WATCH_TMP "test/watch.rec.tmp"
+
+static int
+write_records(const char *path, const char *text)
+{
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs(text, fp);
+    return fclose(fp);
+}
+
+int
+rec_watch_suite_setup(void)
+{
+    if (write_records(TEST_WATCH_REC,
+                      "%rec: Project\n\n"
+                      "Obligation_Number: W-01\n"
+                      "Status: Open\n"
+                      "\n"
+                      "Obligation_Number: W-02\n"
+                      "Status: Open\n"
+                      "\n"
+                      "Obligation_Number: W-03\n"
+                      "Status: Open\n") != 0) {
+        return -1;
+    }
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+rec_watch_suite_teardown(void)
+{
+    rec_watch_shutdown();
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_WATCH_REC);
+    remove(TEST_WATCH_TMP);
+    return 0;
+}
+
+static void
+test_sync_changed_records(void)
+{
+    struct rec_store *store;
+    struct rec_record *untouched;
+    unsigned long version;
+
+    store = rec_store_get("watch");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+    untouched = rec_store_find(store, "W-03");
+    version = store->version;
+
+    /* An unchanged file changes nothing */
+    CU_ASSERT_EQUAL(rec_store_sync("watch"), 0);
+    CU_ASSERT_EQUAL(store->version, version);
+
+    /* Edit one record, drop another, add a third */
+    CU_ASSERT_EQUAL(write_records(TEST_WATCH_REC,
+                                  "%rec: Project\n\n"
+                                  "Obligation_Number: W-01\n"
+                                  "Status: Closed\n"
+                                  "\n"
+                                  "Obligation_Number: W-03\n"
+                                  "Status: Open\n"
+                                  "\n"
+                                  "Obligation_Number: W-04\n"
+                                  "Status: Open\n"), 0);
+    CU_ASSERT_EQUAL(rec_store_sync("watch"), 4);
+    CU_ASSERT_NOT_EQUAL(store->version, version);
+    CU_ASSERT_EQUAL(store->count, 3);
+    CU_ASSERT_STRING_EQUAL(rec_get(rec_store_find(store, "W-01"), "Status"), "Closed");
+    CU_ASSERT_PTR_NULL(rec_store_find(store, "W-02"));
+    CU_ASSERT_PTR_NOT_NULL(rec_store_find(store, "W-04"));
+
+    /* Records whose text did not change are the same objects */
+    CU_ASSERT_PTR_EQUAL(rec_store_find(store, "W-03"), untouched);
+}
+
+static void
+test_sync_own_upsert(void)
+{
+    struct rec_store *store;
+    const char *update;
+    unsigned long version;
+
+    store = rec_store_get("watch");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+
+    /* The server's own write, read back, is not a change */
+    update = "Obligation_Number: W-05\nStatus: Open\n";
+    CU_ASSERT_EQUAL(rec_store_upsert(store, update, strlen(update)), ERR_NONE);
+    version = store->version;
+    CU_ASSERT_EQUAL(write_records(TEST_WATCH_REC,
+                                  "%rec: Project\n\n"
+                                  "Obligation_Number: W-01\n"
+                                  "Status: Closed\n"
+                                  "\n"
+                                  "Obligation_Number: W-03\n"
+                                  "Status: Open\n"
+                                  "\n"
+                                  "Obligation_Number: W-04\n"
+                                  "Status: Open\n"
+                                  "\n"
+                                  "Obligation_Number: W-05\n"
+                                  "Status: Open\n"), 0);
+    CU_ASSERT_EQUAL(rec_store_sync("watch"), 0);
+    CU_ASSERT_EQUAL(store->version, version);
+
+    /* Projects that are not loaded are left for their first use */
+    CU_ASSERT_EQUAL(rec_store_sync("not_loaded"), 0);
+    CU_ASSERT_EQUAL(rec_store_sync("../etc"), -1);
+}
+
+/* Offset of text in the response, or -1 */
+static long
+offset_of(const char *response, const char *text)
+{
+    const char *p;
+
+    p = strstr(response, text);
+    return p ? (long)(p - response) : -1;
+}
+
+static void
+test_sync_reorder(void)
+{
+    char response[8192];
+    struct rec_store *store;
+    unsigned long version;
+
+    store = rec_store_get("watch");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+
+    /* Build the Status index, the query cache and the table order */
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_QUERY "?project=watch&e=Status+%3D+%27Open%27",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NULL(strstr(response, "\"W-01\""));
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_TABLE "?project=watch", response,
+                             sizeof(response)), 0);
+    CU_ASSERT(offset_of(response, "\"W-01\"") < offset_of(response, "\"W-04\""));
+
+    /* Swapping two records changes no record, only their positions */
+    version = store->version;
+    CU_ASSERT_EQUAL(write_records(TEST_WATCH_REC,
+                                  "%rec: Project\n\n"
+                                  "Obligation_Number: W-04\n"
+                                  "Status: Open\n"
+                                  "\n"
+                                  "Obligation_Number: W-03\n"
+                                  "Status: Open\n"
+                                  "\n"
+                                  "Obligation_Number: W-01\n"
+                                  "Status: Closed\n"
+                                  "\n"
+                                  "Obligation_Number: W-05\n"
+                                  "Status: Open\n"), 0);
+    CU_ASSERT_EQUAL(rec_store_sync("watch"), 0);
+    CU_ASSERT_NOT_EQUAL(store->version, version);
+
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_QUERY "?project=watch&e=Status+%3D+%27Open%27",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NULL(strstr(response, "\"W-01\""));
+    CU_ASSERT(offset_of(response, "\"W-04\"") >= 0);
+    CU_ASSERT(offset_of(response, "\"W-04\"") < offset_of(response, "\"W-03\""));
+    CU_ASSERT(offset_of(response, "\"W-03\"") < offset_of(response, "\"W-05\""));
+
+    CU_ASSERT_EQUAL(test_get(ENDPOINT_TABLE "?project=watch", response,
+                             sizeof(response)), 0);
+    CU_ASSERT(offset_of(response, "\"W-04\"") >= 0);
+    CU_ASSERT(offset_of(response, "\"W-04\"") < offset_of(response, "\"W-01\""));
+}
+
+static void
+test_watch_dispatch(void)
+{
+    struct rec_store *store;
+    struct pollfd pfd;
+
+    CU_ASSERT_EQUAL(rec_watch_init("test"), ERR_NONE);
+    store = rec_store_get("watch");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+
+    /* Editors usually rename a new copy over the file */
+    CU_ASSERT_EQUAL(write_records(TEST_WATCH_TMP,
+                                  "%rec: Project\n\n"
+                                  "Obligation_Number: W-01\n"
+                                  "Status: Open\n"), 0);
+    CU_ASSERT_EQUAL(rename(TEST_WATCH_TMP, TEST_WATCH_REC), 0);
+
+    pfd.fd = rec_watch_fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    CU_ASSERT_EQUAL(poll(&pfd, 1, 1000), 1);
+    CU_ASSERT(rec_watch_dispatch() > 0);
+    CU_ASSERT_EQUAL(store->count, 1);
+    CU_ASSERT_STRING_EQUAL(rec_get(rec_store_find(store, "W-01"), "Status"), "Open");
+
+    rec_watch_shutdown();
+    CU_ASSERT_EQUAL(rec_watch_fd(), -1);
+}
+
+int
+init_rec_watch_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Sync Changed Records", test_sync_changed_records) == NULL) ||
+        (CU_add_test(suite, "Test Sync Own Upsert", test_sync_own_upsert) == NULL) ||
+        (CU_add_test(suite, "Test Sync Reorder", test_sync_reorder) == NULL) ||
+        (CU_add_test(suite, "Test Watch Dispatch", test_watch_dispatch) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
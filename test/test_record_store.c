@@ -0,0 +1,368 @@
+/* filepath: test/test_record_store.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+
+#define TEST_KEYS_REC "test/scjv.rec"
+
+int
+record_store_suite_setup(void)
+{
+    FILE *fp;
+
+    /* Stands in for the SCJV register; KEYS-02 is duplicated */
+    fp = fopen(TEST_KEYS_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Obligation_Number: KEYS-01\n"
+        "Status: Open\n"
+        "\n"
+        "Obligation_Number: KEYS-02\n"
+        "Status: Open\n"
+        "\n"
+        "Obligation_Number: KEYS-02\n"
+        "Status: Closed\n");
+    fclose(fp);
+
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+record_store_suite_teardown(void)
+{
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_KEYS_REC);
+    return 0;
+}
+
+static void
+test_interned_fields(void)
+{
+    const char *first_text;
+    const char *second_text;
+    struct rec_record *first;
+    struct rec_record *second;
+    const struct rec_field *a;
+    const struct rec_field *b;
+    int status;
+    int obligation;
+
+    first_text = "Obligation_Number: INTERN-01\n"
+                 "Status: Closed\n"
+                 "Obligation: Free text\n";
+    second_text = "Obligation_Number: INTERN-02\n"
+                  "Status: Closed\n"
+                  "Obligation: Free text\n";
+    first = rec_parse_record(first_text, strlen(first_text));
+    second = rec_parse_record(second_text, strlen(second_text));
+    CU_ASSERT_PTR_NOT_NULL(first);
+    CU_ASSERT_PTR_NOT_NULL(second);
+    if (!first || !second) {
+        free(first);
+        free(second);
+        return;
+    }
+
+    /* Status is interned: same code, one shared copy */
+    status = rec_field_lookup("Status");
+    CU_ASSERT(status >= 0);
+    a = rec_find_field(first, (unsigned short)status);
+    b = rec_find_field(second, (unsigned short)status);
+    CU_ASSERT_PTR_NOT_NULL(a);
+    CU_ASSERT_PTR_NOT_NULL(b);
+    if (a && b) {
+        CU_ASSERT(a->code != 0);
+        CU_ASSERT_EQUAL(a->code, b->code);
+        CU_ASSERT_PTR_EQUAL(a->value, b->value);
+        CU_ASSERT_STRING_EQUAL(a->value, "Closed");
+        CU_ASSERT_EQUAL(rec_dict_lookup((unsigned short)status, "Closed"), a->code);
+    }
+
+    /* Free text stays inline in each record */
+    obligation = rec_field_lookup("Obligation");
+    a = rec_find_field(first, (unsigned short)obligation);
+    b = rec_find_field(second, (unsigned short)obligation);
+    CU_ASSERT_PTR_NOT_NULL(a);
+    CU_ASSERT_PTR_NOT_NULL(b);
+    if (a && b) {
+        CU_ASSERT_EQUAL(a->code, 0);
+        CU_ASSERT(a->value != b->value);
+        CU_ASSERT_STRING_EQUAL(a->value, b->value);
+    }
+
+    /* Interning does not change the content hash */
+    CU_ASSERT_STRING_EQUAL(rec_get(second, "Obligation_Number"), "INTERN-02");
+    CU_ASSERT(first->hash != second->hash);
+
+    free(first);
+    free(second);
+}
+
+static void
+test_dictionary_lookup(void)
+{
+    int status;
+
+    status = rec_field_id("Status");
+    CU_ASSERT(status >= 0);
+    CU_ASSERT_EQUAL(rec_dict_lookup((unsigned short)status, "Never seen value"), 0);
+    CU_ASSERT_EQUAL(rec_dict_lookup((unsigned short)status, NULL), 0);
+
+    /* Fields outside the interned set have no dictionary */
+    CU_ASSERT_EQUAL(rec_dict_lookup((unsigned short)rec_field_id(REC_KEY_FIELD),
+                                    "INTERN-01"), 0);
+}
+
+static void
+test_key_index(void)
+{
+    struct rec_store *store;
+    char text[128];
+    char key[32];
+    int len;
+    int i;
+
+    store = rec_store_get("scjv");
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+
+    CU_ASSERT_PTR_NOT_NULL(rec_store_find(store, "KEYS-01"));
+    CU_ASSERT_PTR_NULL(rec_store_find(store, "KEYS-99"));
+    CU_ASSERT_PTR_NULL(rec_store_find(store, ""));
+
+    /* The later of two records with one key wins */
+    CU_ASSERT_STRING_EQUAL(rec_get(rec_store_find(store, "KEYS-02"), "Status"),
+                           "Closed");
+
+    /* Enough new keys to grow the table several times */
+    for (i = 0; i < 300; i++) {
+        len = snprintf(text, sizeof(text),
+                       "Obligation_Number: GROW-%03d\nStatus: Open\n", i);
+        CU_ASSERT_EQUAL(rec_store_upsert(store, text, (size_t)len), ERR_NONE);
+    }
+    CU_ASSERT_EQUAL(store->count, 303);
+    for (i = 0; i < 300; i += 37) {
+        sprintf(key, "GROW-%03d", i);
+        CU_ASSERT_PTR_NOT_NULL(rec_store_find(store, key));
+    }
+    CU_ASSERT_PTR_NOT_NULL(rec_store_find(store, "KEYS-01"));
+
+    /* Updates replace the indexed record in place */
+    len = snprintf(text, sizeof(text), "Obligation_Number: GROW-005\nStatus: Closed\n");
+    CU_ASSERT_EQUAL(rec_store_upsert(store, text, (size_t)len), ERR_NONE);
+    CU_ASSERT_EQUAL(store->count, 303);
+    CU_ASSERT_STRING_EQUAL(rec_get(rec_store_find(store, "GROW-005"), "Status"),
+                           "Closed");
+}
+
+static void
+test_duplicate_create(void)
+{
+    int test_client[2];
+    char response[BUFFER_SIZE];
+    const char *request;
+    struct stat before;
+    struct stat after;
+    ssize_t n;
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    CU_ASSERT_EQUAL(stat(RECORDS_DIR "/scjv.rec", &before), 0);
+
+    request = "POST /create_record HTTP/1.0\r\n\r\n"
+              "Project_Name: Test\n"
+              "Obligation_Number: KEYS-01\n"
+              "Obligation: Duplicate\n";
+    CU_ASSERT_EQUAL(handle_create_record(test_client[1], request), ERR_EXISTS);
+
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response, "409 Conflict"));
+    }
+
+    /* Rejected before the register was touched */
+    CU_ASSERT_EQUAL(stat(RECORDS_DIR "/scjv.rec", &after), 0);
+    CU_ASSERT_EQUAL(before.st_size, after.st_size);
+
+    close(test_client[0]);
+    close(test_client[1]);
+}
+
+static void
+test_sorted_keys(void)
+{
+    static const char text[] =
+        "%rec: Project\n\n"
+        "Obligation_Number: PCEMP-10\n\n"
+        "Obligation_Number: PCEMP-9\n\n"
+        "Status: Open\n\n"
+        "Obligation_Number: PCEMP-100\n\n"
+        "Obligation_Number: PCEMP-02\n";
+    const struct rec_order *order;
+    struct rec_store *store;
+    FILE *fp;
+
+    CU_ASSERT(rec_natural_compare("PCEMP-9", "PCEMP-10") < 0);
+    CU_ASSERT(rec_natural_compare("PCEMP-100", "PCEMP-99") > 0);
+    CU_ASSERT_EQUAL(rec_natural_compare("pcemp-02", "PCEMP-2"), 0);
+
+    /* No %sort anywhere: no order */
+    store = rec_store_parse("sorted", text, sizeof(text) - 1);
+    CU_ASSERT_PTR_NOT_NULL(store);
+    if (!store) {
+        return;
+    }
+    CU_ASSERT_PTR_NULL(rec_store_order(store));
+    rec_store_free(store);
+
+    /* The schema's %sort for the record type applies */
+    fp = fopen("test/" REC_SCHEMA_FILE, "w");
+    CU_ASSERT_PTR_NOT_NULL(fp);
+    if (!fp) {
+        return;
+    }
+    fprintf(fp, "%%rec: Other\n%%sort: Status\n\n"
+                "%%rec: Project\n%%key: Obligation_Number\n"
+                "%%sort: Obligation_Number\n");
+    fclose(fp);
+    store = rec_store_parse("sorted", text, sizeof(text) - 1);
+    order = store ? rec_store_order(store) : NULL;
+    CU_ASSERT(order != NULL && order->count == 4);
+    if (order && order->count == 4) {
+        CU_ASSERT_EQUAL(order->field, (unsigned long)rec_field_lookup(REC_KEY_FIELD));
+        CU_ASSERT_EQUAL(order->positions[0], 4);
+        CU_ASSERT_EQUAL(order->positions[1], 1);
+        CU_ASSERT_EQUAL(order->positions[2], 0);
+        CU_ASSERT_EQUAL(order->positions[3], 3);
+
+        /* Lower bound, and strictly after for cursors */
+        CU_ASSERT_EQUAL(rec_order_seek(store, order, "PCEMP-9", 0), 1);
+        CU_ASSERT_EQUAL(rec_order_seek(store, order, "PCEMP-9", 1), 2);
+        CU_ASSERT_EQUAL(rec_order_seek(store, order, "PCEMP-50", 0), 3);
+        CU_ASSERT_EQUAL(rec_order_seek(store, order, "PCEMP-999", 0), 4);
+    }
+    rec_store_free(store);
+    remove("test/" REC_SCHEMA_FILE);
+}
+
+static void
+test_project_registry(void)
+{
+    const struct rec_project *projects;
+    struct rec_store *store;
+    struct buffer stats;
+    char request[64];
+    char response[4096];
+    int test_client[2];
+    size_t count;
+    size_t i;
+    ssize_t n;
+    int found;
+    int len;
+    FILE *fp;
+
+    fp = fopen("test/cold.rec", "w");
+    CU_ASSERT_PTR_NOT_NULL(fp);
+    if (!fp) {
+        return;
+    }
+    fprintf(fp, "%%rec: Project\n\nProject_Name: Cold Storage\n"
+                "Obligation_Number: COLD-01\n");
+    fclose(fp);
+
+    /* Discovered from the directory, titled by the first Project_Name */
+    found = 0;
+    count = rec_registry_projects(&projects);
+    for (i = 0; i < count; i++) {
+        if (strcmp(projects[i].name, "cold") == 0) {
+            found = 1;
+            CU_ASSERT_STRING_EQUAL(projects[i].title, "Cold Storage");
+        }
+        CU_ASSERT(i == 0 || strcmp(projects[i - 1].name, projects[i].name) < 0);
+    }
+    CU_ASSERT(found);
+
+    /* Over budget, the least recently used store goes first */
+    CU_ASSERT_PTR_NOT_NULL(rec_store_get("cold"));
+    CU_ASSERT_PTR_NOT_NULL(rec_store_get("scjv"));
+    rec_registry_trim(0);
+    store = rec_registry_list();
+    CU_ASSERT(store != NULL && strcmp(store->name, "scjv") == 0 && !store->next);
+
+    buffer_init(&stats);
+    CU_ASSERT_EQUAL(rec_registry_stats(&stats), 0);
+    CU_ASSERT(stats.data != NULL && strstr(stats.data, "\"loaded\":1,") != NULL);
+    buffer_free(&stats);
+
+    /* An evicted project loads again on its next use */
+    CU_ASSERT_PTR_NOT_NULL(rec_store_find(rec_store_get("cold"), "COLD-01"));
+
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    len = snprintf(request, sizeof(request), "GET /api/projects HTTP/1.0\r\n\r\n");
+    CU_ASSERT(write(test_client[0], request, (size_t)len) == len);
+    CU_ASSERT_EQUAL(handle_client(test_client[1], TEST_WWW_ROOT), 0);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    CU_ASSERT(n > 0);
+    if (n > 0) {
+        response[n] = '\0';
+        CU_ASSERT_PTR_NOT_NULL(strstr(response,
+            "{\"name\":\"cold\",\"title\":\"Cold Storage\",\"size\":"));
+    }
+    close(test_client[0]);
+    close(test_client[1]);
+
+    remove("test/cold.rec");
+}
+
+static void
+test_stats_endpoint(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/stats", response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "{\"interning\":{\"fields\":["));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "\"ratio\":"));
+}
+
+int
+init_record_store_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Interned Fields", test_interned_fields) == NULL) ||
+        (CU_add_test(suite, "Test Dictionary Lookup", test_dictionary_lookup) == NULL) ||
+        (CU_add_test(suite, "Test Key Index", test_key_index) == NULL) ||
+        (CU_add_test(suite, "Test Duplicate Create", test_duplicate_create) == NULL) ||
+        (CU_add_test(suite, "Test Sorted Keys", test_sorted_keys) == NULL) ||
+        (CU_add_test(suite, "Test Project Registry", test_project_registry) == NULL) ||
+        (CU_add_test(suite, "Test Stats Endpoint", test_stats_endpoint) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/* filepath: test/test_result_cache.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/buffer.h"
+#include "../include/result_cache.h"
+
+int
+result_cache_suite_setup(void)
+{
+    result_cache_clear();
+    return 0;
+}
+
+int
+result_cache_suite_teardown(void)
+{
+    result_cache_clear();
+    return 0;
+}
+
+static void
+test_hit_and_miss(void)
+{
+    struct buffer out;
+
+    buffer_init(&out);
+    CU_ASSERT_EQUAL(result_cache_begin("a", 1, &out), RESULT_CACHE_MISS);
+    result_cache_finish("a", 1, "alpha", 5);
+
+    CU_ASSERT_EQUAL(result_cache_begin("a", 1, &out), RESULT_CACHE_HIT);
+    CU_ASSERT_EQUAL(out.len, 5);
+    CU_ASSERT_NSTRING_EQUAL(out.data, "alpha", 5);
+
+    /* Failed computations are not cached */
+    CU_ASSERT_EQUAL(result_cache_begin("b", 1, &out), RESULT_CACHE_MISS);
+    result_cache_finish("b", 1, NULL, 0);
+    CU_ASSERT_EQUAL(result_cache_begin("b", 1, &out), RESULT_CACHE_MISS);
+    result_cache_finish("b", 1, NULL, 0);
+    buffer_free(&out);
+}
+
+static void
+test_version_invalidation(void)
+{
+    struct buffer out;
+    struct buffer stats;
+
+    buffer_init(&out);
+    buffer_init(&stats);
+    result_cache_clear();
+    CU_ASSERT_EQUAL(result_cache_begin("q", 7, &out), RESULT_CACHE_MISS);
+    result_cache_finish("q", 7, "old", 3);
+
+    /* The store moved on: the old body must not be served */
+    CU_ASSERT_EQUAL(result_cache_begin("q", 8, &out), RESULT_CACHE_MISS);
+    result_cache_finish("q", 8, "new", 3);
+    CU_ASSERT_EQUAL(result_cache_begin("q", 8, &out), RESULT_CACHE_HIT);
+    CU_ASSERT_NSTRING_EQUAL(out.data, "new", 3);
+
+    CU_ASSERT_EQUAL(result_cache_stats(&stats), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(stats.data, "\"invalidations\":1"));
+    buffer_free(&stats);
+    buffer_free(&out);
+}
+
+static void
+test_lru_eviction(void)
+{
+    struct buffer out;
+    struct buffer stats;
+    char key[16];
+    int i;
+
+    buffer_init(&out);
+    buffer_init(&stats);
+    result_cache_clear();
+    for (i = 0; i <= RESULT_CACHE_MAX_ENTRIES; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        CU_ASSERT_EQUAL(result_cache_begin(key, 1, &out), RESULT_CACHE_MISS);
+        result_cache_finish(key, 1, key, strlen(key));
+
+        /* Keep the first key hot so it survives */
+        CU_ASSERT_EQUAL(result_cache_begin("k0", 1, &out), RESULT_CACHE_HIT);
+    }
+
+    CU_ASSERT_EQUAL(result_cache_begin("k0", 1, &out), RESULT_CACHE_HIT);
+    CU_ASSERT_EQUAL(result_cache_begin("k1", 1, &out), RESULT_CACHE_MISS);
+    result_cache_finish("k1", 1, NULL, 0);
+
+    CU_ASSERT_EQUAL(result_cache_stats(&stats), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(stats.data, "\"evictions\":1,"));
+    buffer_free(&stats);
+    buffer_free(&out);
+}
+
+static void
+test_oversized_entry(void)
+{
+    static char body[RESULT_CACHE_MAX_ENTRY + 1];
+    struct buffer out;
+
+    buffer_init(&out);
+    memset(body, 'x', sizeof(body));
+    CU_ASSERT_EQUAL(result_cache_begin("big", 1, &out), RESULT_CACHE_MISS);
+    result_cache_finish("big", 1, body, sizeof(body));
+    CU_ASSERT_EQUAL(result_cache_begin("big", 1, &out), RESULT_CACHE_MISS);
+    result_cache_finish("big", 1, NULL, 0);
+    buffer_free(&out);
+}
+
+int
+init_result_cache_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Hit And Miss", test_hit_and_miss) == NULL) ||
+        (CU_add_test(suite, "Test Version Invalidation", test_version_invalidation) == NULL) ||
+        (CU_add_test(suite, "Test LRU Eviction", test_lru_eviction) == NULL) ||
+        (CU_add_test(suite, "Test Oversized Entry", test_oversized_entry) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
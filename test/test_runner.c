@@ -8,12 +8,52 @@
 /* Declarations of test suite initialization functions */
 int init_web_server_suite(CU_pSuite suite);
 int init_web_server_security_suite(CU_pSuite suite);
+int init_forecast_suite(CU_pSuite suite);
+int init_obligation_number_suite(CU_pSuite suite);
+int init_export_suite(CU_pSuite suite);
+int init_record_store_suite(CU_pSuite suite);
+int init_query_suite(CU_pSuite suite);
+int init_result_cache_suite(CU_pSuite suite);
+int init_rec_watch_suite(CU_pSuite suite);
+int init_archive_suite(CU_pSuite suite);
+int init_history_suite(CU_pSuite suite);
+int init_table_suite(CU_pSuite suite);
+int init_user_table_suite(CU_pSuite suite);
+int init_session_suite(CU_pSuite suite);
+int init_password_suite(CU_pSuite suite);
+int init_profile_store_suite(CU_pSuite suite);
+int init_log_writer_suite(CU_pSuite suite);
+int init_audit_store_suite(CU_pSuite suite);
+int init_log_archive_suite(CU_pSuite suite);
+int init_diag_suite(CU_pSuite suite);
+int init_metrics_suite(CU_pSuite suite);
+int init_trace_suite(CU_pSuite suite);
 
 int
 main(void)
 {
     CU_pSuite web_server_suite;
     CU_pSuite web_server_security_suite;
+    CU_pSuite forecast_suite;
+    CU_pSuite obligation_number_suite;
+    CU_pSuite export_suite;
+    CU_pSuite record_store_suite;
+    CU_pSuite query_suite;
+    CU_pSuite result_cache_suite;
+    CU_pSuite rec_watch_suite;
+    CU_pSuite archive_suite;
+    CU_pSuite history_suite;
+    CU_pSuite table_suite;
+    CU_pSuite user_table_suite;
+    CU_pSuite session_suite;
+    CU_pSuite password_suite;
+    CU_pSuite profile_store_suite;
+    CU_pSuite log_writer_suite;
+    CU_pSuite audit_store_suite;
+    CU_pSuite log_archive_suite;
+    CU_pSuite diag_suite;
+    CU_pSuite metrics_suite;
+    CU_pSuite trace_suite;
 
     /* Initialize CUnit registry */
     if (CU_initialize_registry() != CUE_SUCCESS) {
@@ -33,9 +73,175 @@ main(void)
         return CU_get_error();
     }
 
+    forecast_suite = CU_add_suite("Forecast Tests", forecast_suite_setup,
+                                  forecast_suite_teardown);
+    if (forecast_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    obligation_number_suite = CU_add_suite("Obligation Number Tests",
+                                           obligation_number_suite_setup,
+                                           obligation_number_suite_teardown);
+    if (obligation_number_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    export_suite = CU_add_suite("Export Tests", export_suite_setup,
+                                export_suite_teardown);
+    if (export_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    record_store_suite = CU_add_suite("Record Store Tests",
+                                      record_store_suite_setup,
+                                      record_store_suite_teardown);
+    if (record_store_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    query_suite = CU_add_suite("Query Tests", query_suite_setup,
+                               query_suite_teardown);
+    if (query_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    result_cache_suite = CU_add_suite("Result Cache Tests",
+                                      result_cache_suite_setup,
+                                      result_cache_suite_teardown);
+    if (result_cache_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    rec_watch_suite = CU_add_suite("Record Watch Tests", rec_watch_suite_setup,
+                                   rec_watch_suite_teardown);
+    if (rec_watch_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    archive_suite = CU_add_suite("Archive Tests", archive_suite_setup,
+                                 archive_suite_teardown);
+    if (archive_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    history_suite = CU_add_suite("History Tests", history_suite_setup,
+                                 history_suite_teardown);
+    if (history_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    table_suite = CU_add_suite("Table Tests", table_suite_setup,
+                               table_suite_teardown);
+    if (table_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    user_table_suite = CU_add_suite("User Table Suite", user_table_suite_setup,
+                                    user_table_suite_teardown);
+    if (user_table_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    session_suite = CU_add_suite("Session Suite", session_suite_setup,
+                                 session_suite_teardown);
+    if (session_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    password_suite = CU_add_suite("Password Suite", password_suite_setup,
+                                  password_suite_teardown);
+    if (password_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    profile_store_suite = CU_add_suite("Profile Store Suite",
+                                       profile_store_suite_setup,
+                                       profile_store_suite_teardown);
+    if (profile_store_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    log_writer_suite = CU_add_suite("Log Writer Suite", log_writer_suite_setup,
+                                    log_writer_suite_teardown);
+    if (log_writer_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    audit_store_suite = CU_add_suite("Audit Store Suite",
+                                     audit_store_suite_setup,
+                                     audit_store_suite_teardown);
+    if (audit_store_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    log_archive_suite = CU_add_suite("Log Archive Suite",
+                                     log_archive_suite_setup,
+                                     log_archive_suite_teardown);
+    if (log_archive_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    diag_suite = CU_add_suite("Diag Suite", diag_suite_setup,
+                              diag_suite_teardown);
+    if (diag_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    metrics_suite = CU_add_suite("Metrics Tests", metrics_suite_setup,
+                                 metrics_suite_teardown);
+    if (metrics_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    trace_suite = CU_add_suite("Trace Tests", trace_suite_setup,
+                               trace_suite_teardown);
+    if (trace_suite == NULL) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
     /* Initialize test suites */
     if (init_web_server_suite(web_server_suite) != 0 ||
-        init_web_server_security_suite(web_server_security_suite) != 0) {
+        init_web_server_security_suite(web_server_security_suite) != 0 ||
+        init_forecast_suite(forecast_suite) != 0 ||
+        init_obligation_number_suite(obligation_number_suite) != 0 ||
+        init_export_suite(export_suite) != 0 ||
+        init_record_store_suite(record_store_suite) != 0 ||
+        init_query_suite(query_suite) != 0 ||
+        init_result_cache_suite(result_cache_suite) != 0 ||
+        init_rec_watch_suite(rec_watch_suite) != 0 ||
+        init_archive_suite(archive_suite) != 0 ||
+        init_history_suite(history_suite) != 0 ||
+        init_table_suite(table_suite) != 0 ||
+        init_user_table_suite(user_table_suite) != 0 ||
+        init_session_suite(session_suite) != 0 ||
+        init_password_suite(password_suite) != 0 ||
+        init_profile_store_suite(profile_store_suite) != 0 ||
+        init_log_writer_suite(log_writer_suite) != 0 ||
+        init_audit_store_suite(audit_store_suite) != 0 ||
+        init_log_archive_suite(log_archive_suite) != 0 ||
+        init_diag_suite(diag_suite) != 0 ||
+        init_metrics_suite(metrics_suite) != 0 ||
+        init_trace_suite(trace_suite) != 0) {
         CU_cleanup_registry();
         return CU_get_error();
     }
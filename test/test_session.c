@@ -0,0 +1,178 @@
+/* filepath: test/test_session.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/session.h"
+#include "../include/timer_wheel.h"
+#include "../include/user_table.h"
+
+#define TEST_SESSION_USERS "test/session.passwd"
+
+/* Logins rehash the auth file, so they get a copy of their own */
+int
+session_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_SESSION_USERS, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs("test:password:1002:1002:Test User:/home/test:/bin/sh\n", fp);
+    fclose(fp);
+    return user_table_init(TEST_SESSION_USERS) == ERR_NONE ? 0 : -1;
+}
+
+int
+session_suite_teardown(void)
+{
+    session_clear();
+    user_table_init(AUTH_FILE);
+    remove(TEST_SESSION_USERS);
+    return 0;
+}
+
+static void
+test_session_lookup(void)
+{
+    char token[SESSION_TOKEN_LEN + 1];
+    char other[SESSION_TOKEN_LEN + 1];
+    char username[SESSION_USER_MAX];
+
+    CU_ASSERT_EQUAL(session_create("alice", token, sizeof(token)), ERR_NONE);
+    CU_ASSERT_EQUAL(strlen(token), SESSION_TOKEN_LEN);
+    CU_ASSERT_EQUAL(session_create("alice", other, sizeof(other)), ERR_NONE);
+    CU_ASSERT(strcmp(token, other) != 0);
+
+    CU_ASSERT_EQUAL(session_lookup(token, username, sizeof(username)), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(username, "alice");
+
+    /* Tokens are case-insensitive hex; anything else is rejected */
+    CU_ASSERT_EQUAL(session_lookup("not-a-token", username, sizeof(username)),
+                    ERR_PARAM);
+    CU_ASSERT_EQUAL(session_lookup("00000000000000000000000000000000",
+                                   username, sizeof(username)), ERR_NOTFOUND);
+
+    CU_ASSERT_EQUAL(session_destroy(token), ERR_NONE);
+    CU_ASSERT_EQUAL(session_lookup(token, username, sizeof(username)),
+                    ERR_NOTFOUND);
+    CU_ASSERT_EQUAL(session_destroy(token), ERR_NOTFOUND);
+    CU_ASSERT_EQUAL(session_lookup(other, username, sizeof(username)), ERR_NONE);
+
+    CU_ASSERT_EQUAL(session_create("", token, sizeof(token)), ERR_PARAM);
+    CU_ASSERT_EQUAL(session_create("bob", token, 8), ERR_PARAM);
+}
+
+static void
+test_session_expiry(void)
+{
+    char token[SESSION_TOKEN_LEN + 1];
+    char username[SESSION_USER_MAX];
+
+    session_clear();
+    timer_wheel_init(5000);
+    CU_ASSERT_EQUAL(session_create("carol", token, sizeof(token)), ERR_NONE);
+
+    /* Use just before the deadline moves it a full timeout on */
+    timer_wheel_advance(5000 + SESSION_TIMEOUT - 1);
+    CU_ASSERT_EQUAL(session_lookup(token, username, sizeof(username)), ERR_NONE);
+    timer_wheel_advance(5000 + SESSION_TIMEOUT);
+    timer_wheel_advance(5000 + SESSION_TIMEOUT * 2 - 2);
+    CU_ASSERT_EQUAL(session_lookup(token, username, sizeof(username)), ERR_NONE);
+
+    /* Left idle for the timeout, it ends */
+    timer_wheel_advance(5000 + SESSION_TIMEOUT * 3);
+    CU_ASSERT_EQUAL(session_lookup(token, username, sizeof(username)),
+                    ERR_NOTFOUND);
+}
+
+static void
+test_session_from_request(void)
+{
+    char token[SESSION_TOKEN_LEN + 1];
+    char username[SESSION_USER_MAX];
+    char request[256];
+
+    CU_ASSERT_EQUAL(session_create("dave", token, sizeof(token)), ERR_NONE);
+
+    snprintf(request, sizeof(request),
+             "GET / HTTP/1.0\r\nCookie: username=x; session=%s\r\n\r\n", token);
+    CU_ASSERT_EQUAL(session_from_request(request, username, sizeof(username)),
+                    ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(username, "dave");
+
+    /* Only a cookie of that exact name counts */
+    snprintf(request, sizeof(request),
+             "GET / HTTP/1.0\r\nCookie: xsession=%s\r\n\r\n", token);
+    CU_ASSERT_EQUAL(session_from_request(request, username, sizeof(username)),
+                    ERR_NOTFOUND);
+    CU_ASSERT_STRING_EQUAL(username, "");
+
+    /* The username header is not an identity */
+    CU_ASSERT_EQUAL(session_from_request("GET / HTTP/1.0\r\n"
+                                         "X-Username: dave\r\n\r\n",
+                                         username, sizeof(username)),
+                    ERR_NOTFOUND);
+}
+
+static void
+test_session_login(void)
+{
+    char response[1024];
+    char request[256];
+    char username[SESSION_USER_MAX];
+    char *cookie;
+
+    CU_ASSERT_EQUAL(test_exchange("GET /auth?username=test&password=password "
+                                  "HTTP/1.0\r\n\r\n", response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "200 OK"));
+    cookie = strstr(response, "Set-Cookie: session=");
+    CU_ASSERT(cookie != NULL);
+    if (!cookie) {
+        return;
+    }
+    CU_ASSERT_PTR_NOT_NULL(strstr(cookie, "HttpOnly"));
+
+    cookie += strlen("Set-Cookie: ");
+    snprintf(request, sizeof(request), "GET /logout HTTP/1.0\r\nCookie: %.*s\r\n\r\n",
+             (int)strlen(SESSION_COOKIE "=") + SESSION_TOKEN_LEN, cookie);
+    CU_ASSERT_EQUAL(session_from_request(request, username, sizeof(username)),
+                    ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(username, "test");
+
+    CU_ASSERT_EQUAL(test_exchange(request, response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Max-Age=0"));
+    CU_ASSERT_EQUAL(session_from_request(request, username, sizeof(username)),
+                    ERR_NOTFOUND);
+
+    /* Failed logins get no session */
+    CU_ASSERT_EQUAL(test_exchange("GET /auth?username=test&password=wrong "
+                                  "HTTP/1.0\r\n\r\n", response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "401 Unauthorized"));
+    CU_ASSERT_PTR_NULL(strstr(response, "Set-Cookie"));
+}
+
+int
+init_session_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Session Lookup", test_session_lookup) == NULL) ||
+        (CU_add_test(suite, "Test Session Expiry", test_session_expiry) == NULL) ||
+        (CU_add_test(suite, "Test Session From Request", test_session_from_request) == NULL) ||
+        (CU_add_test(suite, "Test Session Login", test_session_login) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -16,6 +16,7 @@
 #define _XOPEN_SOURCE 500
 #endif
 
+#include <stddef.h>
 #include <CUnit/Basic.h>
 
 /* Constants */
@@ -42,5 +43,71 @@
 /* Function prototypes */
 int init_web_server_suite(CU_pSuite suite);
 int init_web_server_security_suite(CU_pSuite suite);
+int init_forecast_suite(CU_pSuite suite);
+int init_obligation_number_suite(CU_pSuite suite);
+int init_export_suite(CU_pSuite suite);
+int init_record_store_suite(CU_pSuite suite);
+int init_query_suite(CU_pSuite suite);
+int init_result_cache_suite(CU_pSuite suite);
+int init_rec_watch_suite(CU_pSuite suite);
+int init_archive_suite(CU_pSuite suite);
+int init_history_suite(CU_pSuite suite);
+int init_table_suite(CU_pSuite suite);
+int init_user_table_suite(CU_pSuite suite);
+int init_session_suite(CU_pSuite suite);
+int init_password_suite(CU_pSuite suite);
+int init_profile_store_suite(CU_pSuite suite);
+int init_log_writer_suite(CU_pSuite suite);
+int init_audit_store_suite(CU_pSuite suite);
+int init_log_archive_suite(CU_pSuite suite);
+int init_diag_suite(CU_pSuite suite);
+int init_metrics_suite(CU_pSuite suite);
+int init_trace_suite(CU_pSuite suite);
+
+/* Suite fixtures, passed to CU_add_suite */
+int forecast_suite_setup(void);
+int forecast_suite_teardown(void);
+int obligation_number_suite_setup(void);
+int obligation_number_suite_teardown(void);
+int export_suite_setup(void);
+int export_suite_teardown(void);
+int record_store_suite_setup(void);
+int record_store_suite_teardown(void);
+int query_suite_setup(void);
+int query_suite_teardown(void);
+int result_cache_suite_setup(void);
+int result_cache_suite_teardown(void);
+int rec_watch_suite_setup(void);
+int rec_watch_suite_teardown(void);
+int archive_suite_setup(void);
+int archive_suite_teardown(void);
+int history_suite_setup(void);
+int history_suite_teardown(void);
+int table_suite_setup(void);
+int table_suite_teardown(void);
+int user_table_suite_setup(void);
+int user_table_suite_teardown(void);
+int session_suite_setup(void);
+int session_suite_teardown(void);
+int password_suite_setup(void);
+int password_suite_teardown(void);
+int profile_store_suite_setup(void);
+int profile_store_suite_teardown(void);
+int log_writer_suite_setup(void);
+int log_writer_suite_teardown(void);
+int audit_store_suite_setup(void);
+int audit_store_suite_teardown(void);
+int log_archive_suite_setup(void);
+int log_archive_suite_teardown(void);
+int diag_suite_setup(void);
+int diag_suite_teardown(void);
+int metrics_suite_setup(void);
+int metrics_suite_teardown(void);
+int trace_suite_setup(void);
+int trace_suite_teardown(void);
+
+/* Shared test helpers */
+int test_exchange(const char *request, char *response, size_t size);
+int test_get(const char *uri, char *response, size_t size);
 
 #endif /* TEST_SUITES_H */
@@ -0,0 +1,265 @@
+/* filepath: test/test_table.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/record_store.h"
+#include "../include/table.h"
+
+#define TEST_TABLE_REC "test/table.rec"
+#define TEST_SORTED_REC "test/sorted.rec"
+#define TEST_PARTIAL_REC "test/partial.rec"
+
+int
+table_suite_setup(void)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_TABLE_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n\n"
+        "Project_Name: Table\n"
+        "Obligation_Number: TABLE-10\n"
+        "Procedure: Dust <monitoring> & \"reporting\"\n"
+        "Action_DueDate: 1/01/2107\n"
+        "Status: Not Started\n"
+        "\n"
+        "Project_Name: Table\n"
+        "Obligation_Number: TABLE-9\n"
+        "Procedure: Waste\n"
+        "Action_DueDate: 2000/01/31\n"
+        "Status: In Progress\n"
+        "\n"
+        "Project_Name: Table\n"
+        "Obligation_Number: TABLE-2\n"
+        "Procedure: Noise\n"
+        "Status: In Progress\n");
+    fclose(fp);
+
+    /* Declares its own %sort, so it defaults to key order */
+    fp = fopen(TEST_SORTED_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n%%sort: Obligation_Number\n\n"
+        "Obligation_Number: KEY-10\nStatus: Open\n\n"
+        "Obligation_Number: KEY-9\nStatus: Closed\n\n"
+        "Obligation_Number: KEY-100\nStatus: Open\n\n"
+        "Obligation_Number: KEY-2\nStatus: Open\n");
+    fclose(fp);
+
+    /* A %sort field that one record lacks */
+    fp = fopen(TEST_PARTIAL_REC, "w");
+    if (!fp) {
+        return -1;
+    }
+    fprintf(fp,
+        "%%rec: Project\n%%sort: Procedure\n\n"
+        "Obligation_Number: PART-1\nProcedure: Waste\n\n"
+        "Obligation_Number: PART-2\nStatus: Open\n\n"
+        "Obligation_Number: PART-3\nProcedure: Dust\n");
+    fclose(fp);
+
+    return rec_registry_init("test") == ERR_NONE ? 0 : -1;
+}
+
+int
+table_suite_teardown(void)
+{
+    table_cache_clear();
+    rec_registry_init(RECORDS_DIR);
+    remove(TEST_TABLE_REC);
+    remove(TEST_SORTED_REC);
+    remove(TEST_PARTIAL_REC);
+    return 0;
+}
+
+/* Offset of a row's key in the response, or -1 */
+static long
+row_at(const char *response, const char *key)
+{
+    char needle[64];
+    const char *p;
+
+    snprintf(needle, sizeof(needle), "data-key=\"%s\"", key);
+    p = strstr(response, needle);
+    return p ? (long)(p - response) : -1;
+}
+
+static void
+test_table_rows(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table", response,
+                             sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Content-Type: text/html"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Total-Count: 3\r\n"));
+
+    /* Values are escaped; the row class follows the due date */
+    CU_ASSERT_PTR_NOT_NULL(strstr(response,
+        "<tr data-key=\"TABLE-10\"><td>Dust &lt;monitoring&gt; &amp; "
+        "&quot;reporting&quot;</td><td></td><td>TABLE-10</td>"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response,
+        "<tr data-key=\"TABLE-9\" class=\"overdue\">"));
+
+    /* File order without sort= */
+    CU_ASSERT(row_at(response, "TABLE-10") < row_at(response, "TABLE-9"));
+    CU_ASSERT(row_at(response, "TABLE-9") < row_at(response, "TABLE-2"));
+}
+
+static void
+test_table_sort(void)
+{
+    char response[8192];
+
+    /* Digit runs compare by value */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&sort=Obligation_Number",
+                             response, sizeof(response)), 0);
+    CU_ASSERT(row_at(response, "TABLE-2") < row_at(response, "TABLE-9"));
+    CU_ASSERT(row_at(response, "TABLE-9") < row_at(response, "TABLE-10"));
+
+    /* Dates compare as dates across formats, records without one last */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&sort=Action_DueDate"
+                             "&order=desc", response, sizeof(response)), 0);
+    CU_ASSERT(row_at(response, "TABLE-10") >= 0);
+    CU_ASSERT(row_at(response, "TABLE-10") < row_at(response, "TABLE-9"));
+    CU_ASSERT(row_at(response, "TABLE-9") < row_at(response, "TABLE-2"));
+}
+
+static void
+test_table_partial_sort(void)
+{
+    char response[8192];
+
+    /* The %sort order holds; the record without the field comes last */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=partial", response,
+                             sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Total-Count: 3\r\n"));
+    CU_ASSERT(row_at(response, "PART-3") >= 0);
+    CU_ASSERT(row_at(response, "PART-3") < row_at(response, "PART-1"));
+    CU_ASSERT(row_at(response, "PART-1") < row_at(response, "PART-2"));
+}
+
+static void
+test_table_pages(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&sort=Obligation_Number"
+                             "&page=2&size=2", response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Total-Count: 3\r\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Page: 2\r\n"));
+    CU_ASSERT(row_at(response, "TABLE-10") >= 0);
+    CU_ASSERT_EQUAL(row_at(response, "TABLE-2"), -1);
+    CU_ASSERT_EQUAL(row_at(response, "TABLE-9"), -1);
+
+    /* Filters are applied before paging and counted for the pager */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&f6=in+prog&size=1",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Total-Count: 2\r\n"));
+    CU_ASSERT(row_at(response, "TABLE-9") >= 0);
+    CU_ASSERT_EQUAL(row_at(response, "TABLE-2"), -1);
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&due=overdue",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Total-Count: 1\r\n"));
+    CU_ASSERT(row_at(response, "TABLE-9") >= 0);
+}
+
+static void
+test_table_key_ranges(void)
+{
+    char response[8192];
+
+    /* %sort order by default, digit runs by value */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=sorted", response,
+                             sizeof(response)), 0);
+    CU_ASSERT(row_at(response, "KEY-2") >= 0);
+    CU_ASSERT(row_at(response, "KEY-2") < row_at(response, "KEY-9"));
+    CU_ASSERT(row_at(response, "KEY-9") < row_at(response, "KEY-10"));
+    CU_ASSERT(row_at(response, "KEY-10") < row_at(response, "KEY-100"));
+
+    /* Inclusive range */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=sorted&from=KEY-9&to=KEY-10",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Total-Count: 2\r\n"));
+    CU_ASSERT_EQUAL(row_at(response, "KEY-2"), -1);
+    CU_ASSERT(row_at(response, "KEY-9") >= 0);
+    CU_ASSERT(row_at(response, "KEY-10") >= 0);
+    CU_ASSERT_EQUAL(row_at(response, "KEY-100"), -1);
+
+    /* Keyset pages hand out the cursor of the next one */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=sorted&size=2", response,
+                             sizeof(response)), 0);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "X-Next-Cursor: KEY-9\r\n"));
+    CU_ASSERT_EQUAL(test_get("/api/table?project=sorted&size=2&after=KEY-9",
+                             response, sizeof(response)), 0);
+    CU_ASSERT_EQUAL(row_at(response, "KEY-9"), -1);
+    CU_ASSERT(row_at(response, "KEY-10") >= 0);
+    CU_ASSERT(row_at(response, "KEY-100") >= 0);
+    CU_ASSERT_PTR_NULL(strstr(response, "X-Next-Cursor"));
+
+    /* Descending cursors continue below the key */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=sorted&order=desc&after=KEY-10",
+                             response, sizeof(response)), 0);
+    CU_ASSERT(row_at(response, "KEY-9") < row_at(response, "KEY-2"));
+    CU_ASSERT_EQUAL(row_at(response, "KEY-100"), -1);
+
+    /* Ranges need a %sort field */
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&from=TABLE-2",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+}
+
+static void
+test_table_errors(void)
+{
+    char response[8192];
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=missing",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "404 Not Found"));
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&sort=No_Such_Field",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Unknown sort field"));
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&size=0",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "400 Bad Request"));
+
+    CU_ASSERT_EQUAL(test_get("/api/table?project=table&due=later",
+                             response, sizeof(response)), -1);
+    CU_ASSERT_PTR_NOT_NULL(strstr(response, "Invalid filter"));
+}
+
+int
+init_table_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Table Rows", test_table_rows) == NULL) ||
+        (CU_add_test(suite, "Test Table Sort", test_table_sort) == NULL) ||
+        (CU_add_test(suite, "Test Table Partial Sort", test_table_partial_sort) == NULL) ||
+        (CU_add_test(suite, "Test Table Pages", test_table_pages) == NULL) ||
+        (CU_add_test(suite, "Test Table Key Ranges", test_table_key_ranges) == NULL) ||
+        (CU_add_test(suite, "Test Table Errors", test_table_errors) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* filepath: test/test_trace.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* POSIX headers */
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/buffer.h"
+#include "../include/record_store.h"
+#include "../include/trace.h"
+#include "../include/web_server.h"
+
+#define TEST_TRACE_FILE "test/trace.json"
+
+int
+trace_suite_setup(void)
+{
+    return 0;
+}
+
+int
+trace_suite_teardown(void)
+{
+    trace_set_sample(0);
+    remove(TEST_TRACE_FILE);
+    return 0;
+}
+
+/* Occurrences of text in the rendered traces */
+static long
+rendered(const char *text)
+{
+    struct buffer out;
+    const char *p;
+    long count;
+
+    buffer_init(&out);
+    count = -1;
+    if (trace_render(&out) == 0) {
+        count = 0;
+        for (p = strstr(out.data, text); p; p = strstr(p + 1, text)) {
+            count++;
+        }
+    }
+    buffer_free(&out);
+    return count;
+}
+
+static void
+traced_request(const char *uri)
+{
+    struct trace_span span;
+
+    trace_request_begin();
+    trace_request_uri(uri);
+    TRACE_BEGIN(span, "parse");
+    TRACE_END(span);
+    trace_request_end();
+}
+
+static void
+test_trace_off(void)
+{
+    struct trace_span span;
+    long requests;
+    long spans;
+
+    trace_set_sample(0);
+    requests = rendered("\"name\":\"request\"");
+    spans = rendered("\"name\":\"parse\"");
+    traced_request("/");
+    traced_request("/");
+
+    /* A span outside any request is never recorded */
+    trace_set_sample(1);
+    TRACE_BEGIN(span, "parse");
+    CU_ASSERT_PTR_NULL(span.name);
+    TRACE_END(span);
+
+    CU_ASSERT_EQUAL(rendered("\"name\":\"request\""), requests);
+    CU_ASSERT_EQUAL(rendered("\"name\":\"parse\""), spans);
+    CU_ASSERT(rendered("\"traceEvents\":[") == 1);
+}
+
+static void
+test_trace_sampling(void)
+{
+    long requests;
+    long events;
+    int i;
+
+    /* One request in three is traced, whatever the others do */
+    trace_set_sample(3);
+    requests = rendered("\"name\":\"request\"");
+    for (i = 0; i < 9; i++) {
+        traced_request("/");
+    }
+    CU_ASSERT_EQUAL(rendered("\"name\":\"request\""), requests + 3);
+
+    /* A ring keeps only its most recent spans */
+    trace_set_sample(1);
+    for (i = 0; i < TRACE_RING_SIZE; i++) {
+        traced_request("/");
+    }
+    events = rendered("\"ph\":\"X\"");
+    CU_ASSERT(events >= TRACE_RING_SIZE);
+    CU_ASSERT(events <= TRACE_RING_SIZE * TRACE_RINGS_MAX);
+    CU_ASSERT_EQUAL(rendered("\"name\":\"request\""), rendered("\"name\":\"parse\""));
+}
+
+static void
+test_trace_spans(void)
+{
+    struct trace_span outer;
+    struct trace_span inner;
+    struct timespec pause;
+    struct buffer out;
+    char *p;
+
+    trace_set_sample(1);
+    trace_request_begin();
+    trace_request_uri("/api/query?q=\"x\"");
+    TRACE_BEGIN(outer, "file_io");
+    TRACE_BEGIN(inner, "flock");
+    pause.tv_sec = 0;
+    pause.tv_nsec = 2000000L;
+    nanosleep(&pause, NULL);
+    TRACE_END(inner);
+    TRACE_END(outer);
+    trace_request_end();
+
+    buffer_init(&out);
+    CU_ASSERT_EQUAL(trace_render(&out), 0);
+    CU_ASSERT(strstr(out.data, "\"uri\":\"/api/query?q=\\\"x\\\"\"") != NULL);
+
+    /* The flock span lasted the 2 ms pause */
+    p = out.data ? strstr(out.data, "\"name\":\"flock\"") : NULL;
+    CU_ASSERT(p != NULL);
+    if (p) {
+        p = strstr(p, "\"dur\":");
+        CU_ASSERT(p != NULL && strtoul(p + 6, NULL, 10) >= 2000);
+    }
+    buffer_free(&out);
+}
+
+static void
+test_trace_request(void)
+{
+    static const char request[] = "GET " ENDPOINT_TRACE " HTTP/1.0\r\n\r\n";
+    char response[4096];
+    int test_client[2];
+    char *data;
+    size_t size;
+    ssize_t n;
+
+    /* A whole request through handle_client, phase by phase */
+    trace_set_sample(1);
+    CU_ASSERT_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, test_client), 0);
+    CU_ASSERT_EQUAL(write(test_client[0], request, sizeof(request) - 1),
+                    (ssize_t)(sizeof(request) - 1));
+    CU_ASSERT_EQUAL(handle_client(test_client[1], "www"), 0);
+    close(test_client[1]);
+    n = read(test_client[0], response, sizeof(response) - 1);
+    close(test_client[0]);
+    CU_ASSERT(n > 0);
+    response[n > 0 ? n : 0] = '\0';
+    CU_ASSERT(strstr(response, "200 OK") != NULL);
+    CU_ASSERT(strstr(response, "\"traceEvents\":[") != NULL);
+
+    CU_ASSERT(rendered("\"uri\":\"" ENDPOINT_TRACE "\"") >= 1);
+    CU_ASSERT(rendered("\"name\":\"read\"") >= 1);
+    CU_ASSERT(rendered("\"name\":\"write\"") >= 1);
+
+    CU_ASSERT_EQUAL(trace_dump(TEST_TRACE_FILE), ERR_NONE);
+    data = rec_read_file(TEST_TRACE_FILE, &size);
+    CU_ASSERT(data != NULL);
+    if (data) {
+        CU_ASSERT(strncmp(data, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39) == 0);
+        CU_ASSERT(strcmp(data + size - 4, "\n]}\n") == 0);
+        free(data);
+    }
+    trace_set_sample(0);
+}
+
+int
+init_trace_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test Trace Off", test_trace_off) == NULL) ||
+        (CU_add_test(suite, "Test Trace Sampling", test_trace_sampling) == NULL) ||
+        (CU_add_test(suite, "Test Trace Spans", test_trace_spans) == NULL) ||
+        (CU_add_test(suite, "Test Trace Request", test_trace_request) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}
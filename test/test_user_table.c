@@ -0,0 +1,165 @@
+/* filepath: test/test_user_table.c */
+/**
+ * Copyright 2024 Enveng Group - Simon French-Bluhm and Adrian Gallo.
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+/* Standard C headers */
+#include <stdio.h>
+#include <string.h>
+
+/* Testing framework */
+#include <CUnit/Basic.h>
+
+/* Local headers */
+#include "test_suites.h"
+#include "../include/web_server.h"
+#include "../include/buffer.h"
+#include "../include/password.h"
+#include "../include/user_table.h"
+
+#define TEST_USERS_FILE "test/users.passwd"
+
+static int
+write_users(const char *content)
+{
+    FILE *fp;
+
+    fp = fopen(TEST_USERS_FILE, "w");
+    if (!fp) {
+        return -1;
+    }
+    fputs(content, fp);
+    fclose(fp);
+    return 0;
+}
+
+int
+user_table_suite_setup(void)
+{
+    if (write_users("# Users\n"
+                    "alice:secret:1000:1000:Alice A:/home/alice:/bin/sh:1\n"
+                    "bob:hunter2:1001:1001:Bob B:/home/bob:/bin/sh\n"
+                    "\n"
+                    "alice:other:1002:1002:Second Alice:/home/a2:/bin/sh\n") != 0) {
+        return -1;
+    }
+    return user_table_init(TEST_USERS_FILE) == ERR_NONE ? 0 : -1;
+}
+
+int
+user_table_suite_teardown(void)
+{
+    user_table_init(AUTH_FILE);
+    remove(TEST_USERS_FILE);
+    return 0;
+}
+
+/* What a login checks: the user's stored password against the one given */
+static int
+check(const char *username, const char *password)
+{
+    struct user_entry entry;
+
+    if (user_table_find(username, &entry) != ERR_NONE) {
+        return 0;
+    }
+    return password_verify(password, entry.password);
+}
+
+static void
+test_user_table_lookup(void)
+{
+    struct user_entry entry;
+
+    CU_ASSERT_EQUAL(check("alice", "secret"), 1);
+    CU_ASSERT_EQUAL(check("bob", "hunter2"), 1);
+    CU_ASSERT_EQUAL(check("bob", "secret"), 0);
+    CU_ASSERT_EQUAL(check("carol", "secret"), 0);
+    CU_ASSERT_EQUAL(user_table_find(NULL, &entry), ERR_PARAM);
+
+    /* The first line for a username wins */
+    CU_ASSERT_EQUAL(check("alice", "other"), 0);
+    CU_ASSERT_EQUAL(user_table_find("alice", &entry), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(entry.fullname, "Alice A");
+    CU_ASSERT_EQUAL(entry.uid, 1000);
+    CU_ASSERT_EQUAL(entry.is_admin, 1);
+
+    CU_ASSERT_EQUAL(user_table_find("bob", &entry), ERR_NONE);
+    CU_ASSERT_STRING_EQUAL(entry.shell, "/bin/sh");
+    CU_ASSERT_EQUAL(entry.is_admin, 0);
+    CU_ASSERT_EQUAL(user_table_find("carol", &entry), ERR_NOTFOUND);
+}
+
+static void
+test_user_table_users(void)
+{
+    struct buffer users;
+
+    buffer_init(&users);
+    CU_ASSERT_EQUAL(user_table_users(&users), ERR_NONE);
+    CU_ASSERT(users.data != NULL);
+    if (users.data) {
+        /* Passwords, hashed or not, are never listed */
+        CU_ASSERT_STRING_EQUAL(users.data,
+            "alice:x:1000:1000:Alice A:/home/alice:/bin/sh:1\n"
+            "bob:x:1001:1001:Bob B:/home/bob:/bin/sh:0\n"
+            "alice:x:1002:1002:Second Alice:/home/a2:/bin/sh:0\n");
+    }
+    buffer_free(&users);
+}
+
+static void
+test_user_table_reload(void)
+{
+    struct user_entry entry;
+
+    /* Unchanged file is not read again */
+    CU_ASSERT_EQUAL(user_table_refresh(), 0);
+
+    /* A different size changes the stamp even within the same second */
+    CU_ASSERT_EQUAL(write_users("bob:changed:1001:1001:Bob B:/home/bob:/bin/sh\n"
+                                "carol:pw:1003:1003:Carol C:/home/c:/bin/sh\n"), 0);
+    CU_ASSERT_EQUAL(user_table_refresh(), 1);
+    CU_ASSERT_EQUAL(check("bob", "hunter2"), 0);
+    CU_ASSERT_EQUAL(check("bob", "changed"), 1);
+    CU_ASSERT_EQUAL(check("alice", "secret"), 0);
+    CU_ASSERT_EQUAL(user_table_find("carol", &entry), ERR_NONE);
+
+    /* Without the file nobody can log in */
+    remove(TEST_USERS_FILE);
+    CU_ASSERT_EQUAL(user_table_refresh(), ERR_IO);
+    CU_ASSERT_EQUAL(user_table_find("bob", &entry), ERR_IO);
+}
+
+static void
+test_user_table_parse_line(void)
+{
+    struct user_entry entry;
+    char line[128];
+
+    strcpy(line, "dave:pw:7:8:Dave D:/home/d:/bin/sh:1\r\n");
+    CU_ASSERT_EQUAL(user_table_parse_line(line, &entry), 8);
+    CU_ASSERT_STRING_EQUAL(entry.username, "dave");
+    CU_ASSERT_EQUAL(entry.gid, 8);
+    CU_ASSERT_EQUAL(entry.is_admin, 1);
+
+    /* Short lines fill what they have; the password has no newline */
+    strcpy(line, "erin:pw\n");
+    CU_ASSERT_EQUAL(user_table_parse_line(line, &entry), 2);
+    CU_ASSERT_STRING_EQUAL(entry.password, "pw");
+    CU_ASSERT_STRING_EQUAL(entry.shell, "");
+}
+
+int
+init_user_table_suite(CU_pSuite suite)
+{
+    if ((CU_add_test(suite, "Test User Table Lookup", test_user_table_lookup) == NULL) ||
+        (CU_add_test(suite, "Test User Table Users", test_user_table_users) == NULL) ||
+        (CU_add_test(suite, "Test User Table Reload", test_user_table_reload) == NULL) ||
+        (CU_add_test(suite, "Test User Table Parse Line", test_user_table_parse_line) == NULL)) {
+        return -1;
+    }
+
+    return 0;
+}